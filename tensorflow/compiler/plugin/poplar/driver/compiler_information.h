@@ -38,6 +38,8 @@ struct CompilerInformation {
 
   int64 minimum_remote_tensor_size = 128;
 
+  int64 max_scheduler_time_ms = 0;
+
   CompilerInformation& set_max_all_reduce_buffer_size(int64 val) {
     max_all_reduce_buffer_size = val;
     return *this;
@@ -72,6 +74,11 @@ struct CompilerInformation {
     minimum_remote_tensor_size = val;
     return *this;
   }
+
+  CompilerInformation& set_max_scheduler_time_ms(int64 val) {
+    max_scheduler_time_ms = val;
+    return *this;
+  }
 };
 
 }  // namespace poplarplugin
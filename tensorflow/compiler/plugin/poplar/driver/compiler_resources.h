@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_COMPILER_RESOURCES_H_
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_COMPILER_RESOURCES_H_
 
+#include <map>
 #include <memory>
 #include <poplar/Graph.hpp>
 #include <poplar/OptionFlags.hpp>
@@ -126,6 +127,10 @@ struct CompilerResources {
 
   std::string scheduler_selection;
 
+  // The scheduler which produced the schedule of each computation when
+  // several schedulers were run in parallel.
+  std::map<std::string, std::string> selected_schedulers;
+
   bool recomputation_enabled;
 
   bool use_stable_norm_statistics;
@@ -15,18 +15,22 @@ limitations under the License.
 
 #include "tensorflow/compiler/plugin/poplar/driver/passes/matmul_combiner.h"
 
-#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
-#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_matcher.h"
-#include "tensorflow/compiler/plugin/poplar/driver/tools/matcher_predicates.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/matmul_util.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
 
-#include "tensorflow/compiler/xla/service/hlo_casting_utils.h"
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
 #include "tensorflow/compiler/xla/service/hlo_instruction.h"
-#include "tensorflow/compiler/xla/service/hlo_instructions.h"
-#include "tensorflow/compiler/xla/service/shape_inference.h"
+#include "tensorflow/compiler/xla/service/hlo_module.h"
+#include "tensorflow/compiler/xla/service/hlo_reachability.h"
+#include "tensorflow/compiler/xla/shape_util.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -35,40 +39,38 @@ namespace poplarplugin {
 
 namespace {
 
-// clang-format off
-static const std::vector<HloMatcherPattern> patterns = {
-  HloMatcherPattern(
-    PatternType("matmul_matmul_shared_lhs"),
-    PatternMetaTarget(0),
-    PatternInputs({2, 3, 4}),
-    PatternOutputs({0, 1}),
-    Pattern({
-      {HloOpcode::kDot, NodeOperands({2, 3})},
-      {HloOpcode::kDot, NodeOperands({2, 4})},
-      {HloMatcherOpcode::kAnyOpcode, NodeOperands({})},
-      {HloMatcherOpcode::kAnyOpcode, NodeOperands({})},
-      {HloMatcherOpcode::kAnyOpcode, NodeOperands({})},
-    })),
-  HloMatcherPattern(
-    PatternType("matmul_matmul_shared_rhs"),
-    PatternMetaTarget(0),
-    PatternInputs({2, 3, 4}),
-    PatternOutputs({0, 1}),
-    Pattern({
-      {HloOpcode::kDot, NodeOperands({2, 3})},
-      {HloOpcode::kDot, NodeOperands({4, 3})},
-      {HloMatcherOpcode::kAnyOpcode, NodeOperands({})},
-      {HloMatcherOpcode::kAnyOpcode, NodeOperands({})},
-      {HloMatcherOpcode::kAnyOpcode, NodeOperands({})},
-    })
-  )
+// Rough estimates of the IPU costs used to decide whether combining matmuls is
+// worth it: each matmul has a fixed overhead for its compute sets and exchange
+// phases, whereas the concatenated operands have to be rearranged using the
+// exchange.
+constexpr int64 kMatmulOverheadCycles = 4000;
+constexpr int64 kExchangeBytesPerCycle = 1216 * 4;
+
+// How the matmuls in a group are combined, which is also the dimension of the
+// packed [Batch, M, N] output the matmuls are concatenated in.
+enum class CombineType {
+  kBatch = 0,
+  kSharedRHS = 1,
+  kSharedLHS = 2,
 };
-// clang-format on
+
+// The combined matmul runs on the device of the matmuls it replaces, so every
+// instruction created for it is given their sharding. SetupDerivedInstruction
+// only copies the sharding between instructions of the same shape, and would
+// copy the sharding of an operand on another device.
+void CopySharding(const HloInstruction* dot, HloInstruction* inst) {
+  if (dot->has_sharding()) {
+    inst->set_sharding(dot->sharding());
+  } else {
+    inst->clear_sharding();
+  }
+}
 
 // Reshape to [Batch, Contracting, N]
-HloInstruction* PrepareRHS(HloInstruction* rhs,
+HloInstruction* PrepareRHS(HloInstruction* dot,
                            const DotDimensionNumbers& dot_dims,
                            HloComputation* computation) {
+  HloInstruction* rhs = dot->mutable_operand(1);
   const auto shape = rhs->shape();
   std::vector<int64> permutations;
   Shape shuffled_shape, packed_shape;
@@ -78,17 +80,20 @@ HloInstruction* PrepareRHS(HloInstruction* rhs,
   HloInstruction* shuffled = computation->AddInstruction(
       HloInstruction::CreateTranspose(shuffled_shape, rhs, permutations));
   rhs->SetupDerivedInstruction(shuffled);
+  CopySharding(dot, shuffled);
 
   HloInstruction* reshaped = computation->AddInstruction(
       HloInstruction::CreateReshape(packed_shape, shuffled));
   rhs->SetupDerivedInstruction(reshaped);
+  CopySharding(dot, reshaped);
   return reshaped;
 }
 
 // Reshape to [Batch, M, Contracting]
-HloInstruction* PrepareLHS(HloInstruction* lhs,
+HloInstruction* PrepareLHS(HloInstruction* dot,
                            const DotDimensionNumbers& dot_dims,
                            HloComputation* computation) {
+  HloInstruction* lhs = dot->mutable_operand(0);
   const auto shape = lhs->shape();
   std::vector<int64> permutations;
   Shape shuffled_shape, packed_shape;
@@ -98,147 +103,324 @@ HloInstruction* PrepareLHS(HloInstruction* lhs,
   HloInstruction* shuffled = computation->AddInstruction(
       HloInstruction::CreateTranspose(shuffled_shape, lhs, permutations));
   lhs->SetupDerivedInstruction(shuffled);
+  CopySharding(dot, shuffled);
 
   HloInstruction* reshaped = computation->AddInstruction(
       HloInstruction::CreateReshape(packed_shape, shuffled));
   lhs->SetupDerivedInstruction(reshaped);
+  CopySharding(dot, reshaped);
   return reshaped;
 }
 
-}  // namespace
-
-MatmulCombiner::MatmulCombiner(struct CompilerAnnotations& annotations)
-    : HloMatcher(patterns, annotations, false, true) {}
-
-bool MatmulCombiner::HandleMatch(HloMatcherMatched& match,
-                                 const absl::optional<int64> sharding_device) {
-  auto pattern = patterns_[match.pattern_idx];
-  HloComputation* computation = match.computation;
-
-  HloDotInstruction* matmul1 =
-      Cast<HloDotInstruction>(match.instruction_mapping.at(0));
-  HloDotInstruction* matmul2 =
-      Cast<HloDotInstruction>(match.instruction_mapping.at(1));
+bool CanCombine(const HloInstruction* inst) {
+  return inst->opcode() == HloOpcode::kDot &&
+         inst->control_predecessors().empty() &&
+         inst->control_successors().empty();
+}
 
-  const DotDimensionNumbers dot_dims1 = matmul1->dot_dimension_numbers();
-  const DotDimensionNumbers dot_dims2 = matmul2->dot_dimension_numbers();
+// Returns a key which is equal for all the matmuls which can be combined with
+// the given type.
+std::string GetCombineKey(const HloInstruction* dot, CombineType type) {
+  const DotDimensionNumbers& dot_dims = dot->dot_dimension_numbers();
+  std::string key = absl::StrCat(
+      PrimitiveType_Name(dot->shape().element_type()), "/",
+      PrimitiveType_Name(dot->operand(0)->shape().element_type()), "/",
+      PrimitiveType_Name(dot->operand(1)->shape().element_type()), "/",
+      dot->precision_config().SerializeAsString(), "/",
+      dot->frontend_attributes().SerializeAsString(), "/",
+      dot->has_sharding() ? dot->sharding().ToString() : "", "/");
+  switch (type) {
+    case CombineType::kSharedLHS: {
+      absl::StrAppend(&key, dot->operand(0)->unique_id(), "/",
+                      dot_dims.SerializeAsString());
+      break;
+    }
+    case CombineType::kSharedRHS: {
+      absl::StrAppend(&key, dot->operand(1)->unique_id(), "/",
+                      dot_dims.SerializeAsString());
+      break;
+    }
+    case CombineType::kBatch: {
+      // Only the batch dimension can differ.
+      const Shape lhs = LeftMatMulPackShape(dot->operand(0)->shape(), dot_dims);
+      const Shape rhs =
+          RightMatMulPackShape(dot->operand(1)->shape(), dot_dims);
+      absl::StrAppend(&key, lhs.dimensions(1), "x", lhs.dimensions(2), "x",
+                      rhs.dimensions(2));
+      break;
+    }
+  }
+  return key;
+}
 
-  if (dot_dims1.SerializeAsString() != dot_dims2.SerializeAsString()) {
-    VLOG(1) << "Can't fuse two matmuls with different dot_dimension_numbers";
-    return false;
+// Keeps track of the groups of matmuls which have been combined, so that
+// combining another group does not create a cycle. Combining a group merges
+// all of its matmuls into a single instruction, which means that a new group
+// creates a cycle if one of its matmuls reaches a combined group from which
+// another one of its matmuls can be reached, possibly through other combined
+// groups.
+class CombinedGroups {
+ public:
+  explicit CombinedGroups(const HloReachabilityMap& reachability)
+      : reachability_(reachability) {}
+
+  bool CanAdd(const std::vector<HloInstruction*>& group) const {
+    for (size_t i = 0; i != group.size(); ++i) {
+      for (size_t j = i + 1; j != group.size(); ++j) {
+        if (reachability_.IsConnected(group[i], group[j])) {
+          return false;
+        }
+      }
+    }
+
+    const int64 num_groups = groups_.size();
+    std::vector<bool> reaches_group(num_groups);
+    std::vector<int64> to_visit;
+    for (int64 i = 0; i != num_groups; ++i) {
+      reaches_group[i] = Reaches(groups_[i], group);
+      if (Reaches(group, groups_[i])) {
+        to_visit.push_back(i);
+      }
+    }
+
+    std::vector<bool> visited(num_groups);
+    while (!to_visit.empty()) {
+      const int64 i = to_visit.back();
+      to_visit.pop_back();
+      if (visited[i]) {
+        continue;
+      }
+      if (reaches_group[i]) {
+        return false;
+      }
+      visited[i] = true;
+      for (int64 j = 0; j != num_groups; ++j) {
+        if (edges_[i][j]) {
+          to_visit.push_back(j);
+        }
+      }
+    }
+    return true;
   }
-  if (matmul1->precision_config().SerializeAsString() !=
-      matmul2->precision_config().SerializeAsString()) {
-    VLOG(1) << "Can't fuse two matmuls with different precision_config";
-    return false;
+
+  void Add(std::vector<HloInstruction*> group) {
+    const int64 num_groups = groups_.size();
+    for (int64 i = 0; i != num_groups; ++i) {
+      edges_[i].push_back(Reaches(groups_[i], group));
+    }
+    edges_.emplace_back(num_groups + 1, false);
+    for (int64 i = 0; i != num_groups; ++i) {
+      edges_[num_groups][i] = Reaches(group, groups_[i]);
+    }
+    groups_.push_back(std::move(group));
   }
 
-  if (matmul1->frontend_attributes().SerializeAsString() !=
-      matmul2->frontend_attributes().SerializeAsString()) {
-    VLOG(1) << "Can't fuse two matmuls with different frontend_attributes";
+ private:
+  bool Reaches(const std::vector<HloInstruction*>& from,
+               const std::vector<HloInstruction*>& to) const {
+    for (const HloInstruction* a : from) {
+      for (const HloInstruction* b : to) {
+        if (reachability_.IsReachable(a, b)) {
+          return true;
+        }
+      }
+    }
     return false;
   }
 
-  HloInstruction *lhs, *rhs;
-  Shape matmul_shape, slice1_shape, slice2_shape;
-  if (matmul1->operand(0) == matmul2->operand(0)) {
-    // Shared lhs
-    lhs = match.instruction_mapping.at(2);
-    HloInstruction* rhs1 = match.instruction_mapping.at(3);
-    HloInstruction* rhs2 = match.instruction_mapping.at(4);
+  const HloReachabilityMap& reachability_;
+  std::vector<std::vector<HloInstruction*>> groups_;
+  // edges_[i][j] is true when group i reaches group j.
+  std::vector<std::vector<bool>> edges_;
+};
 
-    // Reshape to [Batch, Contracting, N]
-    rhs1 = PrepareRHS(rhs1, dot_dims1, computation);
-    rhs2 = PrepareRHS(rhs2, dot_dims2, computation);
-    // Reshape to [Batch, M, Contracting]
-    lhs = PrepareLHS(lhs, dot_dims1, computation);
-
-    const int64 output_width1 = rhs1->shape().dimensions(2);
-    const int64 output_width2 = rhs2->shape().dimensions(2);
-    const int64 output_width = output_width1 + output_width2;
-    const int64 output_height = lhs->shape().dimensions(1);
-    const int64 output_batch = lhs->shape().dimensions(0);
-    slice1_shape =
-        ShapeUtil::MakeShape(matmul1->shape().element_type(),
-                             {output_batch, output_height, output_width1});
-    slice2_shape =
-        ShapeUtil::MakeShape(matmul1->shape().element_type(),
-                             {output_batch, output_height, output_width2});
-
-    std::vector<HloInstruction*> rhs_ops = {rhs1, rhs2};
-    rhs = computation->AddInstruction(HloInstruction::CreateConcatenate(
-        GetConcatenatedShape(rhs_ops, 2), rhs_ops, 2));
-    rhs1->SetupDerivedInstruction(rhs);
-
-    matmul_shape =
-        ShapeUtil::MakeShape(matmul1->shape().element_type(),
-                             {output_batch, output_height, output_width});
-  } else {
-    // Shared rhs
-    HloInstruction* lhs1 = match.instruction_mapping.at(2);
-    rhs = match.instruction_mapping.at(3);
-    HloInstruction* lhs2 = match.instruction_mapping.at(4);
+// Returns whether the fixed overhead saved by executing one matmul instead of
+// many is larger than the cost of concatenating the operands.
+bool IsProfitable(const std::vector<HloInstruction*>& group,
+                  CombineType type) {
+  int64 concatenated_bytes = 0;
+  for (const HloInstruction* dot : group) {
+    if (type != CombineType::kSharedLHS) {
+      concatenated_bytes += ShapeUtil::ByteSizeOf(dot->operand(0)->shape());
+    }
+    if (type != CombineType::kSharedRHS) {
+      concatenated_bytes += ShapeUtil::ByteSizeOf(dot->operand(1)->shape());
+    }
+  }
+  const int64 saved_cycles = (group.size() - 1) * kMatmulOverheadCycles;
+  const int64 cost_cycles = concatenated_bytes / kExchangeBytesPerCycle;
+  VLOG(2) << "Combining " << group.size() << " matmuls saves an estimated "
+          << saved_cycles << " cycles for " << cost_cycles << " cycles.";
+  return cost_cycles < saved_cycles;
+}
 
+// Replace the matmuls with slices of a single matmul. The matmuls are left in
+// the computation without any users.
+Status Combine(const std::vector<HloInstruction*>& group, CombineType type,
+               HloComputation* comp) {
+  HloInstruction* first = group[0];
+  const int64 concat_dim = static_cast<int64>(type);
+
+  std::vector<HloInstruction*> lhs_ops;
+  std::vector<HloInstruction*> rhs_ops;
+  for (HloInstruction* dot : group) {
+    const DotDimensionNumbers& dot_dims = dot->dot_dimension_numbers();
     // Reshape to [Batch, Contracting, N]
-    rhs = PrepareRHS(rhs, dot_dims1, computation);
+    if (type != CombineType::kSharedRHS || rhs_ops.empty()) {
+      rhs_ops.push_back(PrepareRHS(dot, dot_dims, comp));
+    }
     // Reshape to [Batch, M, Contracting]
-    lhs1 = PrepareLHS(lhs1, dot_dims1, computation);
-    lhs2 = PrepareLHS(lhs2, dot_dims2, computation);
-
-    const int64 output_width = rhs->shape().dimensions(2);
-    const int64 output_height1 = lhs1->shape().dimensions(1);
-    const int64 output_height2 = lhs2->shape().dimensions(1);
-    const int64 output_height = output_height1 + output_height2;
-    const int64 output_batch = rhs->shape().dimensions(0);
-
-    slice1_shape =
-        ShapeUtil::MakeShape(matmul1->shape().element_type(),
-                             {output_batch, output_height1, output_width});
-    slice2_shape =
-        ShapeUtil::MakeShape(matmul1->shape().element_type(),
-                             {output_batch, output_height2, output_width});
-
-    std::vector<HloInstruction*> lhs_ops = {lhs1, lhs2};
-    lhs = computation->AddInstruction(HloInstruction::CreateConcatenate(
-        GetConcatenatedShape(lhs_ops, 1), lhs_ops, 1));
-    lhs1->SetupDerivedInstruction(lhs);
-
-    matmul_shape =
-        ShapeUtil::MakeShape(matmul1->shape().element_type(),
-                             {output_batch, output_height, output_width});
+    if (type != CombineType::kSharedLHS || lhs_ops.empty()) {
+      lhs_ops.push_back(PrepareLHS(dot, dot_dims, comp));
+    }
   }
 
-  std::vector<int64> slice2_offset(3);
-  for (int i = 0; i < matmul_shape.rank(); i++) {
-    slice2_offset[i] = matmul_shape.dimensions(i) - slice2_shape.dimensions(i);
+  HloInstruction* lhs = lhs_ops[0];
+  if (lhs_ops.size() > 1) {
+    // Concatenate in the M dimension, or in the batch dimension.
+    const int64 dim = type == CombineType::kSharedRHS ? 1 : 0;
+    lhs = comp->AddInstruction(HloInstruction::CreateConcatenate(
+        GetConcatenatedShape(lhs_ops, dim), lhs_ops, dim));
+    lhs_ops[0]->SetupDerivedInstruction(lhs);
+    CopySharding(first, lhs);
+  }
+  HloInstruction* rhs = rhs_ops[0];
+  if (rhs_ops.size() > 1) {
+    // Concatenate in the N dimension, or in the batch dimension.
+    const int64 dim = type == CombineType::kSharedLHS ? 2 : 0;
+    rhs = comp->AddInstruction(HloInstruction::CreateConcatenate(
+        GetConcatenatedShape(rhs_ops, dim), rhs_ops, dim));
+    rhs_ops[0]->SetupDerivedInstruction(rhs);
+    CopySharding(first, rhs);
   }
 
+  const PrimitiveType type_out = first->shape().element_type();
+  const Shape matmul_shape = ShapeUtil::MakeShape(
+      type_out, {lhs->shape().dimensions(0), lhs->shape().dimensions(1),
+                 rhs->shape().dimensions(2)});
+
   DotDimensionNumbers new_dot_dim;
   new_dot_dim.add_lhs_contracting_dimensions(2);
   new_dot_dim.add_rhs_contracting_dimensions(1);
   new_dot_dim.add_lhs_batch_dimensions(0);
   new_dot_dim.add_rhs_batch_dimensions(0);
 
-  HloInstruction* new_matmul =
-      computation->AddInstruction(HloInstruction::CreateDot(
-          matmul_shape, lhs, rhs, new_dot_dim, matmul1->precision_config()));
-  matmul1->SetupDerivedInstruction(new_matmul);
-
-  HloInstruction* slice1 = computation->AddInstruction(
-      HloInstruction::CreateSlice(slice1_shape, new_matmul, {0, 0, 0},
-                                  slice1_shape.dimensions(), {1, 1, 1}));
-  HloInstruction* output1 = computation->AddInstruction(
-      HloInstruction::CreateReshape(matmul1->shape(), slice1));
-  computation->ReplaceInstruction(matmul1, output1);
-
-  HloInstruction* slice2 = computation->AddInstruction(
-      HloInstruction::CreateSlice(slice2_shape, new_matmul, slice2_offset,
-                                  new_matmul->shape().dimensions(), {1, 1, 1}));
-  HloInstruction* output2 = computation->AddInstruction(
-      HloInstruction::CreateReshape(matmul2->shape(), slice2));
-  computation->ReplaceInstruction(matmul2, output2);
-
-  return true;
+  HloInstruction* new_matmul = comp->AddInstruction(HloInstruction::CreateDot(
+      matmul_shape, lhs, rhs, new_dot_dim, first->precision_config()));
+  first->SetupDerivedInstruction(new_matmul);
+  CopySharding(first, new_matmul);
+
+  std::vector<int64> start(3, 0);
+  for (int64 i = 0; i != static_cast<int64>(group.size()); ++i) {
+    HloInstruction* dot = group[i];
+    const HloInstruction* lhs_op = lhs_ops[lhs_ops.size() > 1 ? i : 0];
+    const HloInstruction* rhs_op = rhs_ops[rhs_ops.size() > 1 ? i : 0];
+    const Shape slice_shape = ShapeUtil::MakeShape(
+        type_out,
+        {lhs_op->shape().dimensions(0), lhs_op->shape().dimensions(1),
+         rhs_op->shape().dimensions(2)});
+
+    std::vector<int64> limit(3);
+    for (int64 d = 0; d != 3; ++d) {
+      limit[d] = start[d] + slice_shape.dimensions(d);
+    }
+    HloInstruction* slice = comp->AddInstruction(
+        HloInstruction::CreateSlice(slice_shape, new_matmul, start, limit,
+                                    {1, 1, 1}));
+    HloInstruction* output = comp->AddInstruction(
+        HloInstruction::CreateReshape(dot->shape(), slice));
+    dot->SetupDerivedInstruction(slice);
+    CopySharding(dot, slice);
+    dot->SetupDerivedInstruction(output);
+    TF_RETURN_IF_ERROR(dot->ReplaceAllUsesWith(output));
+    start[concat_dim] = limit[concat_dim];
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+StatusOr<bool> MatmulCombiner::CombineMatmuls(HloComputation* comp) {
+  std::vector<HloInstruction*> dots;
+  for (HloInstruction* inst : comp->MakeInstructionPostOrder()) {
+    if (CanCombine(inst)) {
+      dots.push_back(inst);
+    }
+  }
+  if (dots.size() < 2) {
+    return false;
+  }
+
+  std::unique_ptr<HloReachabilityMap> reachability =
+      HloReachabilityMap::Build(comp);
+  CombinedGroups combined_groups(*reachability);
+  absl::flat_hash_set<HloInstruction*> combined;
+
+  // Prefer sharing operands over concatenating both of them.
+  for (CombineType type : {CombineType::kSharedLHS, CombineType::kSharedRHS,
+                           CombineType::kBatch}) {
+    std::map<std::string, std::vector<HloInstruction*>> candidates;
+    for (HloInstruction* dot : dots) {
+      if (!combined.contains(dot)) {
+        candidates[GetCombineKey(dot, type)].push_back(dot);
+      }
+    }
+
+    for (auto& pair : candidates) {
+      std::vector<HloInstruction*> remaining = pair.second;
+      while (remaining.size() > 1) {
+        // Greedily build the largest group of independent matmuls.
+        std::vector<HloInstruction*> group;
+        std::vector<HloInstruction*> next_remaining;
+        for (HloInstruction* dot : remaining) {
+          group.push_back(dot);
+          if (group.size() > 1 && !combined_groups.CanAdd(group)) {
+            group.pop_back();
+            next_remaining.push_back(dot);
+          }
+        }
+        remaining = std::move(next_remaining);
+
+        if (group.size() < 2 || !IsProfitable(group, type)) {
+          continue;
+        }
+        VLOG(1) << "Combining " << group.size() << " matmuls starting with "
+                << group[0]->name() << ".";
+        TF_RETURN_IF_ERROR(Combine(group, type, comp));
+        combined.insert(group.begin(), group.end());
+        combined_groups.Add(std::move(group));
+      }
+    }
+  }
+
+  // The combined matmuls are only removed at the end, as they are still used
+  // to look up the reachability.
+  for (HloInstruction* dot : combined) {
+    TF_RETURN_IF_ERROR(comp->RemoveInstruction(dot));
+  }
+  return !combined.empty();
+}
+
+StatusOr<bool> MatmulCombiner::Run(HloModule* module) {
+  VLOG(2) << "Before MatmulCombiner:";
+  XLA_VLOG_LINES(2, module->ToString(HloPrintOptions::ShortParsable()));
+
+  bool changed = false;
+  for (HloComputation* comp : module->MakeComputationPostOrder()) {
+    if (IsPopOpsFusion(comp) || comp->IsFusionComputation()) {
+      continue;
+    }
+    TF_ASSIGN_OR_RETURN(bool combined, CombineMatmuls(comp));
+    changed |= combined;
+  }
+
+  if (changed) {
+    VLOG(2) << "After MatmulCombiner:";
+    XLA_VLOG_LINES(2, module->ToString());
+  } else {
+    VLOG(2) << "No matmuls were combined.";
+  }
+  return changed;
 }
 
 }  // namespace poplarplugin
@@ -16,23 +16,36 @@ limitations under the License.
 #ifndef TENSORFLOW_TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_MATMUL_COMBINER_H_
 #define TENSORFLOW_TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_MATMUL_COMBINER_H_
 
-#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_matcher.h"
-#include "tensorflow/core/framework/types.h"
+#include "tensorflow/compiler/xla/service/hlo_pass_interface.h"
 
 namespace xla {
+
+class HloModule;
+
 namespace poplarplugin {
 
-// A pass which combines multiple matmul instructions.
-class MatmulCombiner : public HloMatcher {
+/**
+ * A pass which combines independent matmul instructions into a single larger
+ * matmul followed by slices, which reduces the number of compute sets and
+ * exchange phases.
+ *
+ * Matmuls can be combined when they share the LHS (for example the Q/K/V
+ * projections of an attention layer), when they share the RHS, or when they
+ * have the same number of rows, columns and contracting elements, in which
+ * case they are concatenated along the batch dimension (for example the
+ * per-head matmuls of an attention layer). The other dimensions of the
+ * matmuls can differ. A group of matmuls is only combined when the estimated
+ * cost of concatenating the operands is lower than the estimated cost of
+ * executing the matmuls separately.
+ */
+class MatmulCombiner : public HloModulePass {
  public:
-  explicit MatmulCombiner(struct CompilerAnnotations& annotations);
-
-  ~MatmulCombiner() override = default;
   absl::string_view name() const override { return "matmul-combiner"; }
 
+  StatusOr<bool> Run(HloModule* module) override;
+
  private:
-  bool HandleMatch(HloMatcherMatched& match,
-                   const absl::optional<int64>) override;
+  StatusOr<bool> CombineMatmuls(HloComputation* comp);
 };
 
 }  // namespace poplarplugin
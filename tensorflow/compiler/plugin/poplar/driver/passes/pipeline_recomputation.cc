@@ -22,6 +22,7 @@ limitations under the License.
 #include <vector>
 
 #include "tensorflow/compiler/plugin/poplar/driver/backend_config.pb.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/recomputation_planner.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/fifo.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/stateful_noop.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/inplace_util.h"
@@ -265,10 +266,46 @@ Status AddClusterToBackwardStage(HloInstruction* const fwd_stage,
                                      bwd_stage, to_lower, replacements));
   return Status::OK();
 }
+
+// Estimate the memory saved and the operations added by recomputing the
+// forward stage inside of the backward stage, given that the stashed tensors
+// are held `fifo_depth` times.
+StatusOr<PipelineStageMemory> GetStageMemory(
+    HloInstruction* fwd_stage, HloInstruction* bwd_stage, int64 fifo_depth,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  TF_ASSIGN_OR_RETURN(OutputToInputInfo oi_info,
+                      GetForwardOutputsUsed(fwd_stage, bwd_stage));
+  std::vector<const HloInstruction*> stashed(oi_info.fwd_outputs.begin(),
+                                             oi_info.fwd_outputs.end());
+  if (stashed.empty()) {
+    return GetPipelineStageMemory(fwd_stage, bwd_stage, {}, {}, {}, fifo_depth,
+                                  shape_size);
+  }
+
+  TF_ASSIGN_OR_RETURN(ClusterInfo cluster_info,
+                      GetRecomputationCluster(fwd_stage, oi_info));
+  if (cluster_info.instructions.empty()) {
+    // The stashed tensors are still counted, but nothing can be saved.
+    return GetPipelineStageMemory(fwd_stage, bwd_stage, stashed, stashed, {},
+                                  fifo_depth, shape_size);
+  }
+
+  std::vector<const HloInstruction*> recomputed_stashed(
+      cluster_info.inputs.begin(), cluster_info.inputs.end());
+  std::vector<const HloInstruction*> recomputed(
+      cluster_info.instructions.begin(), cluster_info.instructions.end());
+  return GetPipelineStageMemory(fwd_stage, bwd_stage, stashed,
+                                recomputed_stashed, recomputed, fifo_depth,
+                                shape_size);
+}
 }  // namespace
 
-PipelineRecomputation::PipelineRecomputation(bool allow_recomputation)
-    : allow_recomputation_(allow_recomputation) {}
+PipelineRecomputation::PipelineRecomputation(
+    bool allow_recomputation, int64 memory_budget_per_ipu,
+    HloCostAnalysis::ShapeSizeFunction shape_size)
+    : allow_recomputation_(allow_recomputation),
+      memory_budget_per_ipu_(memory_budget_per_ipu),
+      shape_size_(std::move(shape_size)) {}
 
 StatusOr<bool> PipelineRecomputation::RecomputePipeline(
     HloInstruction* pipeline_op) {
@@ -281,11 +318,35 @@ StatusOr<bool> PipelineRecomputation::RecomputePipeline(
     return false;
   }
 
+  const int64 num_stages = static_cast<int64>(stages.forward.size()) - 1;
+
+  // When there is a memory budget, only recompute the stages required for
+  // each IPU to fit in it.
+  std::vector<PipelineStageMemory> stage_memory(num_stages);
+  if (memory_budget_per_ipu_ > 0) {
+    TF_ASSIGN_OR_RETURN(const int fifo_depth_multiplier,
+                        GetFifoDepthMultiplier(pipeline_op));
+    for (int64 stage_id = 0; stage_id != num_stages; ++stage_id) {
+      const int64 fifo_depth =
+          fifo_depth_multiplier * (stages.forward.size() - stage_id - 1);
+      TF_ASSIGN_OR_RETURN(
+          stage_memory[stage_id],
+          GetStageMemory(stages.forward[stage_id], stages.backward[stage_id],
+                         fifo_depth, shape_size_));
+    }
+  }
+  const std::vector<bool> recompute =
+      PlanPipelineRecomputation(stage_memory, memory_budget_per_ipu_);
+
   bool changed = false;
   // Go through all the forward stages (apart from the last one which does not
   // need recomputation).
-  for (int64 stage_id = 0;
-       stage_id != static_cast<int64>(stages.forward.size()) - 1; ++stage_id) {
+  for (int64 stage_id = 0; stage_id != num_stages; ++stage_id) {
+    if (!recompute[stage_id]) {
+      VLOG(1) << "Pipeline stage " << stage_id
+              << " fits in the memory budget without recomputation.";
+      continue;
+    }
     HloInstruction* fwd_stage = stages.forward[stage_id];
     HloInstruction* bwd_stage = stages.backward[stage_id];
 
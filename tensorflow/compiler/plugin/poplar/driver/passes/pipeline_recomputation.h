@@ -16,7 +16,9 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_RECOMPUTATION_H_
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_RECOMPUTATION_H_
 
+#include "tensorflow/compiler/xla/service/hlo_cost_analysis.h"
 #include "tensorflow/compiler/xla/service/hlo_pass_interface.h"
+#include "tensorflow/compiler/xla/types.h"
 
 namespace xla {
 
@@ -27,10 +29,15 @@ namespace poplarplugin {
 /**
  * Pass which copies all the non-stateful computation operations from the
  * forward pass into the backward pass.
+ *
+ * When `memory_budget_per_ipu` is positive, only the stages which need to be
+ * recomputed for each IPU to fit in the budget are recomputed.
  */
 class PipelineRecomputation : public HloModulePass {
  public:
-  explicit PipelineRecomputation(bool allow_recomputation);
+  explicit PipelineRecomputation(
+      bool allow_recomputation, int64 memory_budget_per_ipu = 0,
+      HloCostAnalysis::ShapeSizeFunction shape_size = {});
 
   absl::string_view name() const override { return "pipeline_recomputation"; }
 
@@ -41,6 +48,8 @@ class PipelineRecomputation : public HloModulePass {
   StatusOr<bool> RecomputePipeline(HloInstruction* pipeline_op);
 
   bool allow_recomputation_;
+  int64 memory_budget_per_ipu_;
+  HloCostAnalysis::ShapeSizeFunction shape_size_;
 };
 
 }  // namespace poplarplugin
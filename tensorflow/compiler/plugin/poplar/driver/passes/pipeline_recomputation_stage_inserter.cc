@@ -18,8 +18,10 @@ limitations under the License.
 #include <list>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "tensorflow/compiler/plugin/poplar/driver/backend_config.pb.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/recomputation_planner.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/fifo.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/stateful_noop.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/inplace_util.h"
@@ -166,10 +168,44 @@ StatusOr<HloInstruction*> CreateRecomputationStage(
   return recomp_stage;
 }
 
+// Estimate the memory saved and the operations added by recomputing the
+// forward stage, given that the FIFOs between the stages hold `fifo_depth`
+// elements.
+StatusOr<PipelineStageMemory> GetStageMemory(
+    HloInstruction* fwd_stage, HloInstruction* bwd_stage, int64 fifo_depth,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  // Without recomputation the forward outputs are stored in FIFOs...
+  std::vector<const HloInstruction*> stashed;
+  for (const HloInstruction* operand : bwd_stage->operands()) {
+    if (IsPoplarInstruction(PoplarOp::Fifo)(operand) &&
+        operand->operand(0)->opcode() == HloOpcode::kGetTupleElement &&
+        operand->operand(0)->operand(0) == fwd_stage) {
+      stashed.push_back(operand);
+    }
+  }
+  // ...whereas with recomputation the forward inputs are stored instead.
+  std::vector<const HloInstruction*> recomputed_stashed;
+  for (const HloInstruction* operand : fwd_stage->operands()) {
+    if (!IsPipelineStageReadOnlyInput(operand)) {
+      recomputed_stashed.push_back(operand);
+    }
+  }
+
+  HloComputation* fwd_comp = fwd_stage->to_apply();
+  std::vector<const HloInstruction*> recomputed(
+      fwd_comp->instructions().begin(), fwd_comp->instructions().end());
+  return GetPipelineStageMemory(fwd_stage, bwd_stage, stashed,
+                                recomputed_stashed, recomputed, fifo_depth,
+                                shape_size);
+}
 }  // namespace
+
 PipelineRecomputationStageInserter::PipelineRecomputationStageInserter(
-    bool allow_recomputation)
-    : allow_recomputation_(allow_recomputation) {}
+    bool allow_recomputation, int64 memory_budget_per_ipu,
+    HloCostAnalysis::ShapeSizeFunction shape_size)
+    : allow_recomputation_(allow_recomputation),
+      memory_budget_per_ipu_(memory_budget_per_ipu),
+      shape_size_(std::move(shape_size)) {}
 
 StatusOr<bool> PipelineRecomputationStageInserter::RecomputePipeline(
     HloInstruction* pipeline_op) {
@@ -181,11 +217,35 @@ StatusOr<bool> PipelineRecomputationStageInserter::RecomputePipeline(
     return false;
   }
 
+  const int64 num_stages = static_cast<int64>(stages.forward.size()) - 1;
+
+  // When there is a memory budget, only recompute the stages required for
+  // each IPU to fit in it.
+  std::vector<PipelineStageMemory> stage_memory(num_stages);
+  if (memory_budget_per_ipu_ > 0) {
+    TF_ASSIGN_OR_RETURN(const int fifo_depth_multiplier,
+                        GetFifoDepthMultiplier(pipeline_op));
+    for (int64 stage_id = 0; stage_id != num_stages; ++stage_id) {
+      const int64 fifo_depth =
+          fifo_depth_multiplier * (stages.forward.size() - stage_id - 1);
+      TF_ASSIGN_OR_RETURN(
+          stage_memory[stage_id],
+          GetStageMemory(stages.forward[stage_id], stages.backward[stage_id],
+                         fifo_depth, shape_size_));
+    }
+  }
+  const std::vector<bool> recompute =
+      PlanPipelineRecomputation(stage_memory, memory_budget_per_ipu_);
+
   bool changed = false;
   // Go through all the forward stages (apart from the last one which does not
   // need recomputation).
-  for (int64 stage_id = 0;
-       stage_id != static_cast<int64>(stages.forward.size()) - 1; ++stage_id) {
+  for (int64 stage_id = 0; stage_id != num_stages; ++stage_id) {
+    if (!recompute[stage_id]) {
+      VLOG(1) << "Pipeline stage " << stage_id
+              << " fits in the memory budget without recomputation.";
+      continue;
+    }
     HloInstruction* fwd_stage = stages.forward[stage_id];
     HloInstruction* bwd_stage = stages.backward[stage_id];
     // Do not recompute a stage if it has no outputs which go into the
@@ -16,7 +16,9 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_RECOMPUTATION_STAGE_INSERTER_H_
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_RECOMPUTATION_STAGE_INSERTER_H_
 
+#include "tensorflow/compiler/xla/service/hlo_cost_analysis.h"
 #include "tensorflow/compiler/xla/service/hlo_pass_interface.h"
+#include "tensorflow/compiler/xla/types.h"
 
 namespace xla {
 
@@ -26,10 +28,15 @@ namespace poplarplugin {
 
 /**
  * Pass which inserts Pipeline recomputation stages into the graph.
+ *
+ * When `memory_budget_per_ipu` is positive, only the stages which need to be
+ * recomputed for each IPU to fit in the budget are recomputed.
  */
 class PipelineRecomputationStageInserter : public HloModulePass {
  public:
-  explicit PipelineRecomputationStageInserter(bool allow_recomputation);
+  explicit PipelineRecomputationStageInserter(
+      bool allow_recomputation, int64 memory_budget_per_ipu = 0,
+      HloCostAnalysis::ShapeSizeFunction shape_size = {});
 
   absl::string_view name() const override {
     return "pipeline_recomputation_stage_inserter";
@@ -42,6 +49,8 @@ class PipelineRecomputationStageInserter : public HloModulePass {
   StatusOr<bool> RecomputePipeline(HloInstruction* pipeline_op);
 
   bool allow_recomputation_;
+  int64 memory_budget_per_ipu_;
+  HloCostAnalysis::ShapeSizeFunction shape_size_;
 };
 
 }  // namespace poplarplugin
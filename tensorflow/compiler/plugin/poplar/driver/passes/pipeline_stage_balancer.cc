@@ -0,0 +1,551 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_stage_balancer.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/optional.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/liveness_util.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/pipeline_util.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
+#include "tensorflow/compiler/xla/service/hlo_creation_utils.h"
+#include "tensorflow/compiler/xla/service/hlo_dce.h"
+#include "tensorflow/compiler/xla/service/hlo_instruction.h"
+#include "tensorflow/compiler/xla/service/hlo_module.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+// Rough throughput figures for a whole IPU, used to turn the HloCostAnalysis
+// numbers into cycles with a roofline model: an instruction takes as long as
+// the larger of its compute time and its memory time. Only the relative cost
+// of the stages matters, so these do not need to be exact.
+
+// The number of tiles of a Mk1 IPU.
+constexpr double kTilesPerIpu = 1216.0;
+// The single precision multiply-accumulates one tile can issue per cycle with
+// its vector unit, counting each as a flop as HloCostAnalysis does.
+constexpr double kFlopsPerTilePerCycle = 16.0;
+// Transcendental functions are not vectorised, so each tile does one a cycle.
+constexpr double kTranscendentalsPerTilePerCycle = 1.0;
+// The bytes one tile can load from, or store to, its own memory per cycle.
+constexpr double kBytesPerTilePerCycle = 16.0;
+
+constexpr double kFlopsPerCycle = kTilesPerIpu * kFlopsPerTilePerCycle;
+constexpr double kTranscendentalsPerCycle =
+    kTilesPerIpu * kTranscendentalsPerTilePerCycle;
+constexpr double kBytesPerCycle = kTilesPerIpu * kBytesPerTilePerCycle;
+
+struct StageCost {
+  HloInstruction* stage;
+  int64 device;
+  double cycles = 0.0;
+  int64 peak_memory = 0;
+  absl::flat_hash_map<const HloInstruction*, double> instruction_cycles;
+};
+
+struct PipelineCost {
+  std::vector<StageCost> forward;
+  std::vector<StageCost> backward;
+  std::map<int64, double> device_cycles;
+  std::map<int64, int64> device_memory;
+};
+
+StatusOr<StageCost> GetStageCost(
+    HloInstruction* stage, int64 device,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  StageCost cost;
+  cost.stage = stage;
+  cost.device = device;
+
+  HloComputation* comp = stage->to_apply();
+  HloCostAnalysis analysis(shape_size);
+  TF_RETURN_IF_ERROR(comp->Accept(&analysis));
+  for (const HloInstruction* inst : comp->instructions()) {
+    // Unknown costs (such as custom calls) are reported as negative numbers.
+    const double flops = std::max<int64>(analysis.flop_count(*inst), 0);
+    const double transcendentals =
+        std::max<int64>(analysis.transcendental_count(*inst), 0);
+    const double bytes = std::max<int64>(analysis.bytes_accessed(*inst), 0);
+    const double cycles =
+        std::max(flops / kFlopsPerCycle +
+                     transcendentals / kTranscendentalsPerCycle,
+                 bytes / kBytesPerCycle);
+    cost.instruction_cycles[inst] = cycles;
+    cost.cycles += cycles;
+  }
+  cost.peak_memory = EstimatePeakLiveness(comp, shape_size);
+  return cost;
+}
+
+StatusOr<PipelineCost> GetPipelineCost(
+    const PipelineStages& stages,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  PipelineCost cost;
+  for (HloInstruction* stage : stages.forward) {
+    const int64 device = GetSingleShardingDeviceId(stage);
+    TF_ASSIGN_OR_RETURN(StageCost stage_cost,
+                        GetStageCost(stage, device, shape_size));
+    cost.forward.push_back(std::move(stage_cost));
+  }
+  // Backward stages are not sharded, they are placed on the same device as the
+  // corresponding forward stage.
+  for (size_t i = 0; i != stages.backward.size(); ++i) {
+    const int64 device = cost.forward[i].device;
+    TF_ASSIGN_OR_RETURN(StageCost stage_cost,
+                        GetStageCost(stages.backward[i], device, shape_size));
+    cost.backward.push_back(std::move(stage_cost));
+  }
+  for (auto* stage_costs : {&cost.forward, &cost.backward}) {
+    for (const StageCost& stage_cost : *stage_costs) {
+      cost.device_cycles[stage_cost.device] += stage_cost.cycles;
+      cost.device_memory[stage_cost.device] += stage_cost.peak_memory;
+    }
+  }
+  return cost;
+}
+
+void ReportPipelineCost(const std::string& title, const PipelineCost& cost,
+                        int64 gradient_accumulation_count) {
+  if (!VLOG_IS_ON(1) || cost.device_cycles.empty()) {
+    return;
+  }
+  VLOG(1) << title;
+  double max_cycles = 0.0;
+  double total_cycles = 0.0;
+  for (auto& pair : cost.device_cycles) {
+    VLOG(1) << absl::StrFormat(
+        "  IPU %d: %.0f estimated cycles, %d estimated bytes.", pair.first,
+        pair.second, cost.device_memory.at(pair.first));
+    max_cycles = std::max(max_cycles, pair.second);
+    total_cycles += pair.second;
+  }
+  const double num_devices = cost.device_cycles.size();
+  const double mean_cycles = total_cycles / num_devices;
+  const double imbalance =
+      max_cycles > 0.0 ? 1.0 - mean_cycles / max_cycles : 0.0;
+  // While the pipeline ramps up and down, only some of the IPUs are busy.
+  const double num_steps = std::max<int64>(gradient_accumulation_count, 1);
+  const double ramp = (num_devices - 1.0) / (num_steps + num_devices - 1.0);
+  const double overhead = 1.0 - (1.0 - ramp) * (1.0 - imbalance);
+  VLOG(1) << absl::StrFormat(
+      "  Predicted bubble overhead: %.1f%% (%.1f%% from ramp up/down, %.1f%% "
+      "from stage imbalance).",
+      overhead * 100.0, ramp * 100.0, imbalance * 100.0);
+}
+
+bool CanMove(const HloInstruction* inst) {
+  if (inst->HasSideEffect() || inst->shape().IsTuple()) {
+    return false;
+  }
+  switch (inst->opcode()) {
+    case HloOpcode::kCall:
+    case HloOpcode::kConditional:
+    case HloOpcode::kCustomCall:
+    case HloOpcode::kFusion:
+    case HloOpcode::kGetTupleElement:
+    case HloOpcode::kParameter:
+    case HloOpcode::kTuple:
+    case HloOpcode::kWhile:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Returns the output indices of the stage root which hold the instruction.
+std::set<int64> GetOutputIndices(const HloInstruction* stage,
+                                 const HloInstruction* inst) {
+  const HloInstruction* root = stage->to_apply()->root_instruction();
+  auto indices = root->OperandIndices(inst);
+  return std::set<int64>(indices.begin(), indices.end());
+}
+
+// An instruction at the end of the `src` stage can be pushed into the `dst`
+// stage when its only outputs are consumed by `dst` and all of its operands are
+// computed inside of `src`.
+bool CanPush(const HloInstruction* src, const HloInstruction* dst,
+             const HloInstruction* inst) {
+  const HloInstruction* root = src->to_apply()->root_instruction();
+  if (!CanMove(inst) || inst == root || inst->operand_count() == 0) {
+    return false;
+  }
+  if (absl::c_any_of(inst->users(), [root](const HloInstruction* user) {
+        return user != root;
+      })) {
+    return false;
+  }
+  if (absl::c_any_of(inst->operands(), [](const HloInstruction* operand) {
+        return operand->opcode() == HloOpcode::kParameter;
+      })) {
+    return false;
+  }
+  const std::set<int64> indices = GetOutputIndices(src, inst);
+  bool used_by_dst = false;
+  for (const HloInstruction* gte : src->users()) {
+    if (!indices.count(gte->tuple_index())) {
+      continue;
+    }
+    for (const HloInstruction* user : gte->users()) {
+      if (user != dst) {
+        return false;
+      }
+      used_by_dst = true;
+    }
+  }
+  return used_by_dst;
+}
+
+// An instruction at the start of the `dst` stage can be pulled into the `src`
+// stage when all of its operands are outputs of `src`.
+bool CanPull(const HloInstruction* src, const HloInstruction* dst,
+             const HloInstruction* inst) {
+  const HloInstruction* root = dst->to_apply()->root_instruction();
+  if (!CanMove(inst) || inst == root || inst->operand_count() == 0 ||
+      root->IsUserOf(inst)) {
+    return false;
+  }
+  return absl::c_all_of(inst->operands(), [&](const HloInstruction* operand) {
+    if (operand->opcode() != HloOpcode::kParameter) {
+      return false;
+    }
+    const HloInstruction* input = dst->operand(operand->parameter_number());
+    return input->opcode() == HloOpcode::kGetTupleElement &&
+           input->operand(0) == src;
+  });
+}
+
+// Rebuilds the stage so that `inst` is replaced by a new parameter which is
+// given `new_operand`.
+StatusOr<HloInstruction*> ReplaceInstructionWithParameter(
+    HloInstruction* stage, HloInstruction* inst, HloInstruction* new_operand) {
+  HloComputation* comp = stage->to_apply();
+  auto builder = HloComputation::Builder(comp->name());
+  absl::flat_hash_map<HloInstruction*, HloInstruction*> old_to_new;
+  for (HloInstruction* old_inst : comp->MakeInstructionPostOrder()) {
+    HloInstruction* new_inst;
+    if (old_inst == inst) {
+      new_inst = builder.AddInstruction(HloInstruction::CreateParameter(
+          stage->operand_count(), inst->shape(), inst->name()));
+    } else {
+      std::vector<HloInstruction*> new_operands(old_inst->operand_count());
+      absl::c_transform(
+          old_inst->operands(), new_operands.begin(),
+          [&old_to_new](HloInstruction* old) { return old_to_new.at(old); });
+      new_inst = builder.AddInstruction(
+          old_inst->CloneWithNewOperands(old_inst->shape(), new_operands));
+    }
+    old_inst->SetupDerivedInstruction(new_inst);
+    old_to_new[old_inst] = new_inst;
+  }
+  std::vector<HloInstruction*> new_operands = {stage->operands().begin(),
+                                               stage->operands().end()};
+  new_operands.push_back(new_operand);
+  return ReplaceCallWith(stage,
+                         builder.Build(old_to_new.at(comp->root_instruction())),
+                         new_operands, false);
+}
+
+// Removes the given outputs of the stage which are no longer used.
+Status RemoveOutputsIfUnused(HloInstruction* stage, std::set<int64> outputs) {
+  for (HloInstruction* gte : stage->users()) {
+    outputs.erase(gte->tuple_index());
+  }
+  return RemoveOutputsFromCall(stage, outputs);
+}
+
+// Removes the given parameters of the stage which are no longer used.
+StatusOr<HloInstruction*> RemoveParametersIfUnused(
+    HloInstruction* stage, const std::set<int64>& parameters) {
+  TF_RETURN_IF_ERROR(HloDCE::RunOnComputation(stage->to_apply()).status());
+  TF_ASSIGN_OR_RETURN(std::set<int64> unused,
+                      GetUnusedParametersInCall(stage));
+  std::set<int64> to_remove;
+  absl::c_set_intersection(parameters, unused,
+                           std::inserter(to_remove, to_remove.begin()));
+  return RemoveParametersFromCall(stage, to_remove);
+}
+
+// Moves `inst` from the end of the `src` stage to the start of the `dst`
+// stage.
+Status PushInstruction(HloInstruction* src, HloInstruction* dst,
+                       HloInstruction* inst, int64 dst_device) {
+  HloComputation* pipeline_comp = src->parent();
+  HloComputation* src_comp = src->to_apply();
+  const std::set<int64> inst_outputs = GetOutputIndices(src, inst);
+
+  // Make sure all the operands are outputs of the src stage.
+  HloInstruction* root = src_comp->root_instruction();
+  HloInstruction::InstructionVector new_outputs = root->operands();
+  for (HloInstruction* operand : inst->unique_operands()) {
+    if (root->OperandIndices(operand).empty()) {
+      new_outputs.push_back(operand);
+    }
+  }
+  if (new_outputs.size() != root->operand_count()) {
+    HloInstruction* new_root =
+        src_comp->AddInstruction(HloInstruction::CreateTuple(new_outputs));
+    src_comp->set_root_instruction(new_root, true);
+    TF_RETURN_IF_ERROR(src_comp->RemoveInstruction(root));
+    *src->mutable_shape() = new_root->shape();
+    root = new_root;
+  }
+
+  // Recreate the instruction in the pipeline computation.
+  std::vector<HloInstruction*> new_operands(inst->operand_count());
+  for (int64 i = 0; i != inst->operand_count(); ++i) {
+    TF_ASSIGN_OR_RETURN(
+        new_operands[i],
+        MakeGetTupleElementHlo(src,
+                               root->OperandIndices(inst->operand(i))[0]));
+  }
+  HloInstruction* moved = pipeline_comp->AddInstruction(
+      inst->CloneWithNewOperands(inst->shape(), new_operands));
+  inst->SetupDerivedInstruction(moved);
+  if (inst->has_sharding()) {
+    moved->set_device_sharding(dst_device);
+  }
+
+  // Lower it into the dst stage, in place of the parameters which used to
+  // receive it.
+  std::map<int64, HloInstruction*> replacements;
+  std::set<int64> replaced_parameters;
+  for (HloInstruction* gte : src->users()) {
+    if (!inst_outputs.count(gte->tuple_index())) {
+      continue;
+    }
+    for (int64 index : dst->OperandIndices(gte)) {
+      replacements[index] = moved;
+      replaced_parameters.insert(index);
+    }
+  }
+  TF_ASSIGN_OR_RETURN(dst,
+                      AddInstructionsToPipelineStage(dst, {moved}, replacements));
+  TF_ASSIGN_OR_RETURN(dst, RemoveParametersIfUnused(dst, replaced_parameters));
+
+  // The instruction is no longer needed in the src stage.
+  TF_RETURN_IF_ERROR(RemoveOutputsIfUnused(src, inst_outputs));
+  return HloDCE::RunOnComputation(src->to_apply()).status();
+}
+
+// Moves `inst` from the start of the `dst` stage to the end of the `src`
+// stage.
+Status PullInstruction(HloInstruction* src, HloInstruction* dst,
+                       HloInstruction* inst, int64 src_device) {
+  HloComputation* pipeline_comp = src->parent();
+
+  // Recreate the instruction in the pipeline computation using the outputs of
+  // the src stage.
+  std::vector<HloInstruction*> new_operands(inst->operand_count());
+  std::set<int64> parameters;
+  std::set<int64> src_outputs;
+  for (int64 i = 0; i != inst->operand_count(); ++i) {
+    const int64 parameter_number = inst->operand(i)->parameter_number();
+    new_operands[i] = dst->mutable_operand(parameter_number);
+    parameters.insert(parameter_number);
+    src_outputs.insert(new_operands[i]->tuple_index());
+  }
+  HloInstruction* moved = pipeline_comp->AddInstruction(
+      inst->CloneWithNewOperands(inst->shape(), new_operands));
+  inst->SetupDerivedInstruction(moved);
+  if (inst->has_sharding()) {
+    moved->set_device_sharding(src_device);
+  }
+
+  // The dst stage now receives the instruction, which is then lowered into the
+  // src stage.
+  TF_ASSIGN_OR_RETURN(dst, ReplaceInstructionWithParameter(dst, inst, moved));
+  TF_ASSIGN_OR_RETURN(src, AddInstructionsToPipelineStage(src, {moved}));
+  TF_ASSIGN_OR_RETURN(dst, RemoveParametersIfUnused(dst, parameters));
+  return RemoveOutputsIfUnused(src, src_outputs);
+}
+
+struct Move {
+  bool push;
+  int64 stage_index;
+  HloInstruction* inst;
+  double max_cycles;
+  double pair_cycles;
+};
+
+}  // namespace
+
+PipelineStageBalancer::PipelineStageBalancer(
+    bool apply_moves, int64 available_memory_per_ipu,
+    HloCostAnalysis::ShapeSizeFunction shape_size, int64 max_moves)
+    : apply_moves_(apply_moves),
+      available_memory_per_ipu_(available_memory_per_ipu),
+      shape_size_(std::move(shape_size)),
+      max_moves_(max_moves) {}
+
+StatusOr<bool> PipelineStageBalancer::BalancePipeline(
+    HloInstruction* pipeline_op) {
+  HloComputation* pipeline_comp = pipeline_op->to_apply();
+  const int64 gradient_accumulation_count =
+      GetGradientAccumulationCount(pipeline_op);
+
+  TF_ASSIGN_OR_RETURN(PipelineStages stages, GetPipelineStages(pipeline_comp));
+  TF_ASSIGN_OR_RETURN(PipelineCost cost, GetPipelineCost(stages, shape_size_));
+  ReportPipelineCost(absl::StrCat("Estimated cost of pipeline ",
+                                  pipeline_op->name(), " before balancing:"),
+                     cost, gradient_accumulation_count);
+
+  auto fits_in_memory = [&](int64 device, int64 extra_bytes) {
+    return available_memory_per_ipu_ <= 0 ||
+           cost.device_memory.at(device) + extra_bytes <=
+               available_memory_per_ipu_;
+  };
+
+  int64 num_moves = 0;
+  for (; num_moves != max_moves_; ++num_moves) {
+    double max_cycles = 0.0;
+    for (auto& pair : cost.device_cycles) {
+      max_cycles = std::max(max_cycles, pair.second);
+    }
+
+    // Find the move which reduces the time of the slowest IPU the most.
+    absl::optional<Move> best;
+    auto consider = [&](bool push, int64 stage_index, HloInstruction* inst,
+                        int64 from, int64 to, double inst_cycles) {
+      if (inst_cycles <= 0.0 ||
+          !fits_in_memory(to, GetArrayByteSize(inst->shape(), shape_size_))) {
+        return;
+      }
+      const double old_pair = std::max(cost.device_cycles.at(from),
+                                       cost.device_cycles.at(to));
+      const double new_from = cost.device_cycles.at(from) - inst_cycles;
+      const double new_to = cost.device_cycles.at(to) + inst_cycles;
+      const double new_pair = std::max(new_from, new_to);
+      if (new_pair >= old_pair) {
+        return;
+      }
+      double new_max = std::max(new_from, new_to);
+      for (auto& pair : cost.device_cycles) {
+        if (pair.first != from && pair.first != to) {
+          new_max = std::max(new_max, pair.second);
+        }
+      }
+      if (!best || std::make_pair(new_max, new_pair) <
+                       std::make_pair(best->max_cycles, best->pair_cycles)) {
+        best = Move{push, stage_index, inst, new_max, new_pair};
+      }
+    };
+
+    for (size_t i = 0; i + 1 < cost.forward.size(); ++i) {
+      const StageCost& src = cost.forward[i];
+      const StageCost& dst = cost.forward[i + 1];
+      if (src.device == dst.device) {
+        continue;
+      }
+      for (HloInstruction* inst :
+           src.stage->to_apply()->root_instruction()->unique_operands()) {
+        if (CanPush(src.stage, dst.stage, inst)) {
+          consider(true, i, inst, src.device, dst.device,
+                   src.instruction_cycles.at(inst));
+        }
+      }
+      for (HloInstruction* inst : dst.stage->to_apply()->instructions()) {
+        if (CanPull(src.stage, dst.stage, inst)) {
+          consider(false, i, inst, dst.device, src.device,
+                   dst.instruction_cycles.at(inst));
+        }
+      }
+    }
+
+    if (!best) {
+      break;
+    }
+
+    const StageCost& src = cost.forward[best->stage_index];
+    const StageCost& dst = cost.forward[best->stage_index + 1];
+    VLOG(2) << (best->push ? "Pushing " : "Pulling ")
+            << best->inst->ToString() << " from "
+            << (best->push ? src.stage : dst.stage)->ToShortString()
+            << " into "
+            << (best->push ? dst.stage : src.stage)->ToShortString();
+    if (best->push) {
+      TF_RETURN_IF_ERROR(
+          PushInstruction(src.stage, dst.stage, best->inst, dst.device));
+    } else {
+      TF_RETURN_IF_ERROR(
+          PullInstruction(src.stage, dst.stage, best->inst, src.device));
+    }
+
+    // The stages have been replaced, recompute the costs.
+    TF_ASSIGN_OR_RETURN(stages, GetPipelineStages(pipeline_comp));
+    TF_ASSIGN_OR_RETURN(cost, GetPipelineCost(stages, shape_size_));
+  }
+
+  if (num_moves) {
+    TF_RETURN_IF_ERROR(VerifyPipelineAfterFixing(pipeline_op));
+  }
+  ReportPipelineCost(
+      absl::StrCat("Estimated cost of pipeline ", pipeline_op->name(),
+                   " after ", apply_moves_ ? "applying " : "proposing ",
+                   num_moves, " balancing moves:"),
+      cost, gradient_accumulation_count);
+  return num_moves != 0;
+}
+
+StatusOr<bool> PipelineStageBalancer::Run(HloModule* module) {
+  // When only proposing moves, balance a copy of the module instead.
+  std::unique_ptr<HloModule> copy;
+  HloModule* module_to_balance = module;
+  if (!apply_moves_) {
+    copy = module->Clone();
+    module_to_balance = copy.get();
+  }
+
+  TF_ASSIGN_OR_RETURN(std::vector<HloInstruction*> pipeline_ops,
+                      GetPipelines(module_to_balance));
+  if (pipeline_ops.empty()) {
+    // No pipeline ops found - nothing to balance.
+    return false;
+  }
+
+  VLOG(2) << "Before PipelineStageBalancer:";
+  XLA_VLOG_LINES(2, module->ToString(HloPrintOptions::ShortParsable()));
+
+  bool changed = false;
+  for (HloInstruction* pipeline_op : pipeline_ops) {
+    TF_ASSIGN_OR_RETURN(bool balanced, BalancePipeline(pipeline_op));
+    changed |= balanced;
+  }
+  changed &= apply_moves_;
+
+  if (changed) {
+    VLOG(2) << "After PipelineStageBalancer:";
+    XLA_VLOG_LINES(2, module->ToString());
+  } else {
+    VLOG(2) << "No changes were made to the Pipeline.";
+  }
+  return changed;
+}
+
+}  // namespace poplarplugin
+}  // namespace xla
@@ -0,0 +1,62 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_STAGE_BALANCER_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_STAGE_BALANCER_H_
+
+#include "tensorflow/compiler/xla/service/hlo_cost_analysis.h"
+#include "tensorflow/compiler/xla/service/hlo_pass_interface.h"
+#include "tensorflow/compiler/xla/types.h"
+
+namespace xla {
+
+class HloModule;
+
+namespace poplarplugin {
+
+/**
+ * Pass which estimates the compute and memory cost of every pipeline stage and
+ * moves instructions at the boundary between two adjacent forward stages on
+ * different IPUs in order to reduce the time of the slowest IPU. A move is
+ * only made when it keeps the estimated memory of the IPU receiving the
+ * instruction under `available_memory_per_ipu` bytes (zero means no limit).
+ *
+ * When `apply_moves` is false, the moves are only proposed: the balancing is
+ * done on a copy of the module and the predicted outcome is logged at VLOG(1),
+ * together with the predicted pipeline bubble overhead.
+ */
+class PipelineStageBalancer : public HloModulePass {
+ public:
+  PipelineStageBalancer(bool apply_moves, int64 available_memory_per_ipu,
+                        HloCostAnalysis::ShapeSizeFunction shape_size,
+                        int64 max_moves = 256);
+
+  absl::string_view name() const override { return "pipeline-stage-balancer"; }
+
+  StatusOr<bool> Run(HloModule* module) override;
+
+ private:
+  StatusOr<bool> BalancePipeline(HloInstruction* pipeline_op);
+
+  const bool apply_moves_;
+  const int64 available_memory_per_ipu_;
+  const HloCostAnalysis::ShapeSizeFunction shape_size_;
+  const int64 max_moves_;
+};
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_PIPELINE_STAGE_BALANCER_H_
@@ -0,0 +1,339 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/passes/recomputation_planner.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/types/optional.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/liveness_util.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/matcher_predicates.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/pipeline_util.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
+#include "tensorflow/compiler/xla/service/hlo_instruction.h"
+#include "tensorflow/compiler/xla/service/hlo_module.h"
+
+namespace xla {
+namespace poplarplugin {
+
+namespace {
+// Be conservative, and only recompute instructions which have no side effects,
+// sub computations or tuple outputs, similarly to AddBlockRecompute.
+bool CanRecompute(const HloInstruction* inst) {
+  switch (inst->opcode()) {
+    case HloOpcode::kConstant:
+    case HloOpcode::kCustomCall:
+    case HloOpcode::kGetTupleElement:
+    case HloOpcode::kParameter:
+    case HloOpcode::kTuple:
+      return false;
+    default:
+      break;
+  }
+  return !inst->HasSideEffect() && inst->called_computations().empty() &&
+         !inst->shape().IsTuple() &&
+         absl::c_all_of(inst->users(), AllocatesOutput);
+}
+
+// Returns whether the instruction is available for the whole computation.
+bool IsAlwaysLive(const HloInstruction* inst) {
+  switch (inst->opcode()) {
+    case HloOpcode::kConstant:
+    case HloOpcode::kParameter:
+      return true;
+    case HloOpcode::kGetTupleElement:
+      return IsAlwaysLive(inst->operand(0));
+    default:
+      return false;
+  }
+}
+
+// The live ranges of the instructions when the computation is executed in
+// post order.
+class ComputationLiveness {
+ public:
+  ComputationLiveness(HloComputation* comp,
+                      const HloCostAnalysis::ShapeSizeFunction& shape_size)
+      : sequence_(comp->MakeInstructionPostOrder()) {
+    const int64 end = sequence_.size();
+    for (int64 i = 0; i != end; ++i) {
+      position_[sequence_[i]] = i;
+    }
+
+    // Walk backwards so that the users are visited first, which means the
+    // buffers forwarded by tuples and GTEs stay live until their real users.
+    for (int64 i = end - 1; i >= 0; --i) {
+      const HloInstruction* inst = sequence_[i];
+      int64 last_use = i;
+      if (inst == comp->root_instruction() || IsAlwaysLive(inst)) {
+        last_use = end - 1;
+      }
+      for (const HloInstruction* user : inst->users()) {
+        last_use = std::max(last_use, AllocatesOutput(user)
+                                          ? position_.at(user)
+                                          : last_use_.at(user));
+      }
+      last_use_[inst] = last_use;
+    }
+
+    for (const HloInstruction* inst : sequence_) {
+      if (!AllocatesOutput(inst)) {
+        continue;
+      }
+      const int64 bytes = GetArrayByteSize(inst->shape(), shape_size);
+      const int64 start = IsAlwaysLive(inst) ? 0 : position_.at(inst);
+      std::vector<int64>& delta = device_delta_[GetDevice(inst)];
+      delta.resize(end + 1);
+      delta[start] += bytes;
+      delta[last_use_.at(inst) + 1] -= bytes;
+    }
+  }
+
+  static int64 GetDevice(const HloInstruction* inst) {
+    return GetSingleShardingDeviceId(inst);
+  }
+
+  const std::vector<HloInstruction*>& Sequence() const { return sequence_; }
+  int64 Position(const HloInstruction* inst) const {
+    return position_.at(inst);
+  }
+  int64 LastUse(const HloInstruction* inst) const {
+    return last_use_.at(inst);
+  }
+
+  // Returns the device and the position of the highest peak over the budget,
+  // if there is one.
+  absl::optional<std::pair<int64, int64>> FindPeakOverBudget(
+      int64 budget) const {
+    absl::optional<std::pair<int64, int64>> peak;
+    int64 peak_bytes = budget;
+    for (auto& pair : device_delta_) {
+      int64 live = 0;
+      for (int64 i = 0; i + 1 < static_cast<int64>(pair.second.size()); ++i) {
+        live += pair.second[i];
+        if (live > peak_bytes) {
+          peak_bytes = live;
+          peak = std::make_pair(pair.first, i);
+        }
+      }
+    }
+    if (peak) {
+      VLOG(3) << "IPU " << peak->first << " has " << peak_bytes
+              << " bytes live at " << sequence_[peak->second]->name();
+    }
+    return peak;
+  }
+
+ private:
+  std::vector<HloInstruction*> sequence_;
+  absl::flat_hash_map<const HloInstruction*, int64> position_;
+  absl::flat_hash_map<const HloInstruction*, int64> last_use_;
+  std::map<int64, std::vector<int64>> device_delta_;
+};
+}  // namespace
+
+RecomputationPlanner::RecomputationPlanner(
+    int64 memory_budget_per_ipu, HloCostAnalysis::ShapeSizeFunction shape_size,
+    int64 max_recomputations_per_computation)
+    : memory_budget_per_ipu_(memory_budget_per_ipu),
+      shape_size_(std::move(shape_size)),
+      max_recomputations_per_computation_(max_recomputations_per_computation) {
+}
+
+StatusOr<bool> RecomputationPlanner::PlanComputation(HloComputation* comp) {
+  TF_ASSIGN_OR_RETURN(auto flops, GetInstructionFlops(comp, shape_size_));
+
+  bool changed = false;
+  for (int64 i = 0; i != max_recomputations_per_computation_; ++i) {
+    ComputationLiveness liveness(comp, shape_size_);
+    auto peak = liveness.FindPeakOverBudget(memory_budget_per_ipu_);
+    if (!peak) {
+      break;
+    }
+    const int64 device = peak->first;
+    const int64 peak_position = peak->second;
+    HloInstruction* peak_inst = liveness.Sequence()[peak_position];
+
+    // Find the cheapest instruction to recompute, per byte saved.
+    HloInstruction* best = nullptr;
+    double best_cost = 0.0;
+    for (HloInstruction* inst : liveness.Sequence()) {
+      const int64 position = liveness.Position(inst);
+      if (inst == comp->root_instruction() || position >= peak_position ||
+          liveness.LastUse(inst) <= peak_position ||
+          ComputationLiveness::GetDevice(inst) != device ||
+          !CanRecompute(inst) || peak_inst->IsUserOf(inst)) {
+        continue;
+      }
+      // The recomputation is done just before the first user after the peak,
+      // and its operands have to be live there already.
+      int64 first_late_use = liveness.Sequence().size();
+      for (const HloInstruction* user : inst->users()) {
+        const int64 user_position = liveness.Position(user);
+        if (user_position > peak_position) {
+          first_late_use = std::min(first_late_use, user_position);
+        }
+      }
+      const bool operands_live =
+          absl::c_all_of(inst->operands(), [&](const HloInstruction* operand) {
+            return IsAlwaysLive(operand) ||
+                   liveness.LastUse(operand) >= first_late_use;
+          });
+      if (!operands_live) {
+        continue;
+      }
+      const int64 bytes = GetArrayByteSize(inst->shape(), shape_size_);
+      if (bytes == 0) {
+        continue;
+      }
+      const double cost = static_cast<double>(flops.at(inst)) / bytes;
+      if (!best || cost < best_cost) {
+        best = inst;
+        best_cost = cost;
+      }
+    }
+
+    if (!best) {
+      VLOG(1) << "Could not recompute enough of " << comp->name()
+              << " to fit in " << memory_budget_per_ipu_ << " bytes on IPU "
+              << device << ".";
+      break;
+    }
+
+    VLOG(1) << "Recomputing " << best->name() << " after "
+            << peak_inst->name() << " (" << flops.at(best) << " flops).";
+    HloInstruction* clone = comp->AddInstruction(best->Clone());
+    best->SetupDerivedInstruction(clone);
+    flops[clone] = flops.at(best);
+
+    std::vector<HloInstruction*> users = best->users();
+    for (HloInstruction* user : users) {
+      if (liveness.Position(user) > peak_position) {
+        TF_RETURN_IF_ERROR(best->ReplaceUseWith(user, clone));
+      }
+    }
+    // Make sure the clone is executed after the peak, and after anything the
+    // original had to wait for.
+    TF_RETURN_IF_ERROR(peak_inst->AddControlDependencyTo(clone));
+    for (HloInstruction* predecessor : best->control_predecessors()) {
+      TF_RETURN_IF_ERROR(predecessor->AddControlDependencyTo(clone));
+    }
+
+    if (best->user_count() == 0 && best->control_successors().empty()) {
+      TF_RETURN_IF_ERROR(best->DropAllControlDeps());
+      flops.erase(best);
+      TF_RETURN_IF_ERROR(comp->RemoveInstruction(best));
+    }
+    changed = true;
+  }
+  return changed;
+}
+
+StatusOr<bool> RecomputationPlanner::Run(HloModule* module) {
+  if (memory_budget_per_ipu_ <= 0) {
+    return false;
+  }
+
+  // Do not recompute inside of the resource update of pipelines.
+  absl::flat_hash_set<HloComputation*> no_recomputation_computations;
+  TF_ASSIGN_OR_RETURN(std::vector<HloInstruction*> pipeline_ops,
+                      GetPipelines(module));
+  for (HloInstruction* pipeline_op : pipeline_ops) {
+    TF_ASSIGN_OR_RETURN(PipelineStages stages,
+                        GetPipelineStages(pipeline_op->to_apply()));
+    if (stages.resource_update) {
+      no_recomputation_computations.insert(
+          (*stages.resource_update)->to_apply());
+    }
+  }
+
+  VLOG(2) << "Before RecomputationPlanner:";
+  XLA_VLOG_LINES(2, module->ToString(HloPrintOptions::ShortParsable()));
+
+  bool changed = false;
+  for (HloComputation* comp : module->MakeComputationPostOrder()) {
+    if (IsPopOpsFusion(comp) || comp->IsFusionComputation() ||
+        no_recomputation_computations.contains(comp)) {
+      continue;
+    }
+    TF_ASSIGN_OR_RETURN(bool recomputed, PlanComputation(comp));
+    changed |= recomputed;
+  }
+
+  if (changed) {
+    VLOG(2) << "After RecomputationPlanner:";
+    XLA_VLOG_LINES(2, module->ToString());
+  } else {
+    VLOG(2) << "No instructions were recomputed.";
+  }
+  return changed;
+}
+
+std::vector<bool> PlanPipelineRecomputation(
+    const std::vector<PipelineStageMemory>& stages,
+    int64 memory_budget_per_ipu) {
+  if (memory_budget_per_ipu <= 0) {
+    return std::vector<bool>(stages.size(), true);
+  }
+
+  std::map<int64, int64> device_bytes;
+  for (const PipelineStageMemory& stage : stages) {
+    device_bytes[stage.device] += stage.peak_bytes + stage.stashed_bytes;
+  }
+
+  std::vector<bool> recompute(stages.size(), false);
+  while (true) {
+    // Find the cheapest stage to recompute on an IPU which does not fit.
+    absl::optional<size_t> best;
+    double best_cost = 0.0;
+    for (size_t i = 0; i != stages.size(); ++i) {
+      const PipelineStageMemory& stage = stages[i];
+      const int64 saved = stage.stashed_bytes - stage.recomputed_stashed_bytes;
+      if (recompute[i] || saved <= 0 ||
+          device_bytes.at(stage.device) <= memory_budget_per_ipu) {
+        continue;
+      }
+      const double cost = static_cast<double>(stage.recomputation_flops) / saved;
+      if (!best || cost < best_cost) {
+        best = i;
+        best_cost = cost;
+      }
+    }
+    if (!best) {
+      break;
+    }
+    const PipelineStageMemory& stage = stages[*best];
+    recompute[*best] = true;
+    device_bytes[stage.device] -=
+        stage.stashed_bytes - stage.recomputed_stashed_bytes;
+  }
+
+  for (auto& pair : device_bytes) {
+    VLOG(1) << "Pipeline memory estimate for IPU " << pair.first << " is "
+            << pair.second << " bytes with a budget of "
+            << memory_budget_per_ipu << " bytes.";
+  }
+  return recompute;
+}
+
+}  // namespace poplarplugin
+}  // namespace xla
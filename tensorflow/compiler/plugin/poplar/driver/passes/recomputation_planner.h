@@ -0,0 +1,72 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_RECOMPUTATION_PLANNER_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_RECOMPUTATION_PLANNER_H_
+
+#include <vector>
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/pipeline_util.h"
+#include "tensorflow/compiler/xla/service/hlo_cost_analysis.h"
+#include "tensorflow/compiler/xla/service/hlo_pass_interface.h"
+#include "tensorflow/compiler/xla/types.h"
+
+namespace xla {
+
+class HloModule;
+
+namespace poplarplugin {
+
+/**
+ * Pass which recomputes activations so that the estimated peak liveness of
+ * each IPU fits in `memory_budget_per_ipu` bytes.
+ *
+ * Each computation is simulated in post order. While an IPU is over the
+ * budget, the activation which is live at its peak, is not used there and
+ * costs the fewest operations per byte to recompute is cloned just before its
+ * later users. Only instructions whose operands are still live at that point
+ * are recomputed, so the recomputation never extends the liveness of other
+ * tensors. Control dependencies make sure the clones run after the peak.
+ */
+class RecomputationPlanner : public HloModulePass {
+ public:
+  RecomputationPlanner(int64 memory_budget_per_ipu,
+                       HloCostAnalysis::ShapeSizeFunction shape_size,
+                       int64 max_recomputations_per_computation = 1024);
+
+  absl::string_view name() const override { return "recomputation-planner"; }
+
+  StatusOr<bool> Run(HloModule* module) override;
+
+ private:
+  StatusOr<bool> PlanComputation(HloComputation* comp);
+
+  const int64 memory_budget_per_ipu_;
+  const HloCostAnalysis::ShapeSizeFunction shape_size_;
+  const int64 max_recomputations_per_computation_;
+};
+
+// Returns which of the stages should be recomputed so that each IPU fits in
+// `memory_budget_per_ipu` bytes, preferring the stages which recompute the
+// fewest operations per byte saved. When the budget is not positive every
+// stage is recomputed.
+std::vector<bool> PlanPipelineRecomputation(
+    const std::vector<PipelineStageMemory>& stages,
+    int64 memory_budget_per_ipu);
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_RECOMPUTATION_PLANNER_H_
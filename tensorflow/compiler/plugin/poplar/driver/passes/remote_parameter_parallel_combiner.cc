@@ -272,48 +272,84 @@ StatusOr<std::vector<HloInstruction*>> CombineFromDifferentShards(
 }
 
 Status ScheduleAllUsersBefore(HloInstruction* inst, HloInstruction* successor,
-                              HloReachabilityMap& reachability_map) {
+                              HloReachabilityMap& reachability_map,
+                              bool& changed) {
   for (auto* user : inst->users()) {
     if (!reachability_map.IsReachable(successor, user)) {
       TF_RETURN_IF_ERROR(user->AddControlDependencyTo(successor));
       reachability_map.UpdateReachabilityThroughInstruction(successor);
+      changed = true;
       TF_RETURN_IF_ERROR(
-          ScheduleAllUsersBefore(user, successor, reachability_map));
+          ScheduleAllUsersBefore(user, successor, reachability_map, changed));
     }
   }
 
   return Status::OK();
 }
 
-Status AddSchedulingConstraints(
-    HloComputation* comp, const std::vector<HloInstruction*>& combined_loads,
-    const std::vector<HloInstruction*>& combined_stores) {
-  if (combined_loads.size() != combined_stores.size()) {
+// Returns the store which writes back to the remote buffers read by the load,
+// if there is one.
+HloInstruction* GetMatchingStore(const HloInstruction* load) {
+  for (auto* remote_buffer : load->operands()) {
+    for (auto* user : remote_buffer->users()) {
+      if (IsPoplarInstruction(RemoteParameterStore)(user)) {
+        return user;
+      }
+    }
+  }
+  return nullptr;
+}
+
+StatusOr<bool> AddSchedulingConstraints(
+    HloComputation* comp, const std::vector<HloInstruction*>& loads,
+    const std::vector<HloInstruction*>& stores, int64 prefetch_depth) {
+  if (prefetch_depth == 0 && loads.size() != stores.size()) {
     // They're not matching up, bail out.
-    return Status::OK();
+    return false;
   }
 
+  bool changed = false;
   auto reachability_map = HloReachabilityMap::Build(comp);
 
-  for (std::size_t i = 1; i < combined_loads.size(); ++i) {
-    auto* load = combined_loads[i];
+  for (std::size_t i = 1; i < loads.size(); ++i) {
+    auto* load = loads[i];
+
+    // Issue the load before the update which is prefetch_depth earlier, so
+    // that it does not have to wait for the updates in between.
+    if (prefetch_depth > 0 && i >= static_cast<std::size_t>(prefetch_depth)) {
+      auto* prefetch_before = loads[i - prefetch_depth];
+      for (auto* user : prefetch_before->users()) {
+        if (!reachability_map->IsReachable(user, load)) {
+          TF_RETURN_IF_ERROR(load->AddControlDependencyTo(user));
+          reachability_map->UpdateReachabilityThroughInstruction(user);
+          changed = true;
+        }
+      }
+    }
 
     // To minimize liveness we aim towards having the least amount of overlap.
-    // So first we try to schedule load[i] after store[i - 1], and if this is
-    // not possible, we try to schedule it after store[i - 2] and so forth. A
-    // typical reason why the first single-delay attempt might fail is when
-    // using optimizers that require two offloaded parameters for each weight
-    // update (like LAMB/ADAM that require both the first and second moments).
-    for (std::size_t delay = 1; delay <= i; ++delay) {
-      auto* prev_load = combined_loads[i - delay];
+    // So first we try to schedule load[i] after store[i - 1 - prefetch_depth],
+    // and if this is not possible, we try to schedule it after the store
+    // before that and so forth. A typical reason why the first attempt might
+    // fail is when using optimizers that require two offloaded parameters for
+    // each weight update (like LAMB/ADAM that require both the first and
+    // second moments).
+    for (std::size_t delay = 1 + prefetch_depth; delay <= i; ++delay) {
+      auto* prev_load = loads[i - delay];
 
       // To minimze liveness, we also try to schedule all users of the previous
       // load before the current load. This attempts to ensure that the actual
       // weight update is pushed as early as possible in the schedule.
       TF_RETURN_IF_ERROR(
-          ScheduleAllUsersBefore(prev_load, load, *reachability_map));
-
-      auto* prev_store = combined_stores[i - delay];
+          ScheduleAllUsersBefore(prev_load, load, *reachability_map, changed));
+
+      // Without prefetching the loads and stores are paired by position, as
+      // they have been combined in the same order.
+      auto* prev_store = prefetch_depth > 0 ? GetMatchingStore(prev_load)
+                                            : stores[i - delay];
+      if (!prev_store) {
+        continue;
+      }
 
       // If we can successfully schedule the previous store before this load,
       // we are satisifed with the scheduling constraints for this load and
@@ -321,12 +357,13 @@ Status AddSchedulingConstraints(
       if (!reachability_map->IsReachable(load, prev_store)) {
         TF_RETURN_IF_ERROR(prev_store->AddControlDependencyTo(load));
         reachability_map->UpdateReachabilityThroughInstruction(load);
+        changed = true;
         break;
       }
     }
   }
 
-  return Status::OK();
+  return changed;
 }
 
 }  // namespace
@@ -346,6 +383,17 @@ StatusOr<bool> RemoteParameterParallelCombiner::RunOnComputation(
     }
   }
 
+  // When nothing can be combined (for example on a single IPU) the loads are
+  // only ordered when they are prefetched.
+  std::vector<HloInstruction*> single_loads;
+  if (prefetch_depth_ > 0 && shard_loads.size() == 1) {
+    DecreasingSizeQueue queue = shard_loads.begin()->second;
+    for (; !queue.empty(); queue.pop()) {
+      single_loads.push_back(queue.top());
+    }
+    absl::c_reverse(single_loads);
+  }
+
   TF_ASSIGN_OR_RETURN(const auto combined_loads,
                       CombineFromDifferentShards(comp, std::move(shard_loads),
                                                  allocation_map_));
@@ -355,10 +403,13 @@ StatusOr<bool> RemoteParameterParallelCombiner::RunOnComputation(
                                                  allocation_map_));
 
   // Try to help the scheduler a bit by adding some constraints.
-  TF_RETURN_IF_ERROR(
-      AddSchedulingConstraints(comp, combined_loads, combined_stores));
+  TF_ASSIGN_OR_RETURN(
+      const bool constrained,
+      AddSchedulingConstraints(
+          comp, combined_loads.empty() ? single_loads : combined_loads,
+          combined_stores, prefetch_depth_));
 
-  return !combined_loads.empty() || !combined_stores.empty();
+  return !combined_loads.empty() || !combined_stores.empty() || constrained;
 }
 
 StatusOr<bool> RemoteParameterParallelCombiner::Run(HloModule* module) {
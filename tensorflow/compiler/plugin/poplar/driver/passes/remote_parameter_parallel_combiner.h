@@ -28,11 +28,18 @@ namespace poplarplugin {
 /**
  * This pass tries to combine remote parameter loads and stores that can be
  * executed in parallel.
+ *
+ * It also adds scheduling constraints so that the loads are executed in order
+ * of increasing size, each one after the previous update has been stored. When
+ * `prefetch_depth` is positive, the loads for the next `prefetch_depth`
+ * updates are issued before the current update is computed instead (double
+ * buffering when it is 1), so that they are not on its critical path.
  */
 class RemoteParameterParallelCombiner : public HloModulePass {
  public:
-  explicit RemoteParameterParallelCombiner(TensorAllocationMap& allocation_map)
-      : allocation_map_(allocation_map) {}
+  explicit RemoteParameterParallelCombiner(TensorAllocationMap& allocation_map,
+                                           int64 prefetch_depth = 0)
+      : allocation_map_(allocation_map), prefetch_depth_(prefetch_depth) {}
 
   absl::string_view name() const override {
     return "remote-parameter-parallel-combiner";
@@ -44,6 +51,7 @@ class RemoteParameterParallelCombiner : public HloModulePass {
 
  private:
   TensorAllocationMap& allocation_map_;
+  const int64 prefetch_depth_;
 };
 
 }  // namespace poplarplugin
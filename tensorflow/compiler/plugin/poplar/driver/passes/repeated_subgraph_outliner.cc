@@ -0,0 +1,602 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/passes/repeated_subgraph_outliner.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/compiler/plugin/poplar/driver/backend_config.pb.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_hash.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/matcher_predicates.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
+
+#include "tensorflow/compiler/xla/service/call_graph.h"
+#include "tensorflow/compiler/xla/service/call_inliner.h"
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
+#include "tensorflow/compiler/xla/service/hlo_instruction.h"
+#include "tensorflow/compiler/xla/service/hlo_module.h"
+#include "tensorflow/compiler/xla/shape_util.h"
+#include "tensorflow/core/lib/hash/hash.h"
+
+namespace xla {
+namespace poplarplugin {
+
+namespace {
+
+// The number of times the hash of each instruction is combined with the hashes
+// of its operands, which is how many levels of operands have to be identical
+// for instructions to start a subgraph together.
+constexpr int64 kHashRounds = 6;
+
+// Instructions which do not generate any code of their own, and therefore do
+// not count towards the size of a subgraph.
+bool IsTrivial(const HloInstruction* inst) {
+  switch (inst->opcode()) {
+    case HloOpcode::kBitcast:
+    case HloOpcode::kConstant:
+    case HloOpcode::kGetTupleElement:
+    case HloOpcode::kReshape:
+    case HloOpcode::kTuple:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Poplar instructions which keep state in variables created when they are
+// lowered. A function body is only lowered once, so every call to it would
+// share the same counters and accumulators.
+bool IsStatefulPoplarInstruction(const HloInstruction* inst) {
+  static const PoplarOp kStatefulOps[] = {
+      PoplarOp::StatefulGradientAccumulate,
+      PoplarOp::StatefulGradientAccumulateAndAllReduce,
+      PoplarOp::StatefulGradientAccumulateWithMomentum,
+      PoplarOp::StatefulGradientAccumulateWithMomentumAndAllReduceWithNorm,
+      PoplarOp::GradientAccumulatorCreate,
+      PoplarOp::GradientAccumulatorAdd,
+      PoplarOp::GradientAccumulatorSink,
+      PoplarOp::ExecutionCounter,
+      PoplarOp::Fifo,
+  };
+  return absl::c_any_of(kStatefulOps, [inst](PoplarOp op) {
+    return IsPoplarInstruction(op, inst);
+  });
+}
+
+// Whether the instruction can be moved into a function.
+bool CanOutline(const HloInstruction* inst) {
+  switch (inst->opcode()) {
+    case HloOpcode::kAfterAll:
+    case HloOpcode::kConditional:
+    case HloOpcode::kParameter:
+    case HloOpcode::kWhile:
+      return false;
+    case HloOpcode::kCall:
+      // Only nested functions - other calls are pipelines, repeat loops and
+      // similar which need to stay where they are.
+      if (!IsFunction(inst)) {
+        return false;
+      }
+      break;
+    default:
+      break;
+  }
+  return !inst->HasSideEffect() && !IsStatefulPoplarInstruction(inst) &&
+         inst->control_predecessors().empty() &&
+         inst->control_successors().empty() &&
+         !ShapeUtil::HasPrimitiveType(inst->shape(), TOKEN);
+}
+
+bool HaveSameSharding(const HloInstruction* a, const HloInstruction* b) {
+  if (a->has_sharding() != b->has_sharding()) {
+    return false;
+  }
+  return !a->has_sharding() || a->sharding() == b->sharding();
+}
+
+// Whether `a` and `b` compute the same values given equivalent operands.
+bool AreEquivalent(const HloInstruction* a, const HloInstruction* b) {
+  auto eq_operands = [](const HloInstruction* x, const HloInstruction* y) {
+    return ShapeUtil::Equal(x->shape(), y->shape());
+  };
+  auto eq_computations = [](const HloComputation* x, const HloComputation* y) {
+    return *x == *y;
+  };
+  return a->Identical(*b, eq_operands, eq_computations) &&
+         HaveSameSharding(a, b);
+}
+
+// One occurrence of a repeated subgraph. The members of all the occurrences
+// are stored in the same order, so that the instructions at the same position
+// correspond to each other.
+struct SubgraphCopy {
+  std::vector<HloInstruction*> members;
+  absl::flat_hash_map<const HloInstruction*, int64> positions;
+  // The instructions passed to each parameter of the function.
+  std::vector<HloInstruction*> inputs;
+
+  void Add(HloInstruction* inst) {
+    positions[inst] = members.size();
+    members.push_back(inst);
+  }
+
+  bool Contains(const HloInstruction* inst) const {
+    return positions.contains(inst);
+  }
+};
+
+// Where an operand of a member comes from - either the member at the given
+// position or the parameter with the given number.
+struct OperandSource {
+  bool is_parameter;
+  int64 index;
+};
+
+// A copy can only be replaced by a single call if no path leaves it and comes
+// back into it, otherwise the call would depend on itself.
+bool IsConvex(const SubgraphCopy& copy) {
+  std::vector<HloInstruction*> worklist;
+  absl::flat_hash_set<HloInstruction*> visited;
+  auto visit = [&](HloInstruction* inst) {
+    if (visited.insert(inst).second) {
+      worklist.push_back(inst);
+    }
+  };
+  for (HloInstruction* member : copy.members) {
+    for (HloInstruction* user : member->users()) {
+      if (!copy.Contains(user)) {
+        visit(user);
+      }
+    }
+  }
+  while (!worklist.empty()) {
+    HloInstruction* inst = worklist.back();
+    worklist.pop_back();
+    for (HloInstruction* user : inst->users()) {
+      if (copy.Contains(user)) {
+        return false;
+      }
+      visit(user);
+    }
+    for (HloInstruction* successor : inst->control_successors()) {
+      visit(successor);
+    }
+  }
+  return true;
+}
+
+class ComputationOutliner {
+ public:
+  ComputationOutliner(HloComputation* comp, int64 min_subgraph_size,
+                      std::vector<HloComputation*>& functions)
+      : comp_(comp),
+        min_subgraph_size_(min_subgraph_size),
+        functions_(functions) {}
+
+  StatusOr<bool> Run() {
+    // Removed instructions stay in the post order, but they are always
+    // claimed, so they are skipped before being accessed.
+    const std::vector<HloInstruction*> post_order =
+        comp_->MakeInstructionPostOrder();
+
+    // The hashes of the instructions combined with the hashes of their operands
+    // up to each depth.
+    HloStructuralHash structural_hash;
+    std::vector<absl::flat_hash_map<const HloInstruction*, uint64>> hashes(
+        kHashRounds + 1);
+    for (int64 i = 0; i != static_cast<int64>(post_order.size()); ++i) {
+      HloInstruction* inst = post_order[i];
+      post_order_index_[inst] = i;
+      hashes[0][inst] = structural_hash.GetInstructionHash(inst);
+    }
+    for (int64 depth = 1; depth <= kHashRounds; ++depth) {
+      for (HloInstruction* inst : post_order) {
+        uint64 hash = hashes[0].at(inst);
+        for (const HloInstruction* operand : inst->operands()) {
+          hash = tensorflow::Hash64Combine(hash, hashes[depth - 1].at(operand));
+        }
+        hashes[depth][inst] = hash;
+      }
+    }
+
+    // Instructions with the same deep hashes are the most likely to have the
+    // same role, but the instructions close to the start of a chain of
+    // repeated subgraphs, such as the first layers of a model, only have the
+    // same shallow hashes.
+    bool changed = false;
+    for (int64 depth = kHashRounds; depth >= 0; --depth) {
+      absl::flat_hash_map<uint64, std::vector<HloInstruction*>> groups;
+      for (HloInstruction* inst : post_order) {
+        if (!claimed_.contains(inst) && CanOutline(inst)) {
+          groups[hashes[depth].at(inst)].push_back(inst);
+        }
+      }
+
+      // Start from the end of the computation, so that each subgraph is grown
+      // from its last instruction.
+      absl::flat_hash_set<uint64> visited_groups;
+      for (auto itr = post_order.rbegin(); itr != post_order.rend(); ++itr) {
+        HloInstruction* inst = *itr;
+        if (claimed_.contains(inst) || !CanOutline(inst)) {
+          continue;
+        }
+        const uint64 hash = hashes[depth].at(inst);
+        if (!visited_groups.insert(hash).second) {
+          continue;
+        }
+
+        std::vector<HloInstruction*> seeds;
+        for (HloInstruction* other : groups.at(hash)) {
+          if (!claimed_.contains(other) && AreEquivalent(other, inst)) {
+            seeds.push_back(other);
+          }
+        }
+        if (seeds.size() < 2) {
+          continue;
+        }
+        TF_ASSIGN_OR_RETURN(bool outlined, Outline(seeds));
+        changed |= outlined;
+      }
+    }
+    return changed;
+  }
+
+ private:
+  bool IsCandidate(const HloInstruction* inst) const {
+    return !claimed_.contains(inst) && post_order_index_.contains(inst) &&
+           CanOutline(inst);
+  }
+
+  void Release(const SubgraphCopy& copy) {
+    for (const HloInstruction* member : copy.members) {
+      claimed_.erase(member);
+    }
+  }
+
+  // Grows the copies through the operands of their members in lockstep.
+  // Returns false if the copies turn out to have different structures.
+  bool Grow(std::vector<SubgraphCopy>& copies,
+            std::vector<std::vector<OperandSource>>& sources) {
+    const int64 num_copies = copies.size();
+    absl::flat_hash_map<const HloInstruction*, int64> parameters;
+    for (int64 p = 0; p != static_cast<int64>(copies[0].members.size()); ++p) {
+      const HloInstruction* member = copies[0].members[p];
+      std::vector<OperandSource> member_sources;
+      for (int64 op_idx = 0; op_idx != member->operand_count(); ++op_idx) {
+        std::vector<HloInstruction*> operands(num_copies);
+        for (int64 i = 0; i != num_copies; ++i) {
+          operands[i] = copies[i].members[p]->mutable_operand(op_idx);
+        }
+
+        // The operand is already part of the subgraph.
+        auto position_itr = copies[0].positions.find(operands[0]);
+        if (position_itr != copies[0].positions.end()) {
+          for (int64 i = 1; i != num_copies; ++i) {
+            auto itr = copies[i].positions.find(operands[i]);
+            if (itr == copies[i].positions.end() ||
+                itr->second != position_itr->second) {
+              return false;
+            }
+          }
+          member_sources.push_back({false, position_itr->second});
+          continue;
+        }
+
+        // Add the operand to the subgraph if it is equivalent in all copies.
+        bool add = true;
+        absl::flat_hash_set<const HloInstruction*> distinct;
+        for (int64 i = 0; i != num_copies; ++i) {
+          if (copies[i].Contains(operands[i])) {
+            return false;
+          }
+          add &= IsCandidate(operands[i]) &&
+                 distinct.insert(operands[i]).second &&
+                 AreEquivalent(operands[i], operands[0]);
+        }
+        if (add) {
+          member_sources.push_back(
+              {false, static_cast<int64>(copies[0].members.size())});
+          for (int64 i = 0; i != num_copies; ++i) {
+            copies[i].Add(operands[i]);
+            claimed_.insert(operands[i]);
+          }
+          continue;
+        }
+
+        // Otherwise it becomes a parameter of the function.
+        auto parameter_itr = parameters.find(operands[0]);
+        if (parameter_itr == parameters.end()) {
+          parameter_itr =
+              parameters.emplace(operands[0], copies[0].inputs.size()).first;
+          for (int64 i = 0; i != num_copies; ++i) {
+            copies[i].inputs.push_back(operands[i]);
+          }
+        } else {
+          for (int64 i = 1; i != num_copies; ++i) {
+            if (copies[i].inputs[parameter_itr->second] != operands[i]) {
+              return false;
+            }
+          }
+        }
+        member_sources.push_back({true, parameter_itr->second});
+      }
+      sources.push_back(std::move(member_sources));
+    }
+    return true;
+  }
+
+  StatusOr<bool> Outline(const std::vector<HloInstruction*>& seeds) {
+    std::vector<SubgraphCopy> copies(seeds.size());
+    for (int64 i = 0; i != static_cast<int64>(seeds.size()); ++i) {
+      copies[i].Add(seeds[i]);
+      claimed_.insert(seeds[i]);
+    }
+
+    std::vector<std::vector<OperandSource>> sources;
+    const bool grown = Grow(copies, sources);
+    const int64 size = absl::c_count_if(
+        copies[0].members,
+        [](const HloInstruction* inst) { return !IsTrivial(inst); });
+    if (!grown || size < min_subgraph_size_) {
+      for (const SubgraphCopy& copy : copies) {
+        Release(copy);
+      }
+      return false;
+    }
+
+    std::vector<SubgraphCopy*> convex_copies;
+    for (SubgraphCopy& copy : copies) {
+      if (IsConvex(copy)) {
+        convex_copies.push_back(&copy);
+      } else {
+        Release(copy);
+      }
+    }
+    if (convex_copies.size() < 2) {
+      for (SubgraphCopy* copy : convex_copies) {
+        Release(*copy);
+      }
+      return false;
+    }
+
+    // The members in the order they are computed.
+    const SubgraphCopy& copy0 = *convex_copies[0];
+    std::vector<int64> order(copy0.members.size());
+    absl::c_iota(order, 0);
+    absl::c_sort(order, [&](int64 a, int64 b) {
+      return post_order_index_.at(copy0.members[a]) <
+             post_order_index_.at(copy0.members[b]);
+    });
+
+    // The members which are used outside of any of the copies.
+    std::vector<int64> outputs;
+    for (int64 p : order) {
+      const bool is_output =
+          absl::c_any_of(convex_copies, [&](const SubgraphCopy* copy) {
+            const HloInstruction* member = copy->members[p];
+            return member == comp_->root_instruction() ||
+                   absl::c_any_of(member->users(),
+                                  [&](const HloInstruction* user) {
+                                    return !copy->Contains(user);
+                                  });
+          });
+      if (is_output) {
+        outputs.push_back(p);
+      }
+    }
+
+    // Reuse an identical function outlined before, for example when the first
+    // copies only matched once the shallower hashes were used.
+    HloComputation* function = CreateFunction(copy0, sources, order, outputs);
+    auto existing_itr =
+        absl::c_find_if(functions_, [function](const HloComputation* other) {
+          return other->Equal(*function, /*is_layout_sensitive=*/true,
+                              /*is_sharding_sensitive=*/true);
+        });
+    const bool reused = existing_itr != functions_.end();
+    if (reused) {
+      TF_RETURN_IF_ERROR(comp_->parent()->RemoveEmbeddedComputation(function));
+      function = *existing_itr;
+    }
+
+    // Replace the copies one at a time, as replacing a copy can create new
+    // paths between the instructions of the others.
+    absl::flat_hash_map<const HloInstruction*, HloInstruction*> replacements;
+    std::vector<HloInstruction*> calls;
+    for (SubgraphCopy* copy : convex_copies) {
+      if (!IsConvex(*copy)) {
+        Release(*copy);
+        continue;
+      }
+      TF_ASSIGN_OR_RETURN(
+          HloInstruction * call,
+          ReplaceCopy(*copy, function, order, outputs, replacements));
+      calls.push_back(call);
+    }
+
+    if (calls.size() < 2 && !reused) {
+      // Nothing is shared, so undo the outlining.
+      for (HloInstruction* call : calls) {
+        TF_RETURN_IF_ERROR(CallInliner::Inline(call).status());
+      }
+      TF_RETURN_IF_ERROR(comp_->parent()->RemoveEmbeddedComputation(function));
+      return !calls.empty();
+    }
+    if (calls.empty()) {
+      return false;
+    }
+    if (!reused) {
+      functions_.push_back(function);
+    }
+
+    VLOG(1) << "Outlined " << calls.size() << " copies of a subgraph with "
+            << size << " instructions into " << function->name() << ".";
+    return true;
+  }
+
+  HloComputation* CreateFunction(
+      const SubgraphCopy& copy,
+      const std::vector<std::vector<OperandSource>>& sources,
+      const std::vector<int64>& order, const std::vector<int64>& outputs) {
+    HloComputation::Builder builder(
+        absl::StrCat(comp_->name(), "_repeated_subgraph"));
+
+    std::vector<HloInstruction*> parameters(copy.inputs.size());
+    for (int64 i = 0; i != static_cast<int64>(copy.inputs.size()); ++i) {
+      parameters[i] = builder.AddInstruction(HloInstruction::CreateParameter(
+          i, copy.inputs[i]->shape(), absl::StrCat("arg_", i)));
+    }
+
+    std::vector<HloInstruction*> clones(copy.members.size());
+    for (int64 p : order) {
+      const HloInstruction* member = copy.members[p];
+      std::vector<HloInstruction*> new_operands;
+      for (const OperandSource& source : sources[p]) {
+        new_operands.push_back(source.is_parameter ? parameters[source.index]
+                                                   : clones[source.index]);
+      }
+      clones[p] = builder.AddInstruction(
+          member->CloneWithNewOperands(member->shape(), new_operands));
+    }
+
+    std::vector<HloInstruction*> results;
+    for (int64 p : outputs) {
+      results.push_back(clones[p]);
+    }
+    HloInstruction* root =
+        builder.AddInstruction(HloInstruction::CreateTuple(results));
+    return comp_->parent()->AddEmbeddedComputation(builder.Build(root));
+  }
+
+  StatusOr<HloInstruction*> ReplaceCopy(
+      const SubgraphCopy& copy, HloComputation* function,
+      const std::vector<int64>& order, const std::vector<int64>& outputs,
+      absl::flat_hash_map<const HloInstruction*, HloInstruction*>&
+          replacements) {
+    // Inputs produced by copies which have already been replaced now come from
+    // their calls.
+    std::vector<HloInstruction*> inputs;
+    for (HloInstruction* input : copy.inputs) {
+      auto itr = replacements.find(input);
+      inputs.push_back(itr == replacements.end() ? input : itr->second);
+    }
+
+    HloInstruction* call = comp_->AddInstruction(HloInstruction::CreateCall(
+        function->root_instruction()->shape(), inputs, function));
+    PoplarBackendConfig config;
+    config.mutable_call_config()->set_type(
+        PoplarBackendConfig::CallConfig::Function);
+    TF_RETURN_IF_ERROR(call->set_backend_config(config));
+
+    for (int64 i = 0; i != static_cast<int64>(outputs.size()); ++i) {
+      HloInstruction* member = copy.members[outputs[i]];
+      HloInstruction* gte = comp_->AddInstruction(
+          HloInstruction::CreateGetTupleElement(member->shape(), call, i));
+      CopyShardingIfPresent(member, gte);
+      const std::vector<HloInstruction*> users = member->users();
+      for (HloInstruction* user : users) {
+        if (!copy.Contains(user)) {
+          TF_RETURN_IF_ERROR(member->ReplaceUseWith(user, gte));
+        }
+      }
+      if (member == comp_->root_instruction()) {
+        comp_->set_root_instruction(gte);
+      }
+      replacements[member] = gte;
+    }
+
+    // Remove the members, users first. They stay claimed so that they are
+    // never visited again.
+    for (auto itr = order.rbegin(); itr != order.rend(); ++itr) {
+      HloInstruction* member = copy.members[*itr];
+      post_order_index_.erase(member);
+      TF_RETURN_IF_ERROR(comp_->RemoveInstruction(member));
+    }
+    return call;
+  }
+
+  HloComputation* const comp_;
+  const int64 min_subgraph_size_;
+
+  std::vector<HloComputation*>& functions_;
+  // The position of the instructions which were in the computation before it
+  // was outlined.
+  absl::flat_hash_map<const HloInstruction*, int64> post_order_index_;
+  // Instructions which are part of a subgraph.
+  absl::flat_hash_set<const HloInstruction*> claimed_;
+};
+
+}  // namespace
+
+RepeatedSubgraphOutliner::RepeatedSubgraphOutliner(int64 min_subgraph_size)
+    : min_subgraph_size_(min_subgraph_size) {}
+
+StatusOr<bool> RepeatedSubgraphOutliner::OutlineComputation(
+    HloComputation* comp, std::vector<HloComputation*>& functions) {
+  return ComputationOutliner(comp, min_subgraph_size_, functions).Run();
+}
+
+StatusOr<bool> RepeatedSubgraphOutliner::Run(HloModule* module) {
+  VLOG(2) << "Before RepeatedSubgraphOutliner:";
+  XLA_VLOG_LINES(2, module->ToString(HloPrintOptions::ShortParsable()));
+
+  std::unique_ptr<CallGraph> call_graph = CallGraph::Build(module);
+  std::vector<HloComputation*> comps;
+  for (HloComputation* comp : module->MakeComputationPostOrder()) {
+    if (IsPopOpsFusion(comp) || comp->IsFusionComputation()) {
+      continue;
+    }
+    const CallGraphNode& node = call_graph->GetNode(comp);
+    if (node.context() != CallContext::kSequential) {
+      continue;
+    }
+    // Pipelines can only contain pipeline stages, and the resource updates are
+    // rewritten by the variable offloading passes.
+    const bool is_special = absl::c_any_of(
+        node.caller_callsites(), [](const CallSite& callsite) {
+          return IsPipelineOp(callsite.instruction()) ||
+                 IsResourceUpdate(callsite.instruction());
+        });
+    if (!is_special) {
+      comps.push_back(comp);
+    }
+  }
+
+  // The functions which have been outlined so far, which can be shared
+  // between computations.
+  std::vector<HloComputation*> functions;
+  bool changed = false;
+  for (HloComputation* comp : comps) {
+    TF_ASSIGN_OR_RETURN(bool outlined, OutlineComputation(comp, functions));
+    changed |= outlined;
+  }
+
+  if (changed) {
+    VLOG(2) << "After RepeatedSubgraphOutliner:";
+    XLA_VLOG_LINES(2, module->ToString());
+  } else {
+    VLOG(2) << "No subgraphs were outlined.";
+  }
+  return changed;
+}
+
+}  // namespace poplarplugin
+}  // namespace xla
@@ -0,0 +1,65 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_REPEATED_SUBGRAPH_OUTLINER_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_REPEATED_SUBGRAPH_OUTLINER_H_
+
+#include <vector>
+
+#include "tensorflow/compiler/xla/service/hlo_pass_interface.h"
+#include "tensorflow/compiler/xla/types.h"
+
+namespace xla {
+
+class HloComputation;
+class HloModule;
+
+namespace poplarplugin {
+
+/**
+ * Pass which finds structurally identical subgraphs within a computation, such
+ * as the layers of an unrolled model, and replaces each of them with a call to
+ * a single shared Function computation. The Poplar code of the function is then
+ * only generated once by the subcomputation graph cache, which reduces the code
+ * size on each tile.
+ *
+ * Instructions are grouped by a structural hash of themselves and of their
+ * operands a few levels deep, trying the deepest hashes first. Starting from
+ * each group, the subgraphs are grown through their operands in lockstep for as
+ * long as the corresponding instructions are identical and do not belong to
+ * another subgraph. Only subgraphs with at least `min_subgraph_size`
+ * non-trivial instructions are outlined, and identical functions are reused.
+ */
+class RepeatedSubgraphOutliner : public HloModulePass {
+ public:
+  explicit RepeatedSubgraphOutliner(int64 min_subgraph_size = 8);
+
+  absl::string_view name() const override {
+    return "repeated-subgraph-outliner";
+  }
+
+  StatusOr<bool> Run(HloModule* module) override;
+
+ private:
+  StatusOr<bool> OutlineComputation(HloComputation* comp,
+                                    std::vector<HloComputation*>& functions);
+
+  const int64 min_subgraph_size_;
+};
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_PASSES_REPEATED_SUBGRAPH_OUTLINER_H_
@@ -41,6 +41,7 @@ limitations under the License.
 
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
 #include "tensorflow/compiler/plugin/poplar/driver/compiler_resources.h"
 #include "tensorflow/compiler/plugin/poplar/driver/ops/ops.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/add_block_recompute.h"
@@ -99,15 +100,18 @@ limitations under the License.
 #include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_optimizer.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_recomputation.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_recomputation_stage_inserter.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_stage_balancer.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_stage_merger.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_tuple_remover.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_verifier.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/poplar_algebraic_simplifier.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/post_serialize_gradient_accumulation.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/recomputation_planner.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/recompute_instructions.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/remote_parameter_parallel_combiner.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/remove_blocked_recompute_suggestions.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/remove_recompute_suggestions.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/repeated_subgraph_outliner.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/replication_factor_to_constant.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/resource_update_elementwise_clustering.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/resource_update_fixer.h"
@@ -132,10 +136,12 @@ limitations under the License.
 #include "tensorflow/compiler/plugin/poplar/driver/schedulers/shortest_path_scheduler.h"
 #include "tensorflow/compiler/plugin/poplar/driver/schedulers/sync_list_scheduler.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tensor.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/compilation_stats.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/convolution_preplanning.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/data_initializer.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/embedding_plans_preplanning.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/flags.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hash.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_hash.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/matmul_preplanning.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
@@ -616,6 +622,21 @@ Status CreatePoplarGraphs(CompilerResources& resources, const HloModule* module,
 StatusOr<std::vector<IpuSchedulerAlgorithm>> GetSchedulerList(
     CompilerResources& res) {
   std::vector<IpuSchedulerAlgorithm> schedulers;
+  if (res.scheduler_selection == "Parallel") {
+    std::vector<NamedIpuSchedulerAlgorithm> named_schedulers = {
+        {"Clustering", CreateClusteringMemoryScheduler(res.information)},
+        {"PostOrder", MemorySchedulerAlgorithmToIPU(PostOrderMemoryScheduler)},
+        {"LookAhead", CreateLivenessLookAheadMemoryScheduler(res.information)},
+        {"ShortestPath", CreateShortestPathScheduler(res.information)}};
+    TF_ASSIGN_OR_RETURN(
+        auto scheduler,
+        ParallelBestIpuSchedule(named_schedulers,
+                                res.information.max_scheduler_time_ms,
+                                &res.selected_schedulers));
+    schedulers.push_back(scheduler);
+    return schedulers;
+  }
+
   bool all = res.scheduler_selection.empty();
   if (all || res.scheduler_selection == "Clustering") {
     schedulers.push_back(CreateClusteringMemoryScheduler(res.information));
@@ -635,11 +656,19 @@ StatusOr<std::vector<IpuSchedulerAlgorithm>> GetSchedulerList(
   if (schedulers.size() == 0) {
     return xla::InvalidArgument(
         "Invalid scheduler specified. Options are 'LookAhead', "
-        "'PostOrder' and 'Clustering'");
+        "'PostOrder', 'Clustering', 'ShortestPath' and 'Parallel'");
   }
   return schedulers;
 }
 
+// Hash of all the options which affect the schedule chosen for a computation.
+uint64 GetSchedulerOptionsHash(const CompilerResources& res) {
+  return hash_util::hash(res.scheduler_selection,
+                         res.information.max_scheduler_lookahead_depth,
+                         res.information.max_scheduler_search_space_size,
+                         res.information.max_scheduler_time_ms);
+}
+
 void GetCompileProfileStream(const std::unique_ptr<poplar::Engine>& engine,
                              PoplarExecutor* poplar_executor,
                              std::stringstream& report_stream) {
@@ -746,14 +775,16 @@ bool JsonParse(const std::string& env_flags, Json::Value& attributes) {
   return parsed;
 }
 
-void AddFrameworkFileToAutoReportDirectory(const std::string& tensorflow_info,
-                                           const std::string& module_name) {
+// Returns the directory which Poplar writes its automatic reports to, if the
+// automatic reports are enabled.
+absl::optional<std::string> GetAutoReportDirectory(
+    const std::string& module_name) {
   std::string report_directory;
   bool report_directory_set = false;
   char* env_flags = std::getenv("POPLAR_ENGINE_OPTIONS");
 
   if (env_flags == nullptr) {
-    return;
+    return absl::nullopt;
   }
 
   Json::Value attributes;
@@ -761,7 +792,7 @@ void AddFrameworkFileToAutoReportDirectory(const std::string& tensorflow_info,
   if (parsed) {
     if (!attributes.isMember("autoReport.directory") &&
         !attributes.isMember("autoReport.all")) {
-      return;
+      return absl::nullopt;
     }
 
     if (attributes.isMember("autoReport.directory")) {
@@ -775,20 +806,36 @@ void AddFrameworkFileToAutoReportDirectory(const std::string& tensorflow_info,
   }
 
   CreateDirIfMissing(report_directory);
+  return report_directory;
+}
+
+void AddJsonFileToAutoReportDirectory(const std::string& json,
+                                      const std::string& file_name,
+                                      const std::string& module_name) {
+  auto report_directory = GetAutoReportDirectory(module_name);
+  if (!report_directory) {
+    return;
+  }
 
   Json::Value attrib_dummy;
-  bool is_json_str = JsonParse(tensorflow_info, attrib_dummy);
+  bool is_json_str = JsonParse(json, attrib_dummy);
 
-  if (tensorflow_info.size() > 0 && is_json_str) {
+  if (json.size() > 0 && is_json_str) {
     std::unique_ptr<tensorflow::WritableFile> wfile;
-    std::string file_name =
-        tensorflow::io::JoinPath(report_directory, "framework.json");
-    TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(file_name, &wfile));
-    TF_CHECK_OK(wfile->Append(tensorflow_info));
+    std::string file_path =
+        tensorflow::io::JoinPath(*report_directory, file_name);
+    TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(file_path, &wfile));
+    TF_CHECK_OK(wfile->Append(json));
     TF_CHECK_OK(wfile->Close());
   }
 }
 
+void AddFrameworkFileToAutoReportDirectory(const std::string& tensorflow_info,
+                                           const std::string& module_name) {
+  AddJsonFileToAutoReportDirectory(tensorflow_info, "framework.json",
+                                   module_name);
+}
+
 void SetRuntimeReplicaOptions(poplar::OptionFlags* opt_flags,
                               const PoplarExecutor* poplar_executor,
                               int64 global_replication_factor) {
@@ -809,14 +856,29 @@ void SetRuntimeReplicaOptions(poplar::OptionFlags* opt_flags,
                  std::to_string(num_runtime_replica));
 }
 
-void AddPipelineOptimizerPass(HloPassPipeline& pipeline) {
+void AddPipelineOptimizerPass(HloPassPipeline& pipeline,
+                              CompilationStats* compilation_stats) {
   auto& pass = pipeline.AddPass<HloPassFix<HloPassPipeline>>(
-      "pipeline-optimizer-wrapper");
+      "pipeline-optimizer-wrapper", compilation_stats);
   pass.AddPass<PipelineOptimizer>();
   pass.AddPass<HloDCE>();
   pass.AddPass<HloCSE>(true);
 }
 
+// Create an executable for `module` which shares the engine of an executable
+// from the in memory executable cache.
+std::unique_ptr<Executable> ShareCachedEngine(
+    const PoplarExecutable& cached, std::unique_ptr<HloModule> module,
+    std::unique_ptr<HloProfilePrinterData> profile_printer,
+    std::unique_ptr<HloProfileIndexMap> profile_index_map) {
+  const InputOutputAliasingMap input_output_aliasing_map(module.get());
+  VLOG(1) << "Reusing the engine for " << module->name()
+          << " from the in memory executable cache";
+  return cached.ShareEngine(std::move(module), std::move(profile_printer),
+                            std::move(profile_index_map),
+                            input_output_aliasing_map);
+}
+
 }  // namespace
 
 StatusOr<std::unique_ptr<HloModule>> PoplarCompiler::RunHloPasses(
@@ -866,6 +928,15 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
 
   const ModuleFilenames filenames =
       poplar_executor->GetModuleFilenames(*module);
+  if (poplar_executor->HaveInMemoryExecutableCache()) {
+    auto cached = poplar_executor->GetInMemoryCachedExecutable(filenames);
+    if (cached) {
+      return ShareCachedEngine(*cached, std::move(module),
+                               std::move(profile_printer),
+                               std::move(profile_index_map));
+    }
+  }
+
   if (poplar_executor->HaveExecutableCache()) {
     if (poplar_executor->HaveCachedExecutable(filenames)) {
       TF_ASSIGN_OR_RETURN(PoplarExecutable * poplar_executable,
@@ -900,6 +971,12 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
       VLOG(1) << "Loaded " << executable->module().name() << " from "
               << filenames.CachedEngineFilename();
 
+      if (poplar_executor->HaveInMemoryExecutableCache() &&
+          poplar_executable->CanShareEngine()) {
+        poplar_executor->AddInMemoryCachedExecutable(filenames,
+                                                     *poplar_executable);
+      }
+
       return std::move(executable);
     } else {
       VLOG(1) << "Couldn't find " << filenames.CachedEngineFilename()
@@ -915,6 +992,18 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
   }
   std::lock_guard<std::mutex> g(static_mu_);
 
+  // A background compilation of the same module might have finished while
+  // this one was waiting for the lock.
+  if (poplar_executor->HaveInMemoryExecutableCache()) {
+    auto cached = poplar_executor->GetInMemoryCachedExecutable(
+        filenames, /*count_miss=*/false);
+    if (cached) {
+      return ShareCachedEngine(*cached, std::move(module),
+                               std::move(profile_printer),
+                               std::move(profile_index_map));
+    }
+  }
+
   uint64 start_micros = tensorflow::Env::Default()->NowMicros();
 
   // Work out the IPU division for this IPU.
@@ -960,7 +1049,8 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
           .set_max_scheduler_search_space_size(
               poplar_executor->GetMaxSchedulerSearchSpaceSize())
           .set_minimum_remote_tensor_size(
-              poplar_executor->GetMinimumRemoteTensorSize());
+              poplar_executor->GetMinimumRemoteTensorSize())
+          .set_max_scheduler_time_ms(poplar_executor->GetMaxSchedulerTimeMs());
 
   CompilerResources resources(
       module.get(), information, poplar_executor->GetConvolutionOptions(),
@@ -984,8 +1074,10 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
     VLOG(1) << "Created " << replication_factor << " replica IPU graph.";
   }
 
+  // Profile the passes so that the slow ones can be found.
+  PoplarCompilationStats compilation_stats(module.get());
   {
-    HloPassPipeline pipeline("IPU");
+    HloPassPipeline pipeline("IPU", &compilation_stats);
     pipeline.AddPass<FlattenCallGraph>();
     pipeline.AddPass<HloGetDimensionSizeRewriter>();
     pipeline.AddPass<CustomOpReplacer>();
@@ -1011,7 +1103,8 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
         resources.enable_fast_math);
     {
       auto& pass = pipeline.AddPass<HloPassFix<HloPassPipeline>>(
-          "pipeline-gradient-accumulation-optimizer-wrapper");
+          "pipeline-gradient-accumulation-optimizer-wrapper",
+          &compilation_stats);
       pass.AddPass<PipelineGradientAccumulationOptimizer>();
       pass.AddPass<PipelineOptimizer>();
       pass.AddPass<HloDCE>();
@@ -1026,10 +1119,22 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
     pipeline.AddPass<ZeroSizedHloElimination>();
     pipeline.AddPass<FlattenCallGraph>();
     pipeline.AddPass<HloPassFix<SeedHoisting>>();
+    if (PoplarXlaFlags::Get().balance_pipeline_stages) {
+      pipeline.AddPass<PipelineStageBalancer>(
+          /*apply_moves=*/true,
+          target.getBytesPerTile() * target.getTilesPerIPU(),
+          ShapeSizeBytesFunction());
+    }
     pipeline.AddPass<PipelineRecomputation>(
-        poplar_executor->RecomputationEnabled());
+        poplar_executor->RecomputationEnabled(),
+        PoplarXlaFlags::Get().recomputation_memory_budget,
+        ShapeSizeBytesFunction());
     pipeline.AddPass<PipelineTupleRemover>();
     pipeline.AddPass<ComputationFlattener>();
+    if (PoplarXlaFlags::Get().min_outlined_subgraph_size > 0) {
+      pipeline.AddPass<RepeatedSubgraphOutliner>(
+          PoplarXlaFlags::Get().min_outlined_subgraph_size);
+    }
     pipeline.AddPass<TupleSimplifier>(true);
     // pass.AddPass<ConditionalSimplifier>();
     pipeline.AddPass<F16ConstantFolding>();
@@ -1038,8 +1143,8 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
     pipeline.AddPass<WideConstFinder>();
     pipeline.AddPass<CommutativeInstructionReorderOperands>();
     {
-      auto& pass =
-          pipeline.AddPass<HloPassFix<HloPassPipeline>>("repeated-fusing");
+      auto& pass = pipeline.AddPass<HloPassFix<HloPassPipeline>>(
+          "repeated-fusing", &compilation_stats);
       pass.AddPass<CastsElimination>(resources.annotations);
       pass.AddPass<HloCSE>(true);
       pass.AddPass<HloDCE>();
@@ -1069,7 +1174,7 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
                                      resources.replication_factor);
     {
       auto& pass = pipeline.AddPass<HloPassFix<HloPassPipeline>>(
-          "multi-update-optimizer");
+          "multi-update-optimizer", &compilation_stats);
       pass.AddPass<MultiUpdateScaleApply>(resources.annotations);
       pass.AddPass<MultiUpdateApply>(resources.annotations);
       pass.AddPass<HloPassFix<PoplarAlgebraicSimplifier>>(
@@ -1078,7 +1183,7 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
       pass.AddPass<HloDCE>();
     }
     if (poplar_executor->EnableMatmulCombiner()) {
-      pipeline.AddPass<MatmulCombiner>(resources.annotations);
+      pipeline.AddPass<MatmulCombiner>();
     }
     pipeline.AddPass<SerializeGradientAccumulation>();
     pipeline.AddPass<SliceOptimizer>(resources.annotations);
@@ -1092,14 +1197,14 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
         resources.information.minimum_remote_tensor_size);
     pipeline.AddPass<PipelineStageMerger>();
     pipeline.AddPass<PipelineCommunicationOptimizer>();
-    AddPipelineOptimizerPass(pipeline);
+    AddPipelineOptimizerPass(pipeline, &compilation_stats);
     {
       auto& batch_serialization_pass = pipeline.AddPass<HloPassPipeline>(
-          "pipeline-batch-serialization-fixer-wrapper");
+          "pipeline-batch-serialization-fixer-wrapper", &compilation_stats);
       batch_serialization_pass
           .AddPass<PipelineBatchSerializationBufferInserter>(
               resources.remote_memory_supported);
-      AddPipelineOptimizerPass(batch_serialization_pass);
+      AddPipelineOptimizerPass(batch_serialization_pass, &compilation_stats);
       batch_serialization_pass
           .AddPass<PipelineBatchSerializationLoopInserter>();
     }
@@ -1119,12 +1224,18 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
     // Passes below this point need to respect control dependencies.
     pipeline.AddPass<RecomputeInstructions>(
         poplar_executor->RecomputationEnabled());
-    if (poplar_executor->RecomputationEnabled()) {
+    if (poplar_executor->RecomputationEnabled() &&
+        PoplarXlaFlags::Get().recomputation_memory_budget > 0) {
+      // Only recompute what is needed to fit in the memory budget.
+      pipeline.AddPass<RecomputationPlanner>(
+          PoplarXlaFlags::Get().recomputation_memory_budget,
+          ShapeSizeBytesFunction());
+    } else if (poplar_executor->RecomputationEnabled()) {
       pipeline.AddPass<SuggestRecompute>();
       pipeline.AddPass<AddBlockRecompute>();
       {
         auto& pass = pipeline.AddPass<HloPassFix<HloPassPipeline>>(
-            "resolve-recompute-suggestions");
+            "resolve-recompute-suggestions", &compilation_stats);
 
         pass.AddPass<HloPassFix<RemoveBlockedRecomputeSuggestions>>();
         pass.AddPass<HloPassFix<LiftRecomputeSuggestion>>();
@@ -1148,7 +1259,9 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
     pipeline.AddPass<ModuleFlatten>(resources.annotations);
     pipeline.AddPass<ConvolutionClassifier>(resources.annotations);
     pipeline.AddPass<PipelineRecomputationStageInserter>(
-        poplar_executor->RecomputationEnabled());
+        poplar_executor->RecomputationEnabled(),
+        PoplarXlaFlags::Get().recomputation_memory_budget,
+        ShapeSizeBytesFunction());
     if (poplar_executor->RecomputationEnabled()) {
       pipeline.AddPass<FlattenCallGraph>();
     }
@@ -1176,12 +1289,24 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
         resources.annotations, resources.always_rearrange_copies_on_host);
     pipeline.AddPass<HloPassFix<ForwardAllocation>>(resources.annotations);
     pipeline.AddPass<RemoteParameterParallelCombiner>(
-        resources.annotations.tensor_allocation_map);
+        resources.annotations.tensor_allocation_map,
+        PoplarXlaFlags::Get().offload_prefetch_depth);
 
     TF_ASSIGN_OR_RETURN(auto schedulers, GetSchedulerList(resources));
 
     TF_ASSIGN_OR_RETURN(auto scheduler, BestIpuSchedule(schedulers));
 
+    // Executables which are already in the cache never reach this point, so
+    // the schedules only need to be reused when the executable is missing.
+    if (poplar_executor->HaveExecutableCache()) {
+      TF_ASSIGN_OR_RETURN(
+          scheduler,
+          CachedIpuSchedule(scheduler,
+                            poplar_executor->SchedulerCacheDirectory(),
+                            GetSchedulerOptionsHash(resources),
+                            &resources.selected_schedulers));
+    }
+
     pipeline.AddPass<ResourceUpdateScheduleOptimizer>();
     pipeline.AddPass<IpuScheduler>(SizeFunction, scheduler);
     pipeline.AddPass<ModuleFlatten>(resources.annotations);
@@ -1189,6 +1314,7 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
 
     TF_RETURN_IF_ERROR(pipeline.Run(module.get()).status());
   }
+  compilation_stats.CompilationReport();
 
   VLOG(1) << "End XLA compilation: " << module->name() << " (Hash: 0x"
           << std::hex << HloHash(module.get()).GetHash() << ")";
@@ -1269,6 +1395,8 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
   if (compile) {
     TF_ASSIGN_OR_RETURN(const std::string tensorflow_info, GetFrameworkInfo());
     AddFrameworkFileToAutoReportDirectory(tensorflow_info, module->name());
+    AddJsonFileToAutoReportDirectory(compilation_stats.ToJson(),
+                                     "pass_profile.json", module->name());
     // Only create the graphs if we are compiling.
     TF_RETURN_IF_ERROR(
         CreatePoplarGraphs(resources, module.get(), poplar_executor));
@@ -1293,6 +1421,11 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
       VLOG(1) << "Begin Poplar graph contruction.";
       TF_RETURN_IF_ERROR(entry->AcceptOrdered(&visitor, order));
       VLOG(1) << "End Poplar graph contruction.";
+      VLOG(1) << "Graph caching: " << resources.graph_cache.HitCount()
+              << " hits, " << resources.graph_cache.MissCount()
+              << " misses. Subcomputation caching: "
+              << resources.subcomputation_cache.HitCount() << " hits, "
+              << resources.subcomputation_cache.MissCount() << " misses.";
     } catch (const std::exception& e) {
       return PoplarExceptionToTensorflowStatus("[Build graph] ", e);
     }
@@ -1471,6 +1604,11 @@ StatusOr<std::unique_ptr<Executable>> PoplarCompiler::RunBackend(
 
   executable.reset(poplar_executable);
 
+  if (poplar_executor->HaveInMemoryExecutableCache() &&
+      poplar_executable->CanShareEngine()) {
+    poplar_executor->AddInMemoryCachedExecutable(filenames, *poplar_executable);
+  }
+
   return std::move(executable);
 }
 
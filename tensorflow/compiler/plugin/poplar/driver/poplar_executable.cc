@@ -18,6 +18,7 @@ limitations under the License.
 #include <fstream>
 #include <utility>
 
+#include "absl/memory/memory.h"
 #include "ipu/poplar_executable_data.h"
 #include "tensorflow/compiler/plugin/poplar/driver/compiler_annotations.h"
 #include "tensorflow/compiler/plugin/poplar/driver/compiler_resources.h"
@@ -29,9 +30,30 @@ limitations under the License.
 
 namespace xla {
 namespace poplarplugin {
+namespace {
+// An engine can be shared by several executables, so the executor which might
+// have it loaded is only told about it being freed when the last of them has
+// been destroyed.
+std::shared_ptr<poplar::Engine> ShareableEngine(
+    std::unique_ptr<poplar::Engine> engine) {
+  return std::shared_ptr<poplar::Engine>(
+      engine.release(), [](poplar::Engine* engine) {
+        if (engine == nullptr) {
+          return;
+        }
+        auto platform = se::MultiPlatformManager::PlatformWithName(
+            tensorflow::PLATFORM_NAME);
+        if (platform.ok()) {
+          auto* p = static_cast<PoplarPlatform*>(platform.ValueOrDie());
+          p->AboutToFreeEngine(engine);
+        }
+        delete engine;
+      });
+}
+}  // namespace
 
 PoplarExecutable::PoplarExecutable(
-    std::unique_ptr<HloModule> hlo_module,
+    std::shared_ptr<HloModule> hlo_module,
     std::unique_ptr<HloProfilePrinterData> profile_printer,
     std::unique_ptr<HloProfileIndexMap> profile_index_map,
     std::unique_ptr<poplar::Engine> engine,
@@ -51,7 +73,7 @@ PoplarExecutable::PoplarExecutable(
     const std::vector<string>& checkpoint_feeds_order)
     : Executable(std::move(hlo_module), std::move(profile_printer),
                  std::move(profile_index_map)),
-      poplar_engine_(std::move(engine)),
+      poplar_engine_(ShareableEngine(std::move(engine))),
       input_output_aliasing_map_(std::move(input_output_aliasing_map)),
       literal_output_(std::move(literal_output)),
       is_constant_graph_(is_constant_graph),
@@ -74,16 +96,7 @@ PoplarExecutable::PoplarExecutable(
       key_id_mappings_(key_id_mappings),
       checkpoint_feeds_order_(checkpoint_feeds_order) {}
 
-PoplarExecutable::~PoplarExecutable() {
-  if (poplar_engine_.get() != nullptr) {
-    auto platform =
-        se::MultiPlatformManager::PlatformWithName(tensorflow::PLATFORM_NAME);
-    if (platform.ok()) {
-      auto* p = static_cast<PoplarPlatform*>(platform.ValueOrDie());
-      p->AboutToFreeEngine(poplar_engine_.get());
-    }
-  }
-}
+PoplarExecutable::~PoplarExecutable() {}
 
 StatusOr<ScopedShapedBuffer> PoplarExecutable::ExecuteAsyncOnStream(
     const ServiceExecutableRunOptions* run_options,
@@ -183,6 +196,30 @@ StatusOr<ScopedShapedBuffer> PoplarExecutable::ExecuteAsyncOnStream(
   return ShapeUtil::ByteSizeOf(shape, sizeof(void*));
 }
 
+std::unique_ptr<PoplarExecutable> PoplarExecutable::ShareEngine(
+    std::shared_ptr<HloModule> hlo_module,
+    std::unique_ptr<HloProfilePrinterData> profile_printer,
+    std::unique_ptr<HloProfileIndexMap> profile_index_map,
+    const InputOutputAliasingMap& input_output_aliasing_map) const {
+  CHECK(CanShareEngine());
+  auto executable = absl::make_unique<PoplarExecutable>(
+      std::move(hlo_module), std::move(profile_printer),
+      std::move(profile_index_map), nullptr, input_output_aliasing_map, false,
+      std::vector<std::vector<Literal>>{}, false, false,
+      std::vector<uint64>{}, replication_factor_, infeed_infos_,
+      outfeed_infos_, StreamInfos{}, StreamMetaInfos{},
+      SendRecvInfos(send_infos_), SendRecvInfos(recv_infos_),
+      HostEmbeddingInfos(host_embedding_lookup_infos_),
+      HostEmbeddingInfos(host_embedding_update_infos_),
+      HostEmbeddingInfos(host_embedding_notify_infos_),
+      RemoteParameterInfos(remote_parameter_infos_), key_id_mappings_,
+      checkpoint_feeds_order_);
+
+  executable->poplar_engine_ = poplar_engine_;
+  executable->loaded_from_cache_ = true;
+  return executable;
+}
+
 /*static*/ StatusOr<PoplarExecutable*> PoplarExecutable::Deserialize(
     std::unique_ptr<HloModule> hlo_module,
     std::unique_ptr<HloProfilePrinterData> profile_printer,
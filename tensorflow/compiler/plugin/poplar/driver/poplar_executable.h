@@ -43,7 +43,7 @@ class CompilerResources;
 // tensor recorded.
 class PoplarExecutable : public Executable {
  public:
-  PoplarExecutable(std::unique_ptr<HloModule> hlo_module,
+  PoplarExecutable(std::shared_ptr<HloModule> hlo_module,
                    std::unique_ptr<HloProfilePrinterData> hlo_profile_printer,
                    std::unique_ptr<HloProfileIndexMap> hlo_profile_index_map,
                    std::unique_ptr<poplar::Engine> engine,
@@ -139,6 +139,23 @@ class PoplarExecutable : public Executable {
     return checkpoint_feeds_order_;
   }
 
+  // Whether another executable can share this executable's engine. Stream
+  // copies refer to the instructions of this executable's module, so they
+  // cannot be shared.
+  bool CanShareEngine() const {
+    return poplar_engine_ != nullptr && stream_infos_.empty() &&
+           stream_meta_infos_.empty();
+  }
+
+  // Create an executable for `hlo_module` which shares this executable's
+  // engine, so that it does not need to be compiled or loaded again. The module
+  // must have the same hash as the module this executable was compiled from.
+  std::unique_ptr<PoplarExecutable> ShareEngine(
+      std::shared_ptr<HloModule> hlo_module,
+      std::unique_ptr<HloProfilePrinterData> hlo_profile_printer,
+      std::unique_ptr<HloProfileIndexMap> hlo_profile_index_map,
+      const InputOutputAliasingMap& input_output_aliasing_map) const;
+
   static StatusOr<PoplarExecutable*> Deserialize(
       std::unique_ptr<HloModule> hlo_module,
       std::unique_ptr<HloProfilePrinterData> hlo_profile_printer,
@@ -172,9 +189,11 @@ class PoplarExecutable : public Executable {
   friend class GraphCompileIoMapTest;
 
   // If you add fields which are specific to a compiled engine, then you will
-  // need to add them to the poplar_executable.proto, and the serialization code
-  // in PoplarExecutable.
-  std::unique_ptr<poplar::Engine> poplar_engine_;
+  // need to add them to the poplar_executable.proto, the serialization code
+  // in PoplarExecutable and ShareEngine.
+  // Executables which share an engine are all given the same pointer, and the
+  // engine is only freed once all of them have been destroyed.
+  std::shared_ptr<poplar::Engine> poplar_engine_;
   InputOutputAliasingMap input_output_aliasing_map_;
   std::vector<std::vector<Literal>> literal_output_;
   const bool is_constant_graph_;
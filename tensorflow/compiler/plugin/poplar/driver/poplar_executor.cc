@@ -31,6 +31,7 @@ limitations under the License.
 #include <poplar/Tensor.hpp>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "google/protobuf/util/message_differencer.h"
@@ -48,6 +49,7 @@ limitations under the License.
 #include "tensorflow/compiler/plugin/poplar/driver/xla_ipu_common.h"
 #include "tensorflow/compiler/tf2xla/shape_util.h"
 #include "tensorflow/compiler/tf2xla/type_util.h"
+#include "tensorflow/compiler/xla/service/compiler.h"
 #include "tensorflow/compiler/xla/service/hlo_evaluator.h"
 #include "tensorflow/compiler/xla/service/hlo_instruction.h"
 #include "tensorflow/compiler/xla/service/hlo_instructions.h"
@@ -317,14 +319,35 @@ PoplarExecutor::PoplarExecutor()
       device_attached_(false),
       poplar_device_hash_(0),
       configured_(false),
+      infeed_allocator(PoplarXlaFlags::Get().infeed_numa_node),
       has_cycle_counter_(false),
-      rendezvous_(tensorflow::NewLocalRendezvous()) {
+      rendezvous_(tensorflow::NewLocalRendezvous()),
+      executable_cache_(std::max<int64>(
+          PoplarXlaFlags::Get().in_memory_executable_cache_size, 0)),
+      outstanding_precompiles_(0) {
   // TODO should this use the time/ms?
   static std::random_device rd;
   seed_generator_.Seed(rd());
 }
 
-PoplarExecutor::~PoplarExecutor() {}
+PoplarExecutor::~PoplarExecutor() {
+  // Finish any compilations and free the cached engines while the rest of the
+  // executor is still alive.
+  precompile_thread_pool_.reset();
+
+  if (executable_cache_.Capacity() > 0) {
+    const auto statistics = GetExecutableCacheStatistics();
+    VLOG(1) << "In memory executable cache for ordinal " << ordinal_ << ": "
+            << statistics.hits << " hits, " << statistics.misses
+            << " misses and " << statistics.evictions << " evictions.";
+  }
+
+  std::vector<std::shared_ptr<const PoplarExecutable>> cached;
+  {
+    std::lock_guard<std::mutex> g(executable_cache_mutex_);
+    cached = executable_cache_.Clear();
+  }
+}
 
 se::DeviceMemoryBase PoplarExecutor::Allocate(uint64 size, int64 memory_space) {
   TensorControl* allocated = new TensorControl(size);
@@ -816,7 +839,7 @@ void PoplarExecutor::ConnectOutfeedToStreamCallback(
   }
 }
 
-IOFunction PoplarExecutor::CreateInfeedIOThreadFunction(
+IOTaskFunction PoplarExecutor::CreateInfeedIOTaskFunction(
     const FeedInfo& infeed_info) {
   // Find the iterator.
   auto itr = infeed_iterators_.find(infeed_info.config.feed_id());
@@ -827,72 +850,90 @@ IOFunction PoplarExecutor::CreateInfeedIOThreadFunction(
   }
   InfeedIterator* infeed_dataset_iterator = itr->second.get();
 
-  return [this, infeed_dataset_iterator](std::atomic<bool>& cancelled) {
-    auto& infeed_queues = infeed_dataset_iterator->GetInfeedQueues();
-    while (!cancelled) {
-      // We do not call GetNext if queues are full.
-      // We make an assumption that all tensors from each queue for each
-      // replica for an infeed are dequeued every iteration - we therefore
-      // only need to check if the first queue is full to know whether all the
-      // queues are full.
-      if (infeed_queues[0][0]->IsFull()) {
-        VLOG(2) << "Infeed queue is full.";
-        continue;
-      }
+  return [this, infeed_dataset_iterator, end_of_sequence = false,
+          num_queues_signalled = size_t{0}](
+             bool cancelled) mutable -> StatusOr<IOTaskState> {
+    if (cancelled) {
+      return IOTaskState::kFinished;
+    }
 
-      if (infeed_queues[0][0]->IsEmpty()) {
-        VLOG(2) << "Infeed queue is empty.";
+    auto& infeed_queues = infeed_dataset_iterator->GetInfeedQueues();
+    if (end_of_sequence) {
+      // Push the end of queue sentinel into every queue, without blocking the
+      // IO thread on a full queue.
+      size_t queue_idx = 0;
+      for (auto& queues : infeed_queues) {
+        for (auto& queue : queues) {
+          if (queue_idx++ < num_queues_signalled) {
+            continue;
+          }
+          if (!queue->TrySignalEndOfQueue()) {
+            return IOTaskState::kIdle;
+          }
+          num_queues_signalled++;
+        }
       }
 
-      std::vector<tensorflow::Tensor> outputs;
-      bool end_of_sequence = false;
-      TF_RETURN_IF_ERROR(
-          infeed_dataset_iterator->GetNext(&outputs, &end_of_sequence));
-
-      if (end_of_sequence) {
-        VLOG(1) << "The dataset iterator has reached the end of the dataset.";
+      // This is not considered an error. However, we will report an
+      // error if the consumer tries to pop past the end of the queue.
+      return IOTaskState::kFinished;
+    }
 
-        for (auto& queues : infeed_queues) {
-          for (auto& queue : queues) {
-            queue->SignalEndOfQueue();
-          }
+    // We do not call GetNext unless every queue has space for the next
+    // element, so that the pushes below never block the IO thread, which is
+    // shared with other feeds. This is the only producer of the queues, so
+    // their space cannot shrink before the elements are pushed.
+    for (auto& queues : infeed_queues) {
+      for (auto& queue : queues) {
+        if (queue->IsFull()) {
+          VLOG(2) << "Infeed queue is full.";
+          return IOTaskState::kIdle;
         }
-
-        // This is not considered an error. However, we will report an
-        // error if the consumer tries to pop past the end of the queue.
-        return Status::OK();
       }
+    }
 
-      for (size_t j = 0; j < outputs.size(); ++j) {
-        auto& tensor = outputs[j];
-        std::vector<tensorflow::Tensor> tensor_slices;
-        if (current_replication_factor_ > 1) {
-          // For replicated graphs, slice the input tensor and enqueue
-          // it separately for each replica.
-          CHECK_EQ(tensor.dim_size(0), current_replication_factor_);
-          tensor_slices.reserve(current_replication_factor_);
-          for (auto replica_id = 0; replica_id < current_replication_factor_;
-               ++replica_id) {
-            // Note that the tensor_slice shares the data buffer with the
-            // tensor which works with ref counting.
-            tensor_slices.push_back(tensor.SubSlice(replica_id));
-          }
-        } else {
-          tensor_slices = {tensor};
-        }
+    if (infeed_queues[0][0]->IsEmpty()) {
+      VLOG(2) << "Infeed queue is empty.";
+    }
 
-        // Enqueue tensors to each replica.
-        for (size_t replica_id = 0; replica_id < tensor_slices.size();
-             replica_id++) {
-          auto& queue = infeed_queues[replica_id][j];
-          auto* tb = tensorflow::DMAHelper::buffer(&tensor_slices[replica_id]);
-          tb->Ref();
-          queue->BlockPush(tb);
-          queue->AdvanceWritePosition();
+    std::vector<tensorflow::Tensor> outputs;
+    TF_RETURN_IF_ERROR(
+        infeed_dataset_iterator->GetNext(&outputs, &end_of_sequence));
+
+    if (end_of_sequence) {
+      VLOG(1) << "The dataset iterator has reached the end of the dataset.";
+      return IOTaskState::kBusy;
+    }
+
+    for (size_t j = 0; j < outputs.size(); ++j) {
+      auto& tensor = outputs[j];
+      std::vector<tensorflow::Tensor> tensor_slices;
+      if (current_replication_factor_ > 1) {
+        // For replicated graphs, slice the input tensor and enqueue
+        // it separately for each replica.
+        CHECK_EQ(tensor.dim_size(0), current_replication_factor_);
+        tensor_slices.reserve(current_replication_factor_);
+        for (auto replica_id = 0; replica_id < current_replication_factor_;
+             ++replica_id) {
+          // Note that the tensor_slice shares the data buffer with the
+          // tensor which works with ref counting.
+          tensor_slices.push_back(tensor.SubSlice(replica_id));
         }
+      } else {
+        tensor_slices = {tensor};
+      }
+
+      // Enqueue tensors to each replica.
+      for (size_t replica_id = 0; replica_id < tensor_slices.size();
+           replica_id++) {
+        auto& queue = infeed_queues[replica_id][j];
+        auto* tb = tensorflow::DMAHelper::buffer(&tensor_slices[replica_id]);
+        tb->Ref();
+        queue->Push(tb);
+        queue->AdvanceWritePosition();
       }
     }
-    return Status::OK();
+    return IOTaskState::kBusy;
   };
 }
 
@@ -911,7 +952,7 @@ inline void AllocateTensors(std::deque<std::vector<tensorflow::Tensor>>& queue,
 }
 }  // namespace
 
-IOFunction PoplarExecutor::CreateOutfeedIOThreadFunction(
+IOTaskFunction PoplarExecutor::CreateOutfeedIOTaskFunction(
     const FeedInfo& outfeed_info) {
   auto itr = outfeed_contexts_.find(outfeed_info.config.feed_id());
   if (itr == outfeed_contexts_.end()) {
@@ -920,129 +961,172 @@ IOFunction PoplarExecutor::CreateOutfeedIOThreadFunction(
   }
   OutfeedContext* outfeed_context = itr->second.get();
 
-  return [this, outfeed_context](std::atomic<bool>& cancelled) {
+  return [this, outfeed_context, all_queues_empty_for = uint32{0}](
+             bool cancelled) mutable -> StatusOr<IOTaskState> {
     int replicas = current_replication_factor_;
     replicas = std::max(replicas, 1);
 
-    // Lock the outfeed queues if it is of the GetLast type so that the CPU
-    // OP does not try to dequeue the outfeed during the execution.
-    if (outfeed_context->config.mode() == PoplarFeedConfig::GetLast) {
-      outfeed_context->mutex.lock();
-    }
-
-    // Continue while the thread has not been cancelled, and if it has been
+    // Continue while the task has not been cancelled, and if it has been
     // cancelled allow for up to two extra runs.
-    uint32 all_queues_empty_for = 0;
-    while (!cancelled || all_queues_empty_for != 2) {
-      bool all_queues_empty = true;
-      int io_batch_size = outfeed_context->config.io_batch_size();
-      for (auto& tensor_queues :
-           outfeed_context->callback_to_io_thread_queues) {
-        for (auto& replica_queue : tensor_queues) {
-          all_queues_empty &= !replica_queue->HasItemsWaiting();
-        }
-      }
-
-      // Track empty queues when we are trying to exit
-      if (all_queues_empty && cancelled) {
-        all_queues_empty_for++;
-      }
-
-      // Continue if all the outfeed queues are empty.
-      if (all_queues_empty) {
-        continue;
+    if (cancelled && all_queues_empty_for == 2) {
+      return IOTaskState::kFinished;
+    }
+
+    // Only dequeue once every queue has an element, so that the task never
+    // waits for the device in the middle of a step.
+    bool all_queues_empty = true;
+    bool all_queues_waiting = true;
+    int io_batch_size = outfeed_context->config.io_batch_size();
+    for (auto& tensor_queues : outfeed_context->callback_to_io_thread_queues) {
+      for (auto& replica_queue : tensor_queues) {
+        const bool waiting = replica_queue->HasItemsWaiting();
+        all_queues_empty &= !waiting;
+        all_queues_waiting &= waiting;
       }
+    }
 
-      // Lock the outfeed queue so that the CPU OP does not try to dequeue
-      // whilst moving data off the device.
-      {
-        std::lock_guard<std::recursive_mutex> guard(outfeed_context->mutex);
-        // Allocate the tensors before dequeuing.
-        bool allocate_tensors = true;
-        if (outfeed_context->config.mode() == PoplarFeedConfig::GetLast) {
-          // For the get last we only allocate tensors once.
-          allocate_tensors = outfeed_context->io_thread_output_queues.empty();
-        }
+    // Track empty queues when we are trying to exit
+    if (all_queues_empty && cancelled) {
+      all_queues_empty_for++;
+    }
 
-        if (allocate_tensors) {
-          AllocateTensors(outfeed_context->io_thread_output_queues,
-                          outfeed_context->tf_data_types,
-                          outfeed_context->tf_shapes, io_batch_size);
-        }
+    // Continue if the outfeed queues are not ready.
+    if (!all_queues_waiting) {
+      return IOTaskState::kIdle;
+    }
 
-        // We need to copy along 3 axis.  There are multiple queues from
-        // the IPU, one  per tuple and per replica.  In each queue there
-        // is a block of data containing one or more tensors.  There is a
-        // single queue out of the executor, consisting of a vector of
-        // Tensors, one per tuple entry.  If there are multiple replicas
-        // then the outer dimension of the Tensors has the same value as the
-        // replica count, and the output from each replica is concatenated
-        // into that Tensor.
-        //
-        // We loop over each queue (by tuple  and replica), and dequeue the
-        // block of data. This is then inserted  into the output queue as
-        // appropriate.
-        for (size_t tuple_idx = 0; tuple_idx < outfeed_context->shapes.size();
-             ++tuple_idx) {
-          // Dequeue tensors from each replica.
-          for (int64 replica_id = 0; replica_id < replicas; replica_id++) {
-            auto& queue =
-                outfeed_context
-                    ->callback_to_io_thread_queues[tuple_idx][replica_id];
-
-            // Dequeue the data and insert into the correct output queue.
-            uint8_t* src = reinterpret_cast<uint8_t*>(queue->BlockFront());
-            for (int b = 0; b < io_batch_size; b++) {
-              std::vector<tensorflow::Tensor>& tensors_to_write_to =
-                  outfeed_context->io_thread_output_queues.at(io_batch_size -
-                                                              b - 1);
-
-              auto& tensor = tensors_to_write_to[tuple_idx];
-
-              // When there are mutiple replicas, insert the data into a slice
-              // out of dinension 0.  Otherwise just use the whole tensor.
-              auto output_tensor =
-                  (replicas == 1 ? tensor : tensor.SubSlice(replica_id));
-              auto* tb = tensorflow::DMAHelper::buffer(&output_tensor);
-
-              std::memcpy(tb->data(), src, output_tensor.AllocatedBytes());
-              src += output_tensor.AllocatedBytes();
-            }
-            queue->FinishedFront();
-          }
-        }
-      }
+    // Lock the outfeed queue so that the CPU OP does not try to dequeue
+    // whilst moving data off the device. The queues of the GetLast type are
+    // locked for the whole execution in LaunchIOThreads.
+    std::unique_lock<std::recursive_mutex> guard(outfeed_context->mutex,
+                                                 std::defer_lock);
+    if (outfeed_context->config.mode() != PoplarFeedConfig::GetLast) {
+      guard.lock();
     }
 
-    // Unlock all the outfeed if it is of the GetLast type.
+    // Allocate the tensors before dequeuing.
+    bool allocate_tensors = true;
     if (outfeed_context->config.mode() == PoplarFeedConfig::GetLast) {
-      outfeed_context->mutex.unlock();
+      // For the get last we only allocate tensors once.
+      allocate_tensors = outfeed_context->io_thread_output_queues.empty();
+    }
+
+    if (allocate_tensors) {
+      AllocateTensors(outfeed_context->io_thread_output_queues,
+                      outfeed_context->tf_data_types,
+                      outfeed_context->tf_shapes, io_batch_size);
+    }
+
+    // We need to copy along 3 axis.  There are multiple queues from
+    // the IPU, one  per tuple and per replica.  In each queue there
+    // is a block of data containing one or more tensors.  There is a
+    // single queue out of the executor, consisting of a vector of
+    // Tensors, one per tuple entry.  If there are multiple replicas
+    // then the outer dimension of the Tensors has the same value as the
+    // replica count, and the output from each replica is concatenated
+    // into that Tensor.
+    //
+    // We loop over each queue (by tuple  and replica), and dequeue the
+    // block of data. This is then inserted  into the output queue as
+    // appropriate.
+    auto& callback_queues = outfeed_context->callback_to_io_thread_queues;
+    for (size_t tuple_idx = 0; tuple_idx < outfeed_context->shapes.size();
+         ++tuple_idx) {
+      // Dequeue tensors from each replica.
+      for (int64 replica_id = 0; replica_id < replicas; replica_id++) {
+        auto& queue = callback_queues[tuple_idx][replica_id];
+
+        // Dequeue the data and insert into the correct output queue.
+        uint8_t* src = reinterpret_cast<uint8_t*>(queue->BlockFront());
+        for (int b = 0; b < io_batch_size; b++) {
+          std::vector<tensorflow::Tensor>& tensors_to_write_to =
+              outfeed_context->io_thread_output_queues.at(io_batch_size - b -
+                                                          1);
+
+          auto& tensor = tensors_to_write_to[tuple_idx];
+
+          // When there are mutiple replicas, insert the data into a slice
+          // out of dinension 0.  Otherwise just use the whole tensor.
+          auto output_tensor =
+              (replicas == 1 ? tensor : tensor.SubSlice(replica_id));
+          auto* tb = tensorflow::DMAHelper::buffer(&output_tensor);
+
+          std::memcpy(tb->data(), src, output_tensor.AllocatedBytes());
+          src += output_tensor.AllocatedBytes();
+        }
+        queue->FinishedFront();
+      }
     }
-    return Status::OK();
+    return IOTaskState::kBusy;
   };
 }
 
 void PoplarExecutor::LaunchIOThreads(const InfeedInfos& infeed_infos,
                                      const OutfeedInfos& outfeed_infos) {
-  CHECK_EQ(io_threads_.size(), 0);
-  // Start all the infeeds.
+  CHECK(!io_executor_);
+  tensorflow::ThreadOptions options;
+  options.numa_node = GetInfeedAllocator()->NumaNode();
+  io_executor_ = absl::make_unique<IOExecutor>(
+      "io_thread", PoplarXlaFlags::Get().max_io_threads, options);
+
+  // Add all the infeeds.
   for (const FeedInfo& info : infeed_infos) {
-    IOFunction fn = CreateInfeedIOThreadFunction(info);
-    io_threads_.emplace_back(
-        absl::make_unique<IOThread>(info.config.feed_id(), std::move(fn)));
+    const auto& feed_id = info.config.feed_id();
+    InfeedQueue* queue =
+        infeed_iterators_.at(feed_id)->GetInfeedQueues()[0][0];
+    io_executor_->AddTask(
+        feed_id, CreateInfeedIOTaskFunction(info), info.config.io_priority(),
+        [queue]() {
+          return static_cast<double>(queue->Size()) / InfeedQueue::MaxSize();
+        });
   }
 
-  // Start all the outfeeds.
+  // Add all the outfeeds.
   for (const FeedInfo& info : outfeed_infos) {
-    IOFunction fn = CreateOutfeedIOThreadFunction(info);
-    io_threads_.emplace_back(
-        absl::make_unique<IOThread>(info.config.feed_id(), std::move(fn)));
+    const auto& feed_id = info.config.feed_id();
+    OutfeedContext* outfeed_context = outfeed_contexts_.at(feed_id).get();
+    // Lock the outfeed queues if it is of the GetLast type so that the CPU
+    // OP does not try to dequeue the outfeed during the execution.
+    if (outfeed_context->config.mode() == PoplarFeedConfig::GetLast) {
+      outfeed_context->mutex.lock();
+      locked_outfeed_contexts_.push_back(outfeed_context);
+    }
+
+    OutfeedQueueType* queue =
+        outfeed_context->callback_to_io_thread_queues[0][0].get();
+    io_executor_->AddTask(
+        feed_id, CreateOutfeedIOTaskFunction(info), info.config.io_priority(),
+        [queue]() {
+          return static_cast<double>(queue->Size()) / queue->MaxSize();
+        });
   }
+
+  io_executor_->Start();
+  VLOG(1) << "Running " << infeed_infos.size() + outfeed_infos.size()
+          << " feeds on " << io_executor_->NumThreads() << " IO threads.";
 }
 
 void PoplarExecutor::StopIOThreads() {
-  // Blocks the thread until all the threads have stopped and joined back.
-  io_threads_.clear();
+  // Blocks the thread until all the tasks have finished and the threads have
+  // joined back.
+  io_executor_->Stop();
+
+  for (OutfeedContext* outfeed_context : locked_outfeed_contexts_) {
+    outfeed_context->mutex.unlock();
+  }
+  locked_outfeed_contexts_.clear();
+
+  // An infeed which is often empty, or an outfeed which is often full, is
+  // starving the device.
+  for (const IOTaskStats& stats : io_executor_->GetStats()) {
+    VLOG(1) << "Feed " << stats.name << " (priority " << stats.priority
+            << "): " << stats.busy_steps << " busy steps, "
+            << stats.idle_steps << " idle steps, mean queue occupancy "
+            << stats.mean_occupancy << ", empty " << stats.empty_fraction
+            << " of the time, full " << stats.full_fraction
+            << " of the time.";
+  }
+  io_executor_.reset();
 }
 
 void PoplarExecutor::DeferredDeallocation() {
@@ -1674,6 +1758,11 @@ Status PoplarExecutor::CreateExecutableCacheDirIfMissing() const {
   return CreateDirIfMissing(PoplarXlaFlags::Get().executable_cache_path);
 }
 
+std::string PoplarExecutor::SchedulerCacheDirectory() const {
+  return tensorflow::io::JoinPath(PoplarXlaFlags::Get().executable_cache_path,
+                                  "schedules");
+}
+
 std::string ModuleFilenames::SerializedExecutableFilename() const {
   return tensorflow::io::JoinPath(serialization_folder_,
                                   basename_ + ".ipu_bin");
@@ -1717,6 +1806,114 @@ bool PoplarExecutor::HaveCachedExecutable(
       .ok();
 }
 
+bool PoplarExecutor::HaveInMemoryExecutableCache() const {
+  // Executables which are exported need their Poplar executable, which is not
+  // kept once the engine has been created.
+  return executable_cache_.Capacity() > 0 && !EnableSerialization();
+}
+
+std::shared_ptr<const PoplarExecutable>
+PoplarExecutor::GetInMemoryCachedExecutable(const ModuleFilenames& filenames,
+                                            bool count_miss) {
+  std::lock_guard<std::mutex> g(executable_cache_mutex_);
+  auto* executable = executable_cache_.Lookup(filenames.Name());
+  if (executable) {
+    executable_cache_statistics_.hits++;
+    return *executable;
+  }
+  if (count_miss) {
+    executable_cache_statistics_.misses++;
+  }
+  return nullptr;
+}
+
+void PoplarExecutor::AddInMemoryCachedExecutable(
+    const ModuleFilenames& filenames, const PoplarExecutable& executable) {
+  // The cache holds its own executable, sharing the module and the engine, so
+  // that it does not depend on how long XLA keeps this one.
+  std::shared_ptr<const PoplarExecutable> cached = executable.ShareEngine(
+      executable.shared_module(), nullptr, nullptr,
+      executable.GetInputOutputAliasingMap());
+
+  // Evicted executables might free their engines, which needs the IPU lock, so
+  // they are only destroyed once the cache lock has been released.
+  LRUCache<std::string, std::shared_ptr<const PoplarExecutable>>::InsertResult
+      removed;
+  {
+    std::lock_guard<std::mutex> g(executable_cache_mutex_);
+    removed = executable_cache_.Insert(filenames.Name(), std::move(cached));
+    // Replacing the executable for the same module is not an eviction.
+    executable_cache_statistics_.evictions += removed.evicted.size();
+  }
+}
+
+PoplarExecutor::ExecutableCacheStatistics
+PoplarExecutor::GetExecutableCacheStatistics() const {
+  std::lock_guard<std::mutex> g(executable_cache_mutex_);
+  ExecutableCacheStatistics statistics = executable_cache_statistics_;
+  statistics.size = executable_cache_.Size();
+  return statistics;
+}
+
+void PoplarExecutor::PrecompileExecutables(
+    std::vector<std::unique_ptr<HloModule>> modules) {
+  std::lock_guard<std::mutex> g(precompile_mutex_);
+  if (!precompile_thread_pool_) {
+    // The compiler only builds one graph at a time, so more threads would
+    // only help modules which are already in the executable cache.
+    precompile_thread_pool_ = absl::make_unique<tensorflow::thread::ThreadPool>(
+        tensorflow::Env::Default(), "poplar_precompile", 1);
+  }
+
+  outstanding_precompiles_ += modules.size();
+  for (auto& module : modules) {
+    // Scheduled functions must be copyable, so the module is passed as a raw
+    // pointer.
+    HloModule* module_ptr = module.release();
+    precompile_thread_pool_->Schedule([this, module_ptr]() {
+      const std::string name = module_ptr->name();
+      Status status =
+          PrecompileExecutable(std::unique_ptr<HloModule>(module_ptr));
+      if (!status.ok()) {
+        LOG(WARNING) << "Failed to precompile " << name << ": " << status;
+      }
+
+      std::lock_guard<std::mutex> g(precompile_mutex_);
+      precompile_status_.Update(status);
+      if (--outstanding_precompiles_ == 0) {
+        precompile_cv_.notify_all();
+      }
+    });
+  }
+}
+
+Status PoplarExecutor::PrecompileExecutable(std::unique_ptr<HloModule> module) {
+  TF_ASSIGN_OR_RETURN(
+      se::Platform * platform,
+      se::MultiPlatformManager::PlatformWithName(tensorflow::PLATFORM_NAME));
+  TF_ASSIGN_OR_RETURN(se::StreamExecutor * stream_executor,
+                      platform->ExecutorForDevice(ordinal_));
+  TF_ASSIGN_OR_RETURN(Compiler * compiler, Compiler::GetForPlatform(platform));
+
+  VLOG(1) << "Precompiling " << module->name() << " for ordinal " << ordinal_;
+  TF_ASSIGN_OR_RETURN(module,
+                      compiler->RunHloPasses(std::move(module), stream_executor,
+                                             /*device_allocator=*/nullptr));
+  // The executable is not needed as the compiler adds it to the caches.
+  return compiler
+      ->RunBackend(std::move(module), stream_executor,
+                   /*device_allocator=*/nullptr)
+      .status();
+}
+
+Status PoplarExecutor::WaitForPrecompiledExecutables() {
+  std::unique_lock<std::mutex> l(precompile_mutex_);
+  precompile_cv_.wait(l, [this] { return outstanding_precompiles_ == 0; });
+  Status status = precompile_status_;
+  precompile_status_ = Status::OK();
+  return status;
+}
+
 bool PoplarExecutor::SupportsRemoteBuffers() const {
   if (!PoplarDeviceIsAttached()) {
     return false;
@@ -2632,7 +2829,7 @@ void PoplarExecutor::CreateInfeedIterator(
 Status PoplarExecutor::DeleteInfeedIterator(const std::string& feed_id) {
   std::lock_guard<std::recursive_mutex> l(ipu_.Mutex());
 
-  if (io_threads_.size()) {
+  if (io_executor_) {
     return xla::FailedPrecondition(
         "Cannot delete infeed with id='%s' while in use", feed_id.c_str());
   }
@@ -2708,7 +2905,7 @@ Status PoplarExecutor::RegisterOutfeeds(const OutfeedInfos& outfeed_infos) {
 Status PoplarExecutor::DeleteOutfeed(const std::string& feed_id) {
   std::lock_guard<std::recursive_mutex> l(ipu_.Mutex());
 
-  if (io_threads_.size()) {
+  if (io_executor_) {
     return xla::FailedPrecondition(
         "Cannot delete outfeed with id='%s' while in use", feed_id.c_str());
   }
@@ -2747,6 +2944,24 @@ Status PoplarExecutor::DeregisterHostEmbedding(
   {
     std::unique_lock<std::mutex> lk(host_embeddings_mutex_);
 
+    auto itr = host_embeddings_.find(embedding_id);
+    if (itr != host_embeddings_.end() && VLOG_IS_ON(1)) {
+      auto statistics = itr->second->GetStatistics();
+      if (statistics.ok()) {
+        const HostEmbeddingStatistics& stats = statistics.ValueOrDie();
+        const double hit_rate =
+            stats.sampled_lookups
+                ? static_cast<double>(stats.sampled_cache_hits) /
+                      stats.sampled_lookups
+                : 0.0;
+        VLOG(1) << "Host embedding " << embedding_id << ": " << stats.lookups
+                << " rows looked up, cache hit rate " << hit_rate
+                << ". Rows covering 50%/90%/99% of the lookups: "
+                << RowsToCover(stats, 0.5) << "/" << RowsToCover(stats, 0.9)
+                << "/" << RowsToCover(stats, 0.99) << ".";
+      }
+    }
+
     host_embeddings_.erase(embedding_id);
   }
 
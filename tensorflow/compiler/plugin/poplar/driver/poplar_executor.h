@@ -36,10 +36,12 @@ limitations under the License.
 #include "tensorflow/compiler/plugin/poplar/driver/config.pb.h"
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_feed_config.pb.h"
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_transfer_manager.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/host_embedding_util.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_allocator.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_iterator.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/input_output_aliasing_map.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/io_thread.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/lru_cache.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/seed_generator.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/spsc_outfeed_queue.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/spsc_queue.h"
@@ -53,6 +55,7 @@ limitations under the License.
 #include "tensorflow/core/framework/types.pb.h"
 #include "tensorflow/core/lib/gtl/array_slice.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/threadpool.h"
 #include "tensorflow/stream_executor/blas.h"
 #include "tensorflow/stream_executor/device_description.h"
 #include "tensorflow/stream_executor/device_memory_allocator.h"
@@ -446,6 +449,10 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
                            current_config_.max_scheduler_search_space_size());
   }
 
+  int64 GetMaxSchedulerTimeMs() const {
+    return std::max<int64>(0, current_config_.max_scheduler_time_ms());
+  }
+
   int64 GetMaxSendRecvClusterSize() const {
     return current_config_.max_send_recv_cluster_size();
   }
@@ -502,10 +509,57 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
 
   Status CreateExecutableCacheDirIfMissing() const;
 
+  // The directory, inside the executable cache, where the schedules of the
+  // individual computations are stored.
+  std::string SchedulerCacheDirectory() const;
+
   Status CreateSerializedExecutableDirIfMissing() const;
 
   bool HaveCachedExecutable(const ModuleFilenames& filenames) const;
 
+  // The in memory executable cache keeps the most recently used executables,
+  // so that a module which is compiled again can share the engine of the
+  // previous executable rather than being compiled, or loaded from the
+  // executable cache, a second time.
+  struct ExecutableCacheStatistics {
+    // The number of executables which were served from the cache.
+    int64 hits = 0;
+    // The number of executables which were not in the cache when they were
+    // first looked up.
+    int64 misses = 0;
+    // The number of executables which were evicted from the cache to make room
+    // for another module. Replacing the executable of a module already in the
+    // cache is not counted.
+    int64 evictions = 0;
+    // The number of executables in the cache.
+    int64 size = 0;
+  };
+
+  bool HaveInMemoryExecutableCache() const;
+
+  // Returns the cached executable for `filenames`, or nullptr if there isn't
+  // one. Only set `count_miss` on the first lookup of each module.
+  std::shared_ptr<const PoplarExecutable> GetInMemoryCachedExecutable(
+      const ModuleFilenames& filenames, bool count_miss = true);
+
+  // Adds an executable, which must be able to share its engine, to the in
+  // memory executable cache.
+  void AddInMemoryCachedExecutable(const ModuleFilenames& filenames,
+                                   const PoplarExecutable& executable);
+
+  ExecutableCacheStatistics GetExecutableCacheStatistics() const;
+
+  // Compile the modules on a background thread, adding the executables to the
+  // executable caches so that later compilations of the same modules are
+  // served without waiting. Each module is compiled for the shapes of its
+  // entry computation, so there should be one module for each of the argument
+  // shape signatures which are expected to be used.
+  void PrecompileExecutables(std::vector<std::unique_ptr<HloModule>> modules);
+
+  // Blocks until all the modules passed to PrecompileExecutables have been
+  // compiled, returning the first error.
+  Status WaitForPrecompiledExecutables();
+
   ModuleFilenames GetModuleFilenames(const HloModule& module) const;
 
   void AboutToFreeEngine(poplar::Engine* engine);
@@ -554,6 +608,9 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
     virtual xla::StatusOr<int> GetElementSize() const = 0;
 
     virtual Status Notify(int replica) = 0;
+
+    // Which rows have been looked up, for sizing the hot row cache.
+    virtual StatusOr<HostEmbeddingStatistics> GetStatistics() const = 0;
   };
 
   template <typename T>
@@ -803,15 +860,15 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
   // deviceToHostFIFO()
   void ConnectOutfeedToStreamCallback(const OutfeedInfos& outfeed_infos);
 
-  IOFunction CreateInfeedIOThreadFunction(const FeedInfo& infeed_info);
-  IOFunction CreateOutfeedIOThreadFunction(const FeedInfo& outfeed_info);
+  IOTaskFunction CreateInfeedIOTaskFunction(const FeedInfo& infeed_info);
+  IOTaskFunction CreateOutfeedIOTaskFunction(const FeedInfo& outfeed_info);
 
   // Creates and launches the threads which send/receive data from the Poplar
   // stream callbacks.
   void LaunchIOThreads(const InfeedInfos& infeed_infos,
                        const OutfeedInfos& outfeed_infos);
 
-  // Blocks until all the IOThreads stop.
+  // Blocks until all the IO tasks finish and the IO threads stop.
   void StopIOThreads();
 
   void DeferredDeallocation();
@@ -820,9 +877,12 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
 
   void ConnectCycleCounterCallback();
 
+  Status PrecompileExecutable(std::unique_ptr<HloModule> module);
+
   int ordinal_;
 
-  std::vector<std::unique_ptr<IOThread>> io_threads_;
+  // Runs the infeed and outfeed tasks during an execution.
+  std::unique_ptr<IOExecutor> io_executor_;
 
   std::unique_ptr<tensorflow::CancellationManager> cm_;
 
@@ -909,6 +969,9 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
   absl::flat_hash_map<std::string, std::unique_ptr<OutfeedContext>>
       outfeed_contexts_;
 
+  // Outfeeds of the GetLast type which are locked during an execution.
+  std::vector<OutfeedContext*> locked_outfeed_contexts_;
+
   absl::flat_hash_map<std::string, std::unique_ptr<HostEmbeddingInterface_>>
       host_embeddings_;
 
@@ -921,6 +984,20 @@ class PoplarExecutor : public se::internal::StreamExecutorInterface {
   bool has_cycle_counter_;
 
   tensorflow::core::RefCountPtr<tensorflow::Rendezvous> rendezvous_;
+
+  // Executables which can share their engines, keyed by the name of their
+  // module files, and how the cache has been used.
+  mutable std::mutex executable_cache_mutex_;
+  LRUCache<std::string, std::shared_ptr<const PoplarExecutable>>
+      executable_cache_;
+  ExecutableCacheStatistics executable_cache_statistics_;
+
+  // Compiles the modules passed to PrecompileExecutables.
+  std::unique_ptr<tensorflow::thread::ThreadPool> precompile_thread_pool_;
+  std::mutex precompile_mutex_;
+  std::condition_variable precompile_cv_;
+  int64 outstanding_precompiles_;
+  Status precompile_status_;
 };
 
 }  // namespace poplarplugin
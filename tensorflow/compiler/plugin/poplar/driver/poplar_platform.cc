@@ -201,6 +201,27 @@ Status PoplarPlatform::GetCompilerEvents(
   return Status::OK();
 }
 
+Status PoplarPlatform::PrecompileExecutables(
+    int ordinal, std::vector<std::unique_ptr<HloModule>> modules) {
+  TF_ASSIGN_OR_RETURN(se::StreamExecutor * executor,
+                      ExecutorForDevice(ordinal));
+  auto* e = static_cast<PoplarExecutor*>(executor->implementation());
+  if (!e->HaveInMemoryExecutableCache()) {
+    return xla::FailedPrecondition(
+        "Precompiling executables needs the in memory executable cache. Set "
+        "--in_memory_executable_cache_size in TF_POPLAR_FLAGS.");
+  }
+  e->PrecompileExecutables(std::move(modules));
+  return Status::OK();
+}
+
+Status PoplarPlatform::WaitForPrecompiledExecutables(int ordinal) {
+  TF_ASSIGN_OR_RETURN(se::StreamExecutor * executor,
+                      ExecutorForDevice(ordinal));
+  auto* e = static_cast<PoplarExecutor*>(executor->implementation());
+  return e->WaitForPrecompiledExecutables();
+}
+
 void PoplarPlatform::AboutToFreeEngine(poplar::Engine* engine) {
   for (int ordinal = 0; ordinal < VisibleDeviceCount(); ordinal++) {
     auto executor = ExecutorForDevice(ordinal);
@@ -47,6 +47,9 @@ class Engine;
 }
 
 namespace xla {
+
+class HloModule;
+
 namespace poplarplugin {
 
 class PoplarPlatform : public se::Platform {
@@ -95,6 +98,16 @@ class PoplarPlatform : public se::Platform {
 
   Status GetCompilerEvents(std::list<tensorflow::IpuTraceEvent>& out);
 
+  // Compiles the modules in the background for the device `ordinal`, so that
+  // the first run of each one is served from the in memory executable cache.
+  // There should be one module for each expected argument shape signature.
+  Status PrecompileExecutables(int ordinal,
+                               std::vector<std::unique_ptr<HloModule>> modules);
+
+  // Blocks until the modules passed to PrecompileExecutables for the device
+  // `ordinal` have been compiled, returning the first error.
+  Status WaitForPrecompiledExecutables(int ordinal);
+
   void AboutToFreeEngine(poplar::Engine* engine);
 
   void ResetXfeedManagers();
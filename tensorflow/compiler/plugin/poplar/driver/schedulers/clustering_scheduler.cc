@@ -687,7 +687,8 @@ IpuSchedulerAlgorithm CreateClusteringMemoryScheduler(
              const TuplePointsToAnalysis& points_to_analysis,
              const LogicalBuffer::SizeFunction& size_function,
              const absl::flat_hash_map<const HloComputation*, int64>&
-                 memory_by_computation) {
+                 memory_by_computation,
+             HloHash*) {
     return ClusteringScheduler(computation, points_to_analysis, size_function,
                                memory_by_computation, information);
   };
@@ -22,6 +22,14 @@ limitations under the License.
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "absl/types/optional.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hash.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_hash.h"
 #include "tensorflow/compiler/xla/service/heap_simulator.h"
 #include "tensorflow/compiler/xla/service/hlo_casting_utils.h"
 #include "tensorflow/compiler/xla/service/hlo_computation.h"
@@ -32,9 +40,15 @@ limitations under the License.
 #include "tensorflow/compiler/xla/statusor.h"
 #include "tensorflow/compiler/xla/types.h"
 #include "tensorflow/compiler/xla/util.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/gtl/map_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace xla {
 namespace poplarplugin {
@@ -49,11 +63,13 @@ StatusOr<HloSchedule> IpuScheduleModule(
   std::unique_ptr<HloAliasAnalysis> alias_analysis =
       HloAliasAnalysis::NewEmptyAnalysis(module);
   absl::flat_hash_map<const HloComputation*, int64> memory_by_computation;
+  HloHash module_hash(module);
   for (auto* computation : module->MakeComputationPostOrder()) {
     if (!computation->IsFusionComputation()) {
-      TF_ASSIGN_OR_RETURN(HloInstructionSequence computation_sequence,
-                          algorithm(computation, *points_to_analysis,
-                                    size_function, memory_by_computation));
+      TF_ASSIGN_OR_RETURN(
+          HloInstructionSequence computation_sequence,
+          algorithm(computation, *points_to_analysis, size_function,
+                    memory_by_computation, &module_hash));
       TF_ASSIGN_OR_RETURN(
           auto bytes,
           HeapSimulator::MinimumMemoryForComputation(
@@ -70,6 +86,88 @@ StatusOr<HloSchedule> IpuScheduleModule(
 
   return std::move(schedule);
 }
+
+constexpr char kScheduleCacheHeader[] = "ipu_schedule_v2";
+constexpr char kScheduleCacheSchedulerPrefix[] = "scheduler:";
+
+std::string ScheduleCacheFilename(
+    HloComputation* computation, const std::string& cache_path,
+    uint64 options_hash,
+    const absl::flat_hash_map<const HloComputation*, int64>&
+        memory_by_computation,
+    HloHash* module_hash) {
+  uint64 key = tensorflow::Hash64Combine(
+      module_hash->GetComputationHash(computation), options_hash);
+
+  // The schedule also depends on the memory used by the called computations.
+  for (auto* inst : computation->MakeInstructionPostOrder()) {
+    for (auto* called_comp : inst->called_computations()) {
+      auto itr = memory_by_computation.find(called_comp);
+      if (itr != memory_by_computation.end()) {
+        key = tensorflow::Hash64Combine(key, hash_util::hash(itr->second));
+      }
+    }
+  }
+
+  return tensorflow::io::JoinPath(
+      cache_path, tensorflow::strings::Printf("%0llx.ipu_schedule", key));
+}
+
+// Instructions are stored as indices into the post order of the computation,
+// which is the order the instructions are hashed in. The name of the scheduler
+// which produced the sequence is stored with it, and is empty when it is not
+// known.
+std::string SerializeSequence(const std::vector<HloInstruction*>& post_order,
+                              const HloInstructionSequence& sequence,
+                              const std::string& scheduler_name) {
+  absl::flat_hash_map<const HloInstruction*, int64> index;
+  for (int64 i = 0; i != static_cast<int64>(post_order.size()); ++i) {
+    index[post_order[i]] = i;
+  }
+
+  std::vector<int64> ids;
+  ids.reserve(sequence.size());
+  for (auto* inst : sequence.instructions()) {
+    ids.push_back(index.at(inst));
+  }
+
+  return absl::StrCat(kScheduleCacheHeader, "\n",
+                      kScheduleCacheSchedulerPrefix, scheduler_name, "\n",
+                      post_order.size(), "\n", absl::StrJoin(ids, " "), "\n");
+}
+
+StatusOr<HloInstructionSequence> DeserializeSequence(
+    const std::vector<HloInstruction*>& post_order, const std::string& data,
+    std::string* scheduler_name) {
+  std::vector<absl::string_view> lines =
+      absl::StrSplit(data, '\n', absl::SkipEmpty());
+  int64 num_instructions;
+  if (lines.size() != 4 || lines[0] != kScheduleCacheHeader ||
+      !absl::ConsumePrefix(&lines[1], kScheduleCacheSchedulerPrefix) ||
+      !absl::SimpleAtoi(lines[2], &num_instructions) ||
+      num_instructions != static_cast<int64>(post_order.size())) {
+    return xla::InternalError("Invalid cached schedule");
+  }
+
+  HloInstructionSequence sequence;
+  std::vector<bool> seen(post_order.size(), false);
+  for (auto id_str : absl::StrSplit(lines[3], ' ', absl::SkipEmpty())) {
+    int64 id;
+    if (!absl::SimpleAtoi(id_str, &id) || id < 0 || id >= num_instructions ||
+        seen[id]) {
+      return xla::InternalError("Invalid cached schedule");
+    }
+    seen[id] = true;
+    sequence.push_back(post_order[id]);
+  }
+
+  if (sequence.size() != post_order.size()) {
+    return xla::InternalError("Invalid cached schedule");
+  }
+
+  *scheduler_name = std::string(lines[1]);
+  return sequence;
+}
 }  // namespace
 
 IpuSchedulerAlgorithm MemorySchedulerAlgorithmToIPU(
@@ -78,7 +176,8 @@ IpuSchedulerAlgorithm MemorySchedulerAlgorithmToIPU(
                      const TuplePointsToAnalysis& points_to_analysis,
                      const LogicalBuffer::SizeFunction& size_function,
                      const absl::flat_hash_map<const HloComputation*, int64>&
-                        memory_by_computation) {
+                         memory_by_computation,
+                     HloHash*) {
     std::unique_ptr<HloAliasAnalysis> alias_analysis =
         HloAliasAnalysis::NewEmptyAnalysis(computation->parent());
     return algorithm(computation, points_to_analysis, *alias_analysis,
@@ -95,7 +194,7 @@ MemorySchedulerAlgorithm IpuToMemorySchedulerAlgorithm(
                      const absl::flat_hash_map<const HloComputation*, int64>&
                      memory_by_computation, int64* peak_mem) {
     return algorithm(computation, points_to_analysis, size_function,
-                     memory_by_computation);
+                     memory_by_computation, nullptr);
   };
 }
 
@@ -121,17 +220,18 @@ StatusOr<IpuSchedulerAlgorithm> BestIpuSchedule(
           const TuplePointsToAnalysis& tuple_points_to_analysis,
           const LogicalBuffer::SizeFunction& size_function,
           const absl::flat_hash_map<const HloComputation*, int64>&
-              memory_by_computation) -> StatusOr<HloInstructionSequence> {
+              memory_by_computation,
+          HloHash* module_hash) -> StatusOr<HloInstructionSequence> {
         std::unique_ptr<HloAliasAnalysis> alias_analysis =
             HloAliasAnalysis::NewEmptyAnalysis(computation->parent());
 
         auto schedule_a_status =
             algorithm_a(computation, tuple_points_to_analysis, size_function,
-                        memory_by_computation);
+                        memory_by_computation, module_hash);
 
         auto schedule_b_status =
             algorithm_b(computation, tuple_points_to_analysis, size_function,
-                        memory_by_computation);
+                        memory_by_computation, module_hash);
 
         // If no valid schedule could be produced return the first failure
         if (!schedule_a_status.ok() && !schedule_b_status.ok()) {
@@ -204,6 +304,233 @@ StatusOr<IpuSchedulerAlgorithm> BestIpuSchedule(
   return result;
 }
 
+StatusOr<IpuSchedulerAlgorithm> ParallelBestIpuSchedule(
+    const std::vector<NamedIpuSchedulerAlgorithm>& algorithms,
+    int64 max_scheduler_time_ms,
+    std::map<std::string, std::string>* selected_schedulers) {
+  if (algorithms.empty()) {
+    return xla::FailedPrecondition(
+        "Cannot construct ParallelBestIpuSchedule when the input is empty");
+  }
+
+  for (auto& algo : algorithms) {
+    if (!algo.function) {
+      return xla::FailedPrecondition(
+          "Cannot construct ParallelBestIpuSchedule when one of the inputs is "
+          "invalid");
+    }
+  }
+
+  // State shared between the computations of a module.
+  struct RaceState {
+    explicit RaceState(int64 num_algorithms)
+        : pool(tensorflow::Env::Default(), "ipu_scheduler", num_algorithms),
+          exceeded_budget(num_algorithms, false) {}
+
+    tensorflow::thread::ThreadPool pool;
+    tensorflow::mutex mu;
+    std::vector<bool> exceeded_budget GUARDED_BY(mu);
+  };
+  auto state = std::make_shared<RaceState>(algorithms.size());
+
+  return IpuSchedulerAlgorithm{
+      [algorithms, max_scheduler_time_ms, selected_schedulers, state](
+          HloComputation* computation,
+          const TuplePointsToAnalysis& tuple_points_to_analysis,
+          const LogicalBuffer::SizeFunction& size_function,
+          const absl::flat_hash_map<const HloComputation*, int64>&
+              memory_by_computation,
+          HloHash*) -> StatusOr<HloInstructionSequence> {
+        const int64 num_algorithms = algorithms.size();
+        std::vector<int64> candidates;
+        {
+          tensorflow::mutex_lock l(state->mu);
+          for (int64 i = 0; i != num_algorithms; ++i) {
+            if (!state->exceeded_budget[i]) {
+              candidates.push_back(i);
+            }
+          }
+        }
+
+        // If every algorithm exceeded the budget, run them all again so that
+        // a schedule is still produced.
+        if (candidates.empty()) {
+          for (int64 i = 0; i != num_algorithms; ++i) {
+            candidates.push_back(i);
+          }
+        }
+
+        std::vector<StatusOr<HloInstructionSequence>> sequences(
+            num_algorithms);
+        std::vector<int64> memory(num_algorithms, 0);
+        std::vector<uint64> durations_us(num_algorithms, 0);
+
+        // The algorithms read the computation, so all of them need to finish
+        // before returning, even when they exceed the budget. They run on
+        // other threads, so they are not given the module hash.
+        tensorflow::BlockingCounter counter(candidates.size());
+        for (int64 i : candidates) {
+          state->pool.Schedule([&, i]() {
+            tensorflow::Env* env = tensorflow::Env::Default();
+            const uint64 start_us = env->NowMicros();
+            auto sequence_status = algorithms[i].function(
+                computation, tuple_points_to_analysis, size_function,
+                memory_by_computation, nullptr);
+            if (sequence_status.ok()) {
+              std::unique_ptr<HloAliasAnalysis> alias_analysis =
+                  HloAliasAnalysis::NewEmptyAnalysis(computation->parent());
+              auto memory_status = HeapSimulator::MinimumMemoryForComputation(
+                  *computation, sequence_status.ValueOrDie(), *alias_analysis,
+                  size_function, &memory_by_computation);
+              if (memory_status.ok()) {
+                memory[i] = memory_status.ValueOrDie();
+              } else {
+                sequence_status = memory_status.status();
+              }
+            }
+            sequences[i] = std::move(sequence_status);
+            durations_us[i] = env->NowMicros() - start_us;
+            counter.DecrementCount();
+          });
+        }
+        counter.Wait();
+
+        const uint64 budget_us = max_scheduler_time_ms * 1000;
+        auto within_budget = [&](int64 i) {
+          return budget_us == 0 || durations_us[i] <= budget_us;
+        };
+
+        // Prefer the schedules produced within the budget, and only fall back
+        // to the late ones when none are available.
+        int64 best = -1;
+        for (bool late : {false, true}) {
+          for (int64 i : candidates) {
+            if (!sequences[i].ok() || within_budget(i) == late) {
+              continue;
+            }
+            if (best < 0 || memory[i] < memory[best]) {
+              best = i;
+            }
+          }
+          if (best >= 0) {
+            break;
+          }
+        }
+
+        {
+          tensorflow::mutex_lock l(state->mu);
+          for (int64 i : candidates) {
+            if (!within_budget(i)) {
+              VLOG(1) << "Scheduler " << algorithms[i].name << " took "
+                      << durations_us[i] << "us on " << computation->name()
+                      << ", exceeding the budget of " << max_scheduler_time_ms
+                      << "ms.";
+              state->exceeded_budget[i] = true;
+            }
+          }
+        }
+
+        // If no valid schedule could be produced return the first failure
+        if (best < 0) {
+          return sequences[candidates[0]].status();
+        }
+
+        VLOG(1) << "Scheduler " << algorithms[best].name << " selected for "
+                << computation->name() << " with " << memory[best]
+                << " bytes predicted peak liveness.";
+        if (selected_schedulers) {
+          (*selected_schedulers)[computation->name()] = algorithms[best].name;
+        }
+
+        return std::move(sequences[best].ValueOrDie());
+      }};
+}
+
+StatusOr<IpuSchedulerAlgorithm> CachedIpuSchedule(
+    IpuSchedulerAlgorithm algorithm, const std::string& cache_path,
+    uint64 options_hash,
+    std::map<std::string, std::string>* selected_schedulers) {
+  if (!algorithm) {
+    return xla::FailedPrecondition(
+        "Cannot construct CachedIpuSchedule when the input is invalid");
+  }
+
+  if (cache_path.empty()) {
+    return xla::FailedPrecondition(
+        "Cannot construct CachedIpuSchedule without a cache path");
+  }
+
+  return IpuSchedulerAlgorithm{
+      [algorithm, cache_path, options_hash, selected_schedulers](
+          HloComputation* computation,
+          const TuplePointsToAnalysis& tuple_points_to_analysis,
+          const LogicalBuffer::SizeFunction& size_function,
+          const absl::flat_hash_map<const HloComputation*, int64>&
+              memory_by_computation,
+          HloHash* module_hash) -> StatusOr<HloInstructionSequence> {
+        // Without a hash shared by the module, only this computation and the
+        // computations it calls are hashed.
+        absl::optional<HloHash> computation_hash;
+        if (!module_hash) {
+          computation_hash.emplace(computation->parent());
+          module_hash = &*computation_hash;
+        }
+        tensorflow::Env* env = tensorflow::Env::Default();
+        const std::string filename =
+            ScheduleCacheFilename(computation, cache_path, options_hash,
+                                  memory_by_computation, module_hash);
+        const std::vector<HloInstruction*> post_order =
+            computation->MakeInstructionPostOrder();
+
+        if (env->FileExists(filename).ok()) {
+          std::string data;
+          TF_RETURN_IF_ERROR(
+              tensorflow::ReadFileToString(env, filename, &data));
+          std::string scheduler_name;
+          auto sequence_status =
+              DeserializeSequence(post_order, data, &scheduler_name);
+          if (sequence_status.ok()) {
+            VLOG(1) << "Loaded schedule for " << computation->name()
+                    << " from " << filename;
+            if (selected_schedulers && !scheduler_name.empty()) {
+              (*selected_schedulers)[computation->name()] = scheduler_name;
+            }
+            return sequence_status;
+          }
+          VLOG(1) << "Ignoring invalid cached schedule " << filename;
+        }
+
+        TF_ASSIGN_OR_RETURN(
+            HloInstructionSequence sequence,
+            algorithm(computation, tuple_points_to_analysis, size_function,
+                      memory_by_computation, module_hash));
+
+        // Only a race between schedulers records which one was selected.
+        std::string scheduler_name;
+        if (selected_schedulers) {
+          auto itr = selected_schedulers->find(computation->name());
+          if (itr != selected_schedulers->end()) {
+            scheduler_name = itr->second;
+          }
+        }
+
+        // Write to a temporary file first so that concurrent processes never
+        // observe a partially written schedule.
+        TF_RETURN_IF_ERROR(env->RecursivelyCreateDir(cache_path));
+        const std::string tmp_filename = absl::StrCat(
+            filename, ".", env->NowMicros(), ".", env->GetCurrentThreadId(),
+            ".tmp");
+        TF_RETURN_IF_ERROR(tensorflow::WriteStringToFile(
+            env, tmp_filename,
+            SerializeSequence(post_order, sequence, scheduler_name)));
+        TF_RETURN_IF_ERROR(env->RenameFile(tmp_filename, filename));
+        VLOG(1) << "Stored schedule for " << computation->name() << " in "
+                << filename;
+
+        return sequence;
+      }};
+}
+
 IpuScheduler::IpuScheduler(const LogicalBuffer::SizeFunction& size_function,
                            const IpuSchedulerAlgorithm& algorithm)
     : size_function_(size_function), algorithm_(algorithm) {}
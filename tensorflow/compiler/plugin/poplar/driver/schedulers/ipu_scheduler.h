@@ -15,6 +15,8 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_SCHEDULERS_IPU_SCHEDULER_H_
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_SCHEDULERS_IPU_SCHEDULER_H_
 
+#include <map>
+#include <string>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
@@ -32,10 +34,27 @@ limitations under the License.
 namespace xla {
 namespace poplarplugin {
 
+class HloHash;
+
+/**
+ * A scheduling algorithm for a single computation. The computations of a
+ * module are scheduled in post order, and the last argument is a hash of the
+ * module shared by all of them, so that the hashes of the called computations
+ * are only computed once. It is null when there is no such hash, and must only
+ * be used on the calling thread.
+ */
 using IpuSchedulerAlgorithm = std::function<StatusOr<HloInstructionSequence>(
     HloComputation*, const TuplePointsToAnalysis&,
     const LogicalBuffer::SizeFunction&,
-    const absl::flat_hash_map<const HloComputation*, int64>&)>;
+    const absl::flat_hash_map<const HloComputation*, int64>&, HloHash*)>;
+
+/**
+ * A scheduling algorithm together with a name used for reporting.
+ */
+struct NamedIpuSchedulerAlgorithm {
+  std::string name;
+  IpuSchedulerAlgorithm function;
+};
 
 /**
  * Convert a tensorflow MemorySchedulerAlgorithm to a IpuSchedulerAlgorithm
@@ -80,6 +99,48 @@ StatusOr<IpuSchedulerAlgorithm> BestIpuSchedule(
 StatusOr<IpuSchedulerAlgorithm> BestIpuSchedule(
     const std::vector<IpuSchedulerAlgorithm>& algorithms);
 
+/**
+ * Given a set of scheduling algorithms, create a new schedule algorithm which
+ * runs all of them in parallel for each computation and returns the schedule
+ * with the lowest predicted peak liveness.
+ *
+ * Algorithms which take longer than the time budget on a computation have
+ * their result discarded and are not run on the remaining computations.
+ *
+ * @param algorithms The set of named algorithms
+ * @param max_scheduler_time_ms The time budget in milliseconds, or zero for no
+ *                              limit
+ * @param selected_schedulers If not null, the name of the winning algorithm
+ *                            is recorded for each computation
+ *
+ * @returns a valid IpuSchedulerAlgorithm, or a failure status
+ */
+StatusOr<IpuSchedulerAlgorithm> ParallelBestIpuSchedule(
+    const std::vector<NamedIpuSchedulerAlgorithm>& algorithms,
+    int64 max_scheduler_time_ms,
+    std::map<std::string, std::string>* selected_schedulers);
+
+/**
+ * Given a scheduling algorithm, create a new schedule algorithm which stores
+ * the schedule of each computation on disk and reuses it whenever a
+ * computation with the same canonical hash is scheduled again, including by
+ * other processes.
+ *
+ * @param algorithm The algorithm used when the schedule is not in the cache
+ * @param cache_path The directory where the schedules are stored
+ * @param options_hash A hash of all the options which affect the schedule
+ * @param selected_schedulers If not null, the map `algorithm` records the
+ *                            winning scheduler of each computation in. The
+ *                            name is stored with the schedule, and recorded
+ *                            again when the schedule is loaded
+ *
+ * @returns a valid IpuSchedulerAlgorithm, or a failure status
+ */
+StatusOr<IpuSchedulerAlgorithm> CachedIpuSchedule(
+    IpuSchedulerAlgorithm algorithm, const std::string& cache_path,
+    uint64 options_hash,
+    std::map<std::string, std::string>* selected_schedulers = nullptr);
+
 /**
  * An HLO module pass which applies the given scheduling algorithm to each
  * computation in the module.
@@ -184,7 +184,8 @@ IpuSchedulerAlgorithm CreateLivenessLookAheadMemoryScheduler(
              const TuplePointsToAnalysis& points_to_analysis,
              const LogicalBuffer::SizeFunction& size_function,
              const absl::flat_hash_map<const HloComputation*, int64>&
-                 memory_by_computation) {
+                 memory_by_computation,
+             HloHash*) {
     return LivenessLookAheadMemoryScheduler(
         computation, points_to_analysis, size_function, memory_by_computation,
         information.max_scheduler_lookahead_depth,
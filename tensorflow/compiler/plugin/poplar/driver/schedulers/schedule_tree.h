@@ -15,7 +15,9 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_SCHEDULERS_SCHEDULE_TREE_H_
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_SCHEDULERS_SCHEDULE_TREE_H_
 
+#include <algorithm>
 #include <limits>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -30,6 +32,15 @@ namespace poplarplugin {
  *
  * This class helps to find the minimum max-liveness schudule.
  *
+ * The nodes of a tree only store the element they schedule, as a persistent
+ * list shared with their ancestors. The wait and live counts are kept in a
+ * single state shared by all the nodes of the tree, which is moved between
+ * nodes by undoing and redoing the scheduling steps. Creating a child is
+ * therefore O(1), and visiting a neighbouring node is proportional to the
+ * number of counts changed by the steps between them, rather than to the size
+ * of the live set. As the state is shared, a tree must not be used from more
+ * than one thread at a time.
+ *
  * @tparam ElemType The schedule element type.
  * @tparam ElemPreVisitor The schedule element predecessor visitor wrapper type.
  *                        This must be a callable type with signature
@@ -57,22 +68,15 @@ class ScheduleTree
   using ThisType = ScheduleTree<ElemType, ElemPreVisitor, ElemPostVisitor,
                                 GrossCostFunc, TempCostFunc, ElemCompFunc>;
   using ThisTypePtr = std::shared_ptr<ThisType const>;
-  using InstructionCostMap = absl::flat_hash_map<ElemType, int64>;
-  using InstructionWaitList =
-      absl::flat_hash_map<int64, std::set<ElemType, ElemCompFunc>>;
-  using InverseInstructionWaitList = absl::flat_hash_map<ElemType, int64>;
+  using ElemSet = std::set<ElemType, ElemCompFunc>;
+  using InstructionCountMap = absl::flat_hash_map<ElemType, int64>;
 
   ScheduleTree(const std::vector<ElemType>& elems,
                ElemPreVisitor elem_pre_visit = {},
                ElemPostVisitor elem_post_visit = {}, GrossCostFunc cost_f = {},
                TempCostFunc temp_cost_f = {})
-      : ScheduleTree(cost_f, temp_cost_f, elem_pre_visit, elem_post_visit) {
-    for (auto& elem : elems) {
-      auto count = GetOperandCount(elem);
-      wait_list_[count].insert(elem);
-      inv_wait_list_[elem] = count;
-    }
-  }
+      : state_(std::make_shared<State>(elems, elem_pre_visit, elem_post_visit,
+                                       cost_f, temp_cost_f)) {}
 
   /**
    * Return the child node with the lowest max liveness.
@@ -111,10 +115,10 @@ class ScheduleTree
    */
   int64 CurrentLiveness() const {
     if (current_liveness_ == std::numeric_limits<int64>::max()) {
-      current_liveness_ =
-          temp_cost_f_(GetCurrentlyLive(), schedule_prefix_.back());
-      for (auto pair : inv_live_list_) {
-        current_liveness_ += cost_f_(pair.first);
+      state_->MoveTo(history_);
+      current_liveness_ = state_->LiveCost();
+      if (history_) {
+        current_liveness_ += state_->TempCost(history_->elem);
       }
     }
 
@@ -159,76 +163,36 @@ class ScheduleTree
    *
    * @returns The schedule that ends at this node.
    */
-  const std::vector<ElemType>& GetSchedule() const { return schedule_prefix_; }
-
-  /**
-   * Get the set of currently live elements.
-   *   *
-   * @returns The set of live elements.
-   */
-  std::set<ElemType, ElemCompFunc> GetCurrentlyLive() const {
-    std::set<ElemType, ElemCompFunc> result;
-
-    for (auto pair : live_list_) {
-      if (pair.first > 0) {
-        result.insert(pair.second.begin(), pair.second.end());
-      }
+  std::vector<ElemType> GetSchedule() const {
+    std::vector<ElemType> result(history_ ? history_->length : 0);
+    for (auto* step = history_.get(); step; step = step->parent.get()) {
+      result[step->length - 1] = step->elem;
     }
 
     return result;
   }
 
   /**
-   * Get the set of elements that are ready to be scheduled.
+   * Get the set of currently live elements.
    *
-   * @returns The set of ready elements
+   * @returns The set of live elements.
    */
-  const std::set<ElemType, ElemCompFunc>& GetReady() const {
-    return wait_list_.at(0);
+  ElemSet GetCurrentlyLive() const {
+    state_->MoveTo(history_);
+    return state_->GetCurrentlyLive();
   }
 
   /**
-   * Reduce the waiting count of a given element.
+   * Get the set of elements that are ready to be scheduled.
    *
-   * @param elem The element to reduce the waiting count for.
-   */
-  void ReduceWaiting(ElemType elem) {
-    auto& count = inv_wait_list_.at(elem);
-    wait_list_[count].erase(elem);
-    count--;
-    wait_list_[count].insert(elem);
-    inv_wait_list_[elem] = count;
-  }
-
-  /**
-   * Reduce the live count of a given element.
+   * The returned reference is only valid until another node of the tree is
+   * queried.
    *
-   * @param elem The element to reduce the live count for.
-   */
-  void ReduceLive(ElemType elem) {
-    auto& count = inv_live_list_.at(elem);
-    live_list_[count].erase(elem);
-    count--;
-    if (count > 0) {
-      live_list_[count].insert(elem);
-    } else {
-      inv_live_list_.erase(elem);
-    }
-  }
-
-  /**
-   * Schedule the given element.
-   *
-   * @param elem The elements to be scheduled.
+   * @returns The set of ready elements
    */
-  void Schedule(ElemType elem) {
-    auto use_count = GetUserCount(elem);
-
-    live_list_[use_count].insert(elem);
-    inv_live_list_[elem] = use_count;
-
-    schedule_prefix_.push_back(elem);
-    wait_list_.at(0).erase(elem);
+  const ElemSet& GetReady() const {
+    state_->MoveTo(history_);
+    return state_->GetReady();
   }
 
   /**
@@ -245,7 +209,7 @@ class ScheduleTree
       return this->shared_from_this();
     }
 
-    if (!IsLeaf() && (wait_list_.at(0).size() == children_.size())) {
+    if (!IsLeaf() && (GetReady().size() == children_.size())) {
       auto result = std::make_shared<ThisType>(*this);
 
       for (auto& child : result->children_) {
@@ -258,18 +222,10 @@ class ScheduleTree
     if (!IsLeaf() && children_.empty()) {
       auto result = std::make_shared<ThisType>(*this);
 
-      for (auto elem : result->GetReady()) {
+      for (auto elem : GetReady()) {
         auto child = std::make_shared<ThisType>(*this);
         child->current_liveness_ = std::numeric_limits<int64>::max();
-
-        child->Schedule(elem);
-
-        elem_post_visit_(
-            elem, [&](ElemType successor) { child->ReduceWaiting(successor); });
-
-        elem_pre_visit_(elem, [&](ElemType predecessor) mutable {
-          child->ReduceLive(predecessor);
-        });
+        child->history_ = std::make_shared<const History>(history_, elem);
 
         result->children_.emplace_back(std::move(child));
       }
@@ -292,19 +248,12 @@ class ScheduleTree
   ThisTypePtr TakeAllReady(UnaryPredicateType predicate) const {
     auto result = std::make_shared<ThisType>(*this);
     result->current_liveness_ = std::numeric_limits<int64>::max();
+    result->children_.clear();
 
-    auto ready = GetReady();
-    for (auto elem : ready) {
+    for (auto elem : GetReady()) {
       if (predicate(elem)) {
-        result->Schedule(elem);
-
-        elem_post_visit_(elem, [&](ElemType successor) {
-          result->ReduceWaiting(successor);
-        });
-
-        elem_pre_visit_(elem, [&](ElemType predecessor) mutable {
-          result->ReduceLive(predecessor);
-        });
+        result->history_ =
+            std::make_shared<const History>(result->history_, elem);
       }
     }
 
@@ -326,42 +275,223 @@ class ScheduleTree
    *
    * @returns Whether the current node is a leaf node.
    */
-  bool IsLeaf() const { return wait_list_.at(0).empty(); }
+  bool IsLeaf() const { return GetReady().empty(); }
 
  private:
-  ScheduleTree(GrossCostFunc cost_f, TempCostFunc temp_cost_f,
-               ElemPreVisitor elem_pre_visit, ElemPostVisitor elem_post_visit)
-      : cost_f_(cost_f),
-        temp_cost_f_(temp_cost_f),
-        elem_pre_visit_(elem_pre_visit),
-        elem_post_visit_(elem_post_visit) {}
+  // A persistent list of the scheduled elements, from the last to the first.
+  struct History {
+    History(std::shared_ptr<const History> parent, ElemType elem)
+        : parent(std::move(parent)),
+          elem(elem),
+          length(this->parent ? this->parent->length + 1 : 1) {}
+
+    const std::shared_ptr<const History> parent;
+    const ElemType elem;
+    const int64 length;
+  };
+  using HistoryPtr = std::shared_ptr<const History>;
+
+  // View of the live elements passed to the temporary cost function.
+  struct LiveSet {
+    const InstructionCountMap& live_counts;
+
+    int64 count(ElemType elem) const {
+      auto itr = live_counts.find(elem);
+      return (itr != live_counts.end() && itr->second > 0) ? 1 : 0;
+    }
+  };
+
+  // The wait and live counts of the elements at one position in the history,
+  // with an undo log back to the initial position.
+  class State {
+   public:
+    State(const std::vector<ElemType>& elems, ElemPreVisitor elem_pre_visit,
+          ElemPostVisitor elem_post_visit, GrossCostFunc cost_f,
+          TempCostFunc temp_cost_f)
+        : cost_f_(cost_f),
+          temp_cost_f_(temp_cost_f),
+          elem_pre_visit_(elem_pre_visit),
+          elem_post_visit_(elem_post_visit) {
+      for (auto& elem : elems) {
+        SetWaitCount(elem, GetOperandCount(elem));
+      }
+    }
 
-  int64 GetOperandCount(ElemType elem) const {
-    int64 result = 0;
+    /**
+     * Move the state to the given position in the history, undoing the steps
+     * back to the common ancestor and redoing the steps from it.
+     */
+    void MoveTo(const HistoryPtr& target) {
+      if (position_ == target) {
+        return;
+      }
 
-    elem_pre_visit_(elem, [&](ElemType) mutable { result++; });
+      std::vector<ElemType> redo;
+      const History* target_step = target.get();
+      while (Length(position_.get()) > Length(target_step)) {
+        Undo();
+      }
+      while (Length(target_step) > Length(position_.get())) {
+        redo.push_back(target_step->elem);
+        target_step = target_step->parent.get();
+      }
+      while (position_.get() != target_step) {
+        Undo();
+        redo.push_back(target_step->elem);
+        target_step = target_step->parent.get();
+      }
 
-    return result;
-  }
+      for (auto itr = redo.rbegin(); itr != redo.rend(); ++itr) {
+        Apply(*itr);
+      }
+      position_ = target;
+    }
 
-  int64 GetUserCount(ElemType elem) const {
-    int64 result = 0;
+    const ElemSet& GetReady() const { return ready_; }
 
-    elem_post_visit_(elem, [&](ElemType) mutable { result++; });
+    ElemSet GetCurrentlyLive() const {
+      ElemSet result;
+      for (auto& pair : live_counts_) {
+        if (pair.second > 0) {
+          result.insert(pair.first);
+        }
+      }
 
-    return result;
-  }
+      return result;
+    }
+
+    int64 LiveCost() const { return live_cost_; }
+
+    int64 TempCost(ElemType elem) const {
+      return temp_cost_f_(LiveSet{live_counts_}, elem);
+    }
+
+   private:
+    enum class UndoKind { kReady, kWait, kLive };
+
+    struct UndoEntry {
+      UndoKind kind;
+      ElemType elem;
+      int64 count;
+    };
+
+    // Elements which are not live have no live count.
+    static constexpr int64 kNotLive = -1;
+
+    static int64 Length(const History* step) {
+      return step ? step->length : 0;
+    }
+
+    // Schedule the element, and reduce the waiting count of its successors
+    // and the live count of its predecessors.
+    void Apply(ElemType elem) {
+      step_begin_.push_back(undo_log_.size());
+
+      ready_.erase(elem);
+      undo_log_.push_back({UndoKind::kReady, elem, 0});
+
+      undo_log_.push_back({UndoKind::kLive, elem, GetLiveCount(elem)});
+      SetLiveCount(elem, GetUserCount(elem));
+
+      elem_post_visit_(elem, [&](ElemType successor) {
+        const int64 count = wait_counts_.at(successor);
+        undo_log_.push_back({UndoKind::kWait, successor, count});
+        SetWaitCount(successor, count - 1);
+      });
+
+      elem_pre_visit_(elem, [&](ElemType predecessor) mutable {
+        const int64 count = live_counts_.at(predecessor);
+        undo_log_.push_back({UndoKind::kLive, predecessor, count});
+        SetLiveCount(predecessor, count > 1 ? count - 1 : kNotLive);
+      });
+    }
+
+    // Revert the last step applied.
+    void Undo() {
+      const size_t begin = step_begin_.back();
+      step_begin_.pop_back();
+
+      while (undo_log_.size() > begin) {
+        const UndoEntry& entry = undo_log_.back();
+        switch (entry.kind) {
+          case UndoKind::kReady:
+            ready_.insert(entry.elem);
+            break;
+          case UndoKind::kWait:
+            SetWaitCount(entry.elem, entry.count);
+            break;
+          case UndoKind::kLive:
+            SetLiveCount(entry.elem, entry.count);
+            break;
+        }
+        undo_log_.pop_back();
+      }
+
+      position_ = position_->parent;
+    }
+
+    void SetWaitCount(ElemType elem, int64 count) {
+      auto& current = wait_counts_[elem];
+      if (count == 0) {
+        ready_.insert(elem);
+      } else if (current == 0) {
+        ready_.erase(elem);
+      }
+      current = count;
+    }
+
+    int64 GetLiveCount(ElemType elem) const {
+      auto itr = live_counts_.find(elem);
+      return itr == live_counts_.end() ? kNotLive : itr->second;
+    }
+
+    void SetLiveCount(ElemType elem, int64 count) {
+      auto itr = live_counts_.find(elem);
+      if (count == kNotLive) {
+        if (itr != live_counts_.end()) {
+          live_cost_ -= cost_f_(elem);
+          live_counts_.erase(itr);
+        }
+      } else if (itr == live_counts_.end()) {
+        live_cost_ += cost_f_(elem);
+        live_counts_[elem] = count;
+      } else {
+        itr->second = count;
+      }
+    }
+
+    int64 GetOperandCount(ElemType elem) const {
+      int64 result = 0;
+
+      elem_pre_visit_(elem, [&](ElemType) mutable { result++; });
+
+      return result;
+    }
+
+    int64 GetUserCount(ElemType elem) const {
+      int64 result = 0;
+
+      elem_post_visit_(elem, [&](ElemType) mutable { result++; });
+
+      return result;
+    }
 
-  GrossCostFunc cost_f_;
-  TempCostFunc temp_cost_f_;
-  ElemPreVisitor elem_pre_visit_;
-  ElemPostVisitor elem_post_visit_;
+    GrossCostFunc cost_f_;
+    TempCostFunc temp_cost_f_;
+    ElemPreVisitor elem_pre_visit_;
+    ElemPostVisitor elem_post_visit_;
+    HistoryPtr position_;
+    ElemSet ready_;
+    InstructionCountMap wait_counts_;
+    InstructionCountMap live_counts_;
+    int64 live_cost_ = 0;
+    std::vector<UndoEntry> undo_log_;
+    std::vector<size_t> step_begin_;
+  };
+
+  std::shared_ptr<State> state_;
+  HistoryPtr history_;
   std::vector<ThisTypePtr> children_;
-  std::vector<ElemType> schedule_prefix_;
-  InstructionWaitList wait_list_;
-  InverseInstructionWaitList inv_wait_list_;
-  InstructionWaitList live_list_;
-  InverseInstructionWaitList inv_live_list_;
   mutable int64 current_liveness_ = std::numeric_limits<int64>::max();
 };
 
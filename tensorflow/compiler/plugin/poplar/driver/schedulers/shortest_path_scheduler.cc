@@ -347,7 +347,8 @@ IpuSchedulerAlgorithm CreateShortestPathScheduler(
              const TuplePointsToAnalysis& points_to_analysis,
              const LogicalBuffer::SizeFunction& size_function,
              const absl::flat_hash_map<const HloComputation*, int64>&
-                 memory_by_computation) {
+                 memory_by_computation,
+             HloHash*) {
     return ShortestPathScheduler(computation, points_to_analysis, size_function,
                                  memory_by_computation);
   };
@@ -429,7 +429,8 @@ IpuSchedulerAlgorithm CreateSyncListMemoryScheduler(int64 max_syncs) {
              const TuplePointsToAnalysis& points_to_analysis,
              const LogicalBuffer::SizeFunction& size_function,
              const absl::flat_hash_map<const HloComputation*, int64>&
-                 memory_by_computation) {
+                 memory_by_computation,
+             HloHash*) {
     return SyncListMemoryScheduler(computation, points_to_analysis,
                                    size_function, memory_by_computation,
                                    max_syncs);
@@ -0,0 +1,161 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/compilation_stats.h"
+
+#include <algorithm>
+#include <map>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "include/json/json.h"
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
+#include "tensorflow/compiler/xla/service/hlo_module.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+int64 CountInstructions(const HloModule* module) {
+  int64 count = 0;
+  for (const HloComputation* comp : module->computations()) {
+    count += comp->instruction_count();
+  }
+  return count;
+}
+
+// Read the current and the peak resident set size of this process. Both are
+// left as zero on platforms without /proc.
+void GetProcessMemory(int64* rss_bytes, int64* peak_rss_bytes) {
+  *rss_bytes = 0;
+  *peak_rss_bytes = 0;
+
+  std::string status;
+  if (!tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                    "/proc/self/status", &status)
+           .ok()) {
+    return;
+  }
+
+  // The lines look like "VmRSS:     1234 kB".
+  for (absl::string_view line : absl::StrSplit(status, '\n')) {
+    int64* value = nullptr;
+    if (absl::ConsumePrefix(&line, "VmRSS:")) {
+      value = rss_bytes;
+    } else if (absl::ConsumePrefix(&line, "VmHWM:")) {
+      value = peak_rss_bytes;
+    } else {
+      continue;
+    }
+    absl::ConsumeSuffix(&line, "kB");
+    int64 kilobytes;
+    if (absl::SimpleAtoi(line, &kilobytes)) {
+      *value = kilobytes * 1024;
+    }
+  }
+}
+}  // namespace
+
+PoplarCompilationStats::PoplarCompilationStats(const HloModule* module)
+    : module_(module) {}
+
+void PoplarCompilationStats::StartPass(absl::string_view pass_name) {
+  current_ = PassProfile();
+  current_.name = std::string(pass_name);
+  current_.instructions_before = CountInstructions(module_);
+  current_.wall_time_us = tensorflow::Env::Default()->NowMicros();
+}
+
+void PoplarCompilationStats::EndPass(absl::string_view pass_name) {
+  CHECK_EQ(current_.name, pass_name);
+  current_.wall_time_us =
+      tensorflow::Env::Default()->NowMicros() - current_.wall_time_us;
+  current_.instructions_after = CountInstructions(module_);
+  GetProcessMemory(&current_.rss_bytes, &current_.peak_rss_bytes);
+  profiles_.push_back(current_);
+}
+
+void PoplarCompilationStats::CompilationReport() {
+  struct Summary {
+    uint64 wall_time_us = 0;
+    int64 runs = 0;
+    int64 instruction_delta = 0;
+  };
+  std::map<std::string, Summary> summaries;
+  uint64 total_wall_time_us = 0;
+  for (const PassProfile& profile : profiles_) {
+    Summary& summary = summaries[profile.name];
+    summary.wall_time_us += profile.wall_time_us;
+    summary.runs++;
+    summary.instruction_delta +=
+        profile.instructions_after - profile.instructions_before;
+    total_wall_time_us += profile.wall_time_us;
+  }
+
+  std::vector<std::pair<std::string, Summary>> sorted(summaries.begin(),
+                                                      summaries.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<std::string, Summary>& a,
+                      const std::pair<std::string, Summary>& b) {
+                     return a.second.wall_time_us > b.second.wall_time_us;
+                   });
+
+  VLOG(1) << "Compilation passes of " << module_->name() << ", "
+          << total_wall_time_us / 1000 << " ms in total:";
+  for (const auto& pair : sorted) {
+    const Summary& summary = pair.second;
+    VLOG(1) << "  " << pair.first << ": " << summary.wall_time_us / 1000
+            << " ms, " << summary.runs << " runs, "
+            << (summary.instruction_delta > 0 ? "+" : "")
+            << summary.instruction_delta << " instructions";
+  }
+}
+
+const std::vector<PassProfile>& PoplarCompilationStats::GetPassProfiles()
+    const {
+  return profiles_;
+}
+
+std::string PoplarCompilationStats::ToJson() const {
+  Json::Value passes(Json::arrayValue);
+  uint64 total_wall_time_us = 0;
+  for (const PassProfile& profile : profiles_) {
+    Json::Value pass;
+    pass["name"] = profile.name;
+    pass["wall_time_us"] = Json::Value::UInt64(profile.wall_time_us);
+    pass["instructions_before"] =
+        Json::Value::Int64(profile.instructions_before);
+    pass["instructions_after"] = Json::Value::Int64(profile.instructions_after);
+    pass["rss_bytes"] = Json::Value::Int64(profile.rss_bytes);
+    pass["peak_rss_bytes"] = Json::Value::Int64(profile.peak_rss_bytes);
+    passes.append(pass);
+    total_wall_time_us += profile.wall_time_us;
+  }
+
+  Json::Value root;
+  root["module"] = module_->name();
+  root["total_wall_time_us"] = Json::Value::UInt64(total_wall_time_us);
+  root["passes"] = passes;
+
+  Json::StreamWriterBuilder json_builder;
+  json_builder["indentation"] = "";
+  json_builder["commentStyle"] = "None";
+  return Json::writeString(json_builder, root);
+}
+
+}  // namespace poplarplugin
+}  // namespace xla
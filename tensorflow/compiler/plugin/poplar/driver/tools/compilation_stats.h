@@ -0,0 +1,74 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_COMPILATION_STATS_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_COMPILATION_STATS_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "tensorflow/compiler/xla/service/compilation_stats.h"
+#include "tensorflow/compiler/xla/types.h"
+
+namespace xla {
+
+class HloModule;
+
+namespace poplarplugin {
+
+// The profile of a single run of an HLO pass.
+struct PassProfile {
+  std::string name;
+  uint64 wall_time_us = 0;
+  int64 instructions_before = 0;
+  int64 instructions_after = 0;
+  // The resident set size of the process after the pass, and the highest
+  // resident set size the process has reached so far, in bytes. These are zero
+  // if the memory usage of the process cannot be read.
+  int64 rss_bytes = 0;
+  int64 peak_rss_bytes = 0;
+};
+
+// Profiles each pass of an HloPassPipeline which is given this object as its
+// CompilationStats. Nested pipelines are not profiled themselves, but the
+// passes inside them are.
+class PoplarCompilationStats : public CompilationStats {
+ public:
+  explicit PoplarCompilationStats(const HloModule* module);
+
+  void StartPass(absl::string_view pass_name) override;
+  void EndPass(absl::string_view pass_name) override;
+
+  // Log the total time, the number of runs and the change in the number of
+  // instructions of each pass, the slowest first.
+  void CompilationReport() override;
+
+  // Every run of every pass, in the order in which they ran.
+  const std::vector<PassProfile>& GetPassProfiles() const;
+
+  // The pass profiles as a JSON document.
+  std::string ToJson() const;
+
+ private:
+  const HloModule* module_;
+  std::vector<PassProfile> profiles_;
+  PassProfile current_;
+};
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_COMPILATION_STATS_H_
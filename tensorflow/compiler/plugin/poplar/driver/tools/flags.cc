@@ -64,6 +64,26 @@ absl::flat_hash_map<std::string, std::string> GetFlagUsage() {
        "The maximum number of threads which each infeed queue is allowed to "
        "use when accessing data from datasets. Negative value allows the "
        "infeed to automatically pick the number of threads. (int=-1)"},
+      {"infeed_numa_node",
+       "The NUMA node which the infeed buffers and the threads accessing the "
+       "datasets should be bound to. Negative value means no binding. "
+       "(int=-1)"},
+      {"max_io_threads",
+       "The maximum number of threads which are used to move data between "
+       "the infeed/outfeed queues and the host. Negative value uses one "
+       "thread per feed. (int=-1)"},
+      {"max_host_embedding_threads",
+       "The maximum number of threads which are used to look up and update "
+       "the rows of host embeddings. Negative value uses one thread per core. "
+       "(int=-1)"},
+      {"host_embedding_cache_rows",
+       "The number of the most frequently looked up rows of each host "
+       "embedding which are kept in a compact cache backed by huge pages. "
+       "Zero disables the cache. (int=0)"},
+      {"host_embedding_numa_shards",
+       "The number of NUMA nodes the rows of each host embedding are sharded "
+       "across. Each node looks up and updates its own rows. Negative value "
+       "uses every NUMA node. (int=-1)"},
       {"save_vertex_graph",
        "Path to a directory where the Poplar vertex graphs should be saved to. "
        "(path)"},
@@ -71,6 +91,10 @@ absl::flat_hash_map<std::string, std::string> GetFlagUsage() {
        "Path to a directory where the Poplar interval reports should be saved "
        "to. (path)"},
       {"executable_cache_path", "Path to the executable cache. (path)"},
+      {"in_memory_executable_cache_size",
+       "The number of the most recently used executables which are kept in "
+       "memory, so that compiling the same graph again reuses their engines. "
+       "Zero disables the cache. (int=0)"},
       {"dump_schedule_as_dot", "Dumps the scheduler graph as a dot file."},
       {"tensor_map_file_path", "Directory for tensor map dump files."},
       {"null_data_feed",
@@ -80,7 +104,23 @@ absl::flat_hash_map<std::string, std::string> GetFlagUsage() {
        "standard output stream."},
       {"fallback_scheduler",
        "Use the sync list scheduler rather than the default one."},
-      {"allow_nans", "will allow NaNs."}};
+      {"allow_nans", "will allow NaNs."},
+      {"balance_pipeline_stages",
+       "Move instructions between adjacent pipeline stages to balance the "
+       "estimated compute time of each IPU. (bool)"},
+      {"recomputation_memory_budget",
+       "When recomputation is enabled, only recompute the activations needed "
+       "for the estimated memory of each IPU to fit in this number of bytes. "
+       "Zero recomputes everything which can be recomputed. (int=0)"},
+      {"offload_prefetch_depth",
+       "The number of variables offloaded to remote memory whose loads are "
+       "issued ahead of the weight update being computed, so that they are "
+       "not on its critical path. Zero loads each variable after the previous "
+       "one has been updated. (int=0)"},
+      {"min_outlined_subgraph_size",
+       "Outline structurally identical subgraphs with at least this many "
+       "operations into shared functions, so that their code is only "
+       "generated once. Zero disables the outlining. (int=0)"}};
   return flag_usage;
 }
 }  // namespace
@@ -110,13 +150,23 @@ PoplarXlaFlags::PoplarXlaFlags() {
     ADD_FLAG(while_loop_brute_force_max_trip_count)
     ADD_FLAG(max_compilation_threads)
     ADD_FLAG(max_infeed_threads)
+    ADD_FLAG(infeed_numa_node)
+    ADD_FLAG(max_io_threads)
+    ADD_FLAG(max_host_embedding_threads)
+    ADD_FLAG(host_embedding_cache_rows)
+    ADD_FLAG(host_embedding_numa_shards)
     ADD_FLAG(save_vertex_graph)
     ADD_FLAG(save_interval_report)
     ADD_FLAG(executable_cache_path)
+    ADD_FLAG(in_memory_executable_cache_size)
     ADD_FLAG(dump_schedule_as_dot)
     ADD_FLAG(tensor_map_file_path)
     ADD_FLAG(fallback_scheduler)
     ADD_FLAG(allow_nans)
+    ADD_FLAG(balance_pipeline_stages)
+    ADD_FLAG(recomputation_memory_budget)
+    ADD_FLAG(offload_prefetch_depth)
+    ADD_FLAG(min_outlined_subgraph_size)
     ADD_FLAG(null_data_feed)
     ADD_FLAG(dump_text_reports_to_stdio)
 
@@ -166,7 +216,9 @@ PoplarXlaFlags::PoplarXlaFlags() {
   hlo_hash =
       hash_util::hash(use_synthetic_data, synthetic_data_initializer,
                       use_ipu_model, while_loop_brute_force_max_trip_count,
-                      fallback_scheduler, allow_nans, log_cycle_count);
+                      fallback_scheduler, allow_nans, log_cycle_count,
+                      balance_pipeline_stages, recomputation_memory_budget,
+                      offload_prefetch_depth, min_outlined_subgraph_size);
 }
 
 const PoplarXlaFlags& PoplarXlaFlags::Get() {
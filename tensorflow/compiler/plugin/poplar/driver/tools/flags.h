@@ -65,6 +65,26 @@ class PoplarXlaFlags {
   // when accessing data from datasets.
   int64 max_infeed_threads = -1;
 
+  // The NUMA node which the infeed buffers and the threads accessing the
+  // datasets should be bound to.
+  int64 infeed_numa_node = -1;
+
+  // The maximum number of threads which are used to move data between the
+  // infeed/outfeed queues and the host.
+  int64 max_io_threads = -1;
+
+  // The maximum number of threads which are used to look up and update the
+  // rows of host embeddings.
+  int64 max_host_embedding_threads = -1;
+
+  // The number of the most frequently looked up rows of each host embedding
+  // which are kept in a compact cache.
+  int64 host_embedding_cache_rows = 0;
+
+  // The number of NUMA nodes the rows of each host embedding are sharded
+  // across.
+  int64 host_embedding_numa_shards = -1;
+
   // Path to a directory where the Poplar vertex graph should be saved to.
   std::string save_vertex_graph = "";
 
@@ -74,6 +94,10 @@ class PoplarXlaFlags {
   // Path to the executable cache.
   std::string executable_cache_path = "";
 
+  // The number of executables which are kept in memory so that compiling the
+  // same module again reuses their engines.
+  int64 in_memory_executable_cache_size = 0;
+
   // Path for the tensormap files
   std::string tensor_map_file_path = "";
 
@@ -86,6 +110,22 @@ class PoplarXlaFlags {
   // Allow/disallow nans during graph construction.
   bool allow_nans = false;
 
+  // Move instructions between pipeline stages to balance the estimated time of
+  // each IPU.
+  bool balance_pipeline_stages = false;
+
+  // The number of bytes each IPU is allowed to use for activations. When
+  // positive, recomputation is planned to fit in this budget.
+  int64 recomputation_memory_budget = 0;
+
+  // The number of offloaded variables, in the order they are updated, whose
+  // loads from remote memory are issued ahead of the current update.
+  int64 offload_prefetch_depth = 0;
+
+  // The minimum number of operations in a repeated subgraph for it to be
+  // outlined into a shared function. Zero disables the outlining.
+  int64 min_outlined_subgraph_size = 0;
+
   // When true, the infeed callback will return immediately without providing
   // any real data
   bool null_data_feed = false;
@@ -26,6 +26,7 @@ limitations under the License.
 
 #include "tensorflow/compiler/xla/service/hlo_computation.h"
 #include "tensorflow/compiler/xla/service/hlo_instruction.h"
+#include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/platform/human_readable_json.h"
 #include "tensorflow/core/platform/protobuf.h"
 
@@ -39,7 +40,17 @@ namespace generic_graph_caching {
 
 size_t GenericGraphCache::HloInstructionHash::operator()(
     const HloInstruction* inst) const {
-  return inst->Hash();
+  return cache->GetStructuralKey(inst);
+}
+
+GenericGraphCache::GenericGraphCache()
+    : table_(/*bucket_count=*/0, HloInstructionHash{this}) {}
+
+uint64 GenericGraphCache::GetStructuralKey(const HloInstruction* inst) {
+  // Include the sharding as instructions on different shards cannot share a
+  // function.
+  return tensorflow::Hash64Combine(structural_hash_.GetInstructionHash(inst),
+                                   GetSingleShardingDeviceId(inst));
 }
 
 // The instruction will produce the same graph if it is identical apart from:
@@ -92,8 +103,10 @@ Status GenericGraphCache::ExecuteCached(
   auto itr = table_.find(inst);
   if ((itr != table_.end()) && !resources.disable_graph_outlining) {
     // We have a cached graph for this dot operation.
+    hit_count_++;
     itr->second(args, seq);
   } else {
+    miss_count_++;
     // Get the allocation order.
     std::list<int64> alloc_order;
     for (size_t sig_idx = 0; sig_idx != signature.size(); ++sig_idx) {
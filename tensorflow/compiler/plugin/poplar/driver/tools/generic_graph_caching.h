@@ -17,6 +17,7 @@ limitations under the License.
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_GENERIC_GRAPH_CACHING_H_
 
 #include "tensorflow/compiler/plugin/poplar/driver/ops/ops.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_hash.h"
 #include "tensorflow/compiler/xla/status.h"
 
 #include "absl/container/flat_hash_map.h"
@@ -36,6 +37,8 @@ namespace generic_graph_caching {
 
 class GenericGraphCache {
  public:
+  GenericGraphCache();
+
   // Execute the func and cache it for the given instruction if it has not been
   // executed before.
   // `allocating_indices` indicates which of the args for inst have an
@@ -51,17 +54,35 @@ class GenericGraphCache {
       const absl::flat_hash_set<int64>& allocating_indices = {},
       const absl::flat_hash_map<int64, int64>& layout_dependencies = {});
 
+  // The number of times a cached function was reused, and the number of
+  // functions which had to be created.
+  int64 HitCount() const { return hit_count_; }
+  int64 MissCount() const { return miss_count_; }
+
+  // A key for the instruction which only depends on its structure, including
+  // the structure of any computations it calls. It is stable between
+  // compilations, but it is a hash so equal keys do not guarantee that the
+  // instructions are equal.
+  uint64 GetStructuralKey(const HloInstruction* inst);
+
  private:
   // Helper structs for the unordered map.
   struct HloInstructionHash {
     size_t operator()(const HloInstruction* inst) const;
+    GenericGraphCache* cache;
   };
   struct HloInstructionEquals {
     bool operator()(const HloInstruction* a, const HloInstruction* b) const;
   };
+
+  // Must be declared before the table as its hash function uses it.
+  HloStructuralHash structural_hash_;
   std::unordered_map<const HloInstruction*, poputil::graphfn::VoidFunction,
                      HloInstructionHash, HloInstructionEquals>
       table_;
+  int64 hit_count_ = 0;
+  int64 miss_count_ = 0;
+  TF_DISALLOW_COPY_AND_ASSIGN(GenericGraphCache);
 };
 
 }  // namespace generic_graph_caching
@@ -21,6 +21,7 @@ limitations under the License.
 #include "tensorflow/compiler/xla/service/hlo_instruction.h"
 #include "tensorflow/compiler/xla/service/hlo_module.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/lib/strings/proto_serialization.h"
 
 #include <map>
@@ -39,6 +40,35 @@ std::string HloHash::GetProtoStr() {
   return proto_str_;
 }
 
+uint64 HloHash::GetComputationHash(const HloComputation* computation) {
+  auto itr = computation_hashes_.find(computation);
+  if (itr != computation_hashes_.end()) {
+    return itr->second;
+  }
+
+  // Map the called computations to their hashes
+  std::map<uint64, uint64> computation_id_map;
+  for (auto* inst : computation->instructions()) {
+    for (auto* called_comp : inst->called_computations()) {
+      computation_id_map[called_comp->unique_id()] =
+          GetComputationHash(called_comp);
+    }
+  }
+
+  HloComputationProto proto = computation->ToProto();
+  SanitizeHloComputationProto(&proto, 0);
+  for (int inst_id = 0; inst_id < proto.instructions().size(); inst_id++) {
+    PatchComputationReferences(proto.mutable_instructions(inst_id),
+                               computation_id_map);
+  }
+
+  std::string proto_str;
+  tensorflow::SerializeToStringDeterministic(proto, &proto_str);
+  const uint64 hash = hash_util::hash(proto_str);
+  computation_hashes_[computation] = hash;
+  return hash;
+}
+
 void HloHash::HashModule() {
   HloModuleProto proto = module_->ToProto();
   SanitizeHloModuleProto(&proto, module_);
@@ -206,5 +236,36 @@ void HloHash::PatchComputationReferences(
   }
 }
 
+uint64 HloStructuralHash::GetComputationHash(
+    const HloComputation* computation) {
+  auto itr = computation_hashes_.find(computation);
+  if (itr != computation_hashes_.end()) {
+    return itr->second;
+  }
+
+  // Visit the operands before their users so that the hash of each
+  // instruction can include the structural hashes of its operands.
+  absl::flat_hash_map<const HloInstruction*, uint64> hashes;
+  for (const HloInstruction* inst : computation->MakeInstructionPostOrder()) {
+    uint64 hash = GetInstructionHash(inst);
+    for (const HloInstruction* operand : inst->operands()) {
+      hash = tensorflow::Hash64Combine(hash, hashes.at(operand));
+    }
+    hashes[inst] = hash;
+  }
+
+  const uint64 hash = hashes.at(computation->root_instruction());
+  computation_hashes_[computation] = hash;
+  return hash;
+}
+
+uint64 HloStructuralHash::GetInstructionHash(const HloInstruction* inst) {
+  uint64 hash = inst->Hash();
+  for (const HloComputation* called_comp : inst->called_computations()) {
+    hash = tensorflow::Hash64Combine(hash, GetComputationHash(called_comp));
+  }
+  return hash;
+}
+
 }  // namespace poplarplugin
 }  // namespace xla
@@ -17,6 +17,7 @@ limitations under the License.
 
 #include <map>
 
+#include "absl/container/flat_hash_map.h"
 #include "tensorflow/compiler/xla/types.h"
 #include "tensorflow/core/platform/macros.h"
 
@@ -38,11 +39,17 @@ class HloHash {
   uint64 GetHash();
   std::string GetProtoStr();
 
+  // Hash of a single computation of the module. Any called computations are
+  // referenced by their own hashes, so the result does not depend on the ids
+  // assigned to the computations by the module.
+  uint64 GetComputationHash(const HloComputation* computation);
+
  private:
   const HloModule* module_;
   uint64 hash_ = 0;
   std::string proto_str_;
   bool performed_hash_ = false;
+  std::map<const HloComputation*, uint64> computation_hashes_;
 
   void HashModule();
   void SanitizeHloModuleProto(HloModuleProto*, const HloModule*);
@@ -56,6 +63,27 @@ class HloHash {
                                   const std::map<uint64, uint64>&);
 };
 
+// Structural hash of computations and instructions, which is cheaper than
+// HloHash as nothing is serialized. The hash of a computation only depends on
+// the instructions reachable from its root and on the computations they call,
+// so computations which are HloComputation::Equal have the same hash
+// regardless of their names and ids. The hashes do not depend on any pointers
+// or ids either, so they are stable between compilations.
+//
+// The hashes are memoized, so the computations must not be modified while
+// this object is in use.
+class HloStructuralHash {
+ public:
+  uint64 GetComputationHash(const HloComputation* computation);
+
+  // Hash of a single instruction, where the operands only contribute their
+  // shapes, and the called computations contribute their structural hashes.
+  uint64 GetInstructionHash(const HloInstruction* inst);
+
+ private:
+  absl::flat_hash_map<const HloComputation*, uint64> computation_hashes_;
+};
+
 }  // namespace poplarplugin
 }  // namespace xla
 
@@ -0,0 +1,427 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/host_embedding_util.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/flags.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/numa.h"
+
+namespace xla {
+namespace poplarplugin {
+
+void HostEmbeddingIndexGroups::Build(const int* indices, int index_count,
+                                     int num_shards, int rows_per_shard) {
+  row_to_group_.clear();
+  rows_.clear();
+  offsets_.clear();
+
+  // Count how many times each distinct row appears, numbering the rows in the
+  // order they are first seen.
+  std::vector<int>& counts = offsets_;
+  for (int i = 0; i < index_count; ++i) {
+    auto itr = row_to_group_.emplace(indices[i], rows_.size());
+    if (itr.second) {
+      rows_.push_back(indices[i]);
+      counts.push_back(0);
+    }
+    counts[itr.first->second]++;
+  }
+
+  const int num_groups = rows_.size();
+  shard_offsets_.assign(num_shards + 1, 0);
+  shard_offsets_[num_shards] = num_groups;
+
+  if (num_shards > 1) {
+    auto shard_of = [&](int row) {
+      return std::max(std::min(row / rows_per_shard, num_shards - 1), 0);
+    };
+
+    // Order the groups by shard, keeping the order they were first seen in
+    // within each shard.
+    for (int row : rows_) {
+      shard_offsets_[shard_of(row) + 1]++;
+    }
+    std::partial_sum(shard_offsets_.begin(), shard_offsets_.end() - 1,
+                     shard_offsets_.begin());
+    shard_offsets_[num_shards] = num_groups;
+
+    absl::InlinedVector<int, 8> cursors(shard_offsets_.begin(),
+                                        shard_offsets_.end() - 1);
+    shard_order_.resize(2 * num_groups);
+    for (int group = 0; group < num_groups; ++group) {
+      const int new_group = cursors[shard_of(rows_[group])]++;
+      shard_order_[new_group] = rows_[group];
+      shard_order_[num_groups + new_group] = counts[group];
+    }
+    for (int group = 0; group < num_groups; ++group) {
+      rows_[group] = shard_order_[group];
+      counts[group] = shard_order_[num_groups + group];
+      row_to_group_[rows_[group]] = group;
+    }
+  }
+
+  // Turn the counts into the offset of each group in `positions_`.
+  int offset = 0;
+  for (int& count : counts) {
+    const int next = offset + count;
+    count = offset;
+    offset = next;
+  }
+  offsets_.push_back(offset);
+
+  // Place each position into its group, using the start offsets as cursors and
+  // then shifting them back once every position has been placed.
+  positions_.resize(index_count);
+  for (int i = 0; i < index_count; ++i) {
+    positions_[offsets_[row_to_group_[indices[i]]]++] = i;
+  }
+  for (int i = num_groups; i > 0; --i) {
+    offsets_[i] = offsets_[i - 1];
+  }
+  offsets_[0] = 0;
+}
+
+tensorflow::thread::ThreadPool* GetHostEmbeddingThreadPool() {
+  static tensorflow::thread::ThreadPool* pool = [] {
+    const int64 max_threads = PoplarXlaFlags::Get().max_host_embedding_threads;
+    const int num_threads =
+        max_threads > 0 ? max_threads : tensorflow::port::MaxParallelism();
+
+    return new tensorflow::thread::ThreadPool(
+        tensorflow::Env::Default(), "host_embedding", num_threads);
+  }();
+
+  return pool;
+}
+
+tensorflow::thread::ThreadPool* GetHostEmbeddingThreadPool(int numa_node) {
+  static tensorflow::mutex mu(tensorflow::LINKER_INITIALIZED);
+  static auto* pools =
+      new absl::flat_hash_map<int, tensorflow::thread::ThreadPool*>();
+
+  tensorflow::mutex_lock lk(mu);
+  auto itr = pools->find(numa_node);
+  if (itr != pools->end()) {
+    return itr->second;
+  }
+
+  const int64 max_threads = PoplarXlaFlags::Get().max_host_embedding_threads;
+  const int num_threads =
+      max_threads > 0
+          ? std::max<int64>(max_threads / tensorflow::port::NUMANumNodes(), 1)
+          : tensorflow::port::MaxParallelism(numa_node);
+
+  tensorflow::ThreadOptions options;
+  options.numa_node = numa_node;
+  auto* pool = new tensorflow::thread::ThreadPool(
+      tensorflow::Env::Default(), options,
+      absl::StrCat("host_embedding_numa", numa_node), num_threads);
+  (*pools)[numa_node] = pool;
+  return pool;
+}
+
+bool BindToNUMANode(void* ptr, std::size_t num_bytes, int numa_node) {
+  // These match the values in <numaif.h>.
+  constexpr int kMpolPreferred = 1;
+  constexpr unsigned kMpolMfMove = 1 << 1;
+  constexpr std::size_t kBitsPerWord = 8 * sizeof(unsigned long);
+
+  // Only bind the whole pages within the memory, as moving the pages it
+  // shares with the allocations next to it would move those too.
+  const std::uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const std::uintptr_t begin =
+      (reinterpret_cast<std::uintptr_t>(ptr) + page_size - 1) &
+      ~(page_size - 1);
+  const std::uintptr_t end =
+      (reinterpret_cast<std::uintptr_t>(ptr) + num_bytes) & ~(page_size - 1);
+  if (end <= begin) {
+    return true;
+  }
+
+  std::vector<unsigned long> node_mask(numa_node / kBitsPerWord + 1);
+  node_mask[numa_node / kBitsPerWord] |= 1UL << (numa_node % kBitsPerWord);
+
+  const long result = syscall(
+      SYS_mbind, begin, end - begin, kMpolPreferred, node_mask.data(),
+      node_mask.size() * kBitsPerWord + 1, kMpolMfMove);
+  if (result != 0) {
+    VLOG(1) << "Failed to bind " << num_bytes << " bytes to NUMA node "
+            << numa_node << ": " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+HostEmbeddingShards::HostEmbeddingShards(void* rows, int num_rows,
+                                         std::size_t row_bytes,
+                                         int num_shards) {
+  num_shards = std::max(std::min(num_shards, num_rows), 1);
+  rows_per_shard_ = (num_rows + num_shards - 1) / num_shards;
+  shard_mu_.reset(new tensorflow::mutex[num_shards]);
+
+  if (num_shards == 1) {
+    pools_.push_back(GetHostEmbeddingThreadPool());
+    return;
+  }
+
+  // Spread the shards over the NUMA nodes of the host, in case there are more
+  // shards than nodes.
+  const int num_nodes = std::max(tensorflow::port::NUMANumNodes(), 1);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    const int numa_node = shard % num_nodes;
+    const int64 first_row = int64{shard} * rows_per_shard_;
+    const int64 shard_rows =
+        std::min<int64>(rows_per_shard_, num_rows - first_row);
+    if (shard_rows > 0) {
+      BindToNUMANode(static_cast<char*>(rows) + first_row * row_bytes,
+                     shard_rows * row_bytes, numa_node);
+    }
+    pools_.push_back(GetHostEmbeddingThreadPool(numa_node));
+  }
+}
+
+void HostEmbeddingShards::Run(const HostEmbeddingIndexGroups& groups,
+                              int64 cost_per_row, bool exclusive,
+                              const std::function<void(int, int)>& fn) {
+  // Chunks should be big enough that scheduling them is cheap in comparison.
+  constexpr int64 kMinChunkCost = 64 * 1024;
+  const int min_chunk_rows =
+      std::max<int64>(kMinChunkCost / std::max<int64>(cost_per_row, 1), 1);
+
+  const int num_shards = NumShards();
+  auto num_chunks = [&](int shard) {
+    const int rows = groups.ShardEnd(shard) - groups.ShardBegin(shard);
+    return std::min((rows + min_chunk_rows - 1) / min_chunk_rows,
+                    pools_[shard]->NumThreads());
+  };
+
+  // Small batches on a single shard are quicker to do on this thread.
+  if (num_shards == 1 && num_chunks(0) <= 1) {
+    if (exclusive) {
+      tensorflow::mutex_lock lk(shard_mu_[0]);
+      fn(0, groups.NumRows());
+    } else {
+      tensorflow::tf_shared_lock lk(shard_mu_[0]);
+      fn(0, groups.NumRows());
+    }
+    return;
+  }
+
+  // Lock the shards in order, so that batches from different replicas cannot
+  // deadlock, and start each one as soon as it is locked.
+  absl::InlinedVector<std::unique_ptr<tensorflow::BlockingCounter>, 8> done(
+      num_shards);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    const int chunks = num_chunks(shard);
+    if (chunks == 0) {
+      continue;
+    }
+
+    if (exclusive) {
+      shard_mu_[shard].lock();
+    } else {
+      shard_mu_[shard].lock_shared();
+    }
+
+    done[shard] = absl::make_unique<tensorflow::BlockingCounter>(chunks);
+    const int begin = groups.ShardBegin(shard);
+    const int rows = groups.ShardEnd(shard) - begin;
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+      const int chunk_begin = begin + int64{rows} * chunk / chunks;
+      const int chunk_end = begin + int64{rows} * (chunk + 1) / chunks;
+      tensorflow::BlockingCounter* counter = done[shard].get();
+      pools_[shard]->Schedule([&fn, counter, chunk_begin, chunk_end]() {
+        fn(chunk_begin, chunk_end);
+        counter->DecrementCount();
+      });
+    }
+  }
+
+  // Release each shard as soon as it has finished.
+  for (int shard = 0; shard < num_shards; ++shard) {
+    if (!done[shard]) {
+      continue;
+    }
+
+    done[shard]->Wait();
+    if (exclusive) {
+      shard_mu_[shard].unlock();
+    } else {
+      shard_mu_[shard].unlock_shared();
+    }
+  }
+}
+
+int GetHostEmbeddingNumShards() {
+  const int64 flag = PoplarXlaFlags::Get().host_embedding_numa_shards;
+  if (!tensorflow::port::NUMAEnabled()) {
+    return 1;
+  }
+
+  const int num_nodes = tensorflow::port::NUMANumNodes();
+  if (flag < 0) {
+    return num_nodes;
+  }
+  return std::max<int64>(std::min<int64>(flag, num_nodes), 1);
+}
+
+int RowsToCover(const HostEmbeddingStatistics& statistics, double fraction) {
+  const double target = fraction * statistics.window_lookups;
+  int64 covered = 0;
+  for (std::size_t i = 0; i < statistics.hot_rows.size(); ++i) {
+    covered += statistics.hot_rows[i].second;
+    if (covered >= target) {
+      return i + 1;
+    }
+  }
+  return statistics.hot_rows.size();
+}
+
+HostEmbeddingAccessSampler::HostEmbeddingAccessSampler(int sample_interval,
+                                                       int window_size,
+                                                       int max_hot_rows)
+    : sample_interval_(std::max(sample_interval, 1)),
+      window_size_(std::max(window_size, 1)),
+      max_hot_rows_(max_hot_rows) {}
+
+bool HostEmbeddingAccessSampler::Count(int index_count) {
+  lookups_.fetch_add(index_count, std::memory_order_relaxed);
+  return batches_.fetch_add(1, std::memory_order_relaxed) % sample_interval_ ==
+         0;
+}
+
+bool HostEmbeddingAccessSampler::Record(const HostEmbeddingIndexGroups& groups,
+                                        int64 cache_hits) {
+  tensorflow::mutex_lock lk(mu_);
+  for (int i = 0; i < groups.NumRows(); ++i) {
+    window_counts_[groups.Row(i)] += groups.Positions(i).size();
+  }
+  window_lookups_ += groups.NumPositions();
+  sampled_lookups_ += groups.NumPositions();
+  sampled_cache_hits_ += cache_hits;
+
+  if (++window_batches_ < window_size_) {
+    return false;
+  }
+
+  // The window is complete, keep its hottest rows and start a new one.
+  hot_rows_.assign(window_counts_.begin(), window_counts_.end());
+  const std::size_t num_hot_rows =
+      std::min<std::size_t>(hot_rows_.size(), max_hot_rows_);
+  std::partial_sort(hot_rows_.begin(), hot_rows_.begin() + num_hot_rows,
+                    hot_rows_.end(),
+                    [](const std::pair<int, int64>& a,
+                       const std::pair<int, int64>& b) {
+                      return a.second != b.second ? a.second > b.second
+                                                  : a.first < b.first;
+                    });
+  hot_rows_.resize(num_hot_rows);
+  hot_window_lookups_ = window_lookups_;
+
+  window_counts_.clear();
+  window_batches_ = 0;
+  window_lookups_ = 0;
+  return true;
+}
+
+std::vector<int> HostEmbeddingAccessSampler::HotRows(int max_rows) const {
+  tensorflow::mutex_lock lk(mu_);
+  const std::size_t num_rows =
+      std::min<std::size_t>(hot_rows_.size(), std::max(max_rows, 0));
+
+  std::vector<int> rows(num_rows);
+  for (std::size_t i = 0; i < num_rows; ++i) {
+    rows[i] = hot_rows_[i].first;
+  }
+  return rows;
+}
+
+HostEmbeddingStatistics HostEmbeddingAccessSampler::GetStatistics() const {
+  HostEmbeddingStatistics statistics;
+  statistics.lookups = lookups_.load(std::memory_order_relaxed);
+
+  tensorflow::mutex_lock lk(mu_);
+  statistics.sampled_lookups = sampled_lookups_;
+  statistics.sampled_cache_hits = sampled_cache_hits_;
+  statistics.hot_rows = hot_rows_;
+  statistics.window_lookups = hot_window_lookups_;
+  return statistics;
+}
+
+namespace {
+constexpr std::size_t kHugePageSize = 2 * 1024 * 1024;
+
+std::size_t HugePageAlignedSize(std::size_t num_bytes) {
+  return (num_bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+}
+}  // namespace
+
+void* AllocateHugePages(std::size_t num_bytes) {
+  if (num_bytes == 0) {
+    return nullptr;
+  }
+
+  // Anonymous mappings are page aligned but not huge page aligned, so map an
+  // extra huge page and trim the mapping down to an aligned region.
+  const std::size_t size = HugePageAlignedSize(num_bytes);
+  void* mapping = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    LOG(WARNING) << "Failed to allocate " << size
+                 << " bytes for the host embedding cache.";
+    return nullptr;
+  }
+
+  char* begin = static_cast<char*>(mapping);
+  char* aligned = reinterpret_cast<char*>(
+      HugePageAlignedSize(reinterpret_cast<std::uintptr_t>(begin)));
+  if (aligned != begin) {
+    munmap(begin, aligned - begin);
+  }
+  munmap(aligned + size, begin + kHugePageSize - aligned);
+
+  // This is only advice, the memory is still usable when transparent huge
+  // pages are disabled.
+  if (madvise(aligned, size, MADV_HUGEPAGE) != 0) {
+    VLOG(1) << "Transparent huge pages are not available for the host "
+               "embedding cache.";
+  }
+  return aligned;
+}
+
+void FreeHugePages(void* ptr, std::size_t num_bytes) {
+  if (ptr) {
+    munmap(ptr, HugePageAlignedSize(num_bytes));
+  }
+}
+
+}  // namespace poplarplugin
+}  // namespace xla
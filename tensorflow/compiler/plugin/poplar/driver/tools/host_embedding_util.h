@@ -0,0 +1,567 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_HOST_EMBEDDING_UTIL_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_HOST_EMBEDDING_UTIL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
+#include "tensorflow/compiler/xla/types.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/prefetch.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/threadpool.h"
+#include "third_party/eigen3/Eigen/Core"
+
+namespace xla {
+namespace poplarplugin {
+
+constexpr int kHostCacheLineSize = 64;
+
+// How many distinct rows ahead of the one being copied a gather prefetches.
+constexpr int kHostEmbeddingPrefetchDistance = 4;
+
+/**
+ * Groups the positions of a batch of host embedding indices by the row they
+ * refer to, so that each distinct row is only visited once.
+ *
+ * The groups are stored in a compressed form: the positions which refer to the
+ * i-th distinct row are `Positions(i)`, in the order they appear in the batch.
+ * The storage is reused between calls to `Build`, so keeping one of these per
+ * replica avoids allocating on every step.
+ *
+ * When the embedding is split into shards of consecutive rows, the groups are
+ * ordered by shard so that the rows of each shard form a contiguous range of
+ * groups. Within a shard the rows are in the order they are first seen.
+ */
+class HostEmbeddingIndexGroups {
+ public:
+  /**
+   * Group the given indices, replacing any previous grouping.
+   *
+   * \param indices The row index for each position in the batch.
+   * \param index_count The number of indices in the batch.
+   * \param num_shards The number of shards the embedding is split into.
+   * \param rows_per_shard The number of rows in each shard, except the last
+   *                       shard which holds any remaining rows.
+   */
+  void Build(const int* indices, int index_count, int num_shards = 1,
+             int rows_per_shard = 0);
+
+  // The number of distinct rows in the batch.
+  int NumRows() const { return rows_.size(); }
+
+  // The number of indices in the batch.
+  int NumPositions() const { return positions_.size(); }
+
+  // The row index of the i-th distinct row.
+  int Row(int i) const { return rows_[i]; }
+
+  // The positions in the batch which refer to the i-th distinct row.
+  absl::Span<const int> Positions(int i) const {
+    return absl::MakeConstSpan(positions_.data() + offsets_[i],
+                               offsets_[i + 1] - offsets_[i]);
+  }
+
+  // The range of distinct rows which belong to the given shard.
+  int ShardBegin(int shard) const { return shard_offsets_[shard]; }
+  int ShardEnd(int shard) const { return shard_offsets_[shard + 1]; }
+
+ private:
+  absl::flat_hash_map<int, int> row_to_group_;
+  std::vector<int> rows_;
+  std::vector<int> offsets_;
+  std::vector<int> positions_;
+  std::vector<int> shard_offsets_;
+  std::vector<int> shard_order_;
+};
+
+/**
+ * Get the thread pool which is shared by all the host embeddings in the
+ * process. The number of threads is controlled by the
+ * `max_host_embedding_threads` flag.
+ */
+tensorflow::thread::ThreadPool* GetHostEmbeddingThreadPool();
+
+/**
+ * Get the thread pool which is shared by all the host embedding shards on the
+ * given NUMA node. Its threads are bound to the node, and the
+ * `max_host_embedding_threads` flag is split evenly between the nodes.
+ */
+tensorflow::thread::ThreadPool* GetHostEmbeddingThreadPool(int numa_node);
+
+/**
+ * Move the whole pages within the given memory to a NUMA node, and prefer that
+ * node for any of them which are allocated later. The pages it only partly
+ * covers are left alone, as they are shared with other allocations.
+ *
+ * \return False if the memory could not be bound to the node.
+ */
+bool BindToNUMANode(void* ptr, std::size_t num_bytes, int numa_node);
+
+/**
+ * Add one row to another, element-wise. The addition is done with Eigen so
+ * that it is vectorized for every element type we support.
+ */
+template <typename T>
+inline void AddRow(T* dst, const T* src, int width) {
+  using Row = Eigen::Array<T, Eigen::Dynamic, 1>;
+  Eigen::Map<Row>(dst, width) += Eigen::Map<const Row>(src, width);
+}
+
+/**
+ * Prefetch every cache line of a row of an embedding.
+ */
+template <typename T>
+inline void PrefetchRow(const T* row, int width) {
+  const char* begin = reinterpret_cast<const char*>(row);
+  const char* end = begin + width * sizeof(T);
+  for (const char* line = begin; line < end; line += kHostCacheLineSize) {
+    tensorflow::port::prefetch<tensorflow::port::PREFETCH_HINT_T0>(line);
+  }
+}
+
+/**
+ * Prefetch the first `max_rows` distinct rows of a batch, so that they are
+ * already on their way into the cache when the batch is gathered.
+ */
+template <typename Rows>
+void PrefetchRows(const Rows& rows, const HostEmbeddingIndexGroups& groups,
+                  int width, int max_rows) {
+  const int num_rows = std::min(groups.NumRows(), max_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    PrefetchRow(rows[groups.Row(i)], width);
+  }
+}
+
+/**
+ * Gather a range of the distinct rows of a batch into a contiguous buffer, on
+ * the calling thread.
+ *
+ * Each distinct row is read from the embedding once and copied into the first
+ * position that refers to it. Any other positions referring to the same row are
+ * copied from that first position, which is already in the cache, instead of
+ * going back to the embedding. Rows are prefetched a few rows ahead of the one
+ * being copied.
+ *
+ * \param rows The pointer to the start of each row of the embedding, indexed
+ *             by row. Either a std::vector<T*> or a HostEmbeddingCachedRows.
+ * \param groups The grouped indices of the batch.
+ * \param begin The first distinct row to gather.
+ * \param end One past the last distinct row to gather.
+ * \param width The number of elements in each row.
+ * \param destination The buffer of `groups.NumPositions()` rows to write to.
+ */
+template <typename T, typename Rows>
+void GatherRowRange(const Rows& rows, const HostEmbeddingIndexGroups& groups,
+                    int begin, int end, int width, T* destination) {
+  const std::size_t row_bytes = width * sizeof(T);
+
+  for (int i = begin; i != end; ++i) {
+    if (i + kHostEmbeddingPrefetchDistance < end) {
+      PrefetchRow(rows[groups.Row(i + kHostEmbeddingPrefetchDistance)], width);
+    }
+
+    auto positions = groups.Positions(i);
+    T* first = destination + std::size_t(positions[0]) * width;
+    std::memcpy(first, rows[groups.Row(i)], row_bytes);
+
+    for (std::size_t j = 1; j < positions.size(); ++j) {
+      T* dst = destination + std::size_t(positions[j]) * width;
+      std::memcpy(dst, first, row_bytes);
+    }
+  }
+}
+
+/**
+ * Add the gradients for a range of the distinct rows of a batch to the rows of
+ * an embedding, on the calling thread.
+ *
+ * All the gradients for a distinct row are added by the same thread, so no
+ * synchronisation between threads working on different ranges of the same
+ * batch is needed, and each row of the embedding is only brought into the
+ * cache once. The gradients for a row are added in the order they appear in
+ * the batch, which keeps the result identical to applying them one at a time.
+ *
+ * \param rows The pointer to the start of each row of the embedding.
+ * \param groups The grouped indices of the batch.
+ * \param begin The first distinct row to update.
+ * \param end One past the last distinct row to update.
+ * \param width The number of elements in each row.
+ * \param grads The buffer of `groups.NumPositions()` gradient rows.
+ */
+template <typename T>
+void ScatterAddRowRange(const std::vector<T*>& rows,
+                        const HostEmbeddingIndexGroups& groups, int begin,
+                        int end, int width, const T* grads) {
+  for (int i = begin; i != end; ++i) {
+    T* row = rows[groups.Row(i)];
+
+    for (int position : groups.Positions(i)) {
+      AddRow(row, grads + std::size_t(position) * width, width);
+    }
+  }
+}
+
+// The approximate cost, in bytes moved, of processing one distinct row.
+template <typename T>
+int64 HostEmbeddingCostPerRow(const HostEmbeddingIndexGroups& groups,
+                              int width) {
+  return width * sizeof(T) * groups.NumPositions() /
+         std::max(groups.NumRows(), 1);
+}
+
+/**
+ * Gather all the rows of a batch, partitioned across a thread pool. See
+ * `GatherRowRange`.
+ */
+template <typename T, typename Rows>
+void GatherRows(const Rows& rows, const HostEmbeddingIndexGroups& groups,
+                int width, T* destination,
+                tensorflow::thread::ThreadPool* pool) {
+  pool->ParallelFor(groups.NumRows(),
+                    HostEmbeddingCostPerRow<T>(groups, width),
+                    [&](int64 begin, int64 end) {
+                      GatherRowRange(rows, groups, begin, end, width,
+                                     destination);
+                    });
+}
+
+/**
+ * Add a batch of gradients to the rows of an embedding, partitioned across a
+ * thread pool. See `ScatterAddRowRange`.
+ */
+template <typename T>
+void ScatterAddRows(const std::vector<T*>& rows,
+                    const HostEmbeddingIndexGroups& groups, int width,
+                    const T* grads, tensorflow::thread::ThreadPool* pool) {
+  pool->ParallelFor(groups.NumRows(),
+                    HostEmbeddingCostPerRow<T>(groups, width),
+                    [&](int64 begin, int64 end) {
+                      ScatterAddRowRange(rows, groups, begin, end, width,
+                                         grads);
+                    });
+}
+
+/**
+ * Statistics about which rows of a host embedding are looked up. These can be
+ * used to pick the size of the hot row cache, see
+ * `--host_embedding_cache_rows`.
+ */
+struct HostEmbeddingStatistics {
+  // The total number of rows looked up, including repeated rows.
+  int64 lookups = 0;
+
+  // The number of rows looked up in the sampled batches, and how many of those
+  // were served from the hot row cache.
+  int64 sampled_lookups = 0;
+  int64 sampled_cache_hits = 0;
+
+  // The most frequently looked up rows in the last complete sampling window,
+  // most frequent first, with the number of times each was looked up.
+  std::vector<std::pair<int, int64>> hot_rows;
+
+  // The number of rows looked up in the last complete sampling window.
+  int64 window_lookups = 0;
+};
+
+/**
+ * The smallest number of the hottest rows which together account for at least
+ * `fraction` of the lookups in the last sampling window. Returns the number of
+ * hot rows known about when they do not cover `fraction` of the lookups.
+ */
+int RowsToCover(const HostEmbeddingStatistics& statistics, double fraction);
+
+/**
+ * Samples the batches of rows looked up in a host embedding, counting how
+ * often each row is looked up.
+ *
+ * Only one in every `sample_interval` batches is counted, which keeps the cost
+ * low enough for the statistics to always be collected. The counts are kept
+ * for a window of `window_size` sampled batches, after which the hottest rows
+ * of the window are kept and counting starts again. This means the statistics
+ * follow changes in the distribution of the indices during training. It is
+ * safe to use from several replicas at once.
+ */
+class HostEmbeddingAccessSampler {
+ public:
+  HostEmbeddingAccessSampler(int sample_interval, int window_size,
+                             int max_hot_rows);
+
+  /**
+   * Count a batch of lookups and decide whether it should be sampled.
+   *
+   * \param index_count The number of rows in the batch.
+   *
+   * \return True if the batch should be passed to `Record`.
+   */
+  bool Count(int index_count);
+
+  /**
+   * Record a sampled batch.
+   *
+   * \param groups The grouped indices of the batch.
+   * \param cache_hits How many rows in the batch were in the hot row cache.
+   *
+   * \return True if this batch completed a sampling window, meaning the hot
+   *         rows have changed.
+   */
+  bool Record(const HostEmbeddingIndexGroups& groups, int64 cache_hits);
+
+  /**
+   * The hottest `max_rows` rows of the last complete sampling window, most
+   * frequent first.
+   */
+  std::vector<int> HotRows(int max_rows) const;
+
+  HostEmbeddingStatistics GetStatistics() const;
+
+ private:
+  const int sample_interval_;
+  const int window_size_;
+  const int max_hot_rows_;
+
+  std::atomic<int64> lookups_{0};
+  std::atomic<int64> batches_{0};
+
+  mutable tensorflow::mutex mu_;
+  absl::flat_hash_map<int, int64> window_counts_ GUARDED_BY(mu_);
+  int window_batches_ GUARDED_BY(mu_) = 0;
+  int64 window_lookups_ GUARDED_BY(mu_) = 0;
+  int64 sampled_lookups_ GUARDED_BY(mu_) = 0;
+  int64 sampled_cache_hits_ GUARDED_BY(mu_) = 0;
+  std::vector<std::pair<int, int64>> hot_rows_ GUARDED_BY(mu_);
+  int64 hot_window_lookups_ GUARDED_BY(mu_) = 0;
+};
+
+/**
+ * Allocate memory which the kernel is asked to back with transparent huge
+ * pages, so that a small number of TLB entries cover all of it. The memory is
+ * zero initialised.
+ *
+ * \return The memory, or nullptr if it could not be allocated.
+ */
+void* AllocateHugePages(std::size_t num_bytes);
+void FreeHugePages(void* ptr, std::size_t num_bytes);
+
+/**
+ * A compact copy of the most frequently looked up rows of a host embedding.
+ *
+ * Rows in a large embedding which are looked up often are spread over many
+ * pages, so even when they fit in the last level cache each lookup can miss in
+ * the TLB. Copying them next to each other into memory backed by huge pages
+ * avoids this. The embedding remains the primary copy of every row: updates
+ * are applied to the embedding and then copied into the cache.
+ *
+ * The cache is not synchronised, callers must not `Fill` it while it is being
+ * read from or updated.
+ */
+template <typename T>
+class HostEmbeddingRowCache {
+ public:
+  HostEmbeddingRowCache(int capacity, int width)
+      : width_(width),
+        buffer_bytes_(std::size_t(capacity) * width * sizeof(T)),
+        buffer_(static_cast<T*>(AllocateHugePages(buffer_bytes_))),
+        capacity_(buffer_ ? capacity : 0) {}
+
+  ~HostEmbeddingRowCache() {
+    if (buffer_) {
+      FreeHugePages(buffer_, buffer_bytes_);
+    }
+  }
+
+  // The number of rows which can be cached.
+  int Capacity() const { return capacity_; }
+
+  // The cached copy of `row`, or nullptr if it is not cached.
+  T* Find(int row) const {
+    auto itr = slots_.find(row);
+    return itr == slots_.end() ? nullptr : itr->second;
+  }
+
+  /**
+   * Replace the cached rows with copies of the given rows.
+   *
+   * \param rows The pointer to the start of each row of the embedding.
+   * \param row_indices The rows to cache, at most `Capacity()` of them.
+   * \param pool The thread pool to copy the rows with.
+   */
+  void Fill(const std::vector<T*>& rows, const std::vector<int>& row_indices,
+            tensorflow::thread::ThreadPool* pool) {
+    const int num_rows = std::min<int>(row_indices.size(), capacity_);
+    const std::size_t row_bytes = width_ * sizeof(T);
+
+    slots_.clear();
+    slots_.reserve(num_rows);
+    for (int i = 0; i < num_rows; ++i) {
+      slots_[row_indices[i]] = buffer_ + std::size_t(i) * width_;
+    }
+
+    pool->ParallelFor(num_rows, row_bytes, [&](int64 begin, int64 end) {
+      for (int64 i = begin; i != end; ++i) {
+        std::memcpy(buffer_ + i * width_, rows[row_indices[i]], row_bytes);
+      }
+    });
+  }
+
+  // How many positions in the batch refer to rows which are cached.
+  int64 CountHits(const HostEmbeddingIndexGroups& groups) const {
+    int64 hits = 0;
+    for (int i = 0; i < groups.NumRows(); ++i) {
+      if (slots_.contains(groups.Row(i))) {
+        hits += groups.Positions(i).size();
+      }
+    }
+    return hits;
+  }
+
+  /**
+   * Copy any rows of the batch which are cached from the embedding into the
+   * cache, after they have been updated in the embedding.
+   */
+  void Update(const std::vector<T*>& rows,
+              const HostEmbeddingIndexGroups& groups) {
+    Update(rows, groups, 0, groups.NumRows());
+  }
+
+  // As above, for the range [begin, end) of the distinct rows of the batch.
+  void Update(const std::vector<T*>& rows,
+              const HostEmbeddingIndexGroups& groups, int begin, int end) {
+    if (slots_.empty()) {
+      return;
+    }
+
+    for (int i = begin; i < end; ++i) {
+      if (T* cached = Find(groups.Row(i))) {
+        std::memcpy(cached, rows[groups.Row(i)], width_ * sizeof(T));
+      }
+    }
+  }
+
+ private:
+  const int width_;
+  const std::size_t buffer_bytes_;
+  T* const buffer_;
+  const int capacity_;
+
+  absl::flat_hash_map<int, T*> slots_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(HostEmbeddingRowCache);
+};
+
+/**
+ * Indexes the rows of an embedding, returning the cached copy of a row when
+ * there is one. This can be passed to `GatherRows` in place of the rows.
+ */
+template <typename T>
+class HostEmbeddingCachedRows {
+ public:
+  HostEmbeddingCachedRows(const std::vector<T*>& rows,
+                          const HostEmbeddingRowCache<T>* cache)
+      : rows_(rows), cache_(cache) {}
+
+  const T* operator[](int row) const {
+    if (cache_) {
+      if (const T* cached = cache_->Find(row)) {
+        return cached;
+      }
+    }
+    return rows_[row];
+  }
+
+ private:
+  const std::vector<T*>& rows_;
+  const HostEmbeddingRowCache<T>* cache_;
+};
+
+/**
+ * Splits the rows of a host embedding into shards of consecutive rows, one for
+ * each NUMA node, so that the memory bandwidth of every node is used rather
+ * than only that of the node the embedding was allocated on.
+ *
+ * Shard `i` belongs to node `i` modulo the number of nodes. The memory of each
+ * shard is moved to its node, and each node has its own thread pool whose
+ * threads are bound to it. The rows of a batch which belong to a shard are only
+ * ever processed by the threads of that shard's node.
+ *
+ * Each shard also has a lock, so that batches from different replicas can
+ * update different shards at the same time while updates to the same shard
+ * are serialised.
+ */
+class HostEmbeddingShards {
+ public:
+  /**
+   * \param rows The start of the memory holding the embedding, which is
+   *             `num_rows` consecutive rows of `row_bytes` bytes.
+   * \param num_rows The number of rows in the embedding.
+   * \param row_bytes The size of each row in bytes.
+   * \param num_shards The number of shards to split the rows into. Values
+   *                   below two keep all the rows in one shard which uses the
+   *                   shared host embedding thread pool.
+   */
+  HostEmbeddingShards(void* rows, int num_rows, std::size_t row_bytes,
+                      int num_shards);
+
+  int NumShards() const { return pools_.size(); }
+  int RowsPerShard() const { return rows_per_shard_; }
+
+  /**
+   * Process the distinct rows of a batch on the threads of the shards which
+   * own them, and wait for all of them to be processed.
+   *
+   * The rows of each shard are split into chunks which are processed in
+   * parallel by the threads of the shard. The lock of each shard with rows in
+   * the batch is held while its rows are processed: shared for lookups and
+   * exclusive for updates.
+   *
+   * \param groups The grouped indices of the batch, built with `NumShards()`
+   *               and `RowsPerShard()`.
+   * \param cost_per_row The approximate cost of processing one distinct row.
+   * \param exclusive Whether the shard locks are taken exclusively.
+   * \param fn Called with the range of distinct rows of each chunk.
+   */
+  void Run(const HostEmbeddingIndexGroups& groups, int64 cost_per_row,
+           bool exclusive, const std::function<void(int, int)>& fn)
+      NO_THREAD_SAFETY_ANALYSIS;
+
+ private:
+  int rows_per_shard_;
+  std::vector<tensorflow::thread::ThreadPool*> pools_;
+  std::unique_ptr<tensorflow::mutex[]> shard_mu_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(HostEmbeddingShards);
+};
+
+/**
+ * The number of NUMA shards the rows of a host embedding should be split into,
+ * given the `host_embedding_numa_shards` flag and the NUMA nodes of the host.
+ */
+int GetHostEmbeddingNumShards();
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_HOST_EMBEDDING_UTIL_H_
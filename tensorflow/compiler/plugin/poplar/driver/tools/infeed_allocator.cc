@@ -15,20 +15,83 @@ limitations under the License.
 
 #include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_allocator.h"
 
-#include "tensorflow/core/platform/mem.h"
+#include <algorithm>
+
+#include "tensorflow/core/platform/logging.h"
 
 namespace xla {
 namespace poplarplugin {
+namespace {
+// Number of free buffers kept in the pool to begin with. The pool grows
+// automatically when buffers have to be evicted.
+constexpr size_t kInitialPoolSizeLimit = 128;
+
+// Smallest size class.
+constexpr size_t kMinSizeClass = 256;
+
+// Each power of two is split into this many size classes, which bounds the
+// wasted space to 25% of a buffer.
+constexpr size_t kSizeClassesPerPowerOfTwo = 4;
+
+class InfeedSizeRounder : public tensorflow::RoundUpInterface {
+ public:
+  size_t RoundUp(size_t num_bytes) override {
+    return InfeedAllocator::RoundUpToSizeClass(num_bytes);
+  }
+};
+
+int GetNumaNode(int numa_node) {
+  if (numa_node == tensorflow::port::kNUMANoAffinity) {
+    return numa_node;
+  }
+  if (!tensorflow::port::NUMAEnabled() || numa_node < 0 ||
+      numa_node >= tensorflow::port::NUMANumNodes()) {
+    LOG(WARNING) << "Cannot bind the infeed buffers to NUMA node " << numa_node
+                 << ", the memory will not be bound to any node.";
+    return tensorflow::port::kNUMANoAffinity;
+  }
+  return numa_node;
+}
+}  // namespace
+
+InfeedAllocator::InfeedAllocator(int numa_node)
+    : numa_node_(GetNumaNode(numa_node)),
+      pool_(kInitialPoolSizeLimit, /*auto_resize=*/true,
+            new tensorflow::BasicCPUAllocator(numa_node_, {}, {}),
+            new InfeedSizeRounder(), "infeed-allocator-pool") {}
+
 std::string InfeedAllocator::Name() { return "infeed-allocator"; }
 
 void* InfeedAllocator::AllocateRaw(size_t alignment, size_t num_bytes) {
   const size_t min_alignment = 64;
   alignment = alignment < min_alignment ? min_alignment : alignment;
-  return tensorflow::port::AlignedMalloc(num_bytes, min_alignment);
+  return pool_.AllocateRaw(alignment, num_bytes);
+}
+
+void InfeedAllocator::DeallocateRaw(void* ptr) { pool_.DeallocateRaw(ptr); }
+
+int InfeedAllocator::NumaNode() const { return numa_node_; }
+
+tensorflow::int64 InfeedAllocator::PoolHitCount() const {
+  return pool_.get_from_pool_count();
+}
+
+tensorflow::int64 InfeedAllocator::PoolMissCount() const {
+  return pool_.allocated_count();
 }
 
-void InfeedAllocator::DeallocateRaw(void* ptr) {
-  tensorflow::port::AlignedFree(ptr);
+/* static */ size_t InfeedAllocator::RoundUpToSizeClass(size_t num_bytes) {
+  if (num_bytes <= kMinSizeClass) {
+    return kMinSizeClass;
+  }
+  // Find the power of two below num_bytes and round up to the next multiple
+  // of its fraction.
+  size_t power = kMinSizeClass;
+  while (power * 2 < num_bytes) {
+    power *= 2;
+  }
+  const size_t step = power / kSizeClassesPerPowerOfTwo;
+  return ((num_bytes + step - 1) / step) * step;
 }
 
 }  // namespace poplarplugin
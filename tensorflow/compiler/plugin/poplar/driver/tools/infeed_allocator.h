@@ -18,12 +18,24 @@ limitations under the License.
 
 #include <string>
 
+#include "tensorflow/core/common_runtime/pool_allocator.h"
 #include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/platform/numa.h"
 
 namespace xla {
 namespace poplarplugin {
+
+// Allocator for the buffers which are passed through the infeed queues.
+//
+// Buffers are recycled through a pool of fixed size classes rather than being
+// returned to the system, as the same sizes are allocated for every step. A
+// buffer goes back into the pool once the infeed queue releases it (see the
+// `post_apply` function of InfeedQueue). The memory can optionally be bound to
+// a NUMA node.
 class InfeedAllocator : public tensorflow::Allocator {
  public:
+  explicit InfeedAllocator(int numa_node = tensorflow::port::kNUMANoAffinity);
+
   // Returns a string identifying this allocator
   std::string Name() override;
 
@@ -36,6 +48,22 @@ class InfeedAllocator : public tensorflow::Allocator {
   // Deallocate a block of memory pointer to by "ptr"
   // REQUIRES: "ptr" was previously returned by a call to AllocateRaw
   void DeallocateRaw(void* ptr) override;
+
+  // The NUMA node the memory is allocated on, or kNUMANoAffinity.
+  int NumaNode() const;
+
+  // Number of allocations which were satisfied from the pool.
+  tensorflow::int64 PoolHitCount() const;
+
+  // Number of allocations which required a fresh buffer.
+  tensorflow::int64 PoolMissCount() const;
+
+  // Size class used for a request of `num_bytes`. Exposed for testing.
+  static size_t RoundUpToSizeClass(size_t num_bytes);
+
+ private:
+  const int numa_node_;
+  tensorflow::PoolAllocator pool_;
 };
 
 }  // namespace poplarplugin
@@ -144,9 +144,12 @@ InfeedIterator::InfeedIterator(tensorflow::FunctionLibraryRuntime* flr,
       absl::make_unique<tensorflow::data::UnboundedThreadPool>(
           tensorflow::Env::Default(), feed_id + "/unbounded_thread_pool");
 
+  // Run the dataset on the same NUMA node as the infeed buffers are on.
+  tensorflow::ThreadOptions thread_options;
+  thread_options.numa_node = infeed_allocator->NumaNode();
   thread_pool_ = absl::make_unique<tensorflow::thread::ThreadPool>(
-      tensorflow::Env::Default(), tensorflow::ThreadOptions(),
-      feed_id + "/thread_pool", num_threads);
+      tensorflow::Env::Default(), thread_options, feed_id + "/thread_pool",
+      num_threads);
   tensorflow::thread::ThreadPool* thread_pool_ptr = thread_pool_.get();
 
   // Get the new FLR from the newly created PFLR and set up the cache.
@@ -155,6 +158,9 @@ InfeedIterator::InfeedIterator(tensorflow::FunctionLibraryRuntime* flr,
       absl::make_unique<tensorflow::data::FunctionHandleCache>(new_flr);
 
   // Given the previous params, create new params.
+  // The dataset allocates its output tensors with the infeed allocator, so the
+  // IO thread can push their buffers straight into the infeed queues without
+  // copying them.
   tensorflow::data::IteratorContext::Params base_params(params);
   base_params.allocator_getter = [this](tensorflow::AllocatorAttributes) {
     return infeed_allocator_;
@@ -69,6 +69,8 @@ class InfeedQueue {
   void AdvanceWritePosition() { queue_.AdvanceWritePosition(); }
   bool IsFull() const { return queue_.IsFull(); }
   bool IsEmpty() const { return queue_.IsEmpty(); }
+  std::size_t Size() const { return queue_.Size(); }
+  static constexpr std::size_t MaxSize() { return Queue::MaxSize(); }
 
   // Pushing with sanity checking against the sentinel.
   void Push(const T& item) {
@@ -89,6 +91,13 @@ class InfeedQueue {
     queue_.BlockPush(kEndOfQueueSentinel);
     queue_.AdvanceWritePosition();
   }
+  bool TrySignalEndOfQueue() {
+    if (!queue_.TryPush(kEndOfQueueSentinel)) {
+      return false;
+    }
+    queue_.AdvanceWritePosition();
+    return true;
+  }
 
   // Non-blocking pop with sentinel checking. Returns false if no items
   // are available or the end is reached.
@@ -110,7 +119,8 @@ class InfeedQueue {
   }
 
  private:
-  SPSCQueue<T, 2048> queue_;
+  using Queue = SPSCQueue<T, 2048>;
+  Queue queue_;
   static constexpr T kEndOfQueueSentinel{nullptr};
   TF_DISALLOW_COPY_AND_ASSIGN(InfeedQueue);
 };
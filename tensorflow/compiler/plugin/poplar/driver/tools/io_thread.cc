@@ -14,13 +14,18 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow/compiler/plugin/poplar/driver/tools/io_thread.h"
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "tensorflow/compiler/xla/status.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/numa.h"
 
 namespace xla {
 namespace poplarplugin {
@@ -50,5 +55,223 @@ IOThread::~IOThread() {
   // The destructor of `thread_` will now block until the thread has joined.
 }
 
+namespace {
+// Number of consecutive idle steps after which a thread starts yielding, and
+// after which it starts sleeping.
+constexpr int64 kIdleStepsBeforeYield = 64;
+constexpr int64 kIdleStepsBeforeSleep = 1024;
+constexpr int64 kIdleSleepMicros = 20;
+
+// Occupancy is accumulated as an integer in parts per million.
+constexpr double kOccupancyScale = 1e6;
+}  // namespace
+
+struct IOExecutor::Task {
+  std::string name;
+  IOTaskFunction fn;
+  int64 priority;
+  IOOccupancyFunction occupancy;
+
+  std::atomic<int64> busy_steps{0};
+  std::atomic<int64> idle_steps{0};
+  std::atomic<int64> occupancy_samples{0};
+  std::atomic<int64> occupancy_sum{0};
+  std::atomic<int64> empty_samples{0};
+  std::atomic<int64> full_samples{0};
+};
+
+struct IOExecutor::Worker {
+  tensorflow::mutex mu;
+  std::deque<Task*> tasks GUARDED_BY(mu);
+  // Must be destroyed before the task queue.
+  std::unique_ptr<tensorflow::Thread> thread;
+};
+
+IOExecutor::IOExecutor(const std::string& name, int64 max_threads,
+                       const tensorflow::ThreadOptions& options)
+    : name_(name),
+      max_threads_(max_threads),
+      options_(options),
+      cancelled_(false),
+      num_unfinished_tasks_(0) {}
+
+IOExecutor::~IOExecutor() { Stop(); }
+
+void IOExecutor::AddTask(const std::string& name, IOTaskFunction fn,
+                         int64 priority, IOOccupancyFunction occupancy) {
+  CHECK(!started_);
+  auto task = absl::make_unique<Task>();
+  task->name = name;
+  task->fn = std::move(fn);
+  task->priority = std::max<int64>(priority, 0);
+  task->occupancy = std::move(occupancy);
+  tasks_.push_back(std::move(task));
+}
+
+void IOExecutor::Start() {
+  CHECK(!started_);
+  started_ = true;
+  if (tasks_.empty()) {
+    return;
+  }
+
+  const int64 num_tasks = tasks_.size();
+  const int64 num_threads =
+      max_threads_ > 0 ? std::min(max_threads_, num_tasks) : num_tasks;
+  for (int64 i = 0; i != num_threads; ++i) {
+    workers_.push_back(absl::make_unique<Worker>());
+  }
+
+  // Distribute the tasks between the threads, highest priority first so that
+  // they are spread out.
+  std::vector<Task*> tasks(num_tasks);
+  std::transform(tasks_.begin(), tasks_.end(), tasks.begin(),
+                 [](const std::unique_ptr<Task>& task) { return task.get(); });
+  std::stable_sort(tasks.begin(), tasks.end(),
+                   [](const Task* a, const Task* b) {
+                     return a->priority > b->priority;
+                   });
+  for (int64 i = 0; i != num_tasks; ++i) {
+    Worker* worker = workers_[i % num_threads].get();
+    tensorflow::mutex_lock lk(worker->mu);
+    worker->tasks.push_back(tasks[i]);
+  }
+  num_unfinished_tasks_ = num_tasks;
+
+  for (int64 i = 0; i != num_threads; ++i) {
+    Worker* worker = workers_[i].get();
+    worker->thread.reset(tensorflow::Env::Default()->StartThread(
+        options_, absl::StrCat(name_, "/", i), [this, worker]() {
+          // StartThread currently ignores `options`.
+          // Explicitly set the NUMA node if one was requested.
+          if (options_.numa_node != tensorflow::port::kNUMANoAffinity) {
+            tensorflow::port::NUMASetThreadNodeAffinity(options_.numa_node);
+          }
+          RunWorker(worker);
+        }));
+  }
+}
+
+void IOExecutor::Stop() {
+  cancelled_ = true;
+  // The destructor of each thread blocks until it has joined.
+  for (auto& worker : workers_) {
+    worker->thread.reset();
+  }
+}
+
+int64 IOExecutor::NumThreads() const { return workers_.size(); }
+
+std::vector<IOTaskStats> IOExecutor::GetStats() const {
+  std::vector<IOTaskStats> stats;
+  stats.reserve(tasks_.size());
+  for (const auto& task : tasks_) {
+    IOTaskStats task_stats;
+    task_stats.name = task->name;
+    task_stats.priority = task->priority;
+    task_stats.busy_steps = task->busy_steps;
+    task_stats.idle_steps = task->idle_steps;
+    const int64 samples = task->occupancy_samples;
+    if (samples) {
+      task_stats.mean_occupancy =
+          task->occupancy_sum / (kOccupancyScale * samples);
+      task_stats.empty_fraction =
+          static_cast<double>(task->empty_samples) / samples;
+      task_stats.full_fraction =
+          static_cast<double>(task->full_samples) / samples;
+    }
+    stats.push_back(task_stats);
+  }
+  return stats;
+}
+
+IOExecutor::Task* IOExecutor::TakeTask(Worker* worker) {
+  {
+    tensorflow::mutex_lock lk(worker->mu);
+    if (!worker->tasks.empty()) {
+      Task* task = worker->tasks.front();
+      worker->tasks.pop_front();
+      return task;
+    }
+  }
+
+  // Steal from the back of another thread's queue.
+  for (auto& other : workers_) {
+    if (other.get() == worker) {
+      continue;
+    }
+    tensorflow::mutex_lock lk(other->mu);
+    if (!other->tasks.empty()) {
+      Task* task = other->tasks.back();
+      other->tasks.pop_back();
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void IOExecutor::RunWorker(Worker* worker) {
+  int64 idle_steps = 0;
+  while (num_unfinished_tasks_) {
+    // A thread finds no task when all the remaining tasks are being run by
+    // other threads, in which case it counts as idle.
+    Task* task = TakeTask(worker);
+    bool finished = false;
+    bool idle = task == nullptr;
+    for (int64 i = 0; task && i <= task->priority && !finished && !idle;
+         ++i) {
+      if (task->occupancy) {
+        const double occupancy = task->occupancy();
+        task->occupancy_samples++;
+        task->occupancy_sum += static_cast<int64>(occupancy * kOccupancyScale);
+        if (occupancy <= 0.0) {
+          task->empty_samples++;
+        } else if (occupancy >= 1.0) {
+          task->full_samples++;
+        }
+      }
+
+      StatusOr<IOTaskState> state_or = task->fn(cancelled_);
+      if (!state_or.ok()) {
+        LOG(INFO) << "IO task " << task->name << " has finished with status: "
+                  << state_or.status().ToString();
+        finished = true;
+        break;
+      }
+
+      switch (state_or.ValueOrDie()) {
+        case IOTaskState::kBusy: {
+          task->busy_steps++;
+          break;
+        }
+        case IOTaskState::kIdle: {
+          task->idle_steps++;
+          idle = true;
+          break;
+        }
+        case IOTaskState::kFinished: {
+          finished = true;
+          break;
+        }
+      }
+    }
+
+    if (finished) {
+      num_unfinished_tasks_--;
+    } else if (task) {
+      tensorflow::mutex_lock lk(worker->mu);
+      worker->tasks.push_back(task);
+    }
+
+    // Back off when the tasks have nothing to do for a while.
+    idle_steps = idle ? idle_steps + 1 : 0;
+    if (idle_steps > kIdleStepsBeforeSleep) {
+      tensorflow::Env::Default()->SleepForMicroseconds(kIdleSleepMicros);
+    } else if (idle_steps > kIdleStepsBeforeYield) {
+      std::this_thread::yield();
+    }
+  }
+}
+
 }  // namespace poplarplugin
 }  // namespace xla
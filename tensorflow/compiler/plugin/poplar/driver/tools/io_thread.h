@@ -16,11 +16,16 @@ limitations under the License.
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_IO_THREAD_H_
 
 #include <atomic>
+#include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "tensorflow/compiler/xla/status.h"
+#include "tensorflow/compiler/xla/statusor.h"
+#include "tensorflow/compiler/xla/types.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace xla {
 namespace poplarplugin {
@@ -47,6 +52,89 @@ class IOThread {
   TF_DISALLOW_COPY_AND_ASSIGN(IOThread);
 };
 
+// The state of an IO task after running one step of it.
+enum class IOTaskState {
+  // The task made progress and should be run again as soon as possible.
+  kBusy,
+  // The task could not make progress, for example because its queues are full.
+  kIdle,
+  // The task has finished and should not be run again.
+  kFinished,
+};
+
+// A single step of an IO task. A step should only do a bounded amount of work
+// and return rather than wait for its queues, so that one thread can service
+// many tasks. The `cancelled` parameter indicates that the task should finish.
+using IOTaskFunction = std::function<StatusOr<IOTaskState>(bool cancelled)>;
+
+// Returns how full the queues of an IO task are, between 0 and 1.
+using IOOccupancyFunction = std::function<double()>;
+
+// Statistics collected for a single IO task.
+struct IOTaskStats {
+  std::string name;
+  int64 priority = 0;
+  int64 busy_steps = 0;
+  int64 idle_steps = 0;
+  // The queue occupancy is sampled before every step.
+  double mean_occupancy = 0.0;
+  double empty_fraction = 0.0;
+  double full_fraction = 0.0;
+};
+
+// Runs the steps of many IO tasks on a small pool of threads.
+//
+// Each thread has a queue of tasks. A thread takes a task from the front of
+// its own queue, runs `priority + 1` steps of it (or fewer if the task goes
+// idle), and then moves it to the back of its queue. A thread with no tasks
+// steals one from the back of another thread's queue. Threads back off when
+// all their tasks are idle instead of spinning.
+class IOExecutor {
+ public:
+  // Creates an executor which uses at most `max_threads` threads. A
+  // non-positive value uses one thread per task.
+  IOExecutor(const std::string& name, int64 max_threads,
+             const tensorflow::ThreadOptions& options = {});
+  // Destroying the executor stops it.
+  ~IOExecutor();
+
+  // Add a task. Tasks can only be added before the executor is started.
+  void AddTask(const std::string& name, IOTaskFunction fn, int64 priority = 0,
+               IOOccupancyFunction occupancy = nullptr);
+
+  // Start the threads.
+  void Start();
+
+  // Cancel all the tasks and block until they have finished and the threads
+  // have joined.
+  void Stop();
+
+  // The number of threads running the tasks.
+  int64 NumThreads() const;
+
+  // The statistics of each task.
+  std::vector<IOTaskStats> GetStats() const;
+
+ private:
+  struct Task;
+  struct Worker;
+
+  void RunWorker(Worker* worker);
+  Task* TakeTask(Worker* worker);
+
+  const std::string name_;
+  const int64 max_threads_;
+  const tensorflow::ThreadOptions options_;
+
+  std::vector<std::unique_ptr<Task>> tasks_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<bool> cancelled_;
+  std::atomic<int64> num_unfinished_tasks_;
+  bool started_ = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(IOExecutor);
+};
+
 }  // namespace poplarplugin
 }  // namespace xla
 
@@ -0,0 +1,85 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/liveness_util.h"
+
+#include <algorithm>
+
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
+#include "tensorflow/compiler/xla/service/hlo_instruction.h"
+#include "tensorflow/compiler/xla/shape_util.h"
+
+namespace xla {
+namespace poplarplugin {
+
+int64 GetArrayByteSize(const Shape& shape,
+                       const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  int64 bytes = 0;
+  ShapeUtil::ForEachSubshape(
+      shape, [&](const Shape& subshape, const ShapeIndex&) {
+        if (subshape.IsArray()) {
+          bytes += shape_size(subshape);
+        }
+      });
+  return bytes;
+}
+
+bool AllocatesOutput(const HloInstruction* inst) {
+  return inst->opcode() != HloOpcode::kTuple &&
+         inst->opcode() != HloOpcode::kGetTupleElement;
+}
+
+int64 EstimatePeakLiveness(
+    const HloComputation* comp,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  absl::flat_hash_map<const HloInstruction*, int64> remaining_uses;
+  for (const HloInstruction* inst : comp->instructions()) {
+    remaining_uses[inst] = inst->user_count();
+  }
+
+  int64 live = 0;
+  int64 peak = 0;
+  for (const HloInstruction* inst : comp->MakeInstructionPostOrder()) {
+    if (AllocatesOutput(inst)) {
+      live += GetArrayByteSize(inst->shape(), shape_size);
+    }
+    peak = std::max(peak, live);
+    for (const HloInstruction* operand : inst->unique_operands()) {
+      if (--remaining_uses[operand] == 0 && AllocatesOutput(operand) &&
+          operand != comp->root_instruction()) {
+        live -= GetArrayByteSize(operand->shape(), shape_size);
+      }
+    }
+  }
+  return peak;
+}
+
+StatusOr<absl::flat_hash_map<const HloInstruction*, int64>>
+GetInstructionFlops(HloComputation* comp,
+                    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  HloCostAnalysis analysis(shape_size);
+  TF_RETURN_IF_ERROR(comp->Accept(&analysis));
+
+  absl::flat_hash_map<const HloInstruction*, int64> flops;
+  for (const HloInstruction* inst : comp->instructions()) {
+    // Unknown costs (such as custom calls) are reported as negative numbers.
+    flops[inst] = std::max<int64>(analysis.flop_count(*inst), 0) +
+                  std::max<int64>(analysis.transcendental_count(*inst), 0);
+  }
+  return flops;
+}
+
+}  // namespace poplarplugin
+}  // namespace xla
@@ -0,0 +1,54 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_LIVENESS_UTIL_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_LIVENESS_UTIL_H_
+
+#include "absl/container/flat_hash_map.h"
+#include "tensorflow/compiler/xla/service/hlo_cost_analysis.h"
+#include "tensorflow/compiler/xla/statusor.h"
+#include "tensorflow/compiler/xla/types.h"
+
+namespace xla {
+class HloComputation;
+class HloInstruction;
+class Shape;
+
+namespace poplarplugin {
+
+// Returns the number of bytes of all the arrays in the shape.
+int64 GetArrayByteSize(const Shape& shape,
+                       const HloCostAnalysis::ShapeSizeFunction& shape_size);
+
+// Returns whether the instruction allocates the arrays in its shape, rather
+// than forwarding the arrays of its operands.
+bool AllocatesOutput(const HloInstruction* inst);
+
+// Estimates the peak number of bytes which are live when the instructions of
+// the computation are executed in post order.
+int64 EstimatePeakLiveness(
+    const HloComputation* comp,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size);
+
+// Returns the number of floating point and transcendental operations done by
+// each instruction of the computation, with unknown costs counted as zero.
+StatusOr<absl::flat_hash_map<const HloInstruction*, int64>>
+GetInstructionFlops(HloComputation* comp,
+                    const HloCostAnalysis::ShapeSizeFunction& shape_size);
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_LIVENESS_UTIL_H_
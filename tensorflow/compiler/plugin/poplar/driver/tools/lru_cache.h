@@ -0,0 +1,112 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_LRU_CACHE_H_
+#define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_LRU_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
+
+namespace xla {
+namespace poplarplugin {
+
+// A map which holds at most `capacity` values, evicting the least recently
+// used value to make room for a new one. It is not thread safe.
+template <typename Key, typename Value>
+class LRUCache {
+ public:
+  explicit LRUCache(std::size_t capacity) : capacity_(capacity) {}
+
+  std::size_t Capacity() const { return capacity_; }
+  std::size_t Size() const { return entries_.size(); }
+
+  // Returns the value for `key` and marks it as the most recently used one, or
+  // nullptr if there is no value for `key`.
+  Value* Lookup(const Key& key) {
+    auto itr = index_.find(key);
+    if (itr == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, itr->second);
+    return &itr->second->second;
+  }
+
+  // The values taken out of the cache by Insert, so that the caller can choose
+  // where they are destroyed.
+  struct InsertResult {
+    // The previous value for the key, if it was already in the cache.
+    absl::optional<Value> replaced;
+    // The values which were evicted to make room for the new one. A cache with
+    // no capacity evicts the new value itself.
+    std::vector<Value> evicted;
+  };
+
+  // Inserts or replaces the value for `key`, marking it as the most recently
+  // used one.
+  InsertResult Insert(const Key& key, Value value) {
+    InsertResult result;
+    if (capacity_ == 0) {
+      result.evicted.push_back(std::move(value));
+      return result;
+    }
+
+    auto itr = index_.find(key);
+    if (itr != index_.end()) {
+      result.replaced = std::move(itr->second->second);
+      itr->second->second = std::move(value);
+      entries_.splice(entries_.begin(), entries_, itr->second);
+      return result;
+    }
+
+    while (entries_.size() >= capacity_) {
+      index_.erase(entries_.back().first);
+      result.evicted.push_back(std::move(entries_.back().second));
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_[key] = entries_.begin();
+    return result;
+  }
+
+  // Removes every value, returning them.
+  std::vector<Value> Clear() {
+    std::vector<Value> evicted;
+    evicted.reserve(entries_.size());
+    for (auto& entry : entries_) {
+      evicted.push_back(std::move(entry.second));
+    }
+    entries_.clear();
+    index_.clear();
+    return evicted;
+  }
+
+ private:
+  using Entry = std::pair<Key, Value>;
+
+  const std::size_t capacity_;
+  // Ordered from the most to the least recently used.
+  std::list<Entry> entries_;
+  absl::flat_hash_map<Key, typename std::list<Entry>::iterator> index_;
+};
+
+}  // namespace poplarplugin
+}  // namespace xla
+
+#endif  // TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_LRU_CACHE_H_
@@ -22,6 +22,7 @@ limitations under the License.
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/fifo.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/ipu_inter_copy.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/custom_ops/stateful_noop.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/liveness_util.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/matcher_predicates.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
 #include "tensorflow/compiler/xla/service/call_graph.h"
@@ -998,6 +999,40 @@ StatusOr<int> GetFifoDepthMultiplier(const HloInstruction* pipeline_op) {
   }
 }
 
+StatusOr<PipelineStageMemory> GetPipelineStageMemory(
+    HloInstruction* fwd_stage, HloInstruction* bwd_stage,
+    const std::vector<const HloInstruction*>& stashed,
+    const std::vector<const HloInstruction*>& recomputed_stashed,
+    const std::vector<const HloInstruction*>& recomputed, int64 fifo_depth,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size) {
+  PipelineStageMemory memory;
+  memory.device = GetSingleShardingDeviceId(fwd_stage);
+  memory.peak_bytes =
+      EstimatePeakLiveness(fwd_stage->to_apply(), shape_size) +
+      EstimatePeakLiveness(bwd_stage->to_apply(), shape_size);
+
+  // A FIFO holds a copy of the tensor for each step it is delayed by, and
+  // without a FIFO the tensor is still live until the backward stage.
+  const int64 copies = std::max<int64>(fifo_depth, 1);
+  for (const HloInstruction* inst : stashed) {
+    memory.stashed_bytes +=
+        copies * GetArrayByteSize(inst->shape(), shape_size);
+  }
+  for (const HloInstruction* inst : recomputed_stashed) {
+    memory.recomputed_stashed_bytes +=
+        copies * GetArrayByteSize(inst->shape(), shape_size);
+  }
+
+  if (!recomputed.empty()) {
+    TF_ASSIGN_OR_RETURN(auto flops,
+                        GetInstructionFlops(fwd_stage->to_apply(), shape_size));
+    for (const HloInstruction* inst : recomputed) {
+      memory.recomputation_flops += flops[inst];
+    }
+  }
+  return memory;
+}
+
 Status RemoveOutputsFromCall(HloInstruction* call,
                              const std::set<int64>& outputs_to_remove) {
   // Nothing to remove.
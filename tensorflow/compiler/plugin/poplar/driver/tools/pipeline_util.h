@@ -21,6 +21,7 @@ limitations under the License.
 
 #include "absl/container/flat_hash_map.h"
 #include "tensorflow/compiler/plugin/poplar/driver/backend_config.pb.h"
+#include "tensorflow/compiler/xla/service/hlo_cost_analysis.h"
 #include "tensorflow/compiler/xla/service/hlo_instruction.h"
 #include "tensorflow/compiler/xla/service/hlo_value.h"
 #include "tensorflow/compiler/xla/statusor.h"
@@ -201,6 +202,32 @@ GetPipelineSchedule(const HloInstruction* pipeline_op);
 // operation.
 StatusOr<int> GetFifoDepthMultiplier(const HloInstruction* pipeline_op);
 
+// The estimated memory of a forward pipeline stage, used to decide whether it
+// should be recomputed.
+struct PipelineStageMemory {
+  int64 device = 0;
+  // The peak liveness of the forward and backward stage computations.
+  int64 peak_bytes = 0;
+  // The bytes stashed for the backward stage, and the bytes which still need
+  // to be stashed when the stage is recomputed instead.
+  int64 stashed_bytes = 0;
+  int64 recomputed_stashed_bytes = 0;
+  // The number of operations done again when the stage is recomputed.
+  int64 recomputation_flops = 0;
+};
+
+// Estimate the memory of a forward stage and its backward stage. Without
+// recomputation the `stashed` instructions are stashed for the backward stage,
+// whereas recomputing the `recomputed` instructions of the forward stage
+// stashes the `recomputed_stashed` instructions instead. Each stashed tensor
+// is held `fifo_depth` times, and at least once when there is no FIFO.
+StatusOr<PipelineStageMemory> GetPipelineStageMemory(
+    HloInstruction* fwd_stage, HloInstruction* bwd_stage,
+    const std::vector<const HloInstruction*>& stashed,
+    const std::vector<const HloInstruction*>& recomputed_stashed,
+    const std::vector<const HloInstruction*>& recomputed, int64 fifo_depth,
+    const HloCostAnalysis::ShapeSizeFunction& shape_size);
+
 // Removes outputs from the call, and GTEs which are not used by anything.
 Status RemoveOutputsFromCall(HloInstruction* call,
                              const std::set<int64>& outputs_to_remove);
@@ -352,6 +352,23 @@ StatusOr<std::string> GetInstructionCompilationInfo(
   Json::Value root;
   root["ml_types"] = ml_types;
 
+  if (!res.selected_schedulers.empty()) {
+    Json::Value selected_schedulers;
+    for (auto& pair : res.selected_schedulers) {
+      selected_schedulers[pair.first] = pair.second;
+    }
+    root["selected_schedulers"] = selected_schedulers;
+  }
+
+  Json::Value graph_caching;
+  graph_caching["hits"] = Json::Value::Int64(res.graph_cache.HitCount());
+  graph_caching["misses"] = Json::Value::Int64(res.graph_cache.MissCount());
+  graph_caching["subcomputation_hits"] =
+      Json::Value::Int64(res.subcomputation_cache.HitCount());
+  graph_caching["subcomputation_misses"] =
+      Json::Value::Int64(res.subcomputation_cache.MissCount());
+  root["graph_caching"] = graph_caching;
+
   Json::StreamWriterBuilder json_builder;
   json_builder["indentation"] = "";
   json_builder["commentStyle"] = "None";
@@ -66,8 +66,7 @@ class SPSCOutfeedQueue : SPSCQueue<void*, Capacity> {
    */
   inline void*& BlockBack() {
     std::atomic_fetch_add(&items_waiting_, std::size_t{1});
-    while (SPSCQueue<void*, Capacity>::IsFull()) {
-    }
+    SPSCQueue<void*, Capacity>::WaitUntilNotFull();
 
     return buffer_[write_position_];
   }
@@ -88,8 +87,7 @@ class SPSCOutfeedQueue : SPSCQueue<void*, Capacity> {
    * \param item The element to push.
    */
   inline void*& BlockFront() {
-    while (SPSCQueue<void*, Capacity>::IsEmpty()) {
-    }
+    SPSCQueue<void*, Capacity>::WaitUntilNotEmpty();
 
     return buffer_[read_position_];
   }
@@ -114,6 +112,9 @@ class SPSCOutfeedQueue : SPSCQueue<void*, Capacity> {
     return std::atomic_load(&items_waiting_);
   }
 
+  using SPSCQueue<void*, Capacity>::MaxSize;
+  using SPSCQueue<void*, Capacity>::Size;
+
   using SPSCQueue<void*, Capacity>::buffer_;
   using SPSCQueue<void*, Capacity>::write_position_;
   using SPSCQueue<void*, Capacity>::read_position_;
@@ -16,13 +16,25 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_SPSC_QUEUE_H_
 #define TENSORFLOW_COMPILER_PLUGIN_POPLAR_DRIVER_TOOLS_SPSC_QUEUE_H_
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <bitset>
 #include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <thread>
 #include <vector>
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace xla {
 namespace poplarplugin {
 
@@ -30,6 +42,130 @@ namespace {
 constexpr bool is_powerof2(std::size_t v) { return v && ((v & (v - 1)) == 0); }
 }  // namespace
 
+/**
+ * Adaptive wait for a condition which is made true by another thread.
+ *
+ * The waiting thread first spins, then yields its time slice, and finally
+ * sleeps on a futex until the other thread calls Notify. Notify only makes a
+ * system call when a thread is actually sleeping, so the common case where the
+ * condition becomes true while spinning stays cheap.
+ */
+class SPSCWaiter {
+ public:
+  SPSCWaiter() : epoch_(0), sleepers_(0), missed_notifications_(0) {}
+
+  /**
+   * Block until the given predicate returns true.
+   *
+   * \param predicate A callable with signature `bool()`.
+   */
+  template <typename Predicate>
+  inline void Wait(Predicate predicate) {
+    for (int i = 0; i != kSpinIterations; ++i) {
+      if (predicate()) {
+        return;
+      }
+      Pause();
+    }
+
+    for (int i = 0; i != kYieldIterations; ++i) {
+      if (predicate()) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+
+    while (true) {
+      const uint32_t epoch = epoch_.load(std::memory_order_acquire);
+      sleepers_.fetch_add(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (predicate()) {
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+      Sleep(epoch);
+      sleepers_.fetch_sub(1, std::memory_order_relaxed);
+      if (predicate()) {
+        if (epoch_.load(std::memory_order_relaxed) == epoch) {
+          missed_notifications_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+      }
+    }
+  }
+
+  /**
+   * Wake up any thread sleeping in Wait. This must be called after the
+   * condition has been made true.
+   *
+   * The common case, with no thread sleeping, is a single load. Unless
+   * `fence` is set this load may be ordered before the store which made the
+   * condition true, so a thread which is just going to sleep can be missed.
+   * That thread then sleeps until the next notification, or at most for the
+   * timeout in Sleep, and is counted in MissedNotifications.
+   *
+   * \param fence Whether to order the store which made the condition true
+   *        before checking for sleeping threads, so that none is missed.
+   */
+  inline void Notify(bool fence = false) {
+    if (fence) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    if (sleepers_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+
+    // The release orders the store which made the condition true before the
+    // new epoch, which the woken thread observes before checking it again.
+    epoch_.fetch_add(1, std::memory_order_release);
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+  /**
+   * The number of times a sleeping thread found the condition true when it
+   * woke up without having been notified.
+   *
+   * \return The number of missed notifications.
+   */
+  inline uint64_t MissedNotifications() const {
+    return missed_notifications_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr int kSpinIterations = 2048;
+  static constexpr int kYieldIterations = 64;
+
+  static inline void Pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  // Sleep until the epoch changes. The timeout bounds the cost of any missed
+  // notification.
+  inline void Sleep(uint32_t epoch) {
+#if defined(__linux__)
+    struct timespec timeout = {0, 1000000};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAIT_PRIVATE, epoch, &timeout, nullptr, 0);
+#else
+    if (epoch_.load(std::memory_order_acquire) == epoch) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+#endif
+  }
+
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "The futex word must be a plain 32 bit integer");
+
+  std::atomic<uint32_t> epoch_;
+  std::atomic<uint32_t> sleepers_;
+  std::atomic<uint64_t> missed_notifications_;
+};
+
 /**
  * Statically bounded single-producer/single-consumer lock-free queue.
  *
@@ -61,16 +197,18 @@ class SPSCQueue {
    *       element.
    */
   explicit SPSCQueue(T init, std::function<void(T&)> post_apply)
-      : size_(0),
+      : write_count_(0),
         write_position_(0),
+        cached_read_count_(0),
+        read_count_(0),
         read_position_(0),
+        cached_write_count_(0),
         post_apply_(post_apply) {
     assert(post_apply);
     std::fill(buffer_.begin(), buffer_.end(), init);
   }
 
   ~SPSCQueue() {
-    std::atomic_store(&size_, std::size_t{0});
     for (auto& elem : buffer_) {
       post_apply_(elem);
     }
@@ -80,10 +218,14 @@ class SPSCQueue {
    * Advance the write position of the queue.
    * This is only safe to call on the same thread which pushes to the queue.
    *
+   * Advancing by more than one element fences before notifying the consumer,
+   * as the cost of the fence is shared by the whole batch.
    */
-  inline void AdvanceWritePosition() {
-    write_position_ = (write_position_ + 1) % Capacity;
-    std::atomic_fetch_add(&size_, std::size_t{1});
+  inline void AdvanceWritePosition(std::size_t count = 1) {
+    write_position_ = (write_position_ + count) % Capacity;
+    write_count_.store(write_count_.load(std::memory_order_relaxed) + count,
+                       std::memory_order_release);
+    not_empty_.Notify(count > 1);
   }
 
   /**
@@ -107,8 +249,7 @@ class SPSCQueue {
    * \param item The element to push.
    */
   inline void BlockPush(const T& item) {
-    while (IsFull()) {
-    }
+    WaitUntilNotFull();
 
     Push(item);
   }
@@ -122,7 +263,7 @@ class SPSCQueue {
    * \return true if the element was successfully pushed, otherwise false.
    */
   inline bool TryPush(const T& item) {
-    if (IsFull()) {
+    if (!ProducerSpace()) {
       return false;
     }
 
@@ -130,14 +271,67 @@ class SPSCQueue {
     return true;
   }
 
+  /**
+   * Push up to `count` elements into the queue and advance the write position
+   * past them with a single atomic update.
+   *
+   * \param items The elements to push.
+   * \param count The number of elements to push.
+   *
+   * \return The number of elements pushed, which is less than `count` when
+   *         the queue does not have enough space.
+   */
+  inline std::size_t TryPushN(const T* items, std::size_t count) {
+    count = std::min(count, ProducerSpace(count));
+
+    for (std::size_t i = 0; i != count; ++i) {
+      T& slot = buffer_[(write_position_ + i) % Capacity];
+      post_apply_(slot);
+      slot = items[i];
+    }
+
+    if (count) {
+      AdvanceWritePosition(count);
+    }
+    return count;
+  }
+
+  /**
+   * Similar to TryPushN, except it will block until all the elements have been
+   * pushed.
+   *
+   * \param items The elements to push.
+   * \param count The number of elements to push.
+   */
+  inline void BlockPushN(const T* items, std::size_t count) {
+    while (count) {
+      WaitUntilNotFull();
+      const std::size_t pushed = TryPushN(items, count);
+      items += pushed;
+      count -= pushed;
+    }
+  }
+
+  /**
+   * Block until the queue is not full. This is only safe to call on the same
+   * thread which pushes to the queue.
+   */
+  inline void WaitUntilNotFull() {
+    not_full_.Wait([this]() { return ProducerSpace() != 0; });
+  }
+
   /**
    * Advance the read position of the queue.
    * This is only safe to call on the same thread which pops from the queue.
    *
+   * Advancing by more than one element fences before notifying the producer,
+   * as the cost of the fence is shared by the whole batch.
    */
-  inline void AdvanceReadPosition() {
-    read_position_ = (read_position_ + 1) % Capacity;
-    std::atomic_fetch_sub(&size_, std::size_t{1});
+  inline void AdvanceReadPosition(std::size_t count = 1) {
+    read_position_ = (read_position_ + count) % Capacity;
+    read_count_.store(read_count_.load(std::memory_order_relaxed) + count,
+                      std::memory_order_release);
+    not_full_.Notify(count > 1);
   }
 
   /**
@@ -150,8 +344,7 @@ class SPSCQueue {
    * position.
    */
   inline void Pop(T& item, std::size_t look_ahead = 0) {
-    assert(!IsEmpty());
-    assert(std::atomic_load(&size_) > look_ahead);
+    assert(ConsumerSize(look_ahead + 1) > look_ahead);
 
     item = buffer_[(read_position_ + look_ahead) % Capacity];
   }
@@ -162,8 +355,7 @@ class SPSCQueue {
    * \param item The element to pop into.
    */
   inline void BlockPop(T& item, std::size_t look_ahead = 0) {
-    while (std::atomic_load(&size_) <= look_ahead) {
-    }
+    WaitUntilNotEmpty(look_ahead);
 
     Pop(item, look_ahead);
   }
@@ -177,7 +369,7 @@ class SPSCQueue {
    * \return true if the element was successfully poped, otherwise false.
    */
   inline bool TryPop(T& item, std::size_t look_ahead = 0) {
-    if (std::atomic_load(&size_) <= look_ahead) {
+    if (ConsumerSize(look_ahead + 1) <= look_ahead) {
       return false;
     }
 
@@ -185,30 +377,160 @@ class SPSCQueue {
     return true;
   }
 
+  /**
+   * Pop `count` elements from the queue.
+   *
+   * \param items The elements to pop into.
+   * \param count The number of elements to pop.
+   *
+   * \note This function won't block, but assumes there are at least
+   * `look_ahead + count` elements and it does not advance the read position.
+   * As with Pop, the caller advances the read position past the elements once
+   * it has finished with them, because the producer calls `post_apply` on the
+   * slots as soon as they are handed back.
+   */
+  inline void PopN(T* items, std::size_t count, std::size_t look_ahead = 0) {
+    assert(ConsumerSize(look_ahead + count) >= look_ahead + count);
+
+    for (std::size_t i = 0; i != count; ++i) {
+      items[i] = buffer_[(read_position_ + look_ahead + i) % Capacity];
+    }
+  }
+
+  /**
+   * Similar to PopN, except it pops up to `count` elements and returns how
+   * many were popped.
+   *
+   * \param items The elements to pop into.
+   * \param count The maximum number of elements to pop.
+   *
+   * \return The number of elements popped.
+   */
+  inline std::size_t TryPopN(T* items, std::size_t count,
+                             std::size_t look_ahead = 0) {
+    const std::size_t size = ConsumerSize(look_ahead + count);
+    if (size <= look_ahead) {
+      return 0;
+    }
+
+    count = std::min(count, size - look_ahead);
+    PopN(items, count, look_ahead);
+    return count;
+  }
+
+  /**
+   * Similar to TryPopN, except it will block until at least one element is
+   * available.
+   *
+   * \param items The elements to pop into.
+   * \param count The maximum number of elements to pop.
+   *
+   * \return The number of elements popped.
+   */
+  inline std::size_t BlockPopN(T* items, std::size_t count,
+                               std::size_t look_ahead = 0) {
+    WaitUntilNotEmpty(look_ahead);
+    return TryPopN(items, count, look_ahead);
+  }
+
+  /**
+   * Block until the queue has more than `look_ahead` elements. This is only
+   * safe to call on the same thread which pops from the queue.
+   */
+  inline void WaitUntilNotEmpty(std::size_t look_ahead = 0) {
+    not_empty_.Wait([this, look_ahead]() {
+      return ConsumerSize(look_ahead + 1) > look_ahead;
+    });
+  }
+
   /**
    * Test whether the queue is full.
    *
    * \return True if the queue is full, otherwise false.
    */
-  inline bool IsFull() const {
-    return std::atomic_load(&size_) >= Capacity - 8;
-  }
+  inline bool IsFull() const { return Size() >= kUsableCapacity; }
 
   /**
    * Test whether the queue is empty.
    *
    * \return True if the queue is empty, otherwise false.
    */
-  inline bool IsEmpty() const { return std::atomic_load(&size_) == 0; }
+  inline bool IsEmpty() const { return Size() == 0; }
+
+  /**
+   * The number of elements in the queue. This is safe to call on any thread.
+   *
+   * \return The number of elements in the queue.
+   */
+  inline std::size_t Size() const {
+    const std::size_t read_count = read_count_.load(std::memory_order_acquire);
+    return write_count_.load(std::memory_order_acquire) - read_count;
+  }
+
+  /**
+   * The maximum number of elements the queue can hold.
+   *
+   * \return The maximum number of elements.
+   */
+  static constexpr std::size_t MaxSize() { return kUsableCapacity; }
+
+  /**
+   * The number of times the producer or the consumer woke up from sleeping
+   * only because of the timeout, after the other thread had already made
+   * progress.
+   *
+   * \return The number of missed notifications.
+   */
+  inline uint64_t MissedNotifications() const {
+    return not_full_.MissedNotifications() + not_empty_.MissedNotifications();
+  }
 
  protected:
+  // A few slots are always kept free between the producer and the consumer.
+  static constexpr std::size_t kUsableCapacity = Capacity - 8;
+
+  // The number of free slots as seen by the producer. The consumer's count is
+  // only reloaded when the cached copy shows fewer than `wanted` free slots.
+  inline std::size_t ProducerSpace(std::size_t wanted = 1) {
+    const std::size_t write_count =
+        write_count_.load(std::memory_order_relaxed);
+    std::size_t space = kUsableCapacity - (write_count - cached_read_count_);
+    if (space < wanted) {
+      cached_read_count_ = read_count_.load(std::memory_order_acquire);
+      space = kUsableCapacity - (write_count - cached_read_count_);
+    }
+    return space;
+  }
+
+  // The number of elements as seen by the consumer. The producer's count is
+  // only reloaded when the cached copy shows fewer than `wanted` elements.
+  inline std::size_t ConsumerSize(std::size_t wanted = 1) {
+    const std::size_t read_count = read_count_.load(std::memory_order_relaxed);
+    std::size_t size = cached_write_count_ - read_count;
+    if (size < wanted) {
+      cached_write_count_ = write_count_.load(std::memory_order_acquire);
+      size = cached_write_count_ - read_count;
+    }
+    return size;
+  }
+
   std::array<T, Capacity> buffer_;
 
-  alignas(64) std::atomic<std::size_t> size_;
-  alignas(64) std::size_t write_position_;
-  alignas(64) std::size_t read_position_;
+  // Producer side. The counts increase monotonically, and the positions are
+  // the counts modulo the capacity.
+  alignas(64) std::atomic<std::size_t> write_count_;
+  std::size_t write_position_;
+  std::size_t cached_read_count_;
+
+  // Consumer side.
+  alignas(64) std::atomic<std::size_t> read_count_;
+  std::size_t read_position_;
+  std::size_t cached_write_count_;
+
+  alignas(64) std::function<void(T&)> post_apply_;
 
-  std::function<void(T&)> post_apply_;
+  SPSCWaiter not_full_;
+  SPSCWaiter not_empty_;
 };
 }  // namespace poplarplugin
 }  // namespace xla
@@ -24,6 +24,19 @@ namespace xla {
 namespace poplarplugin {
 namespace subcomputation_graph_caching {
 
+size_t SubcomputationGraphCache::StructuralHash::operator()(
+    const HloComputation* computation) const {
+  return cache->GetStructuralKey(computation);
+}
+
+SubcomputationGraphCache::SubcomputationGraphCache()
+    : table_(/*bucket_count=*/0, StructuralHash{this}) {}
+
+uint64 SubcomputationGraphCache::GetStructuralKey(
+    const HloComputation* computation) {
+  return structural_hash_.GetComputationHash(computation);
+}
+
 StatusOr<std::shared_ptr<DeferredVisitor>>
 SubcomputationGraphCache::GetOrCompileSubcomputation(
     CompilerResources& res, TensorOrRemoteBufferVectors& inputs,
@@ -31,7 +44,10 @@ SubcomputationGraphCache::GetOrCompileSubcomputation(
   DeferredArgRBVectors deferred_inputs = ConvertInputsToDeferredInputs(inputs);
   auto itr = table_.find(computation);
   if (itr == table_.end()) {
-    VLOG(2) << "Compiling sub-computation " << computation->name();
+    miss_count_++;
+    VLOG(2) << "Compiling sub-computation " << computation->name()
+            << " (structural key 0x" << std::hex
+            << GetStructuralKey(computation) << std::dec << ")";
     XLA_VLOG_LINES(2, computation->ToString());
 
     auto order =
@@ -49,6 +65,7 @@ SubcomputationGraphCache::GetOrCompileSubcomputation(
     }
     itr = table_.emplace(computation, deferred_visitor).first;
   } else {
+    hit_count_++;
     VLOG(1) << "Computation " << computation->name()
             << " has already been compiled, reusing the code.";
   }
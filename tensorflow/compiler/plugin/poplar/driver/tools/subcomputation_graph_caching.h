@@ -23,6 +23,7 @@ limitations under the License.
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "tensorflow/compiler/plugin/poplar/driver/ops/ops.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_hash.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/poplar_util.h"
 #include "tensorflow/compiler/plugin/poplar/driver/visitors/deferred_visitor.h"
 #include "tensorflow/compiler/xla/status.h"
@@ -35,15 +36,41 @@ namespace subcomputation_graph_caching {
 
 class SubcomputationGraphCache {
  public:
+  SubcomputationGraphCache();
+
   // Get or compile the DeferredVisitor for a computation.
   StatusOr<std::shared_ptr<DeferredVisitor>> GetOrCompileSubcomputation(
       CompilerResources& res, TensorOrRemoteBufferVectors& inputs,
       const HloComputation* computation);
 
+  // The number of times a compiled computation was reused, and the number of
+  // computations which had to be compiled.
+  int64 HitCount() const { return hit_count_; }
+  int64 MissCount() const { return miss_count_; }
+
+  // A key for the computation which only depends on its structure. It is
+  // stable between compilations, but it is a hash so equal keys do not
+  // guarantee that the computations are equal.
+  uint64 GetStructuralKey(const HloComputation* computation);
+
  private:
+  // Hashes the whole computation rather than just its parameters and root, so
+  // that computations with the same interface but different bodies, such as
+  // different transformer layers, do not all land in the same bucket.
+  struct StructuralHash {
+    size_t operator()(const HloComputation* computation) const;
+    SubcomputationGraphCache* cache;
+  };
+
+  // Must be declared before the table as its hash function uses it.
+  HloStructuralHash structural_hash_;
   std::unordered_map<const HloComputation*, std::shared_ptr<DeferredVisitor>,
-                     HloComputationHash, HloComputationEquals>
+                     StructuralHash, HloComputationEquals>
       table_;
+  int64 hit_count_ = 0;
+  int64 miss_count_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(SubcomputationGraphCache);
 };
 
 }  // namespace subcomputation_graph_caching
@@ -13,6 +13,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
+#include <cmath>
 #include <poplar/DeviceManager.hpp>
 #include <poplar/Engine.hpp>
 #include <poplar/Tensor.hpp>
@@ -25,6 +27,7 @@ limitations under the License.
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_executor.h"
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_feed_config.pb.h"
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_platform.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/conversions.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_allocator.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_iterator.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/io_thread.h"
@@ -69,45 +72,107 @@ void XlaShapesFromAttr(OpKernelConstruction* ctx,
   }
 }
 
+// Returns the `percentile` of the sorted `values` using the nearest rank.
+float Percentile(const std::vector<float>& values, float percentile) {
+  CHECK(!values.empty());
+  const size_t rank = static_cast<size_t>(
+      std::ceil(percentile / 100.f * static_cast<float>(values.size())));
+  return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// The consumer drains the infeed queues the way the InfeedPrefetchCallback
+// does for the device - it looks ahead by up to `prefetch_depth` elements
+// in each queue, converts the data to its device representation and only
+// advances the read position once the element has been consumed.
 xla::poplarplugin::IOFunction ConsumerThread(
     bool print_stats, uint64 number_of_epochs, uint64 elements_per_epochs,
+    int64 replication_factor, int64 prefetch_depth,
     Notification* finished_notifiation, Json::Value* stats_json,
     xla::poplarplugin::InfeedIterator* itr) {
   return [=](std::atomic<bool>& cancelled) {
     Json::Value epochs(Json::arrayValue);
 
-    // We only ever have a single replica.
-    const size_t replica_id = 0;
     auto queues = itr->GetInfeedQueues();
     auto shapes = itr->GetShapes();
 
-    // Allocate the buffers we copy into.
-    std::vector<void*> buffers(shapes.size());
-    std::vector<size_t> buffer_sizes(shapes.size());
+    // Allocate the buffers we copy into - each element can be prefetched into
+    // one of `prefetch_depth` buffers, like the Poplar data stream buffers.
+    std::vector<size_t> host_sizes(shapes.size());
+    std::vector<size_t> device_sizes(shapes.size());
+    std::vector<xla::poplarplugin::ConversionFn> conversions(shapes.size());
     std::size_t total_bytes = 0;
     for (uint64 i = 0; i != shapes.size(); ++i) {
-      buffer_sizes[i] = xla::ShapeUtil::ByteSizeOf(shapes[i]);
-      total_bytes += buffer_sizes[i];
-      buffers[i] = port::AlignedMalloc(buffer_sizes[i], 4096);
+      host_sizes[i] =
+          xla::ShapeUtil::ByteSizeOf(shapes[i]) / replication_factor;
+      device_sizes[i] = xla::poplarplugin::HostSizeToDeviceSize(
+          host_sizes[i], shapes[i].element_type());
+      conversions[i] = xla::poplarplugin::GetInputConversionFunction(shapes[i]);
+      total_bytes += host_sizes[i] * replication_factor;
+    }
+
+    const size_t num_queues = replication_factor * shapes.size();
+    std::vector<std::vector<void*>> buffers(num_queues);
+    for (size_t q = 0; q != num_queues; ++q) {
+      for (int64 d = 0; d != prefetch_depth; ++d) {
+        buffers[q].push_back(
+            port::AlignedMalloc(device_sizes[q % shapes.size()], 4096));
+      }
     }
+    std::vector<int64> look_ahead(num_queues, 0);
+    std::vector<uint64> read_index(num_queues, 0);
+
+    auto copy_to_device = [&](size_t q, tensorflow::TensorBuffer* buf) {
+      const size_t k = q % shapes.size();
+      void* dst = buffers[q][(read_index[q] + look_ahead[q]) % prefetch_depth];
+      if (conversions[k]) {
+        std::vector<char> converted =
+            conversions[k](buf->data(), host_sizes[k], 0);
+        std::memcpy(dst, converted.data(), device_sizes[k]);
+      } else {
+        std::memcpy(dst, buf->data(), host_sizes[k]);
+      }
+      look_ahead[q]++;
+    };
 
+    Status status = Status::OK();
+    using seconds = std::chrono::duration<float>;
+    std::vector<float> latencies(elements_per_epochs);
     // Run for the amount of time user has asked us to.
-    for (uint64 i = 0; i != number_of_epochs; ++i) {
-      using seconds = std::chrono::duration<float>;
+    for (uint64 i = 0; i != number_of_epochs && status.ok(); ++i) {
       auto t0 = std::chrono::high_resolution_clock::now();
-      for (uint64 j = 0; j != elements_per_epochs; ++j) {
-        auto& replica_queues = queues[replica_id];
-        for (uint64 k = 0; k != replica_queues.size(); ++k) {
+      for (uint64 j = 0; j != elements_per_epochs && status.ok(); ++j) {
+        auto e0 = std::chrono::high_resolution_clock::now();
+        for (size_t q = 0; q != num_queues; ++q) {
+          auto& queue = queues[q / shapes.size()][q % shapes.size()];
           tensorflow::TensorBuffer* buf;
+          // Prefetch whatever is already available.
+          while (look_ahead[q] < prefetch_depth &&
+                 queue->TryPop(buf, look_ahead[q])) {
+            copy_to_device(q, buf);
+          }
           // Continue to try and get a buffer unless we have been cancelled.
-          while (!replica_queues[k]->TryPop(buf)) {
-            if (cancelled) {
-              return tensorflow::errors::Aborted("Consumer thread cancelled");
+          if (look_ahead[q] == 0) {
+            while (!queue->TryPop(buf)) {
+              if (cancelled) {
+                status =
+                    tensorflow::errors::Aborted("Consumer thread cancelled");
+                break;
+              }
+            }
+            if (!status.ok()) {
+              break;
             }
+            copy_to_device(q, buf);
           }
-          std::memcpy(buffers[k], buf->data(), buffer_sizes[k]);
-          replica_queues[k]->AdvanceReadPosition();
+          queue->AdvanceReadPosition();
+          look_ahead[q]--;
+          read_index[q]++;
         }
+        latencies[j] = static_cast<float>(
+            seconds(std::chrono::high_resolution_clock::now() - e0).count());
+      }
+      if (!status.ok()) {
+        break;
       }
       auto t1 = std::chrono::high_resolution_clock::now();
       Json::Value epoch_stats;
@@ -117,34 +182,65 @@ xla::poplarplugin::IOFunction ConsumerThread(
       const float elements_per_second = elements_processed / time_elapsed;
       const float bandwidth =
           total_bytes_processed / (1000000000.f * time_elapsed);
+      std::sort(latencies.begin(), latencies.end());
 
       epoch_stats["elements_processed"] = elements_processed;
       epoch_stats["total_bytes_processed"] = total_bytes_processed;
       epoch_stats["time_elapsed"] = time_elapsed;
       epoch_stats["elements_per_second"] = elements_per_second;
       epoch_stats["bandwidth"] = bandwidth;
+      epoch_stats["latency_p50"] = Percentile(latencies, 50.f);
+      epoch_stats["latency_p90"] = Percentile(latencies, 90.f);
+      epoch_stats["latency_p99"] = Percentile(latencies, 99.f);
+      epoch_stats["latency_max"] = latencies.back();
       epochs.append(epoch_stats);
 
       if (print_stats) {
         LOG(INFO) << "Processed: " << elements_per_second
                   << " elements/second.";
         LOG(INFO) << "Bandwidth: " << bandwidth << " GB/s.";
+        LOG(INFO) << "Latency: p50 " << epoch_stats["latency_p50"].asFloat()
+                  << "s, p99 " << epoch_stats["latency_p99"].asFloat()
+                  << "s.";
       }
       LOG(INFO) << "Dataset iterator completed epoch " << i << ".";
     }
+
+    for (auto& queue_buffers : buffers) {
+      for (void* buffer : queue_buffers) {
+        port::AlignedFree(buffer);
+      }
+    }
+    TF_RETURN_IF_ERROR(status);
+
+    // Summarise the throughput over all the epochs.
+    std::vector<float> throughputs;
+    for (const auto& epoch : epochs) {
+      throughputs.push_back(epoch["elements_per_second"].asFloat());
+    }
+    std::sort(throughputs.begin(), throughputs.end());
+    Json::Value summary;
+    summary["elements_per_second_p10"] = Percentile(throughputs, 10.f);
+    summary["elements_per_second_p50"] = Percentile(throughputs, 50.f);
+    summary["elements_per_second_p90"] = Percentile(throughputs, 90.f);
+
     // Store stats into the json.
+    (*stats_json)["replication_factor"] = Json::Int64(replication_factor);
+    (*stats_json)["prefetch_depth"] = Json::Int64(prefetch_depth);
+    (*stats_json)["elements_per_epochs"] = Json::UInt64(elements_per_epochs);
     (*stats_json)["epochs"] = epochs;
+    (*stats_json)["summary"] = summary;
     // Notify we have finished.
     finished_notifiation->Notify();
     return Status::OK();
   };
 }
 
+// The producer slices each element between the replicas the same way as the
+// infeed IO task of the PoplarExecutor.
 xla::poplarplugin::IOFunction ProducerThread(
-    xla::poplarplugin::InfeedIterator* itr) {
+    int64 replication_factor, xla::poplarplugin::InfeedIterator* itr) {
   return [=](std::atomic<bool>& cancelled) {
-    // We only ever have a single replica.
-    const size_t replica_id = 0;
     auto queues = itr->GetInfeedQueues();
 
     while (!cancelled) {
@@ -167,11 +263,28 @@ xla::poplarplugin::IOFunction ProducerThread(
       }
 
       for (size_t j = 0; j < outputs.size(); ++j) {
-        auto& queue = queues[replica_id][j];
-        TensorBuffer* tb = tensorflow::DMAHelper::buffer(&outputs[j]);
-        tb->Ref();
-        queue->BlockPush(tb);
-        queue->AdvanceWritePosition();
+        auto& tensor = outputs[j];
+        std::vector<tensorflow::Tensor> tensor_slices;
+        if (replication_factor > 1) {
+          CHECK_EQ(tensor.dim_size(0), replication_factor);
+          tensor_slices.reserve(replication_factor);
+          for (int64 replica_id = 0; replica_id < replication_factor;
+               ++replica_id) {
+            tensor_slices.push_back(tensor.SubSlice(replica_id));
+          }
+        } else {
+          tensor_slices = {tensor};
+        }
+
+        for (size_t replica_id = 0; replica_id < tensor_slices.size();
+             ++replica_id) {
+          auto& queue = queues[replica_id][j];
+          TensorBuffer* tb =
+              tensorflow::DMAHelper::buffer(&tensor_slices[replica_id]);
+          tb->Ref();
+          queue->BlockPush(tb);
+          queue->AdvanceWritePosition();
+        }
       }
     }
     return Status::OK();
@@ -187,7 +300,34 @@ class DatasetBenchmark : public OpKernel {
     OP_REQUIRES_OK(ctx, ctx->GetAttr("number_of_epochs", &number_of_epochs_));
     OP_REQUIRES_OK(ctx,
                    ctx->GetAttr("elements_per_epochs", &elements_per_epochs_));
+    OP_REQUIRES_OK(ctx,
+                   ctx->GetAttr("replication_factor", &replication_factor_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("prefetch_depth", &prefetch_depth_));
+    OP_REQUIRES(ctx, number_of_epochs_ > 0 && elements_per_epochs_ > 0,
+                errors::InvalidArgument(
+                    "Expected number_of_epochs and elements_per_epochs to be "
+                    "at least 1."));
+    OP_REQUIRES(ctx, replication_factor_ > 0,
+                errors::InvalidArgument(
+                    "Expected replication_factor to be at least 1, but got ",
+                    replication_factor_, "."));
+    OP_REQUIRES(ctx, prefetch_depth_ > 0,
+                errors::InvalidArgument(
+                    "Expected prefetch_depth to be at least 1, but got ",
+                    prefetch_depth_, "."));
     XlaShapesFromAttr(ctx, shapes_);
+    // Each element is split between the replicas in the outermost dimension.
+    if (replication_factor_ > 1) {
+      for (const xla::Shape& shape : shapes_) {
+        OP_REQUIRES(
+            ctx,
+            shape.rank() > 0 && shape.dimensions(0) == replication_factor_,
+            errors::InvalidArgument(
+                "Expected the outermost dimension of ",
+                xla::ShapeUtil::HumanString(shape),
+                " to be the replication factor ", replication_factor_, "."));
+      }
+    }
   }
 
   ~DatasetBenchmark() override {}
@@ -203,8 +343,8 @@ class DatasetBenchmark : public OpKernel {
 
     xla::poplarplugin::InfeedAllocator infeed_allocator;
     xla::poplarplugin::InfeedIterator infeed_iterator(
-        flr, params, dataset, &infeed_allocator,
-        /* replication factor */ 1, shapes_, "benchmark");
+        flr, params, dataset, &infeed_allocator, replication_factor_, shapes_,
+        "benchmark");
 
     Json::Value stats_json;
     {
@@ -214,12 +354,13 @@ class DatasetBenchmark : public OpKernel {
       xla::poplarplugin::IOThread consumer_thread(
           "consumer",
           ConsumerThread(print_stats_, number_of_epochs_, elements_per_epochs_,
+                         replication_factor_, prefetch_depth_,
                          &consumer_finished_notifiation, &stats_json,
                          &infeed_iterator));
 
       // Start the producer thread.
       xla::poplarplugin::IOThread producer_thread(
-          "producer", ProducerThread(&infeed_iterator));
+          "producer", ProducerThread(replication_factor_, &infeed_iterator));
 
       // Wait until the consumer thread has finished - note that the thread will
       // be cancelled and destroyed as we exit the scope.
@@ -241,6 +382,8 @@ class DatasetBenchmark : public OpKernel {
   bool print_stats_;
   int number_of_epochs_;
   int elements_per_epochs_;
+  int replication_factor_;
+  int prefetch_depth_;
   std::vector<xla::Shape> shapes_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(DatasetBenchmark);
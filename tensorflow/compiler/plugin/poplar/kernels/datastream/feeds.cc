@@ -92,6 +92,16 @@ void GetFeedConfig(OpKernelConstruction* ctx,
   config.set_io_batch_size(io_batch_size);
   config.set_prefetch_depth(prefetch_depth);
 
+  // Not every op which shares this config has a priority.
+  int64 io_priority = 0;
+  if (ctx->HasAttr("io_priority")) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("io_priority", &io_priority));
+  }
+  OP_REQUIRES(
+      ctx, 0 <= io_priority,
+      errors::InvalidArgument("Need 0 <= io_priority, got ", io_priority));
+  config.set_io_priority(io_priority);
+
   OP_REQUIRES(
       ctx, 0 < prefetch_depth,
       errors::InvalidArgument("Need 0 < prefetch_depth, got ", prefetch_depth));
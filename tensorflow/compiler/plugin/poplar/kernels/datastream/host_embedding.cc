@@ -19,6 +19,8 @@ limitations under the License.
 
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_executor.h"
 #include "tensorflow/compiler/plugin/poplar/driver/poplar_platform.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/flags.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/host_embedding_util.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
 #include "tensorflow/compiler/plugin/poplar/driver/trace.pb.h"
 #include "tensorflow/compiler/plugin/poplar/driver/xla_ipu_common.h"
@@ -55,8 +57,19 @@ namespace tensorflow {
 namespace {
 
 using PoplarExecutor = xla::poplarplugin::PoplarExecutor;
+using HostEmbeddingIndexGroups = xla::poplarplugin::HostEmbeddingIndexGroups;
+using HostEmbeddingStatistics = xla::poplarplugin::HostEmbeddingStatistics;
 constexpr int max_replication_factor = 16;
 
+// One in this many lookup batches is sampled to find the hot rows.
+constexpr int lookup_sample_interval = 8;
+// The hot rows are recomputed after this many sampled batches.
+constexpr int lookup_sample_window = 64;
+// The most hot rows reported in the statistics when the cache is smaller.
+constexpr int max_statistics_hot_rows = 1 << 16;
+// How many distinct rows are prefetched when the lookup indices arrive.
+constexpr int lookup_prefetch_rows = 64;
+
 template <typename T>
 class HostEmbeddingSGD
     : public xla::poplarplugin::PoplarExecutor::HostEmbeddingInterface<T> {
@@ -65,7 +78,14 @@ class HostEmbeddingSGD
       : encoding_width_(embedding.dim_size(1)),
         embedding_(std::move(embedding)),
         lookup_indices_(max_replication_factor),
-        update_indices_(max_replication_factor) {
+        update_indices_(max_replication_factor),
+        lookup_groups_(max_replication_factor),
+        update_groups_(max_replication_factor),
+        thread_pool_(xla::poplarplugin::GetHostEmbeddingThreadPool()),
+        sampler_(lookup_sample_interval, lookup_sample_window,
+                 std::max<int64>(max_statistics_hot_rows,
+                                 xla::poplarplugin::PoplarXlaFlags::Get()
+                                     .host_embedding_cache_rows)) {
     embedding_rows_.reserve(embedding_.dim_size(0));
 
     for (std::size_t i = 0; i < embedding_.dim_size(0); ++i) {
@@ -74,6 +94,19 @@ class HostEmbeddingSGD
 
       embedding_rows_.push_back(buffer->base<T>());
     }
+
+    shards_ = absl::make_unique<xla::poplarplugin::HostEmbeddingShards>(
+        tensorflow::DMAHelper::base(&embedding_), embedding_rows_.size(),
+        encoding_width_ * sizeof(T),
+        xla::poplarplugin::GetHostEmbeddingNumShards());
+
+    const int64 cache_rows = std::min<int64>(
+        xla::poplarplugin::PoplarXlaFlags::Get().host_embedding_cache_rows,
+        embedding_rows_.size());
+    if (cache_rows > 0) {
+      cache_ = absl::make_unique<xla::poplarplugin::HostEmbeddingRowCache<T>>(
+          cache_rows, encoding_width_);
+    }
   }
 
   virtual ~HostEmbeddingSGD() = default;
@@ -85,15 +118,46 @@ class HostEmbeddingSGD
     std::memcpy(lookup_indices_[replica].data(), indices,
                 index_count * sizeof(int));
 
+    HostEmbeddingIndexGroups& groups = lookup_groups_[replica];
+    groups.Build(indices, index_count, shards_->NumShards(),
+                 shards_->RowsPerShard());
+
+    bool hot_rows_changed = false;
+    {
+      tf_shared_lock lk(cache_mu_);
+
+      // Start bringing the first rows into the cache while the device gets
+      // ready to receive the activations.
+      xla::poplarplugin::PrefetchRows(CachedRows(), groups, encoding_width_,
+                                      lookup_prefetch_rows);
+
+      if (sampler_.Count(index_count)) {
+        const int64 cache_hits = cache_ ? cache_->CountHits(groups) : 0;
+        hot_rows_changed = sampler_.Record(groups, cache_hits);
+      }
+    }
+
+    if (hot_rows_changed && cache_) {
+      mutex_lock lk(cache_mu_);
+      cache_->Fill(embedding_rows_, sampler_.HotRows(cache_->Capacity()),
+                   thread_pool_);
+    }
+
     return Status::OK();
   }
 
   Status DequeueLookupActivations(int replica, T* destination) final {
-    for (std::size_t i = 0; i < lookup_indices_[replica].size(); ++i) {
-      std::memcpy(destination + i * encoding_width_,
-                  embedding_rows_[lookup_indices_[replica][i]],
-                  encoding_width_ * sizeof(T));
-    }
+    const HostEmbeddingIndexGroups& groups = lookup_groups_[replica];
+    const auto rows = CachedRows();
+
+    tf_shared_lock lk(cache_mu_);
+    shards_->Run(groups,
+                 xla::poplarplugin::HostEmbeddingCostPerRow<T>(
+                     groups, encoding_width_),
+                 /*exclusive=*/false, [&](int begin, int end) {
+                   xla::poplarplugin::GatherRowRange(
+                       rows, groups, begin, end, encoding_width_, destination);
+                 });
 
     return Status::OK();
   }
@@ -109,16 +173,7 @@ class HostEmbeddingSGD
   }
 
   Status EnqueueUpdateGrads(int replica, const T* grads) override {
-    std::size_t index_count = update_indices_[replica].size();
-
-    for (std::size_t i = 0; i < index_count; ++i) {
-      const T* src_ptr = grads + (encoding_width_ * i);
-
-      std::transform(src_ptr, src_ptr + encoding_width_,
-                     embedding_rows_[update_indices_[replica][i]],
-                     embedding_rows_[update_indices_[replica][i]],
-                     std::plus<T>{});
-    }
+    ApplyUpdates(replica, grads);
 
     return Status::OK();
   }
@@ -137,13 +192,61 @@ class HostEmbeddingSGD
 
   Status Notify(int) override { return Status::OK(); }
 
+  xla::StatusOr<HostEmbeddingStatistics> GetStatistics() const final {
+    return sampler_.GetStatistics();
+  }
+
  protected:
+  xla::poplarplugin::HostEmbeddingCachedRows<T> CachedRows() const {
+    return {embedding_rows_, cache_.get()};
+  }
+
+  // Add the gradients to the rows in `update_indices_[replica]`, keeping any
+  // cached copies of the rows up to date. Replicas updating the same shard
+  // take turns.
+  void ApplyUpdates(int replica, const T* grads) {
+    HostEmbeddingIndexGroups& groups = update_groups_[replica];
+    groups.Build(update_indices_[replica].data(),
+                 update_indices_[replica].size(), shards_->NumShards(),
+                 shards_->RowsPerShard());
+
+    tf_shared_lock lk(cache_mu_);
+    shards_->Run(groups,
+                 xla::poplarplugin::HostEmbeddingCostPerRow<T>(
+                     groups, encoding_width_),
+                 /*exclusive=*/true, [&](int begin, int end) {
+                   xla::poplarplugin::ScatterAddRowRange(
+                       embedding_rows_, groups, begin, end, encoding_width_,
+                       grads);
+                   if (cache_) {
+                     cache_->Update(embedding_rows_, groups, begin, end);
+                   }
+                 });
+  }
+
   int encoding_width_;
 
   Tensor embedding_;
   std::vector<T*> embedding_rows_;
   std::vector<std::vector<int>> lookup_indices_;
   std::vector<std::vector<int>> update_indices_;
+
+  // The indices of each replica grouped by row, so that repeated rows are only
+  // read from and written to the embedding once.
+  std::vector<HostEmbeddingIndexGroups> lookup_groups_;
+  std::vector<HostEmbeddingIndexGroups> update_groups_;
+
+  tensorflow::thread::ThreadPool* thread_pool_;
+
+  // The rows split across the NUMA nodes, with the threads which look up and
+  // update each shard.
+  std::unique_ptr<xla::poplarplugin::HostEmbeddingShards> shards_;
+
+  // Finds the hot rows, and keeps copies of them in the cache when it is
+  // enabled. The cache is only refilled when no replica is using it.
+  xla::poplarplugin::HostEmbeddingAccessSampler sampler_;
+  mutex cache_mu_;
+  std::unique_ptr<xla::poplarplugin::HostEmbeddingRowCache<T>> cache_;
 };
 
 template <typename T>
@@ -173,18 +276,10 @@ class HostEmbeddingSGDAcc : public HostEmbeddingSGD<T> {
   }
 
   Status Notify(int replica) final {
-    std::size_t index_count = update_indices_[replica].size();
-
-    const T* base_ptr = updates_[replica].data();
-    const int* idx_ptr = update_indices_[replica].data();
-
-    for (std::size_t i = 0; i < index_count; ++i) {
-      const T* src_ptr = base_ptr + (encoding_width_ * i);
-      const int* idx = idx_ptr + i;
-
-      std::transform(src_ptr, src_ptr + encoding_width_, embedding_rows_[*idx],
-                     embedding_rows_[*idx], std::plus<T>{});
-    }
+    // All the accumulated gradients for a row are applied by the same thread,
+    // so rows which are updated by several of the accumulated batches are only
+    // brought into the cache once.
+    ApplyUpdates(replica, updates_[replica].data());
 
     update_indices_[replica].clear();
     updates_[replica].clear();
@@ -193,8 +288,8 @@ class HostEmbeddingSGDAcc : public HostEmbeddingSGD<T> {
   }
 
  private:
+  using HostEmbeddingSGD<T>::ApplyUpdates;
   using HostEmbeddingSGD<T>::encoding_width_;
-  using HostEmbeddingSGD<T>::embedding_rows_;
   using HostEmbeddingSGD<T>::update_indices_;
 
   std::vector<std::vector<T>> updates_;
@@ -23,6 +23,8 @@ REGISTER_OP("DatasetBenchmark")
     .Attr("print_stats: bool")
     .Attr("number_of_epochs: int")
     .Attr("elements_per_epochs: int")
+    .Attr("replication_factor: int = 1")
+    .Attr("prefetch_depth: int = 1")
     .Attr("output_types: list(type) >= 1")
     .Attr("output_shapes: list(shape) >= 1")
     .SetIsStateful()
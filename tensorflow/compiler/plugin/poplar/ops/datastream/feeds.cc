@@ -28,6 +28,7 @@ REGISTER_OP("PopDatastreamInfeedDequeue")
     .Attr("output_shapes: list(shape) >= 1")
     .Attr("io_batch_size: int = 1")
     .Attr("prefetch_depth: int = 1")
+    .Attr("io_priority: int = 0")
     .SetIsStateful()
     .SetShapeFn(shape_inference::poplarplugin::ShapeFromOutputShapeAttribute)
     .Doc(R"doc(
@@ -51,6 +52,8 @@ prefetch_depth: the number of elements poplar will prefetch.
   of multiple entries, increasing the probability there will be a valid
   entry in the buffer for the device to read before falling back to
   synchronously fetching the next entry.
+io_priority: the priority of this feed when it shares the host IO threads
+  with other feeds. Higher priority feeds get more steps per turn.
 )doc");
 
 REGISTER_OP("IPUCreateDatasetIterator")
@@ -80,6 +83,7 @@ REGISTER_OP("PopDatastreamOutfeedEnqueue")
     .Attr("replication_factor: int")
     .Attr("io_batch_size: int")
     .Attr("prefetch_depth: int = 1")
+    .Attr("io_priority: int = 0")
     .SetIsStateful()
     .SetShapeFn(shape_inference::NoOutputs)
     .Doc(R"doc(
@@ -96,6 +100,8 @@ replication_factor: the number of replica graphs that this operation will
 io_batch_size: the number of tensors which should be fetched from the host
   in one go.  This reduces the host->device IO, at the cost of memory on the
   device.
+io_priority: the priority of this feed when it shares the host IO threads
+  with other feeds. Higher priority feeds get more steps per turn.
 )doc");
 
 REGISTER_OP("PopDatastreamOutfeedDequeue")
@@ -0,0 +1,202 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/compilation_stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/compiler/plugin/poplar/driver/compiler_annotations.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/casts_elimination.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/custom_op_replacer.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/expression_outliner.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/fuse_ops_early.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/fuse_ops_late.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/inplace_finder.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/parse_poplar_backend_config.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/poplar_algebraic_simplifier.h"
+#include "tensorflow/compiler/xla/service/flatten_call_graph.h"
+#include "tensorflow/compiler/xla/service/hlo_cse.h"
+#include "tensorflow/compiler/xla/service/hlo_dce.h"
+#include "tensorflow/compiler/xla/service/hlo_parser.h"
+#include "tensorflow/compiler/xla/service/hlo_pass_fix.h"
+#include "tensorflow/compiler/xla/service/hlo_pass_pipeline.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/compiler/xla/tests/hlo_test_base.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+using CompilationStatsTest = HloTestBase;
+
+TEST_F(CompilationStatsTest, ProfilesEveryPass) {
+  std::string hlo_string = R"(
+HloModule top
+
+ENTRY cluster_1 {
+  arg0 = f32[2] parameter(0)
+  arg1 = f32[2] parameter(1)
+  dead0 = f32[2] multiply(arg0, arg1)
+  dead1 = f32[2] subtract(arg0, arg1)
+  add0 = f32[2] add(arg0, arg1)
+  add1 = f32[2] add(arg0, arg1)
+  ROOT mul = f32[2] multiply(add0, add1)
+}
+)";
+
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo_string));
+
+  PoplarCompilationStats stats(module.get());
+  HloPassPipeline pipeline("test", &stats);
+  pipeline.AddPass<HloDCE>();
+  auto& nested = pipeline.AddPass<HloPassPipeline>("nested", &stats);
+  nested.AddPass<HloCSE>(false);
+  nested.AddPass<HloDCE>();
+  TF_ASSERT_OK(pipeline.Run(module.get()).status());
+
+  // The nested pipeline is not profiled itself, only its passes.
+  const auto& profiles = stats.GetPassProfiles();
+  ASSERT_EQ(profiles.size(), 3);
+  EXPECT_EQ(profiles[0].name, "dce");
+  EXPECT_EQ(profiles[1].name, "cse");
+  EXPECT_EQ(profiles[2].name, "dce");
+
+  EXPECT_EQ(profiles[0].instructions_before, 7);
+  EXPECT_EQ(profiles[0].instructions_after, 5);
+  EXPECT_EQ(profiles[1].instructions_before, 5);
+  EXPECT_EQ(profiles[1].instructions_after, 4);
+  EXPECT_EQ(profiles[2].instructions_before, 4);
+  EXPECT_EQ(profiles[2].instructions_after, 4);
+
+  for (const PassProfile& profile : profiles) {
+    EXPECT_GE(profile.peak_rss_bytes, profile.rss_bytes);
+  }
+
+  const std::string json = stats.ToJson();
+  EXPECT_TRUE(absl::StrContains(json, "\"name\":\"cse\""));
+  EXPECT_TRUE(absl::StrContains(json, "\"instructions_after\":4"));
+  EXPECT_TRUE(absl::StrContains(json, "\"total_wall_time_us\""));
+}
+
+// Creates a module with `num_layers` identical layers, each a matmul followed
+// by a bias add, a cast and an activation.
+std::string CreateLayersHlo(int num_layers) {
+  std::string hlo = R"(
+HloModule layers
+
+ENTRY cluster {
+  x0 = f16[16,64] parameter(0)
+  w = f16[64,64] parameter(1)
+  b = f16[64] parameter(2)
+  zero = f32[] constant(0)
+  zeros = f32[16,64] broadcast(zero), dimensions={}
+)";
+  for (int i = 0; i != num_layers; ++i) {
+    absl::StrAppend(&hlo, "  dot", i, " = f16[16,64] dot(x", i, ", w), ",
+                    "lhs_contracting_dims={1}, rhs_contracting_dims={0}\n");
+    absl::StrAppend(&hlo, "  bias", i,
+                    " = f16[16,64] broadcast(b), dimensions={1}\n");
+    absl::StrAppend(&hlo, "  add", i, " = f16[16,64] add(dot", i, ", bias", i,
+                    ")\n");
+    absl::StrAppend(&hlo, "  cast", i, " = f32[16,64] convert(add", i, ")\n");
+    absl::StrAppend(&hlo, "  relu", i, " = f32[16,64] maximum(cast", i,
+                    ", zeros)\n");
+    absl::StrAppend(&hlo, "  x", i + 1, " = f16[16,64] convert(relu", i,
+                    ")\n");
+  }
+  absl::StrAppend(&hlo, "  ROOT out = f16[16,64] copy(x", num_layers, ")\n}\n");
+  return hlo;
+}
+
+// Loads the HLO text files of the corpus from the directory given in the
+// TF_POPLAR_HLO_CORPUS environment variable. Without it, a generated model of
+// `num_layers` layers is used instead.
+std::vector<std::string> LoadCorpus(int num_layers) {
+  const char* corpus_dir = std::getenv("TF_POPLAR_HLO_CORPUS");
+  if (corpus_dir == nullptr) {
+    return {CreateLayersHlo(num_layers)};
+  }
+
+  auto* env = tensorflow::Env::Default();
+  std::vector<std::string> children;
+  TF_CHECK_OK(env->GetChildren(corpus_dir, &children));
+  std::sort(children.begin(), children.end());
+
+  std::vector<std::string> corpus;
+  for (const std::string& child : children) {
+    std::string hlo;
+    TF_CHECK_OK(tensorflow::ReadFileToString(
+        env, tensorflow::io::JoinPath(corpus_dir, child), &hlo));
+    corpus.push_back(hlo);
+  }
+  return corpus;
+}
+
+// Runs the device independent part of the IPU pass pipeline over a corpus of
+// HLO modules. The per pass profile is logged with --v=1.
+void BM_PassPipeline(int num_iters, int num_layers) {
+  tensorflow::testing::StopTiming();
+  const std::vector<std::string> corpus = LoadCorpus(num_layers);
+
+  for (int iter = 0; iter != num_iters; ++iter) {
+    for (const std::string& hlo : corpus) {
+      auto module = ParseAndReturnUnverifiedModule(hlo).ConsumeValueOrDie();
+      CompilerAnnotations annotations(module.get());
+      PoplarCompilationStats stats(module.get());
+
+      HloPassPipeline pipeline("benchmark", &stats);
+      pipeline.AddPass<FlattenCallGraph>();
+      pipeline.AddPass<CustomOpReplacer>();
+      pipeline.AddPass<ParsePoplarBackendConfig>();
+      pipeline.AddPass<HloPassFix<FuseOpsEarly>>(annotations);
+      pipeline.AddPass<HloCSE>(false);
+      pipeline.AddPass<HloPassFix<PoplarAlgebraicSimplifier>>();
+      {
+        auto& pass = pipeline.AddPass<HloPassFix<HloPassPipeline>>(
+            "repeated-fusing", &stats);
+        pass.AddPass<CastsElimination>(annotations);
+        pass.AddPass<HloCSE>(true);
+        pass.AddPass<HloDCE>();
+      }
+      pipeline.AddPass<HloPassFix<FuseOpsLate>>(annotations);
+      pipeline.AddPass<HloDCE>();
+      pipeline.AddPass<InplaceFinder>();
+      pipeline.AddPass<ExpressionOutliner>();
+
+      tensorflow::testing::StartTiming();
+      TF_CHECK_OK(pipeline.Run(module.get()).status());
+      tensorflow::testing::StopTiming();
+
+      if (iter == num_iters - 1) {
+        stats.CompilationReport();
+      }
+    }
+  }
+}
+BENCHMARK(BM_PassPipeline)->Arg(16)->Arg(128);
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
@@ -61,6 +61,14 @@ def _temporary_executable_cache():
       yield
 
 
+@contextlib.contextmanager
+def _temporary_in_memory_executable_cache(size):
+  poplar_flags = "--in_memory_executable_cache_size={} {}".format(
+      size, os.environ.get("TF_POPLAR_FLAGS", ""))
+  with test.mock.patch.dict("os.environ", {"TF_POPLAR_FLAGS": poplar_flags}):
+    yield
+
+
 def _count_ipu_compilations_in_summary(summary):
   count = 0
   for val in summary.value:
@@ -360,6 +368,61 @@ class TestExecutableCache(xla_test.XLATestCase):  # pylint: disable=abstract-met
       self.assertEqual(1, _count_ipu_compilations(events0))
       self.assertEqual(0, _count_ipu_compilations(events1))
 
+  def _compile_models_in_new_graphs(self, net_names):
+    nets = {"square": lambda x: x * x, "double": lambda x: x + x}
+
+    def build_and_run_models():
+      results = []
+      compilations = []
+      for name in net_names:
+        # Each Graph has its own XLA compilation cache, so every model is
+        # compiled by the Poplar backend.
+        with ops.Graph().as_default():
+          v = array_ops.placeholder(dtype=np.float32, shape=(2,))
+          with ipu.scopes.ipu_scope("/device:IPU:0"):
+            [result] = ipu.ipu_compiler.compile(nets[name], inputs=[v])
+
+          with session.Session() as sess:
+            report = ReportJSON(self,
+                                sess,
+                                set_opts_fn=_use_offline_compilation_if_needed)
+            try:
+              results.append(sess.run(result, {v: [1.0, 3.0]}))
+            except errors.InvalidArgumentError as e:
+              if offline_compilation_needed and "compilation only" in e.message:
+                results.append([])
+              else:
+                raise
+            compilations.append(
+                _count_ipu_compilations(report.get_event_trace(sess)))
+      return results, compilations
+
+    return self._run_in_new_process(build_and_run_models)
+
+  @test_util.deprecated_graph_mode_only
+  def test_in_memory_executable_cache_hit(self):
+    with _temporary_in_memory_executable_cache(2):
+      results, compilations = self._compile_models_in_new_graphs(
+          ["square", "double", "square", "double"])
+    # The second time, each model reuses the engine of its first executable.
+    self.assertEqual([1, 1, 0, 0], compilations)
+    if not offline_compilation_needed:
+      self.assertAllEqual(results[0], [1.0, 9.0])
+      self.assertAllEqual(results[1], [2.0, 6.0])
+      self.assertAllEqual(results[2], results[0])
+      self.assertAllEqual(results[3], results[1])
+
+  @test_util.deprecated_graph_mode_only
+  def test_in_memory_executable_cache_eviction(self):
+    with _temporary_in_memory_executable_cache(1):
+      results, compilations = self._compile_models_in_new_graphs(
+          ["square", "double", "square"])
+    # Only the most recent executable is kept, so the first model is compiled
+    # again after the second one evicted it.
+    self.assertEqual([1, 1, 1], compilations)
+    if not offline_compilation_needed:
+      self.assertAllEqual(results[2], results[0])
+
 
 if __name__ == "__main__":
   googletest.main()
@@ -931,6 +931,177 @@ ENTRY c1 {
   EXPECT_EQ(hash0.GetProtoStr(), hash1.GetProtoStr());
 }
 
+TEST_F(HloHashTest, ComputationHashIgnoresSurroundingModule) {
+  std::string hlo_string0 = R"(
+HloModule top
+
+comp_0 {
+  p0 = f32[2] parameter(0)
+  p1 = f32[2] parameter(1)
+  ROOT add = f32[2] add(p0, p1)
+}
+
+ENTRY cluster_1 {
+  arg0 = f32[2] parameter(0)
+  arg1 = f32[2] parameter(1)
+  ROOT call = f32[2] call(arg0, arg1), to_apply=comp_0
+}
+
+)";
+
+  std::string hlo_string1 = R"(
+HloModule top
+
+comp_1 {
+  a = f32[2] parameter(0)
+  b = f32[2] parameter(1)
+  ROOT c = f32[2] add(a, b)
+}
+
+ENTRY cluster_2 {
+  arg0 = f32[2] parameter(0)
+  arg1 = f32[2] parameter(1)
+  mul = f32[2] multiply(arg0, arg1)
+  ROOT call = f32[2] call(mul, arg1), to_apply=comp_1
+}
+
+)";
+
+  auto module0_or_status =
+      HloRunner::CreateModuleFromString(hlo_string0, GetDebugOptionsForTest());
+  EXPECT_TRUE(module0_or_status.ok());
+  auto* module0 = module0_or_status.ValueOrDie().get();
+
+  auto module1_or_status =
+      HloRunner::CreateModuleFromString(hlo_string1, GetDebugOptionsForTest());
+  EXPECT_TRUE(module1_or_status.ok());
+  auto* module1 = module1_or_status.ValueOrDie().get();
+
+  HloHash hash0(module0);
+  HloHash hash1(module1);
+  EXPECT_NE(hash0.GetHash(), hash1.GetHash());
+
+  // The called computations are the same.
+  auto* call0 = module0->entry_computation()->root_instruction();
+  auto* call1 = module1->entry_computation()->root_instruction();
+  EXPECT_EQ(hash0.GetComputationHash(call0->to_apply()),
+            hash1.GetComputationHash(call1->to_apply()));
+
+  // The entry computations are not.
+  EXPECT_NE(hash0.GetComputationHash(module0->entry_computation()),
+            hash1.GetComputationHash(module1->entry_computation()));
+}
+
+TEST_F(HloHashTest, StructuralHashSameLayers) {
+  std::string hlo_string = R"(
+HloModule top
+
+layer_0 {
+  p0 = f32[2] parameter(0)
+  p1 = f32[2] parameter(1)
+  mul = f32[2] multiply(p0, p1)
+  ROOT add = f32[2] add(mul, p1)
+}
+
+layer_1 {
+  a = f32[2] parameter(0)
+  b = f32[2] parameter(1)
+  c = f32[2] multiply(a, b)
+  ROOT d = f32[2] add(c, b)
+}
+
+layer_2 {
+  p0 = f32[2] parameter(0)
+  p1 = f32[2] parameter(1)
+  sub = f32[2] subtract(p0, p1)
+  ROOT add = f32[2] add(sub, p1)
+}
+
+ENTRY cluster_1 {
+  arg0 = f32[2] parameter(0)
+  arg1 = f32[2] parameter(1)
+  call0 = f32[2] call(arg0, arg1), to_apply=layer_0
+  call1 = f32[2] call(call0, arg1), to_apply=layer_1
+  ROOT call2 = f32[2] call(call1, arg1), to_apply=layer_2
+}
+
+)";
+
+  auto module_or_status =
+      HloRunner::CreateModuleFromString(hlo_string, GetDebugOptionsForTest());
+  EXPECT_TRUE(module_or_status.ok());
+  auto* module = module_or_status.ValueOrDie().get();
+
+  auto* layer_0 = module->GetComputationWithName("layer_0");
+  auto* layer_1 = module->GetComputationWithName("layer_1");
+  auto* layer_2 = module->GetComputationWithName("layer_2");
+
+  HloStructuralHash hash;
+  // The first two layers only differ by names.
+  EXPECT_EQ(hash.GetComputationHash(layer_0), hash.GetComputationHash(layer_1));
+  // The last layer has the same parameters and root, but a different body.
+  EXPECT_NE(hash.GetComputationHash(layer_0), hash.GetComputationHash(layer_2));
+
+  // The calls of the same layers with the same operand shapes are the same.
+  auto* call0 = module->entry_computation()->GetInstructionWithName("call0");
+  auto* call1 = module->entry_computation()->GetInstructionWithName("call1");
+  auto* call2 = module->entry_computation()->GetInstructionWithName("call2");
+  EXPECT_EQ(hash.GetInstructionHash(call0), hash.GetInstructionHash(call1));
+  EXPECT_NE(hash.GetInstructionHash(call0), hash.GetInstructionHash(call2));
+}
+
+TEST_F(HloHashTest, StructuralHashStableBetweenModules) {
+  std::string hlo_string0 = R"(
+HloModule top
+
+comp_0 {
+  p0 = f32[2] parameter(0)
+  p1 = f32[2] parameter(1)
+  ROOT add = f32[2] add(p0, p1)
+}
+
+ENTRY cluster_1 {
+  arg0 = f32[2] parameter(0)
+  arg1 = f32[2] parameter(1)
+  ROOT call = f32[2] call(arg0, arg1), to_apply=comp_0
+}
+
+)";
+
+  std::string hlo_string1 = R"(
+HloModule other
+
+other_comp {
+  a = f32[2] parameter(0)
+  b = f32[2] parameter(1)
+  ROOT c = f32[2] add(a, b)
+}
+
+ENTRY cluster_2 {
+  x = f32[2] parameter(0)
+  y = f32[2] parameter(1)
+  ROOT z = f32[2] call(x, y), to_apply=other_comp
+}
+
+)";
+
+  auto module0_or_status =
+      HloRunner::CreateModuleFromString(hlo_string0, GetDebugOptionsForTest());
+  EXPECT_TRUE(module0_or_status.ok());
+  auto* module0 = module0_or_status.ValueOrDie().get();
+
+  auto module1_or_status =
+      HloRunner::CreateModuleFromString(hlo_string1, GetDebugOptionsForTest());
+  EXPECT_TRUE(module1_or_status.ok());
+  auto* module1 = module1_or_status.ValueOrDie().get();
+
+  // Separate hashers, as if the modules were in different compilations.
+  HloStructuralHash hash0;
+  HloStructuralHash hash1;
+  EXPECT_EQ(hash0.GetComputationHash(module0->entry_computation()),
+            hash1.GetComputationHash(module1->entry_computation()));
+}
+
 }  // namespace
 }  // namespace poplarplugin
 }  // namespace xla
@@ -0,0 +1,337 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/host_embedding_util.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+// A small embedding where every element of row i is i.
+template <typename T>
+struct TestEmbedding {
+  TestEmbedding(int num_rows, int width) : data(num_rows * width) {
+    for (int i = 0; i != num_rows; ++i) {
+      std::fill_n(data.begin() + i * width, width, T(i));
+      rows.push_back(data.data() + i * width);
+    }
+  }
+
+  std::vector<T> data;
+  std::vector<T*> rows;
+};
+
+TEST(HostEmbeddingUtilTest, GroupsByRow) {
+  const std::vector<int> indices = {4, 2, 4, 7, 2, 4};
+
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size());
+
+  ASSERT_EQ(groups.NumRows(), 3);
+  ASSERT_EQ(groups.NumPositions(), 6);
+
+  EXPECT_EQ(groups.Row(0), 4);
+  EXPECT_EQ(groups.Row(1), 2);
+  EXPECT_EQ(groups.Row(2), 7);
+
+  EXPECT_THAT(groups.Positions(0), ::testing::ElementsAre(0, 2, 5));
+  EXPECT_THAT(groups.Positions(1), ::testing::ElementsAre(1, 4));
+  EXPECT_THAT(groups.Positions(2), ::testing::ElementsAre(3));
+
+  // Rebuilding replaces the previous grouping.
+  const std::vector<int> more_indices = {1, 1};
+  groups.Build(more_indices.data(), more_indices.size());
+  ASSERT_EQ(groups.NumRows(), 1);
+  EXPECT_EQ(groups.Row(0), 1);
+  EXPECT_THAT(groups.Positions(0), ::testing::ElementsAre(0, 1));
+
+  groups.Build(nullptr, 0);
+  EXPECT_EQ(groups.NumRows(), 0);
+  EXPECT_EQ(groups.NumPositions(), 0);
+}
+
+TEST(HostEmbeddingUtilTest, GroupsByShard) {
+  const std::vector<int> indices = {9, 2, 5, 9, 0, 6, 2};
+
+  // Three shards of four rows, [0, 4), [4, 8) and [8, 10).
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size(), 3, 4);
+
+  ASSERT_EQ(groups.NumRows(), 5);
+  EXPECT_EQ(groups.ShardBegin(0), 0);
+  EXPECT_EQ(groups.ShardEnd(0), 2);
+  EXPECT_EQ(groups.ShardBegin(1), 2);
+  EXPECT_EQ(groups.ShardEnd(1), 4);
+  EXPECT_EQ(groups.ShardBegin(2), 4);
+  EXPECT_EQ(groups.ShardEnd(2), 5);
+
+  // Within a shard the rows keep the order they were first seen in.
+  EXPECT_EQ(groups.Row(0), 2);
+  EXPECT_EQ(groups.Row(1), 0);
+  EXPECT_EQ(groups.Row(2), 5);
+  EXPECT_EQ(groups.Row(3), 6);
+  EXPECT_EQ(groups.Row(4), 9);
+
+  EXPECT_THAT(groups.Positions(0), ::testing::ElementsAre(1, 6));
+  EXPECT_THAT(groups.Positions(1), ::testing::ElementsAre(4));
+  EXPECT_THAT(groups.Positions(2), ::testing::ElementsAre(2));
+  EXPECT_THAT(groups.Positions(3), ::testing::ElementsAre(5));
+  EXPECT_THAT(groups.Positions(4), ::testing::ElementsAre(0, 3));
+}
+
+TEST(HostEmbeddingUtilTest, GatherRows) {
+  constexpr int kWidth = 13;
+  TestEmbedding<float> embedding(10, kWidth);
+  tensorflow::thread::ThreadPool pool(tensorflow::Env::Default(), "test", 4);
+
+  const std::vector<int> indices = {3, 9, 3, 0, 9, 3};
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size());
+
+  std::vector<float> result(indices.size() * kWidth, -1.0f);
+  GatherRows(embedding.rows, groups, kWidth, result.data(), &pool);
+
+  for (std::size_t i = 0; i != indices.size(); ++i) {
+    for (int j = 0; j != kWidth; ++j) {
+      EXPECT_EQ(result[i * kWidth + j], indices[i]);
+    }
+  }
+}
+
+template <typename T>
+class HostEmbeddingScatterTest : public ::testing::Test {};
+
+using ScatterTypes = ::testing::Types<float, Eigen::half, int32, uint32>;
+TYPED_TEST_SUITE(HostEmbeddingScatterTest, ScatterTypes);
+
+TYPED_TEST(HostEmbeddingScatterTest, ScatterAddRows) {
+  using T = TypeParam;
+  constexpr int kRows = 8;
+  constexpr int kWidth = 19;
+  TestEmbedding<T> embedding(kRows, kWidth);
+  TestEmbedding<T> expected(kRows, kWidth);
+  tensorflow::thread::ThreadPool pool(tensorflow::Env::Default(), "test", 4);
+
+  const std::vector<int> indices = {5, 1, 5, 5, 7, 1};
+  std::vector<T> grads(indices.size() * kWidth);
+  for (std::size_t i = 0; i != grads.size(); ++i) {
+    grads[i] = T(static_cast<int>(i % 5));
+  }
+
+  // Apply the gradients one row at a time as the reference.
+  for (std::size_t i = 0; i != indices.size(); ++i) {
+    for (int j = 0; j != kWidth; ++j) {
+      T& element = expected.rows[indices[i]][j];
+      element = element + grads[i * kWidth + j];
+    }
+  }
+
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size());
+  ScatterAddRows(embedding.rows, groups, kWidth, grads.data(), &pool);
+
+  for (int i = 0; i != kRows * kWidth; ++i) {
+    EXPECT_EQ(embedding.data[i], expected.data[i]);
+  }
+}
+
+TEST(HostEmbeddingUtilTest, SamplerFindsHotRows) {
+  // Sample every other batch, with a window of two sampled batches.
+  HostEmbeddingAccessSampler sampler(2, 2, 2);
+  const std::vector<int> indices = {3, 1, 3, 2, 3, 1};
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size());
+
+  EXPECT_TRUE(sampler.Count(indices.size()));
+  EXPECT_FALSE(sampler.Record(groups, 0));
+  EXPECT_FALSE(sampler.Count(indices.size()));
+  EXPECT_TRUE(sampler.Count(indices.size()));
+  EXPECT_TRUE(sampler.Record(groups, 4));
+
+  EXPECT_THAT(sampler.HotRows(10), ::testing::ElementsAre(3, 1));
+  EXPECT_THAT(sampler.HotRows(1), ::testing::ElementsAre(3));
+
+  HostEmbeddingStatistics statistics = sampler.GetStatistics();
+  EXPECT_EQ(statistics.lookups, 18);
+  EXPECT_EQ(statistics.sampled_lookups, 12);
+  EXPECT_EQ(statistics.sampled_cache_hits, 4);
+  EXPECT_EQ(statistics.window_lookups, 12);
+  ASSERT_EQ(statistics.hot_rows.size(), 2);
+  EXPECT_EQ(statistics.hot_rows[0], std::make_pair(3, int64{6}));
+  EXPECT_EQ(statistics.hot_rows[1], std::make_pair(1, int64{4}));
+
+  EXPECT_EQ(RowsToCover(statistics, 0.5), 1);
+  EXPECT_EQ(RowsToCover(statistics, 0.8), 2);
+  // Only the two hottest rows are kept.
+  EXPECT_EQ(RowsToCover(statistics, 1.0), 2);
+}
+
+TEST(HostEmbeddingUtilTest, RowCache) {
+  constexpr int kWidth = 16;
+  TestEmbedding<float> embedding(10, kWidth);
+  tensorflow::thread::ThreadPool pool(tensorflow::Env::Default(), "test", 4);
+
+  HostEmbeddingRowCache<float> cache(2, kWidth);
+  ASSERT_EQ(cache.Capacity(), 2);
+  EXPECT_EQ(cache.Find(4), nullptr);
+
+  // Only the first two rows fit in the cache.
+  cache.Fill(embedding.rows, {4, 7, 1}, &pool);
+  ASSERT_NE(cache.Find(4), nullptr);
+  ASSERT_NE(cache.Find(7), nullptr);
+  EXPECT_EQ(cache.Find(1), nullptr);
+  EXPECT_NE(cache.Find(4), embedding.rows[4]);
+  EXPECT_EQ(cache.Find(7)[kWidth - 1], 7.0f);
+
+  const std::vector<int> indices = {7, 1, 4, 7};
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size());
+  EXPECT_EQ(cache.CountHits(groups), 3);
+
+  // Updates to the embedding are copied into the cache.
+  std::vector<float> grads(indices.size() * kWidth, 1.0f);
+  ScatterAddRows(embedding.rows, groups, kWidth, grads.data(), &pool);
+  cache.Update(embedding.rows, groups);
+  EXPECT_EQ(cache.Find(7)[0], 9.0f);
+  EXPECT_EQ(cache.Find(4)[0], 5.0f);
+
+  // Lookups through the cache see the same values as the embedding.
+  std::vector<float> result(indices.size() * kWidth);
+  GatherRows(HostEmbeddingCachedRows<float>(embedding.rows, &cache), groups,
+             kWidth, result.data(), &pool);
+  for (std::size_t i = 0; i != indices.size(); ++i) {
+    for (int j = 0; j != kWidth; ++j) {
+      EXPECT_EQ(result[i * kWidth + j], embedding.rows[indices[i]][j]);
+    }
+  }
+}
+
+TEST(HostEmbeddingUtilTest, ShardedLookupAndUpdate) {
+  constexpr int kRows = 1000;
+  constexpr int kWidth = 8;
+  TestEmbedding<float> embedding(kRows, kWidth);
+
+  // The shards are spread over the NUMA nodes of the host, so this works on
+  // any host.
+  HostEmbeddingShards shards(embedding.data.data(), kRows,
+                             kWidth * sizeof(float), 2);
+  ASSERT_EQ(shards.NumShards(), 2);
+  EXPECT_EQ(shards.RowsPerShard(), 500);
+
+  std::vector<int> indices(4096);
+  for (std::size_t i = 0; i != indices.size(); ++i) {
+    indices[i] = (i * 7919) % kRows;
+  }
+  HostEmbeddingIndexGroups groups;
+  groups.Build(indices.data(), indices.size(), shards.NumShards(),
+               shards.RowsPerShard());
+
+  // Several replicas updating at once each add one to every row they use.
+  std::vector<float> grads(indices.size() * kWidth, 1.0f);
+  std::vector<std::thread> replicas;
+  for (int replica = 0; replica != 4; ++replica) {
+    replicas.emplace_back([&]() {
+      shards.Run(groups, 0, /*exclusive=*/true, [&](int begin, int end) {
+        ScatterAddRowRange(embedding.rows, groups, begin, end, kWidth,
+                           grads.data());
+      });
+    });
+  }
+  for (auto& replica : replicas) {
+    replica.join();
+  }
+
+  std::vector<float> result(indices.size() * kWidth);
+  shards.Run(groups, 0, /*exclusive=*/false, [&](int begin, int end) {
+    GatherRowRange(embedding.rows, groups, begin, end, kWidth, result.data());
+  });
+
+  std::vector<int> uses(kRows);
+  for (int index : indices) {
+    uses[index]++;
+  }
+  for (std::size_t i = 0; i != indices.size(); ++i) {
+    EXPECT_EQ(result[i * kWidth], indices[i] + 4 * uses[indices[i]]);
+  }
+}
+
+// Look up and then update a batch of Zipf distributed indices, as a
+// recommender model would, optionally through a cache of the hottest rows.
+void BM_HostEmbeddingLookupUpdate(int iters, int batch_size, int cache_rows) {
+  tensorflow::testing::StopTiming();
+  constexpr int kRows = 1 << 20;
+  constexpr int kWidth = 64;
+  TestEmbedding<float> embedding(kRows, kWidth);
+
+  std::mt19937 generator(42);
+  std::vector<double> weights(kRows);
+  for (int i = 0; i != kRows; ++i) {
+    weights[i] = 1.0 / (i + 1);
+  }
+  std::discrete_distribution<int> distribution(weights.begin(), weights.end());
+
+  // Scatter the hot rows over the whole embedding.
+  std::vector<int> permutation(kRows);
+  std::iota(permutation.begin(), permutation.end(), 0);
+  std::shuffle(permutation.begin(), permutation.end(), generator);
+
+  std::vector<int> indices(batch_size);
+  for (int& index : indices) {
+    index = permutation[distribution(generator)];
+  }
+
+  std::vector<float> activations(batch_size * kWidth);
+  std::vector<float> grads(batch_size * kWidth, 0.5f);
+  HostEmbeddingIndexGroups groups;
+  auto* pool = GetHostEmbeddingThreadPool();
+
+  HostEmbeddingRowCache<float> cache(cache_rows, kWidth);
+  if (cache_rows) {
+    std::vector<int> hot_rows(permutation.begin(),
+                              permutation.begin() + cache_rows);
+    cache.Fill(embedding.rows, hot_rows, pool);
+  }
+  HostEmbeddingCachedRows<float> rows(embedding.rows,
+                                      cache_rows ? &cache : nullptr);
+  tensorflow::testing::StartTiming();
+
+  for (int i = 0; i != iters; ++i) {
+    groups.Build(indices.data(), indices.size());
+    PrefetchRows(rows, groups, kWidth, 64);
+    GatherRows(rows, groups, kWidth, activations.data(), pool);
+    ScatterAddRows(embedding.rows, groups, kWidth, grads.data(), pool);
+    cache.Update(embedding.rows, groups);
+  }
+  tensorflow::testing::BytesProcessed(int64{iters} * batch_size * kWidth *
+                                      sizeof(float) * 2);
+}
+BENCHMARK(BM_HostEmbeddingLookupUpdate)
+    ->ArgPair(1024, 0)
+    ->ArgPair(65536, 0)
+    ->ArgPair(65536, 1 << 16);
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
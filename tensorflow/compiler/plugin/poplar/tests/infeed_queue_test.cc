@@ -13,6 +13,9 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_allocator.h"
 #include "tensorflow/compiler/plugin/poplar/driver/tools/infeed_iterator.h"
 #include "tensorflow/compiler/xla/test.h"
 #include "tensorflow/core/common_runtime/dma_helper.h"
@@ -56,6 +59,85 @@ TEST(InfeedQueueTest, EndOfQueue) {
   ASSERT_FALSE(q.BlockPop(outbuf));
 }
 
+TEST(InfeedQueueTest, AllocatorAlignment) {
+  InfeedAllocator allocator;
+
+  for (size_t alignment : {8, 64, 128, 4096}) {
+    void* ptr = allocator.AllocateRaw(alignment, 100);
+    ASSERT_NE(ptr, nullptr);
+    const size_t expected_alignment = std::max<size_t>(alignment, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % expected_alignment, 0);
+    allocator.DeallocateRaw(ptr);
+  }
+}
+
+TEST(InfeedQueueTest, AllocatorSizeClasses) {
+  EXPECT_EQ(InfeedAllocator::RoundUpToSizeClass(1), 256);
+  EXPECT_EQ(InfeedAllocator::RoundUpToSizeClass(256), 256);
+  EXPECT_EQ(InfeedAllocator::RoundUpToSizeClass(257), 320);
+  EXPECT_EQ(InfeedAllocator::RoundUpToSizeClass(1000), 1024);
+  EXPECT_EQ(InfeedAllocator::RoundUpToSizeClass(1025), 1280);
+  EXPECT_EQ(InfeedAllocator::RoundUpToSizeClass(3 << 20), 3 << 20);
+}
+
+TEST(InfeedQueueTest, AllocatorRecyclesBuffers) {
+  InfeedAllocator allocator;
+
+  void* first = allocator.AllocateRaw(64, 1000);
+  EXPECT_EQ(allocator.PoolMissCount(), 1);
+  allocator.DeallocateRaw(first);
+
+  // A buffer in the same size class is reused.
+  void* second = allocator.AllocateRaw(64, 1010);
+  EXPECT_EQ(second, first);
+  EXPECT_EQ(allocator.PoolHitCount(), 1);
+  EXPECT_EQ(allocator.PoolMissCount(), 1);
+
+  // A buffer in a different size class is not.
+  void* third = allocator.AllocateRaw(64, 100000);
+  EXPECT_NE(third, first);
+  EXPECT_EQ(allocator.PoolMissCount(), 2);
+
+  allocator.DeallocateRaw(second);
+  allocator.DeallocateRaw(third);
+}
+
+TEST(InfeedQueueTest, QueueReleasesBuffersToAllocator) {
+  InfeedAllocator allocator;
+  InfeedQueue q;
+
+  tensorflow::TensorBuffer* inbuf;
+  {
+    tensorflow::Tensor in(&allocator, tensorflow::DT_FLOAT,
+                          tensorflow::TensorShape({256}));
+    inbuf = tensorflow::DMAHelper::buffer(&in);
+    inbuf->Ref();
+    q.Push(inbuf);
+    q.AdvanceWritePosition();
+  }
+
+  tensorflow::TensorBuffer* outbuf;
+  ASSERT_TRUE(q.TryPop(outbuf));
+  void* data = outbuf->data();
+  q.AdvanceReadPosition();
+
+  // The buffer is only released when its slot is overwritten, after which the
+  // next allocation of the same size reuses it.
+  for (int i = 0; i != 2048; ++i) {
+    tensorflow::Tensor in(1.0f);
+    auto* buf = tensorflow::DMAHelper::buffer(&in);
+    buf->Ref();
+    q.BlockPush(buf);
+    q.AdvanceWritePosition();
+    q.BlockPop(outbuf);
+    q.AdvanceReadPosition();
+  }
+  tensorflow::Tensor reused(&allocator, tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({256}));
+  EXPECT_EQ(tensorflow::DMAHelper::buffer(&reused)->data(), data);
+  EXPECT_EQ(allocator.PoolHitCount(), 1);
+}
+
 }  // namespace
 }  // namespace poplarplugin
 }  // namespace xla
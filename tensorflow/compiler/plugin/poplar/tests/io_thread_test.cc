@@ -0,0 +1,153 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/io_thread.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+// A task which is busy for `steps` steps and then finishes.
+IOTaskFunction CountingTask(std::atomic<int64>* count, int64 steps) {
+  return [count, steps](bool cancelled) -> StatusOr<IOTaskState> {
+    if (cancelled || *count == steps) {
+      return IOTaskState::kFinished;
+    }
+    (*count)++;
+    return IOTaskState::kBusy;
+  };
+}
+
+TEST(IOExecutorTest, RunsTasksToCompletion) {
+  constexpr int64 kNumTasks = 8;
+  constexpr int64 kSteps = 1000;
+  std::vector<std::atomic<int64>> counts(kNumTasks);
+
+  IOExecutor executor("test", 2);
+  for (int64 i = 0; i != kNumTasks; ++i) {
+    counts[i] = 0;
+    executor.AddTask(absl::StrCat("task", i), CountingTask(&counts[i], kSteps));
+  }
+  executor.Start();
+  EXPECT_EQ(executor.NumThreads(), 2);
+
+  // All the tasks finish on their own, so they must all have run to the end
+  // before the threads join.
+  while (true) {
+    int64 done = 0;
+    for (auto& count : counts) {
+      done += count == kSteps;
+    }
+    if (done == kNumTasks) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  executor.Stop();
+
+  for (const IOTaskStats& stats : executor.GetStats()) {
+    EXPECT_EQ(stats.busy_steps, kSteps);
+  }
+}
+
+TEST(IOExecutorTest, OneThreadPerTaskByDefault) {
+  std::atomic<int64> a(0);
+  std::atomic<int64> b(0);
+  IOExecutor executor("test", -1);
+  executor.AddTask("a", CountingTask(&a, 1));
+  executor.AddTask("b", CountingTask(&b, 1));
+  executor.Start();
+  EXPECT_EQ(executor.NumThreads(), 2);
+}
+
+TEST(IOExecutorTest, StopCancelsIdleTasks) {
+  std::atomic<bool> was_cancelled(false);
+  IOExecutor executor("test", 1);
+  executor.AddTask("idle", [&was_cancelled](bool cancelled)
+                               -> StatusOr<IOTaskState> {
+    if (cancelled) {
+      was_cancelled = true;
+      return IOTaskState::kFinished;
+    }
+    return IOTaskState::kIdle;
+  });
+  executor.Start();
+  executor.Stop();
+  EXPECT_TRUE(was_cancelled);
+
+  auto stats = executor.GetStats();
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].busy_steps, 0);
+}
+
+TEST(IOExecutorTest, ErrorFinishesTask) {
+  std::atomic<int64> steps(0);
+  IOExecutor executor("test", 1);
+  executor.AddTask("error",
+                   [&steps](bool cancelled) -> StatusOr<IOTaskState> {
+                     steps++;
+                     return tensorflow::errors::Internal("Task failed.");
+                   });
+  executor.Start();
+  executor.Stop();
+  EXPECT_EQ(steps, 1);
+}
+
+TEST(IOExecutorTest, PriorityGivesMoreSteps) {
+  // Both tasks share one thread and are never finished by themselves, so the
+  // higher priority task runs four steps for every one of the other task.
+  std::atomic<int64> low(0);
+  std::atomic<int64> high(0);
+  IOExecutor executor("test", 1);
+  executor.AddTask("low", CountingTask(&low, -1), 0);
+  executor.AddTask("high", CountingTask(&high, -1), 3);
+  executor.Start();
+  while (low < 1000) {
+    std::this_thread::yield();
+  }
+  executor.Stop();
+
+  const double ratio = static_cast<double>(high) / low;
+  EXPECT_NEAR(ratio, 4.0, 0.1);
+}
+
+TEST(IOExecutorTest, OccupancyStats) {
+  std::atomic<int64> count(0);
+  IOExecutor executor("test", 1);
+  executor.AddTask("feed", CountingTask(&count, 100), 0, []() { return 0.5; });
+  executor.Start();
+  while (count < 100) {
+    std::this_thread::yield();
+  }
+  executor.Stop();
+
+  auto stats = executor.GetStats();
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_NEAR(stats[0].mean_occupancy, 0.5, 1e-6);
+  EXPECT_EQ(stats[0].empty_fraction, 0.0);
+  EXPECT_EQ(stats[0].full_fraction, 0.0);
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
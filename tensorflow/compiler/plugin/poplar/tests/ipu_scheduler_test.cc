@@ -0,0 +1,361 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/schedulers/ipu_scheduler.h"
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/hlo_hash.h"
+#include "tensorflow/compiler/xla/service/hlo_memory_scheduler.h"
+#include "tensorflow/compiler/xla/service/hlo_parser.h"
+#include "tensorflow/compiler/xla/service/tuple_points_to_analysis.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/compiler/xla/tests/hlo_test_base.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+using IpuSchedulerTest = HloTestBase;
+
+int64 SizeFunction(const BufferValue& buffer) {
+  return ShapeUtil::ByteSizeOf(buffer.shape(), 1);
+}
+
+std::string GetCacheDirectory(const std::string& test_name) {
+  auto path = tensorflow::io::JoinPath(testing::TmpDir(), test_name);
+  int64 undeleted_files, undeleted_dirs;
+  tensorflow::Env::Default()
+      ->DeleteRecursively(path, &undeleted_files, &undeleted_dirs)
+      .IgnoreError();
+  return path;
+}
+
+IpuSchedulerAlgorithm CountingAlgorithm(int* count) {
+  auto post_order = MemorySchedulerAlgorithmToIPU(PostOrderMemoryScheduler);
+  return [count, post_order](
+             HloComputation* computation,
+             const TuplePointsToAnalysis& points_to_analysis,
+             const LogicalBuffer::SizeFunction& size_function,
+             const absl::flat_hash_map<const HloComputation*, int64>&
+                 memory_by_computation,
+             HloHash* module_hash) {
+    (*count)++;
+    return post_order(computation, points_to_analysis, size_function,
+                      memory_by_computation, module_hash);
+  };
+}
+
+// Returns the instructions in the order of the given names.
+IpuSchedulerAlgorithm FixedOrderAlgorithm(std::vector<std::string> names,
+                                          int* count, int64 sleep_us = 0) {
+  return [names, count, sleep_us](
+             HloComputation* computation, const TuplePointsToAnalysis&,
+             const LogicalBuffer::SizeFunction&,
+             const absl::flat_hash_map<const HloComputation*, int64>&,
+             HloHash*) -> StatusOr<HloInstructionSequence> {
+    (*count)++;
+    if (sleep_us) {
+      tensorflow::Env::Default()->SleepForMicroseconds(sleep_us);
+    }
+    HloInstructionSequence sequence;
+    for (auto& name : names) {
+      auto* inst = computation->GetInstructionWithName(name);
+      if (!inst) {
+        return xla::NotFound("Instruction %s not found", name);
+      }
+      sequence.push_back(inst);
+    }
+    return sequence;
+  };
+}
+
+const char* kTwoChainsHlo = R"(
+HloModule top
+
+%cluster_1  {
+  p0 = f32[] parameter(0)
+  b0 = f32[1000] broadcast(p0), dimensions={}
+  n0 = f32[1000] negate(b0)
+  s0 = f32[1] slice(n0), slice={[0:1]}
+  b1 = f32[1000] broadcast(p0), dimensions={}
+  n1 = f32[1000] negate(b1)
+  s1 = f32[1] slice(n1), slice={[0:1]}
+  ROOT t = (f32[1], f32[1]) tuple(s0, s1)
+}
+  )";
+
+const std::vector<std::string> kGoodOrder = {"p0", "b0", "n0", "s0",
+                                             "b1", "n1", "s1", "t"};
+const std::vector<std::string> kBadOrder = {"p0", "b0", "b1", "n0",
+                                            "n1", "s0", "s1", "t"};
+
+TEST_F(IpuSchedulerTest, ParallelSelectsLowestLiveness) {
+  int good_count = 0;
+  int bad_count = 0;
+  std::map<std::string, std::string> selected;
+  auto algorithm =
+      ParallelBestIpuSchedule(
+          {{"Bad", FixedOrderAlgorithm(kBadOrder, &bad_count)},
+           {"Good", FixedOrderAlgorithm(kGoodOrder, &good_count)}},
+          0, &selected)
+          .ValueOrDie();
+
+  auto module = ParseAndReturnVerifiedModule(kTwoChainsHlo).ConsumeValueOrDie();
+  IpuScheduler scheduler(SizeFunction, algorithm);
+  EXPECT_TRUE(scheduler.Run(module.get()).ValueOrDie());
+  EXPECT_EQ(good_count, 1);
+  EXPECT_EQ(bad_count, 1);
+
+  auto seq =
+      module->schedule().sequence(module->entry_computation()).instructions();
+  ASSERT_EQ(seq.size(), kGoodOrder.size());
+  for (size_t i = 0; i != seq.size(); ++i) {
+    EXPECT_EQ(seq[i]->name(), kGoodOrder[i]);
+  }
+
+  ASSERT_EQ(selected.size(), 1);
+  EXPECT_EQ(selected.begin()->second, "Good");
+}
+
+TEST_F(IpuSchedulerTest, ParallelDiscardsSchedulersOverBudget) {
+  int good_count = 0;
+  int bad_count = 0;
+  std::map<std::string, std::string> selected;
+  auto algorithm =
+      ParallelBestIpuSchedule(
+          {{"Bad", FixedOrderAlgorithm(kBadOrder, &bad_count)},
+           {"Good", FixedOrderAlgorithm(kGoodOrder, &good_count, 200000)}},
+          10, &selected)
+          .ValueOrDie();
+
+  for (int i = 0; i != 2; ++i) {
+    auto module =
+        ParseAndReturnVerifiedModule(kTwoChainsHlo).ConsumeValueOrDie();
+    IpuScheduler scheduler(SizeFunction, algorithm);
+    EXPECT_TRUE(scheduler.Run(module.get()).ValueOrDie());
+    ASSERT_EQ(selected.size(), 1);
+    EXPECT_EQ(selected.begin()->second, "Bad");
+  }
+
+  // The slow scheduler is not run again once it exceeded the budget.
+  EXPECT_EQ(good_count, 1);
+  EXPECT_EQ(bad_count, 2);
+}
+
+TEST_F(IpuSchedulerTest, ReuseScheduleAcrossModules) {
+  std::string hlo_string0 = R"(
+HloModule top
+
+%cluster_1  {
+  p0 = f32[] parameter(0)
+  p1 = f32[] parameter(1)
+  cos0 = f32[] cosine(p0)
+  add0 = f32[] add(cos0, p1)
+  ROOT tuple = (f32[]) tuple(add0)
+}
+  )";
+
+  // Same program with different names.
+  std::string hlo_string1 = R"(
+HloModule other
+
+%cluster_2  {
+  a = f32[] parameter(0)
+  b = f32[] parameter(1)
+  c = f32[] cosine(a)
+  d = f32[] add(c, b)
+  ROOT e = (f32[]) tuple(d)
+}
+  )";
+
+  const std::string cache_path =
+      GetCacheDirectory("ReuseScheduleAcrossModules");
+
+  int count = 0;
+  auto algorithm_status =
+      CachedIpuSchedule(CountingAlgorithm(&count), cache_path, 0);
+  ASSERT_TRUE(algorithm_status.ok());
+  auto algorithm = algorithm_status.ValueOrDie();
+
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string0).ConsumeValueOrDie();
+  IpuScheduler scheduler0(SizeFunction, algorithm);
+  EXPECT_TRUE(scheduler0.Run(module0.get()).ValueOrDie());
+  EXPECT_EQ(count, 1);
+
+  auto module1 = ParseAndReturnVerifiedModule(hlo_string1).ConsumeValueOrDie();
+  IpuScheduler scheduler1(SizeFunction, algorithm);
+  EXPECT_TRUE(scheduler1.Run(module1.get()).ValueOrDie());
+  EXPECT_EQ(count, 1);
+
+  auto seq0 =
+      module0->schedule().sequence(module0->entry_computation()).instructions();
+  auto seq1 =
+      module1->schedule().sequence(module1->entry_computation()).instructions();
+  ASSERT_EQ(seq0.size(), seq1.size());
+  for (size_t i = 0; i != seq0.size(); ++i) {
+    EXPECT_EQ(seq0[i]->opcode(), seq1[i]->opcode());
+  }
+}
+
+TEST_F(IpuSchedulerTest, SharedModuleHashMatchesComputationHash) {
+  std::string hlo_string = R"(
+HloModule top
+
+inner {
+  a = f32[] parameter(0)
+  ROOT b = f32[] cosine(a)
+}
+
+outer {
+  c = f32[] parameter(0)
+  d = f32[] call(c), to_apply=inner
+  ROOT e = f32[] sine(d)
+}
+
+ENTRY main {
+  f = f32[] parameter(0)
+  g = f32[] call(f), to_apply=outer
+  ROOT h = f32[] negate(g)
+}
+  )";
+
+  const std::string cache_path =
+      GetCacheDirectory("SharedModuleHashMatchesComputationHash");
+
+  int count = 0;
+  auto algorithm =
+      CachedIpuSchedule(CountingAlgorithm(&count), cache_path, 0).ValueOrDie();
+
+  auto module = ParseAndReturnVerifiedModule(hlo_string).ConsumeValueOrDie();
+  auto points_to_analysis =
+      TuplePointsToAnalysis::Run(module.get()).ConsumeValueOrDie();
+  const absl::flat_hash_map<const HloComputation*, int64> memory;
+
+  // Store the schedules using a hash shared by all the computations...
+  HloHash module_hash(module.get());
+  for (auto* computation : module->MakeComputationPostOrder()) {
+    TF_ASSERT_OK(algorithm(computation, *points_to_analysis, SizeFunction,
+                           memory, &module_hash)
+                     .status());
+  }
+  EXPECT_EQ(count, 3);
+
+  // ...and load them using a hash of each computation.
+  for (auto* computation : module->MakeComputationPostOrder()) {
+    TF_ASSERT_OK(algorithm(computation, *points_to_analysis, SizeFunction,
+                           memory, nullptr)
+                     .status());
+  }
+  EXPECT_EQ(count, 3);
+}
+
+TEST_F(IpuSchedulerTest, DifferentOptionsMiss) {
+  std::string hlo_string = R"(
+HloModule top
+
+%cluster_1  {
+  p0 = f32[] parameter(0)
+  p1 = f32[] parameter(1)
+  cos0 = f32[] cosine(p0)
+  add0 = f32[] add(cos0, p1)
+  ROOT tuple = (f32[]) tuple(add0)
+}
+  )";
+
+  const std::string cache_path = GetCacheDirectory("DifferentOptionsMiss");
+
+  int count = 0;
+  for (uint64 options_hash : {1, 2, 1}) {
+    auto algorithm =
+        CachedIpuSchedule(CountingAlgorithm(&count), cache_path, options_hash)
+            .ValueOrDie();
+    auto module = ParseAndReturnVerifiedModule(hlo_string).ConsumeValueOrDie();
+    IpuScheduler scheduler(SizeFunction, algorithm);
+    EXPECT_TRUE(scheduler.Run(module.get()).ValueOrDie());
+  }
+  EXPECT_EQ(count, 2);
+}
+
+TEST_F(IpuSchedulerTest, InvalidCacheEntryIgnored) {
+  std::string hlo_string = R"(
+HloModule top
+
+%cluster_1  {
+  p0 = f32[] parameter(0)
+  cos0 = f32[] cosine(p0)
+  ROOT tuple = (f32[]) tuple(cos0)
+}
+  )";
+
+  const std::string cache_path = GetCacheDirectory("InvalidCacheEntryIgnored");
+
+  int count = 0;
+  auto algorithm =
+      CachedIpuSchedule(CountingAlgorithm(&count), cache_path, 0).ValueOrDie();
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string).ConsumeValueOrDie();
+  IpuScheduler scheduler0(SizeFunction, algorithm);
+  EXPECT_TRUE(scheduler0.Run(module0.get()).ValueOrDie());
+  EXPECT_EQ(count, 1);
+
+  // Corrupt every cached schedule.
+  std::vector<std::string> children;
+  TF_ASSERT_OK(tensorflow::Env::Default()->GetChildren(cache_path, &children));
+  ASSERT_EQ(children.size(), 1);
+  TF_ASSERT_OK(tensorflow::WriteStringToFile(
+      tensorflow::Env::Default(),
+      tensorflow::io::JoinPath(cache_path, children[0]), "garbage"));
+
+  auto module1 = ParseAndReturnVerifiedModule(hlo_string).ConsumeValueOrDie();
+  IpuScheduler scheduler1(SizeFunction, algorithm);
+  EXPECT_TRUE(scheduler1.Run(module1.get()).ValueOrDie());
+  EXPECT_EQ(count, 2);
+}
+
+TEST_F(IpuSchedulerTest, CachedScheduleReportsSelectedScheduler) {
+  const std::string cache_path =
+      GetCacheDirectory("CachedScheduleReportsSelectedScheduler");
+
+  int good_count = 0;
+  int bad_count = 0;
+  for (int i = 0; i != 2; ++i) {
+    std::map<std::string, std::string> selected;
+    auto parallel =
+        ParallelBestIpuSchedule(
+            {{"Bad", FixedOrderAlgorithm(kBadOrder, &bad_count)},
+             {"Good", FixedOrderAlgorithm(kGoodOrder, &good_count)}},
+            0, &selected)
+            .ValueOrDie();
+    auto algorithm =
+        CachedIpuSchedule(parallel, cache_path, 0, &selected).ValueOrDie();
+
+    auto module =
+        ParseAndReturnVerifiedModule(kTwoChainsHlo).ConsumeValueOrDie();
+    IpuScheduler scheduler(SizeFunction, algorithm);
+    EXPECT_TRUE(scheduler.Run(module.get()).ValueOrDie());
+
+    // The second schedule is loaded from the cache, together with the name of
+    // the scheduler which produced it.
+    ASSERT_EQ(selected.size(), 1);
+    EXPECT_EQ(selected.begin()->second, "Good");
+  }
+  EXPECT_EQ(good_count, 1);
+  EXPECT_EQ(bad_count, 1);
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
@@ -0,0 +1,89 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <memory>
+#include <string>
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/lru_cache.h"
+#include "tensorflow/compiler/xla/test.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+TEST(LRUCacheTest, EvictsLeastRecentlyUsed) {
+  LRUCache<std::string, int> cache(2);
+  EXPECT_TRUE(cache.Insert("a", 1).evicted.empty());
+  EXPECT_TRUE(cache.Insert("b", 2).evicted.empty());
+  EXPECT_EQ(cache.Size(), 2);
+
+  // Using "a" makes "b" the least recently used.
+  ASSERT_NE(cache.Lookup("a"), nullptr);
+  EXPECT_EQ(*cache.Lookup("a"), 1);
+
+  auto result = cache.Insert("c", 3);
+  EXPECT_FALSE(result.replaced.has_value());
+  EXPECT_THAT(result.evicted, ::testing::ElementsAre(2));
+  EXPECT_EQ(cache.Size(), 2);
+  EXPECT_EQ(cache.Lookup("b"), nullptr);
+  EXPECT_EQ(*cache.Lookup("a"), 1);
+  EXPECT_EQ(*cache.Lookup("c"), 3);
+}
+
+TEST(LRUCacheTest, ReplacesValues) {
+  LRUCache<std::string, int> cache(2);
+  cache.Insert("a", 1);
+  cache.Insert("b", 2);
+
+  // Replacing "a" returns the old value, without evicting anything, and makes
+  // it the most recently used.
+  auto replace_result = cache.Insert("a", 3);
+  ASSERT_TRUE(replace_result.replaced.has_value());
+  EXPECT_EQ(*replace_result.replaced, 1);
+  EXPECT_TRUE(replace_result.evicted.empty());
+  EXPECT_EQ(cache.Size(), 2);
+
+  auto insert_result = cache.Insert("c", 4);
+  EXPECT_FALSE(insert_result.replaced.has_value());
+  EXPECT_THAT(insert_result.evicted, ::testing::ElementsAre(2));
+  EXPECT_EQ(*cache.Lookup("a"), 3);
+  EXPECT_EQ(*cache.Lookup("c"), 4);
+}
+
+TEST(LRUCacheTest, ZeroCapacity) {
+  LRUCache<std::string, int> cache(0);
+  EXPECT_THAT(cache.Insert("a", 1).evicted, ::testing::ElementsAre(1));
+  EXPECT_EQ(cache.Size(), 0);
+  EXPECT_EQ(cache.Lookup("a"), nullptr);
+}
+
+TEST(LRUCacheTest, ClearReturnsValues) {
+  LRUCache<int, std::shared_ptr<int>> cache(4);
+  auto value = std::make_shared<int>(1);
+  cache.Insert(1, value);
+  EXPECT_EQ(value.use_count(), 2);
+
+  // The values are handed back rather than destroyed.
+  auto cleared = cache.Clear();
+  EXPECT_EQ(cache.Size(), 0);
+  ASSERT_EQ(cleared.size(), 1);
+  EXPECT_EQ(value.use_count(), 2);
+  cleared.clear();
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
@@ -13,7 +13,6 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 #include "tensorflow/compiler/plugin/poplar/driver/passes/matmul_combiner.h"
-#include "tensorflow/compiler/plugin/poplar/driver/compiler_annotations.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/custom_op_replacer.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/poplar_algebraic_simplifier.h"
 #include "tensorflow/compiler/plugin/poplar/driver/passes/scatter_simplifier.h"
@@ -125,8 +124,6 @@ ENTRY main {
   auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
   auto* module = module0.get();
 
-  CompilerAnnotations annotations(module);
-
   ScatterSimplifier sc;
   EXPECT_FALSE(sc.Run(module).ValueOrDie());
 
@@ -136,7 +133,7 @@ ENTRY main {
   EXPECT_EQ(GetNumReshape(module->entry_computation()), 0);
   EXPECT_EQ(GetNumTranspose(module->entry_computation()), 0);
 
-  HloPassFix<MatmulCombiner> combiner(annotations);
+  HloPassFix<MatmulCombiner> combiner;
   EXPECT_TRUE(combiner.Run(module).ValueOrDie());
 
   EXPECT_EQ(GetNumMatmul(module->entry_computation()), 1);
@@ -221,8 +218,6 @@ ENTRY main {
   auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
   auto* module = module0.get();
 
-  CompilerAnnotations annotations(module);
-
   ScatterSimplifier sc;
   EXPECT_FALSE(sc.Run(module).ValueOrDie());
 
@@ -232,7 +227,7 @@ ENTRY main {
   EXPECT_EQ(GetNumReshape(module->entry_computation()), 0);
   EXPECT_EQ(GetNumTranspose(module->entry_computation()), 0);
 
-  HloPassFix<MatmulCombiner> combiner(annotations);
+  HloPassFix<MatmulCombiner> combiner;
   EXPECT_TRUE(combiner.Run(module).ValueOrDie());
 
   EXPECT_EQ(GetNumMatmul(module->entry_computation()), 1);
@@ -318,8 +313,6 @@ ENTRY main {
   auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
   auto* module = module0.get();
 
-  CompilerAnnotations annotations(module);
-
   ScatterSimplifier sc;
   EXPECT_FALSE(sc.Run(module).ValueOrDie());
 
@@ -329,7 +322,7 @@ ENTRY main {
   EXPECT_EQ(GetNumReshape(module->entry_computation()), 0);
   EXPECT_EQ(GetNumTranspose(module->entry_computation()), 0);
 
-  HloPassFix<MatmulCombiner> combiner(annotations);
+  HloPassFix<MatmulCombiner> combiner;
   EXPECT_TRUE(combiner.Run(module).ValueOrDie());
 
   EXPECT_EQ(GetNumMatmul(module->entry_computation()), 1);
@@ -394,6 +387,226 @@ ENTRY main {
     return true;
   });
 }
+
+TEST_F(MatmulCombinerTest, MatmulSharedLHSThreeWay) {
+  // The Q/K/V projections of an attention layer with a larger V.
+  std::string hlo_string = R"(
+HloModule main
+
+ENTRY main {
+  x = f32[8,16] parameter(0)
+  wq = f32[16,16] parameter(1)
+  wk = f32[16,16] parameter(2)
+  wv = f32[16,32] parameter(3)
+  q = f32[8,16] dot(x, wq), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  k = f32[8,16] dot(x, wk), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  v = f32[8,32] dot(x, wv), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  ROOT t = (f32[8,16], f32[8,16], f32[8,32]) tuple(q, k, v)
+}
+  )";
+
+  HloModuleConfig config;
+  config.set_debug_options(GetDebugOptionsForTest());
+
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
+  auto* module = module0.get();
+
+  MatmulCombiner combiner;
+  EXPECT_TRUE(combiner.Run(module).ValueOrDie());
+
+  EXPECT_EQ(GetNumMatmul(module->entry_computation()), 1);
+  EXPECT_EQ(GetNumSlice(module->entry_computation()), 3);
+  EXPECT_EQ(GetNumConcatenate(module->entry_computation()), 1);
+
+  auto root = module->entry_computation()->root_instruction();
+  const HloInstruction* matmul = root->operand(0)->operand(0)->operand(0);
+  EXPECT_TRUE(Match(matmul, m::Dot(m::Reshape(m::Transpose(m::Parameter(0))),
+                                   m::Concatenate())));
+  EXPECT_TRUE(ShapeUtil::Equal(matmul->shape(),
+                               ShapeUtil::MakeShape(F32, {1, 8, 64})));
+  for (int64 i = 0; i != 3; ++i) {
+    EXPECT_TRUE(Match(root->operand(i), m::Reshape(m::Slice(m::Dot()))));
+    EXPECT_EQ(root->operand(i)->operand(0)->operand(0), matmul);
+  }
+  // The V projection is the last slice.
+  EXPECT_EQ(root->operand(2)->operand(0)->slice_starts(2), 32);
+  EXPECT_EQ(root->operand(2)->operand(0)->slice_limits(2), 64);
+}
+
+TEST_F(MatmulCombinerTest, DependentMatmuls) {
+  // The second matmul uses the output of the first one, so they cannot be
+  // combined even though they share the LHS.
+  std::string hlo_string = R"(
+HloModule main
+
+ENTRY main {
+  x = f32[8,16] parameter(0)
+  w = f32[16,16] parameter(1)
+  matmul1 = f32[8,16] dot(x, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t = f32[16,8] transpose(matmul1), dimensions={1,0}
+  ROOT matmul2 = f32[8,8] dot(x, t), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+}
+  )";
+
+  HloModuleConfig config;
+  config.set_debug_options(GetDebugOptionsForTest());
+
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
+  auto* module = module0.get();
+
+  MatmulCombiner combiner;
+  EXPECT_FALSE(combiner.Run(module).ValueOrDie());
+  EXPECT_EQ(GetNumMatmul(module->entry_computation()), 2);
+}
+
+TEST_F(MatmulCombinerTest, MatmulBatched) {
+  // The matmuls share no operands, but only their batch size differs.
+  std::string hlo_string = R"(
+HloModule main
+
+ENTRY main {
+  lhs = f32[2,4,3] parameter(0)
+  rhs = f32[2,3,5] parameter(1)
+  lhs2 = f32[3,4,3] parameter(2)
+  rhs2 = f32[3,3,5] parameter(3)
+  matmul1 = f32[2,4,5] dot(lhs, rhs), lhs_contracting_dims={2}, rhs_contracting_dims={1}, lhs_batch_dims={0}, rhs_batch_dims={0}
+  matmul2 = f32[3,4,5] dot(lhs2, rhs2), lhs_contracting_dims={2}, rhs_contracting_dims={1}, lhs_batch_dims={0}, rhs_batch_dims={0}
+  ROOT t = (f32[2,4,5], f32[3,4,5]) tuple(matmul1, matmul2)
+}
+  )";
+
+  HloModuleConfig config;
+  config.set_debug_options(GetDebugOptionsForTest());
+
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
+  auto* module = module0.get();
+
+  MatmulCombiner combiner;
+  EXPECT_TRUE(combiner.Run(module).ValueOrDie());
+
+  EXPECT_EQ(GetNumMatmul(module->entry_computation()), 1);
+  EXPECT_EQ(GetNumSlice(module->entry_computation()), 2);
+  EXPECT_EQ(GetNumConcatenate(module->entry_computation()), 2);
+
+  auto root = module->entry_computation()->root_instruction();
+  EXPECT_TRUE(Match(root->operand(0),
+                    m::Reshape(m::Slice(
+                        m::Dot(m::Concatenate(), m::Concatenate())))));
+  EXPECT_TRUE(Match(root->operand(1),
+                    m::Reshape(m::Slice(
+                        m::Dot(m::Concatenate(), m::Concatenate())))));
+  EXPECT_EQ(root->operand(0)->operand(0)->operand(0),
+            root->operand(1)->operand(0)->operand(0));
+
+  // Check the expected value.
+  auto populate_lhs = [](const xla::DimensionVector& index) {
+    return index[0] + index[1] * 10.0f + index[2] * 100.0f;
+  };
+  auto populate_rhs = [](const xla::DimensionVector& index) {
+    return index[0] * 0.1f + index[1] + index[2] * 0.01f;
+  };
+  Literal lhs(ShapeUtil::MakeShape(F32, {2, 4, 3}));
+  lhs.Populate<float>(populate_lhs);
+  Literal rhs(ShapeUtil::MakeShape(F32, {2, 3, 5}));
+  rhs.Populate<float>(populate_rhs);
+  Literal lhs2(ShapeUtil::MakeShape(F32, {3, 4, 3}));
+  lhs2.Populate<float>(populate_rhs);
+  Literal rhs2(ShapeUtil::MakeShape(F32, {3, 3, 5}));
+  rhs2.Populate<float>(populate_lhs);
+
+  Literal result =
+      Execute(
+          std::move(
+              ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie()),
+          {&lhs, &rhs, &lhs2, &rhs2})
+          .ValueOrDie();
+  ASSERT_TRUE(result.shape().IsTuple());
+
+  const Shape& slice1 = ShapeUtil::GetSubshape(result.shape(), {0});
+  ShapeUtil::ForEachIndex(slice1, [&](absl::Span<const int64> output_index) {
+    float expected_value = ComputeMatMulValue3D(lhs, rhs, output_index);
+    float value = result.Get<float>(output_index, {0});
+    EXPECT_FLOAT_EQ(value, expected_value);
+    return true;
+  });
+  const Shape& slice2 = ShapeUtil::GetSubshape(result.shape(), {1});
+  ShapeUtil::ForEachIndex(slice2, [&](absl::Span<const int64> output_index) {
+    float expected_value = ComputeMatMulValue3D(lhs2, rhs2, output_index);
+    float value = result.Get<float>(output_index, {1});
+    EXPECT_FLOAT_EQ(value, expected_value);
+    return true;
+  });
+}
+
+TEST_F(MatmulCombinerTest, MatmulBatchedSharded) {
+  // The operands are on a different IPU from the matmuls, so every
+  // instruction created for the combined matmul must be placed on the IPU of
+  // the matmuls.
+  std::string hlo_string = R"(
+HloModule main
+
+ENTRY main {
+  lhs = f32[2,4,3] parameter(0), sharding={maximal device=0}
+  rhs = f32[2,3,5] parameter(1), sharding={maximal device=0}
+  lhs2 = f32[3,4,3] parameter(2), sharding={maximal device=0}
+  rhs2 = f32[3,3,5] parameter(3), sharding={maximal device=0}
+  matmul1 = f32[2,4,5] dot(lhs, rhs), lhs_contracting_dims={2}, rhs_contracting_dims={1}, lhs_batch_dims={0}, rhs_batch_dims={0}, sharding={maximal device=1}
+  matmul2 = f32[3,4,5] dot(lhs2, rhs2), lhs_contracting_dims={2}, rhs_contracting_dims={1}, lhs_batch_dims={0}, rhs_batch_dims={0}, sharding={maximal device=1}
+  ROOT t = (f32[2,4,5], f32[3,4,5]) tuple(matmul1, matmul2), sharding={{maximal device=1}, {maximal device=1}}
+}
+  )";
+
+  HloModuleConfig config;
+  config.set_debug_options(GetDebugOptionsForTest());
+
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
+  auto* module = module0.get();
+
+  MatmulCombiner combiner;
+  EXPECT_TRUE(combiner.Run(module).ValueOrDie());
+
+  HloComputation* entry = module->entry_computation();
+  EXPECT_EQ(GetNumMatmul(entry), 1);
+  EXPECT_EQ(GetNumConcatenate(entry), 2);
+  EXPECT_GT(GetNumTranspose(entry), 0);
+
+  const HloSharding expected = HloSharding::AssignDevice(1);
+  for (const HloInstruction* inst : entry->instructions()) {
+    if (inst->opcode() == HloOpcode::kParameter ||
+        inst == entry->root_instruction()) {
+      continue;
+    }
+    ASSERT_TRUE(inst->has_sharding()) << inst->ToString();
+    EXPECT_EQ(inst->sharding(), expected) << inst->ToString();
+  }
+}
+
+TEST_F(MatmulCombinerTest, NotProfitable) {
+  // Concatenating the large weights costs more than executing the matmuls
+  // separately.
+  std::string hlo_string = R"(
+HloModule main
+
+ENTRY main {
+  x = f32[2,2048] parameter(0)
+  w1 = f32[2048,2048] parameter(1)
+  w2 = f32[2048,2048] parameter(2)
+  matmul1 = f32[2,2048] dot(x, w1), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  matmul2 = f32[2,2048] dot(x, w2), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  ROOT t = (f32[2,2048], f32[2,2048]) tuple(matmul1, matmul2)
+}
+  )";
+
+  HloModuleConfig config;
+  config.set_debug_options(GetDebugOptionsForTest());
+
+  auto module0 = ParseAndReturnVerifiedModule(hlo_string, config).ValueOrDie();
+  auto* module = module0.get();
+
+  MatmulCombiner combiner;
+  EXPECT_FALSE(combiner.Run(module).ValueOrDie());
+  EXPECT_EQ(GetNumMatmul(module->entry_computation()), 2);
+}
 }  // namespace
 }  // namespace poplarplugin
 }  // namespace xla
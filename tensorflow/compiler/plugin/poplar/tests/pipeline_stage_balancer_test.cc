@@ -0,0 +1,123 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/passes/pipeline_stage_balancer.h"
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/pipeline_util.h"
+#include "tensorflow/compiler/xla/service/pattern_matcher.h"
+#include "tensorflow/compiler/xla/shape_util.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/compiler/xla/tests/hlo_test_base.h"
+
+namespace xla {
+namespace m = match;
+namespace poplarplugin {
+namespace {
+
+// The first stage does a matmul followed by a chain of elementwise
+// operations, whereas the second stage only does a single addition.
+const char* kUnbalancedPipeline = R"(
+HloModule top
+
+stage_0_fwd {
+  stage_0_fwd_weights = f32[64,64] parameter(0)
+  stage_0_fwd_input = f32[64,64] parameter(1)
+  stage_0_fwd_dot = f32[64,64] dot(stage_0_fwd_input, stage_0_fwd_weights), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  stage_0_fwd_sin = f32[64,64] sine(stage_0_fwd_dot)
+  stage_0_fwd_cos = f32[64,64] cosine(stage_0_fwd_sin)
+  stage_0_fwd_exp = f32[64,64] exponential(stage_0_fwd_cos)
+  ROOT stage_0_fwd_tuple = (f32[64,64]) tuple(stage_0_fwd_exp)
+}
+
+stage_1_fwd {
+  stage_1_fwd_acts = f32[64,64] parameter(0)
+  stage_1_fwd_add = f32[64,64] add(stage_1_fwd_acts, stage_1_fwd_acts)
+  ROOT stage_1_fwd_tuple = (f32[64,64]) tuple(stage_1_fwd_add)
+}
+
+pipeline {
+  pipeline_weights = f32[64,64] parameter(0)
+  pipeline_input = f32[64,64] parameter(1)
+  pipeline_stage_0 = (f32[64,64]) call(pipeline_weights, pipeline_input), to_apply=stage_0_fwd, backend_config="{\"callConfig\":{\"type\":\"PipelineStage\",\"pipelineStageConfig\":{\"stageId\":\"0\"}}}", sharding={maximal device=0}
+  pipeline_stage_0_acts = f32[64,64] get-tuple-element(pipeline_stage_0), index=0
+  pipeline_stage_1 = (f32[64,64]) call(pipeline_stage_0_acts), to_apply=stage_1_fwd, backend_config="{\"callConfig\":{\"type\":\"PipelineStage\",\"pipelineStageConfig\":{\"stageId\":\"1\"}}}", sharding={maximal device=1}
+  pipeline_stage_1_out = f32[64,64] get-tuple-element(pipeline_stage_1), index=0
+  ROOT pipeline_tuple = (f32[64,64], f32[64,64]) tuple(pipeline_weights, pipeline_stage_1_out)
+}
+
+ENTRY e {
+  e.weights = f32[64,64] parameter(0), parameter_replication={false}
+  e.input = f32[64,64] parameter(1), parameter_replication={false}
+  ROOT e.call = (f32[64,64], f32[64,64]) call(e.weights, e.input), to_apply=pipeline, backend_config="{\"callConfig\":{\"type\":\"Pipeline\"}}"
+}
+)";
+
+int64 ShapeSize(const Shape& shape) { return ShapeUtil::ByteSizeOf(shape, 8); }
+
+using PipelineStageBalancerTest = HloTestBase;
+
+TEST_F(PipelineStageBalancerTest, MovesTailOfSlowStage) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(
+      auto module, ParseAndReturnVerifiedModule(kUnbalancedPipeline, config));
+
+  PipelineStageBalancer balancer(true, 0, ShapeSize);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, balancer.Run(module.get()));
+  EXPECT_TRUE(changed);
+
+  TF_ASSERT_OK_AND_ASSIGN(auto pipelines, GetPipelines(module.get()));
+  ASSERT_EQ(pipelines.size(), 1);
+  TF_ASSERT_OK(VerifyPipelineAfterFixing(pipelines[0]));
+  TF_ASSERT_OK_AND_ASSIGN(auto stages,
+                          GetPipelineStages(pipelines[0]->to_apply()));
+  ASSERT_EQ(stages.forward.size(), 2);
+
+  // The matmul cannot be moved as it uses the weights, but all the elementwise
+  // operations are now done by the second stage.
+  EXPECT_TRUE(Match(stages.forward[0]->to_apply()->root_instruction(),
+                    m::Tuple(m::Dot(m::Parameter(), m::Parameter()))));
+  EXPECT_TRUE(Match(
+      stages.forward[1]->to_apply()->root_instruction(),
+      m::Tuple(m::Add(m::Exp(m::Cos(m::Sin(m::Parameter()))), m::Exp()))));
+}
+
+TEST_F(PipelineStageBalancerTest, RespectsMemoryLimit) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(
+      auto module, ParseAndReturnVerifiedModule(kUnbalancedPipeline, config));
+
+  // There is not enough memory for anything to be moved.
+  PipelineStageBalancer balancer(true, 1, ShapeSize);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, balancer.Run(module.get()));
+  EXPECT_FALSE(changed);
+}
+
+TEST_F(PipelineStageBalancerTest, OnlyProposesMoves) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(
+      auto module, ParseAndReturnVerifiedModule(kUnbalancedPipeline, config));
+
+  PipelineStageBalancer balancer(false, 0, ShapeSize);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, balancer.Run(module.get()));
+  EXPECT_FALSE(changed);
+
+  HloInstruction* stage_1 = FindInstruction(module.get(), "pipeline_stage_1");
+  EXPECT_TRUE(Match(stage_1->to_apply()->root_instruction(),
+                    m::Tuple(m::Add(m::Parameter(0), m::Parameter(0)))));
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
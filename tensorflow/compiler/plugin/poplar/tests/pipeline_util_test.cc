@@ -17,6 +17,7 @@ limitations under the License.
 
 #include "tensorflow/compiler/xla/service/call_graph.h"
 #include "tensorflow/compiler/xla/service/pattern_matcher.h"
+#include "tensorflow/compiler/xla/shape_util.h"
 #include "tensorflow/compiler/xla/test.h"
 #include "tensorflow/compiler/xla/tests/hlo_test_base.h"
 
@@ -1696,6 +1697,50 @@ ENTRY e {
                                  comp0, comp1, comp2, stage_1_fwd));
 }
 
+TEST_F(PipelineUtilTest, GetPipelineStageMemoryTest) {
+  std::string hlo = GetCorrectPipelineStages();
+
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+  auto* module0 = module.get();
+  auto shape_size = [](const Shape& shape) {
+    return ShapeUtil::ByteSizeOf(shape, 8);
+  };
+
+  HloInstruction* fwd_stage = FindInstruction(module0, "pipeline_stage_0");
+  HloInstruction* bwd_stage = FindInstruction(module0, "pipeline_stage_0_bwd");
+  // The infeed input is stashed for the backward stage, and recomputing the
+  // activations would stash the weights instead.
+  const std::vector<const HloInstruction*> stashed = {
+      FindInstruction(module0, "pipeline_input")};
+  const std::vector<const HloInstruction*> recomputed_stashed = {
+      FindInstruction(module0, "pipeline_weights0")};
+  const std::vector<const HloInstruction*> recomputed = {
+      FindInstruction(module0, "stage_0_fwd_acts_0")};
+  const int64 bytes = 4 * 4 * 2 * sizeof(float);
+
+  // Each stashed tensor is held once for each step of FIFO depth.
+  TF_ASSERT_OK_AND_ASSIGN(
+      PipelineStageMemory memory,
+      GetPipelineStageMemory(fwd_stage, bwd_stage, stashed, recomputed_stashed,
+                             recomputed, 3, shape_size));
+  EXPECT_EQ(memory.device, 0);
+  EXPECT_GT(memory.peak_bytes, 0);
+  EXPECT_EQ(memory.stashed_bytes, 3 * bytes);
+  EXPECT_EQ(memory.recomputed_stashed_bytes, 3 * bytes);
+  EXPECT_EQ(memory.recomputation_flops, 4 * 4 * 2);
+
+  // Without a FIFO the stashed tensors are still live until the backward
+  // stage.
+  TF_ASSERT_OK_AND_ASSIGN(
+      memory, GetPipelineStageMemory(fwd_stage, bwd_stage, stashed, {}, {}, 0,
+                                     shape_size));
+  EXPECT_EQ(memory.stashed_bytes, bytes);
+  EXPECT_EQ(memory.recomputed_stashed_bytes, 0);
+  EXPECT_EQ(memory.recomputation_flops, 0);
+}
+
 }  // namespace
 }  // namespace poplarplugin
 }  // namespace xla
@@ -0,0 +1,101 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/compiler/plugin/poplar/driver/poplar_executor.h"
+#include "tensorflow/compiler/plugin/poplar/driver/poplar_platform.h"
+#include "tensorflow/compiler/xla/literal_util.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/compiler/xla/tests/hlo_test_base.h"
+#include "tensorflow/compiler/xla/tests/literal_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+// The flags are read when the first executor is created, so the in memory
+// executable cache has to be enabled before any of the tests start.
+const bool in_memory_executable_cache_enabled = [] {
+  const char* flags = getenv("TF_POPLAR_FLAGS");
+  const std::string new_flags =
+      absl::StrCat("--in_memory_executable_cache_size=4 ", flags ? flags : "");
+  return setenv("TF_POPLAR_FLAGS", new_flags.c_str(), 1) == 0;
+}();
+
+const char* const kHloString = R"(
+HloModule top
+
+ENTRY main {
+  arg0 = f32[2] parameter(0)
+  arg1 = f32[2] parameter(1)
+  add = f32[2] add(arg0, arg1)
+  ROOT mul = f32[2] multiply(add, arg1)
+}
+)";
+
+class PrecompileExecutablesTest : public HloTestBase {
+ protected:
+  PoplarPlatform* platform() {
+    return static_cast<PoplarPlatform*>(backend().platform());
+  }
+
+  PoplarExecutor* executor() {
+    return static_cast<PoplarExecutor*>(
+        backend().default_stream_executor()->implementation());
+  }
+};
+
+TEST_F(PrecompileExecutablesTest, FirstRunIsServedFromTheCache) {
+  ASSERT_TRUE(in_memory_executable_cache_enabled);
+  ASSERT_TRUE(executor()->HaveInMemoryExecutableCache());
+  const auto before = executor()->GetExecutableCacheStatistics();
+
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(kHloString));
+  std::vector<std::unique_ptr<HloModule>> modules;
+  modules.push_back(module->Clone());
+  TF_ASSERT_OK(platform()->PrecompileExecutables(0, std::move(modules)));
+  TF_ASSERT_OK(platform()->WaitForPrecompiledExecutables(0));
+
+  // Precompiling missed the cache and added the executable to it.
+  const auto precompiled = executor()->GetExecutableCacheStatistics();
+  EXPECT_EQ(precompiled.hits, before.hits);
+  EXPECT_EQ(precompiled.misses, before.misses + 1);
+  EXPECT_EQ(precompiled.size, before.size + 1);
+
+  Literal arg0 = LiteralUtil::CreateR1<float>({1.0f, 2.0f});
+  Literal arg1 = LiteralUtil::CreateR1<float>({3.0f, 4.0f});
+  TF_ASSERT_OK_AND_ASSIGN(Literal result,
+                          Execute(std::move(module), {&arg0, &arg1}));
+  EXPECT_TRUE(LiteralTestUtil::Equal(
+      LiteralUtil::CreateR1<float>({12.0f, 24.0f}), result));
+
+  // The first run shared the engine of the precompiled executable.
+  const auto after = executor()->GetExecutableCacheStatistics();
+  EXPECT_EQ(after.hits, precompiled.hits + 1);
+  EXPECT_EQ(after.misses, precompiled.misses);
+  EXPECT_EQ(after.size, precompiled.size);
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
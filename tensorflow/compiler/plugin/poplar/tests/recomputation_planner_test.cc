@@ -0,0 +1,118 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/passes/recomputation_planner.h"
+
+#include "tensorflow/compiler/xla/service/pattern_matcher.h"
+#include "tensorflow/compiler/xla/shape_util.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/compiler/xla/tests/hlo_test_base.h"
+
+namespace xla {
+namespace m = match;
+namespace poplarplugin {
+namespace {
+
+// The sine is computed first but only used by the final dot, so it is live
+// while the chain of elementwise operations is computed.
+const char* kLongLivedActivation = R"(
+HloModule top
+
+ENTRY e {
+  input = f32[1024] parameter(0)
+  early = f32[1024] sine(input)
+  chain0 = f32[1024] cosine(input)
+  chain1 = f32[1024] exponential(chain0)
+  chain2 = f32[1024] log(chain1)
+  ROOT out = f32[] dot(early, chain2), lhs_contracting_dims={0}, rhs_contracting_dims={0}
+}
+)";
+
+int64 ShapeSize(const Shape& shape) { return ShapeUtil::ByteSizeOf(shape, 8); }
+
+using RecomputationPlannerTest = HloTestBase;
+
+TEST_F(RecomputationPlannerTest, RecomputesAfterPeak) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(
+      auto module, ParseAndReturnVerifiedModule(kLongLivedActivation, config));
+
+  // Without recomputation four arrays of 4096 bytes are live at the peak, so
+  // only allow three of them and the scalar output.
+  RecomputationPlanner planner(3 * 4096 + 4, ShapeSize);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, planner.Run(module.get()));
+  EXPECT_TRUE(changed);
+
+  HloInstruction* root = module->entry_computation()->root_instruction();
+  EXPECT_TRUE(Match(root, m::Dot(m::Sin(m::Parameter(0)),
+                                 m::Log(m::Exp(m::Cos(m::Parameter(0)))))));
+
+  // The sine is recomputed after the last operation of the chain.
+  const HloInstruction* recomputed = root->operand(0);
+  HloInstruction* chain2 = FindInstruction(module.get(), "chain2");
+  EXPECT_THAT(recomputed->control_predecessors(), ::testing::Contains(chain2));
+  EXPECT_EQ(FindInstruction(module.get(), "early"), nullptr);
+}
+
+TEST_F(RecomputationPlannerTest, FitsInBudget) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(
+      auto module, ParseAndReturnVerifiedModule(kLongLivedActivation, config));
+
+  RecomputationPlanner planner(4 * 4096, ShapeSize);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, planner.Run(module.get()));
+  EXPECT_FALSE(changed);
+}
+
+TEST_F(RecomputationPlannerTest, NoBudget) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(
+      auto module, ParseAndReturnVerifiedModule(kLongLivedActivation, config));
+
+  RecomputationPlanner planner(0, ShapeSize);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, planner.Run(module.get()));
+  EXPECT_FALSE(changed);
+}
+
+TEST_F(RecomputationPlannerTest, PlansCheapestPipelineStages) {
+  std::vector<PipelineStageMemory> stages(3);
+  // Saves 90 bytes for 1000 operations.
+  stages[0].device = 0;
+  stages[0].peak_bytes = 100;
+  stages[0].stashed_bytes = 100;
+  stages[0].recomputed_stashed_bytes = 10;
+  stages[0].recomputation_flops = 1000;
+  // Saves 100 bytes for 100 operations.
+  stages[1].device = 0;
+  stages[1].peak_bytes = 100;
+  stages[1].stashed_bytes = 100;
+  stages[1].recomputation_flops = 100;
+  // On an IPU which already fits.
+  stages[2].device = 1;
+  stages[2].peak_bytes = 100;
+  stages[2].stashed_bytes = 100;
+  stages[2].recomputation_flops = 1;
+
+  EXPECT_THAT(PlanPipelineRecomputation(stages, 350),
+              ::testing::ElementsAre(false, true, false));
+  EXPECT_THAT(PlanPipelineRecomputation(stages, 250),
+              ::testing::ElementsAre(true, true, false));
+  EXPECT_THAT(PlanPipelineRecomputation(stages, 0),
+              ::testing::ElementsAre(true, true, true));
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
@@ -623,6 +623,68 @@ ENTRY top {
   module->VerifyOrAddFailure("module should be valid after pass");
 }
 
+TEST_F(RemoteParameterParallelCombinerTest, TestPrefetch) {
+  const auto hlo_string = R"(
+HloModule top
+
+ENTRY top {
+  arg1 = f32[1] parameter(0)
+  arg2 = f32[2] parameter(1)
+  arg3 = f32[3] parameter(2)
+
+  load1 = f32[1] custom-call(arg1), custom_call_target="RemoteParameterLoad", backend_config="{\"replication_factor\":1}\n", sharding={maximal device=0}
+  load2 = f32[2] custom-call(arg2), custom_call_target="RemoteParameterLoad", backend_config="{\"replication_factor\":1}\n", sharding={maximal device=0}
+  load3 = f32[3] custom-call(arg3), custom_call_target="RemoteParameterLoad", backend_config="{\"replication_factor\":1}\n", sharding={maximal device=0}
+
+  add1 = f32[1] add(load1, load1), sharding={maximal device=0}
+  add2 = f32[2] add(load2, load2), sharding={maximal device=0}
+  add3 = f32[3] add(load3, load3), sharding={maximal device=0}
+
+  store1 = f32[1] custom-call(arg1, add1), custom_call_target="RemoteParameterStore", backend_config="{\"replication_factor\":1}\n", sharding={maximal device=0}
+  store2 = f32[2] custom-call(arg2, add2), custom_call_target="RemoteParameterStore", backend_config="{\"replication_factor\":1}\n", sharding={maximal device=0}
+  store3 = f32[3] custom-call(arg3, add3), custom_call_target="RemoteParameterStore", backend_config="{\"replication_factor\":1}\n", sharding={maximal device=0}
+
+  ROOT tuple = (f32[1], f32[2], f32[3]) tuple(store1, store2, store3)
+}
+  )";
+
+  HloModuleConfig config;
+  config.set_debug_options(GetDebugOptionsForTest());
+
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo_string, config));
+  EXPECT_TRUE(CustomOpReplacer().Run(module.get()).ValueOrDie());
+  EXPECT_TRUE(InplaceFinder().Run(module.get()).ValueOrDie());
+
+  // Nothing to combine on a single IPU, so there are no constraints by
+  // default.
+  TensorAllocationMap allocation_map;
+  EXPECT_FALSE(RemoteParameterParallelCombiner(allocation_map)
+                   .RunOnComputation(module->entry_computation())
+                   .ValueOrDie());
+
+  ASSERT_TRUE(RemoteParameterParallelCombiner(allocation_map, 1)
+                  .RunOnComputation(module->entry_computation())
+                  .ValueOrDie());
+  module->VerifyOrAddFailure("module should be valid after pass");
+
+  HloInstruction* root = module->entry_computation()->root_instruction();
+  const HloInstruction* store1 = root->operand(0);
+  const HloInstruction* store2 = root->operand(1);
+  const HloInstruction* add1 = store1->operand(1);
+  const HloInstruction* add2 = store2->operand(1);
+  const HloInstruction* load2 = add2->operand(0);
+  const HloInstruction* load3 = root->operand(2)->operand(1)->operand(0);
+
+  // The next load is issued before the current update.
+  EXPECT_THAT(add1->control_predecessors(), ::testing::Contains(load2));
+  EXPECT_THAT(add2->control_predecessors(), ::testing::Contains(load3));
+  // But only after the update before has been stored.
+  EXPECT_THAT(load3->control_predecessors(), ::testing::Contains(store1));
+  EXPECT_THAT(load2->control_predecessors(),
+              ::testing::Not(::testing::Contains(store1)));
+}
+
 }  // namespace
 }  // namespace poplarplugin
 }  // namespace xla
@@ -0,0 +1,529 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/compiler/plugin/poplar/driver/passes/repeated_subgraph_outliner.h"
+
+#include <map>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "tensorflow/compiler/plugin/poplar/driver/passes/custom_op_replacer.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/matcher_predicates.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/util.h"
+#include "tensorflow/compiler/xla/service/hlo_verifier.h"
+#include "tensorflow/compiler/xla/service/pattern_matcher.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/compiler/xla/tests/hlo_test_base.h"
+
+namespace xla {
+namespace m = match;
+namespace poplarplugin {
+namespace {
+
+// Two towers which share their weights.
+const char* kTowers = R"(
+HloModule top
+
+ENTRY e {
+  a0 = f32[16,16] parameter(0)
+  a1 = f32[16,16] parameter(1)
+  w = f32[16,16] parameter(2)
+  t0_dot = f32[16,16] dot(a0, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t0_sin = f32[16,16] sine(t0_dot)
+  t0_cos = f32[16,16] cosine(t0_sin)
+  t0_exp = f32[16,16] exponential(t0_cos)
+  t0_log = f32[16,16] log(t0_exp)
+  t1_dot = f32[16,16] dot(a1, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t1_sin = f32[16,16] sine(t1_dot)
+  t1_cos = f32[16,16] cosine(t1_sin)
+  t1_exp = f32[16,16] exponential(t1_cos)
+  t1_log = f32[16,16] log(t1_exp)
+  ROOT t = (f32[16,16], f32[16,16]) tuple(t0_log, t1_log)
+}
+)";
+
+std::vector<HloInstruction*> GetFunctionCalls(const HloComputation* comp) {
+  std::vector<HloInstruction*> calls;
+  for (HloInstruction* inst : comp->instructions()) {
+    if (inst->opcode() == HloOpcode::kCall) {
+      EXPECT_TRUE(IsFunction(inst));
+      calls.push_back(inst);
+    }
+  }
+  return calls;
+}
+
+using RepeatedSubgraphOutlinerTest = HloTestBase;
+
+TEST_F(RepeatedSubgraphOutlinerTest, Towers) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(kTowers, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_TRUE(changed);
+  TF_ASSERT_OK(HloVerifier(false, true).Run(module.get()).status());
+
+  HloInstruction* root = module->entry_computation()->root_instruction();
+  HloInstruction* call0;
+  HloInstruction* call1;
+  ASSERT_TRUE(Match(root, m::Tuple(m::GetTupleElement(m::Op(&call0), 0),
+                                   m::GetTupleElement(m::Op(&call1), 0))));
+  EXPECT_TRUE(IsFunction(call0));
+  EXPECT_TRUE(IsFunction(call1));
+  EXPECT_NE(call0, call1);
+  EXPECT_EQ(call0->to_apply(), call1->to_apply());
+
+  // The weights are passed to both calls.
+  EXPECT_TRUE(Match(call0, m::Call(m::Parameter(0), m::Parameter(2))));
+  EXPECT_TRUE(Match(call1, m::Call(m::Parameter(1), m::Parameter(2))));
+  EXPECT_TRUE(Match(
+      call0->to_apply()->root_instruction(),
+      m::Tuple(m::Log(m::Exp(m::Cos(m::Sin(
+          m::Dot(m::Parameter(0), m::Parameter(1)))))))));
+}
+
+TEST_F(RepeatedSubgraphOutlinerTest, TooSmall) {
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(kTowers, config));
+
+  RepeatedSubgraphOutliner outliner(8);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_FALSE(changed);
+}
+
+// A chain of layers with residual connections, where each layer uses the
+// output of the previous one.
+TEST_F(RepeatedSubgraphOutlinerTest, ResidualLayers) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  x = f32[16,16] parameter(0)
+  w0 = f32[16,16] parameter(1)
+  w1 = f32[16,16] parameter(2)
+  w2 = f32[16,16] parameter(3)
+  w3 = f32[16,16] parameter(4)
+  l0_dot = f32[16,16] dot(x, w0), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  l0_sin = f32[16,16] sine(l0_dot)
+  l0_cos = f32[16,16] cosine(l0_sin)
+  l0_exp = f32[16,16] exponential(l0_cos)
+  l0_log = f32[16,16] log(l0_exp)
+  l0_add = f32[16,16] add(l0_log, x)
+  l1_dot = f32[16,16] dot(l0_add, w1), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  l1_sin = f32[16,16] sine(l1_dot)
+  l1_cos = f32[16,16] cosine(l1_sin)
+  l1_exp = f32[16,16] exponential(l1_cos)
+  l1_log = f32[16,16] log(l1_exp)
+  l1_add = f32[16,16] add(l1_log, l0_add)
+  l2_dot = f32[16,16] dot(l1_add, w2), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  l2_sin = f32[16,16] sine(l2_dot)
+  l2_cos = f32[16,16] cosine(l2_sin)
+  l2_exp = f32[16,16] exponential(l2_cos)
+  l2_log = f32[16,16] log(l2_exp)
+  l2_add = f32[16,16] add(l2_log, l1_add)
+  l3_dot = f32[16,16] dot(l2_add, w3), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  l3_sin = f32[16,16] sine(l3_dot)
+  l3_cos = f32[16,16] cosine(l3_sin)
+  l3_exp = f32[16,16] exponential(l3_cos)
+  l3_log = f32[16,16] log(l3_exp)
+  l3_add = f32[16,16] add(l3_log, l2_add)
+  ROOT t = (f32[16,16]) tuple(l3_add)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_TRUE(changed);
+  TF_ASSERT_OK(HloVerifier(false, true).Run(module.get()).status());
+
+  // All the matmuls and elementwise chains are now computed by functions, each
+  // of which is called more than once.
+  std::map<const HloComputation*, int64> num_calls;
+  for (const HloInstruction* inst :
+       module->entry_computation()->instructions()) {
+    switch (inst->opcode()) {
+      case HloOpcode::kCall:
+        EXPECT_TRUE(IsFunction(inst));
+        num_calls[inst->to_apply()]++;
+        break;
+      case HloOpcode::kAdd:
+      case HloOpcode::kGetTupleElement:
+      case HloOpcode::kParameter:
+      case HloOpcode::kTuple:
+        break;
+      default:
+        ADD_FAILURE() << "Unexpected instruction " << inst->ToString();
+    }
+  }
+  // The last two layers are outlined first, together with the residual add
+  // feeding into each of them, and the first two layers share another
+  // function.
+  EXPECT_EQ(num_calls.size(), 2);
+  for (auto& pair : num_calls) {
+    EXPECT_EQ(pair.second, 2);
+  }
+  EXPECT_EQ(module->computation_count(), 3);
+
+  // The output of the last layer and its residual input both come from the
+  // same call, which uses the output of a call to the same function.
+  HloInstruction* root = module->entry_computation()->root_instruction();
+  HloInstruction* last_call;
+  HloInstruction* residual_call;
+  ASSERT_TRUE(Match(root, m::Tuple(m::Add(
+                              m::GetTupleElement(m::Op(&last_call)),
+                              m::GetTupleElement(m::Op(&residual_call))))));
+  EXPECT_EQ(last_call, residual_call);
+  EXPECT_TRUE(IsFunction(last_call));
+  EXPECT_TRUE(absl::c_any_of(
+      last_call->operands(), [last_call](const HloInstruction* operand) {
+        if (operand->opcode() != HloOpcode::kGetTupleElement) {
+          return false;
+        }
+        const HloInstruction* producer = operand->operand(0);
+        return producer != last_call &&
+               producer->opcode() == HloOpcode::kCall &&
+               producer->to_apply() == last_call->to_apply();
+      }));
+}
+
+// Identical functions outlined from different computations are shared.
+TEST_F(RepeatedSubgraphOutlinerTest, ReuseBetweenComputations) {
+  std::string hlo = R"(
+HloModule top
+
+towers {
+  a0 = f32[16,16] parameter(0)
+  a1 = f32[16,16] parameter(1)
+  w = f32[16,16] parameter(2)
+  t0_dot = f32[16,16] dot(a0, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t0_sin = f32[16,16] sine(t0_dot)
+  t0_cos = f32[16,16] cosine(t0_sin)
+  t0_exp = f32[16,16] exponential(t0_cos)
+  t0_log = f32[16,16] log(t0_exp)
+  t1_dot = f32[16,16] dot(a1, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t1_sin = f32[16,16] sine(t1_dot)
+  t1_cos = f32[16,16] cosine(t1_sin)
+  t1_exp = f32[16,16] exponential(t1_cos)
+  t1_log = f32[16,16] log(t1_exp)
+  ROOT t = (f32[16,16], f32[16,16]) tuple(t0_log, t1_log)
+}
+
+ENTRY e {
+  a0 = f32[16,16] parameter(0)
+  a1 = f32[16,16] parameter(1)
+  a2 = f32[16,16] parameter(2)
+  a3 = f32[16,16] parameter(3)
+  w = f32[16,16] parameter(4)
+  t0_dot = f32[16,16] dot(a0, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t0_sin = f32[16,16] sine(t0_dot)
+  t0_cos = f32[16,16] cosine(t0_sin)
+  t0_exp = f32[16,16] exponential(t0_cos)
+  t0_log = f32[16,16] log(t0_exp)
+  t1_dot = f32[16,16] dot(a1, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t1_sin = f32[16,16] sine(t1_dot)
+  t1_cos = f32[16,16] cosine(t1_sin)
+  t1_exp = f32[16,16] exponential(t1_cos)
+  t1_log = f32[16,16] log(t1_exp)
+  c = (f32[16,16], f32[16,16]) call(a2, a3, w), to_apply=towers
+  c0 = f32[16,16] get-tuple-element(c), index=0
+  c1 = f32[16,16] get-tuple-element(c), index=1
+  ROOT t = (f32[16,16], f32[16,16], f32[16,16], f32[16,16]) tuple(t0_log, t1_log, c0, c1)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_TRUE(changed);
+  TF_ASSERT_OK(HloVerifier(false, true).Run(module.get()).status());
+
+  HloComputation* towers = module->GetComputationWithName("towers");
+  ASSERT_NE(towers, nullptr);
+  std::vector<HloInstruction*> calls =
+      GetFunctionCalls(module->entry_computation());
+  const std::vector<HloInstruction*> towers_calls = GetFunctionCalls(towers);
+  calls.insert(calls.end(), towers_calls.begin(), towers_calls.end());
+  ASSERT_EQ(calls.size(), 4);
+  for (const HloInstruction* call : calls) {
+    EXPECT_EQ(call->to_apply(), calls[0]->to_apply());
+  }
+  // Only the entry, the towers and the single function are left.
+  EXPECT_EQ(module->computation_count(), 3);
+}
+
+// A copy with a path which leaves it and comes back into it cannot be
+// replaced by a call, but the other copies still can.
+TEST_F(RepeatedSubgraphOutlinerTest, NotConvex) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  a0 = f32[16] parameter(0)
+  a1 = f32[16] parameter(1)
+  a2 = f32[16] parameter(2)
+  t0_sin = f32[16] sine(a0)
+  t0_cos = f32[16] cosine(t0_sin)
+  t0_exp = f32[16] exponential(t0_cos)
+  t0_neg = f32[16] negate(t0_sin)
+  t0_mul = f32[16] multiply(t0_exp, t0_neg)
+  t0_log = f32[16] log(t0_mul)
+  t1_sin = f32[16] sine(a1)
+  t1_cos = f32[16] cosine(t1_sin)
+  t1_exp = f32[16] exponential(t1_cos)
+  t1_abs = f32[16] abs(a1)
+  t1_mul = f32[16] multiply(t1_exp, t1_abs)
+  t1_log = f32[16] log(t1_mul)
+  t2_sin = f32[16] sine(a2)
+  t2_cos = f32[16] cosine(t2_sin)
+  t2_exp = f32[16] exponential(t2_cos)
+  t2_floor = f32[16] floor(a2)
+  t2_mul = f32[16] multiply(t2_exp, t2_floor)
+  t2_log = f32[16] log(t2_mul)
+  ROOT t = (f32[16], f32[16], f32[16]) tuple(t0_log, t1_log, t2_log)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_TRUE(changed);
+  TF_ASSERT_OK(HloVerifier(false, true).Run(module.get()).status());
+
+  HloInstruction* root = module->entry_computation()->root_instruction();
+  HloInstruction* call1;
+  HloInstruction* call2;
+  ASSERT_TRUE(Match(
+      root,
+      m::Tuple(m::Log(m::Multiply(
+                   m::Exp(m::Cos(m::Sin(m::Parameter(0)))),
+                   m::Negate(m::Sin(m::Parameter(0))))),
+               m::GetTupleElement(m::Op(&call1), 0),
+               m::GetTupleElement(m::Op(&call2), 0))));
+  EXPECT_TRUE(Match(call1, m::Call(m::Abs(), m::Parameter(1))));
+  EXPECT_TRUE(Match(call2, m::Call(m::Floor(), m::Parameter(2))));
+  EXPECT_EQ(call1->to_apply(), call2->to_apply());
+}
+
+// Each copy is convex on its own, but once one of them has been replaced by a
+// call, the other one goes through that call. The copy which was replaced is
+// then inlined again as nothing is shared.
+TEST_F(RepeatedSubgraphOutlinerTest, NotConvexAfterReplacing) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  p0 = f32[16] parameter(0)
+  p1 = f32[16] parameter(1)
+  b_sin = f32[16] sine(p0)
+  b_cos = f32[16] cosine(b_sin)
+  a_sin = f32[16] sine(b_cos)
+  a_cos = f32[16] cosine(a_sin)
+  a_exp = f32[16] exponential(p1)
+  a_log = f32[16] log(a_exp)
+  b_exp = f32[16] exponential(a_log)
+  b_log = f32[16] log(b_exp)
+  a_add = f32[16] add(a_cos, a_log)
+  b_add = f32[16] add(b_cos, b_log)
+  ROOT t = (f32[16], f32[16]) tuple(a_add, b_add)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK(outliner.Run(module.get()).status());
+  TF_ASSERT_OK(HloVerifier(false, true).Run(module.get()).status());
+
+  EXPECT_TRUE(GetFunctionCalls(module->entry_computation()).empty());
+  EXPECT_EQ(module->computation_count(), 1);
+  // The second copy is untouched and uses the inlined outputs of the first.
+  HloInstruction* root = module->entry_computation()->root_instruction();
+  EXPECT_TRUE(Match(
+      root->operand(1),
+      m::Add(m::Cos(m::Sin(m::Parameter(0))),
+             m::Log(m::Exp(m::GetTupleElement(
+                 m::Tuple(m::Op(), m::Log(m::Exp(m::Parameter(1))), m::Op()),
+                 1))))));
+}
+
+// Instructions with sharding are only outlined together with instructions on
+// the same shard.
+TEST_F(RepeatedSubgraphOutlinerTest, DifferentSharding) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  a0 = f32[16,16] parameter(0)
+  a1 = f32[16,16] parameter(1)
+  w = f32[16,16] parameter(2)
+  t0_dot = f32[16,16] dot(a0, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}, sharding={maximal device=0}
+  t0_sin = f32[16,16] sine(t0_dot), sharding={maximal device=0}
+  t0_cos = f32[16,16] cosine(t0_sin), sharding={maximal device=0}
+  t0_exp = f32[16,16] exponential(t0_cos), sharding={maximal device=0}
+  t0_log = f32[16,16] log(t0_exp), sharding={maximal device=0}
+  t1_dot = f32[16,16] dot(a1, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}, sharding={maximal device=1}
+  t1_sin = f32[16,16] sine(t1_dot), sharding={maximal device=1}
+  t1_cos = f32[16,16] cosine(t1_sin), sharding={maximal device=1}
+  t1_exp = f32[16,16] exponential(t1_cos), sharding={maximal device=1}
+  t1_log = f32[16,16] log(t1_exp), sharding={maximal device=1}
+  ROOT t = (f32[16,16], f32[16,16]) tuple(t0_log, t1_log)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_FALSE(changed);
+}
+
+// Side effecting instructions stay where they are and become inputs of the
+// function.
+TEST_F(RepeatedSubgraphOutlinerTest, SideEffects) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  a0 = f32[16,16] parameter(0)
+  a1 = f32[16,16] parameter(1)
+  w = f32[16,16] parameter(2)
+  zero = f32[] constant(0)
+  one = f32[] constant(1)
+  t0_dot = f32[16,16] dot(a0, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t0_sin = f32[16,16] sine(t0_dot)
+  t0_rng = f32[16,16] rng(zero, one), distribution=rng_uniform
+  t0_mul = f32[16,16] multiply(t0_sin, t0_rng)
+  t0_exp = f32[16,16] exponential(t0_mul)
+  t0_log = f32[16,16] log(t0_exp)
+  t1_dot = f32[16,16] dot(a1, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t1_sin = f32[16,16] sine(t1_dot)
+  t1_rng = f32[16,16] rng(zero, one), distribution=rng_uniform
+  t1_mul = f32[16,16] multiply(t1_sin, t1_rng)
+  t1_exp = f32[16,16] exponential(t1_mul)
+  t1_log = f32[16,16] log(t1_exp)
+  ROOT t = (f32[16,16], f32[16,16]) tuple(t0_log, t1_log)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_TRUE(changed);
+  TF_ASSERT_OK(HloVerifier(false, true).Run(module.get()).status());
+
+  const std::vector<HloInstruction*> calls =
+      GetFunctionCalls(module->entry_computation());
+  ASSERT_EQ(calls.size(), 2);
+  EXPECT_EQ(calls[0]->to_apply(), calls[1]->to_apply());
+  for (const HloInstruction* call : calls) {
+    EXPECT_EQ(absl::c_count_if(call->operands(),
+                               [](const HloInstruction* operand) {
+                                 return operand->opcode() == HloOpcode::kRng;
+                               }),
+              1);
+  }
+  EXPECT_TRUE(absl::c_none_of(calls[0]->to_apply()->instructions(),
+                              [](const HloInstruction* inst) {
+                                return inst->opcode() == HloOpcode::kRng;
+                              }));
+}
+
+// Instructions with control dependencies are not moved, which leaves chains
+// which are too short to be outlined.
+TEST_F(RepeatedSubgraphOutlinerTest, ControlDependencies) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  a0 = f32[16,16] parameter(0)
+  a1 = f32[16,16] parameter(1)
+  w = f32[16,16] parameter(2)
+  t0_dot = f32[16,16] dot(a0, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t0_sin = f32[16,16] sine(t0_dot)
+  t0_cos = f32[16,16] cosine(t0_sin)
+  t0_exp = f32[16,16] exponential(t0_cos), control-predecessors={t0_sin}
+  t0_log = f32[16,16] log(t0_exp)
+  t1_dot = f32[16,16] dot(a1, w), lhs_contracting_dims={1}, rhs_contracting_dims={0}
+  t1_sin = f32[16,16] sine(t1_dot)
+  t1_cos = f32[16,16] cosine(t1_sin)
+  t1_exp = f32[16,16] exponential(t1_cos), control-predecessors={t1_sin}
+  t1_log = f32[16,16] log(t1_exp)
+  ROOT t = (f32[16,16], f32[16,16]) tuple(t0_log, t1_log)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+
+  RepeatedSubgraphOutliner outliner(4);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_FALSE(changed);
+}
+
+// Each lowering of a stateful gradient accumulation creates its own
+// accumulator, so identical accumulations must not be shared.
+TEST_F(RepeatedSubgraphOutlinerTest, StatefulGradientAccumulate) {
+  std::string hlo = R"(
+HloModule top
+
+ENTRY e {
+  g0 = f32[16] parameter(0)
+  g1 = f32[16] parameter(1)
+  g0_sin = f32[16] sine(g0)
+  g0_cos = f32[16] cosine(g0_sin)
+  g0_acc = f32[16] custom-call(g0_cos), custom_call_target="StatefulGradientAccumulate", backend_config="{\"num_mini_batches\":4}\n"
+  g0_exp = f32[16] exponential(g0_acc)
+  g0_log = f32[16] log(g0_exp)
+  g1_sin = f32[16] sine(g1)
+  g1_cos = f32[16] cosine(g1_sin)
+  g1_acc = f32[16] custom-call(g1_cos), custom_call_target="StatefulGradientAccumulate", backend_config="{\"num_mini_batches\":4}\n"
+  g1_exp = f32[16] exponential(g1_acc)
+  g1_log = f32[16] log(g1_exp)
+  ROOT t = (f32[16], f32[16]) tuple(g0_log, g1_log)
+}
+)";
+  auto config = GetModuleConfigForTest();
+  TF_ASSERT_OK_AND_ASSIGN(auto module,
+                          ParseAndReturnVerifiedModule(hlo, config));
+  TF_ASSERT_OK_AND_ASSIGN(bool replaced, CustomOpReplacer().Run(module.get()));
+  EXPECT_TRUE(replaced);
+
+  // Without the accumulations the chains on either side are too short.
+  RepeatedSubgraphOutliner outliner(3);
+  TF_ASSERT_OK_AND_ASSIGN(bool changed, outliner.Run(module.get()));
+  EXPECT_FALSE(changed);
+  EXPECT_EQ(absl::c_count_if(
+                module->entry_computation()->instructions(),
+                IsPoplarInstruction(PoplarOp::StatefulGradientAccumulate)),
+            2);
+}
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
@@ -15,9 +15,15 @@ limitations under the License.
 
 #include "tensorflow/compiler/plugin/poplar/driver/schedulers/schedule_tree.h"
 
+#include "tensorflow/compiler/plugin/poplar/driver/compiler_information.h"
+#include "tensorflow/compiler/plugin/poplar/driver/schedulers/ipu_scheduler.h"
+#include "tensorflow/compiler/plugin/poplar/driver/schedulers/liveness_look_ahead_scheduler.h"
+#include "tensorflow/compiler/xla/service/hlo_computation.h"
+#include "tensorflow/compiler/xla/service/hlo_module.h"
 #include "tensorflow/compiler/xla/test.h"
 #include "tensorflow/compiler/xla/tests/hlo_test_base.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test_benchmark.h"
 
 namespace xla {
 namespace poplarplugin {
@@ -271,6 +277,96 @@ TEST(SchedulerTreeTest, MultiBranchSchedule) {
   }
 }
 
+TEST(SchedulerTreeTest, BranchesDoNotShareState) {
+  using CharScheduleTree =
+      ScheduleTree<char, ForEachPredecessor, ForEachSucessor, CharGrossCost,
+                   CharTempCost>;
+  std::vector<char> instructions = {'A', 'B', 'C', 'D'};
+
+  // clang-format off
+  std::map<char, std::set<char>> successors = {
+    {'A', {'C'}},
+    {'B', {'D'}},
+  };
+  std::map<char, int64> gross_cost = {
+      {'A', 1},
+      {'B', 10},
+      {'C', 100},
+      {'D', 1000},
+  };
+  // clang-format on
+
+  std::map<char, std::set<char>> predecessors =
+      createPredecessorsFromSucessors(successors);
+
+  auto tree = std::make_shared<const CharScheduleTree>(
+      instructions, ForEachPredecessor(predecessors),
+      ForEachSucessor(successors), CharGrossCost(gross_cost),
+      CharTempCost({}));
+
+  tree = tree->Grow(2);
+  ASSERT_EQ(tree->GetReady(), std::set<char>({'A', 'B'}));
+
+  // Query the branches in an interleaved order, so that the shared state has
+  // to be moved back and forth between them.
+  auto best = tree->BestChild();
+  auto a = tree->TakeAllReady([](char c) { return c == 'A'; });
+  auto b = tree->TakeAllReady([](char c) { return c == 'B'; });
+
+  EXPECT_EQ(a->GetReady(), std::set<char>({'B', 'C'}));
+  EXPECT_EQ(b->GetReady(), std::set<char>({'A', 'D'}));
+  EXPECT_EQ(a->GetCurrentlyLive(), std::set<char>({'A'}));
+  EXPECT_EQ(b->GetCurrentlyLive(), std::set<char>({'B'}));
+  EXPECT_EQ(a->CurrentLiveness(), 1);
+  EXPECT_EQ(b->CurrentLiveness(), 10);
+  EXPECT_EQ(tree->GetReady(), std::set<char>({'A', 'B'}));
+  EXPECT_EQ(best->GetSchedule(), std::vector<char>({'A'}));
+}
+
+// Build a computation with `num_instructions` elementwise instructions, where
+// each instruction uses the previous one and one more instruction from the
+// recent past, which creates a wide frontier of live tensors.
+std::unique_ptr<HloModule> CreateSyntheticModule(int64 num_instructions) {
+  HloModuleConfig config;
+  auto module = absl::make_unique<HloModule>("synthetic", config);
+  const Shape shape = ShapeUtil::MakeShape(F32, {16});
+
+  auto builder = HloComputation::Builder("synthetic");
+  std::vector<HloInstruction*> instructions;
+  instructions.push_back(
+      builder.AddInstruction(HloInstruction::CreateParameter(0, shape, "p0")));
+  for (int64 i = 1; i < num_instructions; ++i) {
+    HloInstruction* prev = instructions.back();
+    HloInstruction* other =
+        instructions[std::max<int64>(0, i - 1 - (i * 7919) % 32)];
+    instructions.push_back(builder.AddInstruction(
+        HloInstruction::CreateBinary(shape, HloOpcode::kAdd, prev, other)));
+  }
+  module->AddEntryComputation(builder.Build());
+  return module;
+}
+
+void BM_LivenessLookAheadScheduler(int num_iters, int num_instructions) {
+  tensorflow::testing::StopTiming();
+  const auto information = CompilerInformation()
+                               .set_max_scheduler_lookahead_depth(5)
+                               .set_max_scheduler_search_space_size(64);
+  auto size_function = [](const BufferValue& buffer) {
+    return ShapeUtil::ByteSizeOf(buffer.shape(), 1);
+  };
+
+  for (int i = 0; i < num_iters; ++i) {
+    auto module = CreateSyntheticModule(num_instructions);
+    IpuScheduler scheduler(size_function,
+                           CreateLivenessLookAheadMemoryScheduler(information));
+    tensorflow::testing::StartTiming();
+    TF_CHECK_OK(scheduler.Run(module.get()).status());
+    tensorflow::testing::StopTiming();
+  }
+}
+
+BENCHMARK(BM_LivenessLookAheadScheduler)->Arg(1000)->Arg(10000)->Arg(100000);
+
 }  // namespace
 }  // namespace poplarplugin
 }  // namespace xla
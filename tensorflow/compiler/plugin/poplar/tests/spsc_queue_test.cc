@@ -0,0 +1,409 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/compiler/plugin/poplar/driver/tools/spsc_outfeed_queue.h"
+#include "tensorflow/compiler/plugin/poplar/driver/tools/spsc_queue.h"
+#include "tensorflow/compiler/xla/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace xla {
+namespace poplarplugin {
+namespace {
+
+constexpr std::size_t kCapacity = 2048;
+using Queue = SPSCQueue<int, kCapacity>;
+
+void NoOp(int&) {}
+
+TEST(SPSCQueueTest, PushNPopN) {
+  Queue q(0, NoOp);
+
+  std::vector<int> in(100);
+  for (int i = 0; i != 100; ++i) {
+    in[i] = i;
+  }
+  ASSERT_EQ(q.TryPushN(in.data(), in.size()), 100);
+  ASSERT_FALSE(q.IsEmpty());
+
+  std::vector<int> out(60);
+  ASSERT_EQ(q.TryPopN(out.data(), out.size()), 60);
+  for (int i = 0; i != 60; ++i) {
+    EXPECT_EQ(out[i], i);
+  }
+  q.AdvanceReadPosition(60);
+
+  // Only 40 elements remain.
+  ASSERT_EQ(q.TryPopN(out.data(), out.size()), 40);
+  for (int i = 0; i != 40; ++i) {
+    EXPECT_EQ(out[i], 60 + i);
+  }
+  q.AdvanceReadPosition(40);
+  ASSERT_TRUE(q.IsEmpty());
+  ASSERT_EQ(q.TryPopN(out.data(), out.size()), 0);
+}
+
+TEST(SPSCQueueTest, PushNStopsWhenFull) {
+  Queue q(0, NoOp);
+
+  std::vector<int> in(kCapacity);
+  const std::size_t pushed = q.TryPushN(in.data(), in.size());
+  ASSERT_LT(pushed, kCapacity);
+  ASSERT_TRUE(q.IsFull());
+  ASSERT_EQ(q.TryPushN(in.data(), in.size()), 0);
+}
+
+TEST(SPSCQueueTest, PushNPostApply) {
+  int overwritten = 0;
+  SPSCQueue<int, 16> q(-1, [&overwritten](int& item) {
+    if (item != -1) {
+      overwritten++;
+    }
+  });
+
+  std::vector<int> in(8, 1);
+  std::vector<int> out(8);
+  ASSERT_EQ(q.TryPushN(in.data(), in.size()), 8);
+  ASSERT_EQ(q.TryPopN(out.data(), out.size()), 8);
+  q.AdvanceReadPosition(8);
+  ASSERT_EQ(q.TryPushN(in.data(), in.size()), 8);
+  ASSERT_EQ(q.TryPopN(out.data(), out.size()), 8);
+  q.AdvanceReadPosition(8);
+  EXPECT_EQ(overwritten, 0);
+
+  // The third batch wraps around onto the slots used by the first.
+  ASSERT_EQ(q.TryPushN(in.data(), in.size()), 8);
+  EXPECT_EQ(overwritten, 8);
+}
+
+TEST(SPSCQueueTest, PopNLookAhead) {
+  Queue q(0, NoOp);
+
+  std::vector<int> in(10);
+  for (int i = 0; i != 10; ++i) {
+    in[i] = i;
+  }
+  ASSERT_EQ(q.TryPushN(in.data(), in.size()), 10);
+
+  std::vector<int> out(4);
+  q.PopN(out.data(), 4, 2);
+  for (int i = 0; i != 4; ++i) {
+    EXPECT_EQ(out[i], 2 + i);
+  }
+
+  // Only 2 elements are left past a look ahead of 8.
+  ASSERT_EQ(q.TryPopN(out.data(), out.size(), 8), 2);
+  EXPECT_EQ(out[0], 8);
+  EXPECT_EQ(out[1], 9);
+  ASSERT_EQ(q.TryPopN(out.data(), out.size(), 10), 0);
+  ASSERT_EQ(q.Size(), 10);
+}
+
+// A reference counted element, similar to the TensorBuffers in the infeed
+// queues, where `post_apply` drops the reference held by the queue.
+struct RefCounted {
+  int value = 0;
+  int refs = 0;
+};
+
+TEST(SPSCQueueTest, PopNKeepsElementsAliveUntilAdvanced) {
+  std::vector<RefCounted> objects(16);
+  std::vector<RefCounted*> in;
+  for (int i = 0; i != 16; ++i) {
+    objects[i].value = i;
+    objects[i].refs = 1;
+    in.push_back(&objects[i]);
+  }
+
+  SPSCQueue<RefCounted*, 16> q(nullptr, [](RefCounted*& item) {
+    if (item) {
+      item->refs--;
+      item = nullptr;
+    }
+  });
+  ASSERT_EQ(q.TryPushN(in.data(), 8), 8);
+  ASSERT_TRUE(q.IsFull());
+
+  // Popping does not hand the slots back to the producer, so the popped
+  // elements stay alive while the consumer uses them.
+  RefCounted* out[8];
+  ASSERT_EQ(q.TryPopN(out, 8), 8);
+  ASSERT_EQ(q.TryPushN(in.data() + 8, 8), 0);
+  for (int i = 0; i != 8; ++i) {
+    EXPECT_EQ(out[i]->value, i);
+    EXPECT_EQ(out[i]->refs, 1);
+  }
+  q.AdvanceReadPosition(8);
+
+  // Once advanced, the elements are released when the producer reuses their
+  // slots, which happens on the next pass around the buffer.
+  ASSERT_EQ(q.TryPushN(in.data() + 8, 8), 8);
+  ASSERT_EQ(q.TryPopN(out, 8), 8);
+  q.AdvanceReadPosition(8);
+  for (int i = 0; i != 8; ++i) {
+    EXPECT_EQ(objects[i].refs, 1);
+  }
+  ASSERT_EQ(q.TryPushN(in.data() + 8, 8), 8);
+  for (int i = 0; i != 8; ++i) {
+    EXPECT_EQ(objects[i].refs, 0);
+  }
+}
+
+TEST(SPSCQueueTest, BlockPopWakesUp) {
+  Queue q(0, NoOp);
+
+  std::thread consumer([&q]() {
+    for (int i = 0; i != 10; ++i) {
+      int item;
+      q.BlockPop(item);
+      EXPECT_EQ(item, i);
+      q.AdvanceReadPosition();
+    }
+  });
+
+  // Give the consumer long enough to go to sleep between each push.
+  for (int i = 0; i != 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    q.BlockPush(i);
+    q.AdvanceWritePosition();
+  }
+  consumer.join();
+  ASSERT_TRUE(q.IsEmpty());
+}
+
+TEST(SPSCQueueTest, BlockPushNWakesUp) {
+  SPSCQueue<int, 16> q(0, NoOp);
+  constexpr int kItems = 1000;
+
+  std::thread consumer([&q]() {
+    int expected = 0;
+    int items[4];
+    while (expected != kItems) {
+      const std::size_t count = q.BlockPopN(items, 4);
+      for (std::size_t i = 0; i != count; ++i) {
+        EXPECT_EQ(items[i], expected++);
+      }
+      q.AdvanceReadPosition(count);
+    }
+  });
+
+  std::vector<int> in(kItems);
+  for (int i = 0; i != kItems; ++i) {
+    in[i] = i;
+  }
+  q.BlockPushN(in.data(), in.size());
+  consumer.join();
+  ASSERT_TRUE(q.IsEmpty());
+}
+
+TEST(SPSCQueueTest, BatchedNotificationsAreNotMissed) {
+  SPSCQueue<int, 16> q(0, NoOp);
+  constexpr int kBatches = 200;
+  constexpr std::size_t kBatchSize = SPSCQueue<int, 16>::MaxSize();
+
+  // Both threads always advance by a whole batch, so every notification is
+  // fenced.
+  std::thread consumer([&q]() {
+    int items[kBatchSize];
+    for (int i = 0; i != kBatches; ++i) {
+      q.WaitUntilNotEmpty(kBatchSize - 1);
+      q.PopN(items, kBatchSize);
+      EXPECT_EQ(items[0], i);
+      q.AdvanceReadPosition(kBatchSize);
+    }
+  });
+
+  // Give the consumer long enough to go to sleep between each batch.
+  std::vector<int> in(kBatchSize);
+  for (int i = 0; i != kBatches; ++i) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    std::fill(in.begin(), in.end(), i);
+    q.BlockPushN(in.data(), in.size());
+  }
+  consumer.join();
+  ASSERT_TRUE(q.IsEmpty());
+  EXPECT_EQ(q.MissedNotifications(), 0);
+}
+
+TEST(SPSCQueueTest, OutfeedBlockFrontWakesUp) {
+  SPSCOutfeedQueue<16> q(sizeof(int));
+
+  std::thread consumer([&q]() {
+    void*& item = q.BlockFront();
+    EXPECT_EQ(*static_cast<int*>(item), 42);
+    q.FinishedFront();
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  void*& slot = q.BlockBack();
+  *static_cast<int*>(slot) = 42;
+  q.FinishedBack();
+  consumer.join();
+  ASSERT_FALSE(q.HasItemsWaiting());
+}
+
+// Label a benchmark with how often a thread went to sleep, was not notified
+// and only woke up on the futex timeout.
+template <typename... Queues>
+void ReportMissedNotifications(const Queues&... queues) {
+  uint64_t missed = 0;
+  for (uint64_t count : {queues.MissedNotifications()...}) {
+    missed += count;
+  }
+  tensorflow::testing::SetLabel("missed notifications: " +
+                                std::to_string(missed));
+}
+
+// Throughput of transferring `iters` elements between two threads. The
+// baseline busy spins on TryPush/TryPop, which is how BlockPush/BlockPop used
+// to behave.
+void BM_SPSCQueueBusySpin(int iters) {
+  tensorflow::testing::StopTiming();
+  Queue q(0, NoOp);
+  tensorflow::testing::StartTiming();
+
+  std::thread consumer([&q, iters]() {
+    int item;
+    for (int i = 0; i != iters; ++i) {
+      while (!q.TryPop(item)) {
+      }
+      q.AdvanceReadPosition();
+    }
+  });
+  for (int i = 0; i != iters; ++i) {
+    while (!q.TryPush(i)) {
+    }
+    q.AdvanceWritePosition();
+  }
+  consumer.join();
+}
+BENCHMARK(BM_SPSCQueueBusySpin);
+
+void BM_SPSCQueueBlocking(int iters) {
+  tensorflow::testing::StopTiming();
+  Queue q(0, NoOp);
+  tensorflow::testing::StartTiming();
+
+  std::thread consumer([&q, iters]() {
+    int item;
+    for (int i = 0; i != iters; ++i) {
+      q.BlockPop(item);
+      q.AdvanceReadPosition();
+    }
+  });
+  for (int i = 0; i != iters; ++i) {
+    q.BlockPush(i);
+    q.AdvanceWritePosition();
+  }
+  consumer.join();
+  ReportMissedNotifications(q);
+}
+BENCHMARK(BM_SPSCQueueBlocking);
+
+void BM_SPSCQueueBatched(int iters, int batch_size) {
+  tensorflow::testing::StopTiming();
+  Queue q(0, NoOp);
+  std::vector<int> in(batch_size);
+  tensorflow::testing::StartTiming();
+
+  std::thread consumer([&q, iters, batch_size]() {
+    std::vector<int> out(batch_size);
+    int remaining = iters;
+    while (remaining) {
+      const std::size_t count =
+          q.BlockPopN(out.data(), std::min(remaining, batch_size));
+      q.AdvanceReadPosition(count);
+      remaining -= count;
+    }
+  });
+  for (int i = 0; i < iters; i += batch_size) {
+    q.BlockPushN(in.data(), std::min(iters - i, batch_size));
+  }
+  consumer.join();
+  ReportMissedNotifications(q);
+}
+BENCHMARK(BM_SPSCQueueBatched)->Arg(8)->Arg(64);
+
+// Latency of waking up a consumer which has gone idle, measured as a round
+// trip between two queues with a pause between each element.
+void BM_SPSCQueueIdleWakeUp(int iters) {
+  tensorflow::testing::StopTiming();
+  Queue request(0, NoOp);
+  Queue response(0, NoOp);
+
+  std::thread consumer([&request, &response, iters]() {
+    int item;
+    for (int i = 0; i != iters; ++i) {
+      request.BlockPop(item);
+      request.AdvanceReadPosition();
+      response.BlockPush(item);
+      response.AdvanceWritePosition();
+    }
+  });
+
+  for (int i = 0; i != iters; ++i) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    tensorflow::testing::StartTiming();
+    request.BlockPush(i);
+    request.AdvanceWritePosition();
+    int item;
+    response.BlockPop(item);
+    response.AdvanceReadPosition();
+    tensorflow::testing::StopTiming();
+  }
+  consumer.join();
+  ReportMissedNotifications(request, response);
+}
+BENCHMARK(BM_SPSCQueueIdleWakeUp);
+
+// Round trip latency between two threads bouncing one element back and forth
+// over a pair of queues. When both threads have their own core this is
+// dominated by how many cache lines move between the cores for each element.
+void BM_SPSCQueuePingPong(int iters) {
+  tensorflow::testing::StopTiming();
+  Queue ping(0, NoOp);
+  Queue pong(0, NoOp);
+  tensorflow::testing::StartTiming();
+
+  std::thread consumer([&ping, &pong, iters]() {
+    int item;
+    for (int i = 0; i != iters; ++i) {
+      ping.BlockPop(item);
+      ping.AdvanceReadPosition();
+      pong.Push(item);
+      pong.AdvanceWritePosition();
+    }
+  });
+
+  for (int i = 0; i != iters; ++i) {
+    ping.Push(i);
+    ping.AdvanceWritePosition();
+    int item;
+    pong.BlockPop(item);
+    pong.AdvanceReadPosition();
+  }
+  consumer.join();
+  ReportMissedNotifications(ping, pong);
+}
+BENCHMARK(BM_SPSCQueuePingPong);
+
+}  // namespace
+}  // namespace poplarplugin
+}  // namespace xla
@@ -16,6 +16,8 @@ limitations under the License.
 #include "tensorflow/core/common_runtime/bfc_allocator.h"
 
 #include <atomic>
+#include <functional>
+#include <thread>
 
 #include "tensorflow/core/common_runtime/allocator_retry.h"
 #include "tensorflow/core/lib/core/bits.h"
@@ -357,6 +359,102 @@ void BFCAllocator::DeallocateRegions(
   }
 }
 
+BFCAllocator::FrontCacheShard* BFCAllocator::FrontCacheShardForThread() {
+  const size_t hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+  return &front_cache_[hash % kNumFrontCacheShards];
+}
+
+BFCAllocator::FrontCacheShard* BFCAllocator::FrontCacheShardForPtr(
+    const void* ptr) const {
+  const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(ptr);
+  return &front_cache_[(p >> kMinAllocationBits) % kNumFrontCacheShards];
+}
+
+void* BFCAllocator::AllocateFromFrontCache(size_t num_bytes) {
+  if (num_front_cached_.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+  const size_t rounded_bytes = RoundedBytes(num_bytes);
+  FrontCacheShard* shard = FrontCacheShardForThread();
+  mutex_lock l(shard->mu);
+  auto it = shard->free.find(rounded_bytes);
+  if (it == shard->free.end() || it->second.empty()) {
+    return nullptr;
+  }
+  void* ptr = it->second.back();
+  it->second.pop_back();
+  shard->free_bytes -= rounded_bytes;
+  num_front_cached_.fetch_sub(1, std::memory_order_relaxed);
+  return ptr;
+}
+
+bool BFCAllocator::DeallocateToFrontCache(void* ptr) {
+  if (front_cache_bytes_ == 0) {
+    return false;
+  }
+  // Under memory pressure, the buffer is returned to the bins.
+  const bool under_pressure =
+      front_cache_under_pressure_.load(std::memory_order_relaxed);
+  size_t num_bytes;
+  {
+    FrontCacheShard* shard = FrontCacheShardForPtr(ptr);
+    mutex_lock l(shard->mu);
+    auto it = shard->live.find(ptr);
+    if (it == shard->live.end()) {
+      return false;
+    }
+    num_bytes = it->second;
+    shard->live.erase(it);
+  }
+  if (under_pressure) {
+    return false;
+  }
+  const size_t rounded_bytes = RoundedBytes(num_bytes);
+  FrontCacheShard* shard = FrontCacheShardForThread();
+  mutex_lock l(shard->mu);
+  if (shard->free_bytes + rounded_bytes > front_cache_bytes_) {
+    return false;
+  }
+  shard->free[rounded_bytes].push_back(ptr);
+  shard->free_bytes += rounded_bytes;
+  num_front_cached_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool BFCAllocator::FlushFrontCache() {
+  if (num_front_cached_.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  int64 num_flushed = 0;
+  for (FrontCacheShard& shard : front_cache_) {
+    mutex_lock l(shard.mu);
+    for (auto& entry : shard.free) {
+      for (void* ptr : entry.second) {
+        FreeChunkPtr(ptr);
+        ++num_flushed;
+      }
+    }
+    shard.free.clear();
+    shard.free_bytes = 0;
+  }
+  num_front_cached_.fetch_sub(num_flushed, std::memory_order_relaxed);
+  VLOG(2) << "Flushed " << num_flushed << " buffers from the front cache of "
+          << Name();
+  return num_flushed > 0;
+}
+
+void BFCAllocator::UpdateFrontCachePressure() {
+  if (front_cache_bytes_ == 0) {
+    return;
+  }
+  // The cached buffers count as in use, so flushing them relieves the
+  // pressure.
+  const bool under_pressure =
+      stats_.bytes_in_use >
+      static_cast<int64>(memory_limit_ * kFrontCacheFlushFraction);
+  front_cache_under_pressure_.store(under_pressure, std::memory_order_relaxed);
+}
+
 void* BFCAllocator::AllocateRawInternal(size_t unused_alignment,
                                         size_t num_bytes,
                                         bool dump_log_on_failure,
@@ -365,6 +463,31 @@ void* BFCAllocator::AllocateRawInternal(size_t unused_alignment,
     VLOG(2) << "tried to allocate 0 bytes";
     return nullptr;
   }
+  // Cached buffers are not timestamped when they are freed, so the front cache
+  // cannot be used together with a timing counter.
+  if (front_cache_bytes_ == 0 || timing_counter_ != nullptr ||
+      num_bytes > kMaxFrontCacheBytes) {
+    return AllocateRawFromBins(unused_alignment, num_bytes,
+                               dump_log_on_failure, freed_before);
+  }
+  void* ptr = AllocateFromFrontCache(num_bytes);
+  if (ptr == nullptr) {
+    ptr = AllocateRawFromBins(unused_alignment, num_bytes, dump_log_on_failure,
+                              freed_before);
+    if (ptr == nullptr) {
+      return nullptr;
+    }
+  }
+  FrontCacheShard* shard = FrontCacheShardForPtr(ptr);
+  mutex_lock l(shard->mu);
+  shard->live[ptr] = num_bytes;
+  return ptr;
+}
+
+void* BFCAllocator::AllocateRawFromBins(size_t unused_alignment,
+                                        size_t num_bytes,
+                                        bool dump_log_on_failure,
+                                        uint64 freed_before) {
   // First, always allocate memory of at least kMinAllocationSize
   // bytes, and always allocate multiples of kMinAllocationSize bytes
   // so all memory addresses are nicely byte aligned.
@@ -378,6 +501,9 @@ void* BFCAllocator::AllocateRawInternal(size_t unused_alignment,
     // Merge timestamped chunks whose counts have become safe for general use.
     MergeTimestampedChunks(0);
   }
+  if (front_cache_under_pressure_.load(std::memory_order_relaxed)) {
+    FlushFrontCache();
+  }
   void* ptr = FindChunkPtr(bin_num, rounded_bytes, num_bytes, freed_before);
   if (ptr != nullptr) {
     return ptr;
@@ -391,6 +517,15 @@ void* BFCAllocator::AllocateRawInternal(size_t unused_alignment,
     }
   }
 
+  // The memory cannot grow any further, so return the buffers held by the
+  // front cache to the bins where they can be coalesced.
+  if (FlushFrontCache()) {
+    ptr = FindChunkPtr(bin_num, rounded_bytes, num_bytes, freed_before);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+  }
+
   if ((freed_before == 0) && (!timestamped_chunks_.empty())) {
     // We're unable to satisfy an allocation request without a specific
     // timestamp requirement.  Rather than fail, try merging any held-out
@@ -476,6 +611,7 @@ void* BFCAllocator::FindChunkPtr(BinNum bin_num, size_t rounded_bytes,
             std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
         stats_.largest_alloc_size =
             std::max<std::size_t>(stats_.largest_alloc_size, chunk->size);
+        UpdateFrontCachePressure();
 
 #ifdef TENSORFLOW_MEM_DEBUG
         if (ShouldRecordOpName()) {
@@ -548,7 +684,9 @@ void BFCAllocator::SplitChunk(BFCAllocator::ChunkHandle h, size_t num_bytes) {
 void BFCAllocator::DeallocateRaw(void* ptr) {
   VLOG(1) << "DeallocateRaw " << Name() << " "
           << (ptr ? RequestedSize(ptr) : 0);
-  DeallocateRawInternal(ptr);
+  if (!DeallocateToFrontCache(ptr)) {
+    DeallocateRawInternal(ptr);
+  }
   retry_helper_.NotifyDealloc();
 }
 
@@ -558,7 +696,10 @@ void BFCAllocator::DeallocateRawInternal(void* ptr) {
     return;
   }
   mutex_lock l(lock_);
+  FreeChunkPtr(ptr);
+}
 
+void BFCAllocator::FreeChunkPtr(void* ptr) {
   // Find the chunk from the ptr.
   BFCAllocator::ChunkHandle h = region_manager_.get_handle(ptr);
   CHECK(h != kInvalidChunkHandle);
@@ -661,6 +802,7 @@ void BFCAllocator::MarkFree(BFCAllocator::ChunkHandle h) {
 
   // Updates the stats.
   stats_.bytes_in_use -= c->size;
+  UpdateFrontCachePressure();
 
 #ifdef TENSORFLOW_MEM_DEBUG
   if (ShouldRecordOpName()) {
@@ -792,6 +934,16 @@ bool BFCAllocator::TracksAllocationSizes() const { return true; }
 
 size_t BFCAllocator::RequestedSize(const void* ptr) const {
   CHECK(ptr);
+  if (front_cache_bytes_ > 0) {
+    // A cached buffer may have been handed out again for a different size in
+    // the same size class.
+    FrontCacheShard* shard = FrontCacheShardForPtr(ptr);
+    mutex_lock l(shard->mu);
+    auto it = shard->live.find(ptr);
+    if (it != shard->live.end()) {
+      return it->second;
+    }
+  }
   mutex_lock l(lock_);
   BFCAllocator::ChunkHandle h = region_manager_.get_handle(ptr);
   CHECK(h != kInvalidChunkHandle)
@@ -23,6 +23,7 @@ limitations under the License.
 #include <unordered_map>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "tensorflow/core/common_runtime/allocator_retry.h"
 #include "tensorflow/core/common_runtime/shared_counter.h"
@@ -79,6 +80,17 @@ class BFCAllocator : public Allocator {
 
   void SetTimingCounter(SharedCounter* sc) { timing_counter_ = sc; }
 
+  // Enables a front cache which keeps up to 'bytes' of recently freed small
+  // buffers in each of kNumFrontCacheShards shards, picked by thread. Requests
+  // which round to the same size as a cached buffer are then served from the
+  // shard without taking the allocator lock. The cached buffers still count as
+  // in use in the stats and keep the allocation id they were first given. They
+  // are returned to the bins, and no more are cached, while more than
+  // kFrontCacheFlushFraction of the memory limit is in use, and whenever an
+  // allocation could not otherwise be satisfied. Must be called before the
+  // first allocation. It has no effect together with a timing counter.
+  void SetFrontCacheBytes(size_t bytes) { front_cache_bytes_ = bytes; }
+
   void SetSafeFrontier(uint64 count) override;
 
   virtual bool ShouldRecordOpName() const { return false; }
@@ -92,12 +104,32 @@ class BFCAllocator : public Allocator {
                             bool dump_log_on_failure,
                             uint64 freed_before_count);
 
+  void* AllocateRawFromBins(size_t alignment, size_t num_bytes,
+                            bool dump_log_on_failure,
+                            uint64 freed_before_count);
+
   void* AllocateRawInternalWithRetry(
       size_t alignment, size_t num_bytes,
       const AllocationAttributes& allocation_attr);
 
   void DeallocateRawInternal(void* ptr);
 
+  // Returns the chunk of 'ptr' to the bins.
+  void FreeChunkPtr(void* ptr) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Returns a cached buffer of RoundedBytes(num_bytes) bytes, or nullptr.
+  void* AllocateFromFrontCache(size_t num_bytes);
+
+  // Keeps 'ptr' in the front cache if it was allocated through it and there
+  // is room. Returns false if the caller must free it instead.
+  bool DeallocateToFrontCache(void* ptr);
+
+  // Returns all the cached buffers to the bins. Returns true if any were.
+  bool FlushFrontCache() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Records whether the bytes in use are above the front cache threshold.
+  void UpdateFrontCachePressure() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
   // Chunks whose freed_at_count is later than the safe frontier value are kept
   // on a special list and not subject to merging immediately upon being freed.
   //
@@ -240,6 +272,29 @@ class BFCAllocator : public Allocator {
   static const size_t kMinAllocationBits = 8;
   static const size_t kMinAllocationSize = 1 << kMinAllocationBits;
 
+  // The front cache is split into shards to reduce contention, and only holds
+  // buffers of up to kMaxFrontCacheBytes bytes.
+  static const int kNumFrontCacheShards = 16;
+  static const size_t kMaxFrontCacheBytes = 64 << 10;
+  // The fraction of the memory limit in use above which the front cache is
+  // flushed.
+  static constexpr double kFrontCacheFlushFraction = 0.9;
+
+  // A shard of the front cache. 'live' maps the buffers handed out through the
+  // front cache whose address maps to this shard to their requested sizes, and
+  // 'free' holds the buffers cached by the threads which map to this shard,
+  // keyed by the RoundedBytes of their requested size. Shard locks are only
+  // ever taken on their own or while holding lock_.
+  struct FrontCacheShard {
+    mutex mu;
+    absl::flat_hash_map<const void*, size_t> live GUARDED_BY(mu);
+    absl::flat_hash_map<size_t, std::vector<void*>> free GUARDED_BY(mu);
+    size_t free_bytes GUARDED_BY(mu) = 0;
+  };
+
+  FrontCacheShard* FrontCacheShardForThread();
+  FrontCacheShard* FrontCacheShardForPtr(const void* ptr) const;
+
   // BFCAllocator allocates memory into a collection of disjoint
   // AllocationRegions.  Each AllocationRegion corresponds to one call to
   // SubAllocator::Alloc().  (Actually, if a subsequent call to
@@ -519,6 +574,13 @@ class BFCAllocator : public Allocator {
 
   std::atomic<uint64> safe_frontier_ = {0};
 
+  size_t front_cache_bytes_ = 0;
+  mutable std::array<FrontCacheShard, kNumFrontCacheShards> front_cache_;
+  // The number of buffers in the free lists of all the shards.
+  std::atomic<int64> num_front_cached_ = {0};
+  // Whether more than kFrontCacheFlushFraction of the memory limit is in use.
+  std::atomic<bool> front_cache_under_pressure_ = {false};
+
   // Structures mutable after construction
   mutable mutex lock_;
   RegionManager region_manager_ GUARDED_BY(lock_);
@@ -0,0 +1,212 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/bfc_allocator.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/common_runtime/pool_allocator.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+std::unique_ptr<BFCAllocator> CreateAllocator(size_t total_memory,
+                                              bool allow_growth,
+                                              size_t front_cache_bytes) {
+  std::unique_ptr<BFCAllocator> a(new BFCAllocator(
+      new BasicCPUAllocator(port::kNUMANoAffinity, {}, {}), total_memory,
+      allow_growth, "cpu_bfc"));
+  a->SetFrontCacheBytes(front_cache_bytes);
+  return a;
+}
+
+TEST(BFCAllocatorTest, FrontCacheReusesBuffers) {
+  auto a = CreateAllocator(1 << 20, true, 64 << 10);
+
+  void* p1 = a->AllocateRaw(Allocator::kAllocatorAlignment, 1000);
+  const int64 id = a->AllocationId(p1);
+  a->DeallocateRaw(p1);
+
+  // Served from the cache, so the allocation is not counted again.
+  void* p2 = a->AllocateRaw(Allocator::kAllocatorAlignment, 1000);
+  EXPECT_EQ(p1, p2);
+  EXPECT_EQ(a->RequestedSize(p2), 1000);
+  EXPECT_EQ(a->AllocationId(p2), id);
+  EXPECT_EQ(a->GetStats()->num_allocs, 1);
+
+  // Requests which round to the same size reuse the buffer too.
+  a->DeallocateRaw(p2);
+  void* p3 = a->AllocateRaw(Allocator::kAllocatorAlignment, 900);
+  EXPECT_EQ(p1, p3);
+  EXPECT_EQ(a->RequestedSize(p3), 900);
+  EXPECT_EQ(a->GetStats()->num_allocs, 1);
+
+  // Requests of another size class do not.
+  a->DeallocateRaw(p3);
+  void* p4 = a->AllocateRaw(Allocator::kAllocatorAlignment, 2000);
+  EXPECT_NE(p1, p4);
+  EXPECT_EQ(a->RequestedSize(p4), 2000);
+  EXPECT_EQ(a->GetStats()->num_allocs, 2);
+  EXPECT_EQ(a->GetStats()->bytes_in_use, 1024 + 2048);
+  a->DeallocateRaw(p4);
+}
+
+TEST(BFCAllocatorTest, FrontCacheFlushedWhenOutOfMemory) {
+  auto a = CreateAllocator(1 << 20, false, 1 << 20);
+
+  // Fill the whole memory with small buffers, and cache all of them.
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 1024; i++) {
+    void* p = a->AllocateRaw(Allocator::kAllocatorAlignment, 1000);
+    ASSERT_NE(p, nullptr);
+    ptrs.push_back(p);
+  }
+  for (void* p : ptrs) {
+    a->DeallocateRaw(p);
+  }
+  // The buffers freed while the memory was under pressure went back to the
+  // bins, and the rest were cached.
+  EXPECT_LE(a->GetStats()->bytes_in_use, (1 << 20) * 9 / 10);
+  EXPECT_GT(a->GetStats()->bytes_in_use, 512 << 10);
+
+  // The cached buffers are coalesced to satisfy a large allocation.
+  void* p = a->AllocateRaw(Allocator::kAllocatorAlignment, 512 << 10);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(a->GetStats()->bytes_in_use, 512 << 10);
+  a->DeallocateRaw(p);
+}
+
+TEST(BFCAllocatorTest, FrontCacheFlushedUnderMemoryPressure) {
+  // With allow_growth the memory can still grow when the pressure rises.
+  auto a = CreateAllocator(1 << 20, true, 1 << 20);
+
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 100; i++) {
+    void* p = a->AllocateRaw(Allocator::kAllocatorAlignment, 1000);
+    ASSERT_NE(p, nullptr);
+    ptrs.push_back(p);
+  }
+  for (void* p : ptrs) {
+    a->DeallocateRaw(p);
+  }
+  const int64 cached_bytes = 100 * 1024;
+  EXPECT_EQ(a->GetStats()->bytes_in_use, cached_bytes);
+
+  // Takes the memory in use, including the cache, above the threshold.
+  void* large = a->AllocateRaw(Allocator::kAllocatorAlignment, 900 << 10);
+  ASSERT_NE(large, nullptr);
+  const int64 large_bytes = a->AllocatedSize(large);
+  EXPECT_EQ(a->GetStats()->bytes_in_use, cached_bytes + large_bytes);
+
+  // The next allocation from the bins flushes the cache, and buffers freed
+  // under pressure are not cached.
+  void* p = a->AllocateRaw(Allocator::kAllocatorAlignment, 5000);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(a->GetStats()->bytes_in_use, large_bytes + 5120);
+  a->DeallocateRaw(p);
+  EXPECT_EQ(a->GetStats()->bytes_in_use, large_bytes);
+
+  // Buffers are cached again once the pressure has gone.
+  a->DeallocateRaw(large);
+  p = a->AllocateRaw(Allocator::kAllocatorAlignment, 5000);
+  a->DeallocateRaw(p);
+  EXPECT_EQ(a->GetStats()->bytes_in_use, 5120);
+}
+
+TEST(BFCAllocatorTest, FrontCacheConcurrentAllocations) {
+  auto a = CreateAllocator(64 << 20, true, 16 << 10);
+  thread::ThreadPool pool(Env::Default(), "test", 8);
+  for (int t = 0; t < 8; t++) {
+    pool.Schedule([&a, t]() {
+      random::PhiloxRandom philox(t, 17);
+      random::SimplePhilox rand(&philox);
+      std::vector<std::pair<char*, size_t>> live;
+      for (int i = 0; i < 10000; i++) {
+        if (live.size() < 16 && rand.Uniform(2) == 0) {
+          const size_t bytes = 1 + rand.Uniform(8192);
+          char* p = static_cast<char*>(
+              a->AllocateRaw(Allocator::kAllocatorAlignment, bytes));
+          ASSERT_NE(p, nullptr);
+          std::memset(p, t, bytes);
+          live.emplace_back(p, bytes);
+        } else if (!live.empty()) {
+          // No other thread has written to the buffer while it was live.
+          const size_t index = rand.Uniform(live.size());
+          char* p = live[index].first;
+          for (size_t j = 0; j < live[index].second; j++) {
+            ASSERT_EQ(p[j], static_cast<char>(t));
+          }
+          a->DeallocateRaw(p);
+          live.erase(live.begin() + index);
+        }
+      }
+      for (auto& entry : live) {
+        a->DeallocateRaw(entry.first);
+      }
+    });
+  }
+}
+
+// Each thread keeps a few small buffers of different sizes live at a time, as
+// the kernels of an inference server do.
+static void BM_SmallAllocationsThreaded(int iters, int num_threads,
+                                        int front_cache_kb) {
+  testing::StopTiming();
+  testing::UseRealTime();
+  auto a = CreateAllocator(1uLL << 30, true, front_cache_kb << 10);
+  const int iters_per_thread = iters / num_threads;
+  testing::StartTiming();
+  {
+    thread::ThreadPool pool(Env::Default(), "test", num_threads);
+    for (int t = 0; t < num_threads; t++) {
+      pool.Schedule([&a, t, iters_per_thread]() {
+        static const size_t kSizes[] = {64, 256, 1024, 4096, 512, 16384};
+        std::vector<void*> live(8, nullptr);
+        for (int i = 0; i < iters_per_thread; i++) {
+          const int slot = (i * 7 + t) % live.size();
+          if (live[slot] != nullptr) {
+            a->DeallocateRaw(live[slot]);
+          }
+          live[slot] = a->AllocateRaw(Allocator::kAllocatorAlignment,
+                                      kSizes[i % TF_ARRAYSIZE(kSizes)]);
+        }
+        for (void* p : live) {
+          if (p != nullptr) {
+            a->DeallocateRaw(p);
+          }
+        }
+      });
+    }
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters_per_thread) * num_threads);
+}
+BENCHMARK(BM_SmallAllocationsThreaded)
+    ->ArgPair(1, 0)
+    ->ArgPair(4, 0)
+    ->ArgPair(16, 0)
+    ->ArgPair(1, 256)
+    ->ArgPair(4, 256)
+    ->ArgPair(16, 256);
+
+}  // namespace
+}  // namespace tensorflow
@@ -338,11 +338,21 @@ DirectSession::DirectSession(const SessionOptions& options,
   }
   // The default value of sync_on_finish will be flipped soon and this
   // environment variable will be removed as well.
-  const Status status =
+  Status status =
       ReadBoolFromEnvVar("TF_SYNC_ON_FINISH", true, &sync_on_finish_);
   if (!status.ok()) {
     LOG(ERROR) << status.error_message();
   }
+  status = ReadBoolFromEnvVar("TF_EXECUTOR_PRIORITIZE_CRITICAL_PATH", false,
+                              &prioritize_critical_path_);
+  if (!status.ok()) {
+    LOG(ERROR) << status.error_message();
+  }
+  status = ReadInt64FromEnvVar("TF_SESSION_STATIC_MEMORY_PLAN_STEPS", 0,
+                               &static_memory_plan_steps_);
+  if (!status.ok()) {
+    LOG(ERROR) << status.error_message();
+  }
   session_handle_ =
       strings::StrCat("direct", strings::FpToString(random::New64()));
   int devices_added = 0;
@@ -660,7 +670,9 @@ Status DirectSession::RunInternal(
   if (ShouldUseRunHandlerPool(run_options) &&
       run_options.experimental().use_run_handler_pool()) {
     VLOG(1) << "Using RunHandler to scheduler inter-op closures.";
-    handler = GetOrCreateRunHandlerPool(options_)->Get(step_id);
+    handler = GetOrCreateRunHandlerPool(options_)->Get(
+        step_id, run_options.timeout_in_ms() > 0 ? run_options.timeout_in_ms()
+                                                 : operation_timeout_in_ms_);
   }
   auto* handler_ptr = handler.get();
 
@@ -1344,6 +1356,13 @@ Status DirectSession::CreateExecutors(
       *r = new IntraProcessRendezvous(device_mgr);
       return Status::OK();
     };
+    params.prioritize_critical_path = prioritize_critical_path_;
+    if (static_memory_plan_steps_ > 0 && device->device_type() == DEVICE_CPU) {
+      item->memory_plan.reset(
+          new StaticMemoryPlan(device->GetAllocator(AllocatorAttributes()),
+                               static_memory_plan_steps_));
+      params.memory_plan = item->memory_plan.get();
+    }
 
     optimizer.Optimize(lib, options_.env, device, &partition_graph,
                        /*shape_map=*/nullptr);
@@ -32,6 +32,7 @@ limitations under the License.
 #include "tensorflow/core/common_runtime/process_function_library_runtime.h"
 #include "tensorflow/core/common_runtime/rendezvous_mgr.h"
 #include "tensorflow/core/common_runtime/session_factory.h"
+#include "tensorflow/core/common_runtime/static_memory_plan.h"
 #include "tensorflow/core/framework/cancellation.h"
 #include "tensorflow/core/framework/collective.h"
 #include "tensorflow/core/framework/graph.pb.h"
@@ -132,6 +133,8 @@ class DirectSession : public Session {
  private:
   // For access to collective_graph_key_.
   friend class DirectSessionCollectiveTest;
+  // For access to the memory plans of executors_.
+  friend class DirectSessionStaticMemoryPlanTest;
 
   // We create one executor and its dependent library runtime for
   // every partition.
@@ -139,6 +142,7 @@ class DirectSession : public Session {
     std::unique_ptr<Graph> graph = nullptr;
     Device* device = nullptr;                // not owned.
     FunctionLibraryRuntime* flib = nullptr;  // not owned.
+    core::RefCountPtr<StaticMemoryPlan> memory_plan;
     std::unique_ptr<Executor> executor;
   };
 
@@ -341,6 +345,13 @@ class DirectSession : public Session {
   // If true, blocks until device has finished all queued operations in a step.
   bool sync_on_finish_ = true;
 
+  // If true, the executors run the ready nodes on the critical path first.
+  bool prioritize_critical_path_ = false;
+
+  // If positive, the tensors allocated on CPU devices are served from a memory
+  // plan computed from this many steps of each executor.
+  int64 static_memory_plan_steps_ = 0;
+
   std::vector<std::unique_ptr<FunctionInfo>> functions_
       GUARDED_BY(executor_lock_);
 
@@ -27,6 +27,7 @@ limitations under the License.
 #include "tensorflow/core/common_runtime/device_factory.h"
 #include "tensorflow/core/common_runtime/device_mgr.h"
 #include "tensorflow/core/common_runtime/function_testlib.h"
+#include "tensorflow/core/common_runtime/static_memory_plan.h"
 #include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/framework/op_kernel.h"
@@ -2725,4 +2726,78 @@ TEST_F(DirectSessionCollectiveTest,
   ASSERT_EQ(key1, key2);
 }
 
+class DirectSessionStaticMemoryPlanTest : public ::testing::Test {
+ public:
+  // Returns the memory plans of every executor created by 'session'.
+  std::vector<StaticMemoryPlan*> GetMemoryPlans(Session* session) {
+    DirectSession* direct_session = static_cast<DirectSession*>(session);
+    std::vector<StaticMemoryPlan*> plans;
+    mutex_lock l(direct_session->executor_lock_);
+    for (const auto& entry : direct_session->executors_) {
+      for (const auto& item : entry.second->items) {
+        if (item.memory_plan) {
+          plans.push_back(item.memory_plan.get());
+        }
+      }
+    }
+    return plans;
+  }
+};
+
+TEST_F(DirectSessionStaticMemoryPlanTest, ServesRepeatedStepsFromArena) {
+  // z = -(x * a) * a, where the intermediate tensors are freed within the
+  // step and z is fetched.
+  Graph graph(OpRegistry::Global());
+  Tensor a_tensor(DT_FLOAT, TensorShape({2, 2}));
+  test::FillValues<float>(&a_tensor, {1, 2, 3, 4});
+  Node* a = test::graph::Constant(&graph, a_tensor);
+  // x is always fed, so it is not folded with the rest of the graph.
+  Node* x = test::graph::Constant(&graph, a_tensor);
+  Node* y = test::graph::Matmul(&graph, x, a, false, false);
+  Node* y_neg = test::graph::Unary(&graph, "Neg", y);
+  Node* z = test::graph::Matmul(&graph, y_neg, a, false, false);
+  GraphDef def;
+  graph.ToGraphDef(&def);
+
+  const int kRecordedSteps = 2;
+  setenv("TF_SESSION_STATIC_MEMORY_PLAN_STEPS",
+         std::to_string(kRecordedSteps).c_str(), 1);
+  std::unique_ptr<Session> session(NewSession(SessionOptions()));
+  unsetenv("TF_SESSION_STATIC_MEMORY_PLAN_STEPS");
+  ASSERT_NE(session, nullptr);
+  TF_ASSERT_OK(session->Create(def));
+
+  // Keep every fetched output, so that a planned output would be overwritten
+  // by the later steps.
+  std::vector<Tensor> fetched;
+  for (int step = 0; step < kRecordedSteps + 3; ++step) {
+    Tensor x_tensor(DT_FLOAT, TensorShape({2, 2}));
+    test::FillValues<float>(&x_tensor, {1.0f * step, 0, 0, 1});
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(session->Run({{strings::StrCat(x->name(), ":0"), x_tensor}},
+                              {strings::StrCat(z->name(), ":0")}, {},
+                              &outputs));
+    ASSERT_EQ(outputs.size(), 1);
+    fetched.push_back(outputs[0]);
+  }
+
+  std::vector<StaticMemoryPlan*> plans = GetMemoryPlans(session.get());
+  ASSERT_EQ(plans.size(), 1);
+  StaticMemoryPlan* plan = plans[0];
+  EXPECT_TRUE(plan->planned());
+  EXPECT_GT(plan->arena_bytes(), 0);
+
+  for (int step = 0; step < static_cast<int>(fetched.size()); ++step) {
+    // x * a = [[s, 2s], [3, 4]], and z = -(x * a) * a.
+    const float s = step;
+    test::ExpectTensorEqual<float>(
+        fetched[step],
+        test::AsTensor<float>(
+            {-(s + 6 * s), -(2 * s + 8 * s), -(3 + 12), -(6 + 16)},
+            TensorShape({2, 2})));
+    // The output escapes the step, so it is never served from the arena.
+    EXPECT_FALSE(plan->InArena(fetched[step].tensor_data().data()));
+  }
+}
+
 }  // namespace tensorflow
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow/core/common_runtime/executor.h"
 
+#include <algorithm>
 #include <atomic>
 #include <deque>
 #include <memory>
@@ -28,6 +29,7 @@ limitations under the License.
 #include "tensorflow/core/common_runtime/executor_factory.h"
 #include "tensorflow/core/common_runtime/pending_counts.h"
 #include "tensorflow/core/common_runtime/renamed_device.h"
+#include "tensorflow/core/common_runtime/static_memory_plan.h"
 #include "tensorflow/core/common_runtime/step_stats_collector.h"
 #include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/cancellation.h"
@@ -42,6 +44,8 @@ limitations under the License.
 #include "tensorflow/core/framework/tensor_reference.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/graph/algorithm.h"
+#include "tensorflow/core/graph/costmodel.h"
 #include "tensorflow/core/graph/edgeset.h"
 #include "tensorflow/core/graph/graph.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -172,6 +176,8 @@ struct NodeItem {
   bool is_initialization_op : 1;  // True iff IsInitializationOp(node)
   bool is_recv_or_switch : 1;     // True iff IsRecv(node) || IsSwitch(node)
   bool is_next_iteration : 1;     // True iff IsNextIteration(node)
+  // True iff any of the out edges of the node goes to a merge node.
+  bool is_any_consumer_merge : 1;
 
   // The kernel for this node.
   OpKernel* kernel = nullptr;
@@ -187,6 +193,10 @@ struct NodeItem {
 
   PendingCounts::Handle pending_id;
 
+  // The estimated time of the longest path from this node to the end of the
+  // graph. Only set when the executor prioritizes the critical path.
+  int64 priority = 0;
+
   // Number of output edges.
   size_t num_output_edges;
 
@@ -379,6 +389,7 @@ class ExecutorImpl : public Executor {
   static Status BuildControlFlowInfo(const Graph* graph,
                                      ControlFlowInfo* cf_info);
   void InitializePending(const Graph* graph, const ControlFlowInfo& cf_info);
+  void InitializePriorities(const Graph* graph);
 
   FrameInfo* EnsureFrameInfo(const string& fname) {
     auto slot = &frame_info_[fname];
@@ -676,6 +687,13 @@ Status ExecutorImpl::Initialize(const Graph& graph) {
     item->is_initialization_op = IsInitializationOp(n);
     item->is_recv_or_switch = IsRecv(n) || IsSwitch(n);
     item->is_next_iteration = IsNextIteration(n);
+    item->is_any_consumer_merge = false;
+    for (const Edge* e : n->out_edges()) {
+      if (IsMerge(e->dst())) {
+        item->is_any_consumer_merge = true;
+        break;
+      }
+    }
 
     // Compute the maximum values we'll store for this node in the
     // pending counts data structure, and allocate a handle in
@@ -704,9 +722,33 @@ Status ExecutorImpl::Initialize(const Graph& graph) {
   // all nodes.
   InitializePending(&graph, cf_info);
 
+  if (params_.prioritize_critical_path) {
+    InitializePriorities(&graph);
+  }
+
   return gview_.SetAllocAttrs(&graph, params_.device);
 }
 
+void ExecutorImpl::InitializePriorities(const Graph* graph) {
+  // In post order every node comes after the nodes it reaches, apart from
+  // along the back edges of loops, whose destinations still have a priority of
+  // zero and are therefore ignored.
+  std::vector<Node*> order;
+  GetPostOrder(*graph, &order);
+  for (const Node* n : order) {
+    int64 longest_path = 0;
+    for (const Edge* e : n->out_edges()) {
+      longest_path =
+          std::max(longest_path, gview_.node(e->dst()->id())->priority);
+    }
+    int64 cost = 1;
+    if (params_.cost_model != nullptr && n->IsOp()) {
+      cost = params_.cost_model->TimeEstimate(n).value();
+    }
+    gview_.node(n->id())->priority = cost + longest_path;
+  }
+}
+
 // If a Node has been marked to use a ScopedAllocator x for output i, then
 // sc_attr will contain the subsequence (i, x) at an even offset.  This function
 // extracts and transfers that ScopedAllocator id to alloc_attr.  For now, we
@@ -985,8 +1027,9 @@ class ExecutorState {
     // edge. The latter node is never run concurrently with the former node.
     Entry* input_tensors;
 
-    // The number of outstanding ops for each iteration.
-    size_t outstanding_ops;
+    // The number of outstanding ops for each iteration. It is atomic so that
+    // it can be updated with only a shared lock on the frame.
+    std::atomic<size_t> outstanding_ops;
 
     // The number of outstanding frames for each iteration.
     int outstanding_frame_count;
@@ -1014,6 +1057,12 @@ class ExecutorState {
       counts.adjust_for_activation(h, increment_dead, pending_result,
                                    dead_result);
     }
+    void adjust_for_activation_atomic(PendingCounts::Handle h,
+                                      bool increment_dead, int* pending_result,
+                                      int* dead_result) {
+      counts.adjust_for_activation_atomic(h, increment_dead, pending_result,
+                                          dead_result);
+    }
 
     ~IterationState() { delete[] input_tensors; }
 
@@ -1134,7 +1183,7 @@ class ExecutorState {
     }
 
     inline IterationState* GetIteration(int64 iter)
-        EXCLUSIVE_LOCKS_REQUIRED(mu) {
+        SHARED_LOCKS_REQUIRED(mu) {
       if (TF_PREDICT_TRUE(iter == 0)) {
         return iterations_first;
       } else {
@@ -1175,6 +1224,24 @@ class ExecutorState {
       }
     }
 
+    // Decrement the outstanding op count with only a shared lock, unless it
+    // would become zero, in which case the iteration may have to be cleaned up
+    // with the exclusive lock held. Returns true iff the count was
+    // decremented.
+    inline bool DecrementOutstandingOpsShared(int64 iter)
+        SHARED_LOCKS_REQUIRED(mu) {
+      std::atomic<size_t>& outstanding_ops =
+          GetIteration(iter)->outstanding_ops;
+      size_t count = outstanding_ops.load(std::memory_order_relaxed);
+      while (count > 1) {
+        if (outstanding_ops.compare_exchange_weak(count, count - 1,
+                                                  std::memory_order_relaxed)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
     // Returns true if the computation in the frame is completed.
     inline bool IsFrameDone() EXCLUSIVE_LOCKS_REQUIRED(mu) {
       return (num_pending_inputs == 0 && num_outstanding_iterations == 0);
@@ -1206,6 +1273,13 @@ class ExecutorState {
                        EntryVector* outputs, TaggedNodeSeq* ready)
         EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+    // The same as ActivateNodes, but with only a shared lock held, which is
+    // possible when none of the successors is a merge node. The pending counts
+    // and the outstanding op count are updated atomically.
+    void ActivateNodesShared(const NodeItem* item, const bool is_dead,
+                             int64 iter, EntryVector* outputs,
+                             TaggedNodeSeq* ready) SHARED_LOCKS_REQUIRED(mu);
+
     // Cleanup iterations of this frame starting from iteration iter.
     bool CleanupIterations(const GraphView* gview, int64 iter,
                            TaggedNodeSeq* ready) EXCLUSIVE_LOCKS_REQUIRED(mu);
@@ -1243,14 +1317,32 @@ class ExecutorState {
           is_dead(dead) {}
   };
 
+  // Whether `a` should run before `b` when prioritizing the critical path.
+  static bool HasHigherPriority(const TaggedNode& a, const TaggedNode& b) {
+    return a.node_item->priority > b.node_item->priority;
+  }
+
   // A drop-in replacement for std::deque<TaggedNode>.  We typically don't
   // have that many nodes in the ready queue, so we just use a vector and
   // don't free up memory from the queue as we consume nodes.
+  //
+  // When `by_priority` is true the queue is kept sorted by decreasing node
+  // priority instead, with nodes of equal priority in the order they were
+  // added.
   class TaggedNodeReadyQueue {
    public:
-    TaggedNodeReadyQueue() : front_index_(0) {}
-
-    void push_back(TaggedNode node) { ready_.push_back(node); }
+    explicit TaggedNodeReadyQueue(bool by_priority = false)
+        : front_index_(0), by_priority_(by_priority) {}
+
+    void push_back(TaggedNode node) {
+      if (by_priority_) {
+        ready_.insert(std::upper_bound(ready_.begin() + front_index_,
+                                       ready_.end(), node, HasHigherPriority),
+                      node);
+      } else {
+        ready_.push_back(node);
+      }
+    }
     TaggedNode front() const {
       DCHECK_LT(front_index_, ready_.size());
       return ready_[front_index_];
@@ -1276,6 +1368,7 @@ class ExecutorState {
    private:
     gtl::InlinedVector<TaggedNode, 16> ready_;
     int front_index_;
+    const bool by_priority_;
   };
 
   struct AsyncState;
@@ -1462,6 +1555,10 @@ ExecutorState::ExecutorState(const Executor::Args& args, ExecutorImpl* impl)
                             root_frame_->total_input_tensors));
 
   outstanding_frames_.insert({root_frame_->frame_name, root_frame_});
+
+  if (impl_->params_.memory_plan != nullptr) {
+    impl_->params_.memory_plan->StartStep();
+  }
 }
 
 ExecutorState::~ExecutorState() {
@@ -1472,6 +1569,11 @@ ExecutorState::~ExecutorState() {
     device_context_->Unref();
   }
   delete slice_reader_cache_;
+  // The tensors which are still live, such as the outputs of the step, are
+  // not planned.
+  if (impl_->params_.memory_plan != nullptr) {
+    impl_->params_.memory_plan->EndStep();
+  }
 }
 
 Status ExecutorImpl::BuildControlFlowInfo(const Graph* g,
@@ -1664,7 +1766,7 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_nsec) {
       2);
   WithContext wc(context_);
   TaggedNodeSeq ready;
-  TaggedNodeReadyQueue inline_ready;
+  TaggedNodeReadyQueue inline_ready(impl_->params_.prioritize_critical_path);
 
   // Parameters passed to OpKernel::Compute.
   TensorValueVec inputs;
@@ -1698,6 +1800,7 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_nsec) {
   params.input_alloc_attrs = &input_alloc_attrs;
   params.runner = &runner_;
   params.stats_collector = stats_collector_;
+  params.memory_plan = impl_->params_.memory_plan;
   params.inc_num_deferred_ops_function = [this]() {
     mutex_lock lock(num_deferred_ops_mu_);
     num_deferred_ops_++;
@@ -2150,10 +2253,24 @@ void ExecutorState::PropagateOutputs(const TaggedNode& tagged_node,
   FrameState* output_frame = input_frame;
   int64 output_iter = input_iter;
 
-  if (!item->is_enter_exit_or_next_iter) {
-    // Fast path for nodes types that don't need special handling
+  if (!item->is_enter_exit_or_next_iter && !item->is_any_consumer_merge) {
+    // Fast path for nodes types that don't need special handling, which only
+    // takes the frame lock exclusively when the iteration may be done.
+    DCHECK_EQ(input_frame, output_frame);
+    bool decremented;
+    {
+      tf_shared_lock l(input_frame->mu);
+      output_frame->ActivateNodesShared(item, is_dead, output_iter, outputs,
+                                        ready);
+      decremented = input_frame->DecrementOutstandingOpsShared(input_iter);
+    }
+    if (!decremented) {
+      is_frame_done = input_frame->DecrementOutstandingOps(&impl_->gview_,
+                                                           input_iter, ready);
+    }
+  } else if (!item->is_enter_exit_or_next_iter) {
+    // Nodes which activate merge nodes.
     DCHECK_EQ(input_frame, output_frame);
-    // Normal path for most nodes
     mutex_lock l(input_frame->mu);
     output_frame->ActivateNodes(item, is_dead, output_iter, outputs, ready);
     is_frame_done = input_frame->DecrementOutstandingOpsLocked(
@@ -2311,20 +2428,34 @@ void ExecutorState::ScheduleReady(const TaggedNodeSeq& ready,
     scheduled_nsec = nodestats::NowInNsec();
   }
 
+  // Dispatch the nodes on the longest paths first, and keep the most critical
+  // expensive node on this thread.
+  const bool by_priority = impl_->params_.prioritize_critical_path;
+  TaggedNodeSeq sorted;
+  if (by_priority && ready.size() > 1) {
+    sorted = ready;
+    std::stable_sort(sorted.begin(), sorted.end(), HasHigherPriority);
+  }
+  const TaggedNodeSeq& nodes = sorted.empty() ? ready : sorted;
+
   if (inline_ready == nullptr) {
     // Schedule to run all the ready ops in thread pool.
-    for (auto& tagged_node : ready) {
+    for (auto& tagged_node : nodes) {
       runner_([=]() { Process(tagged_node, scheduled_nsec); });
     }
     return;
   }
 
   const TaggedNode* curr_expensive_node = nullptr;
-  for (auto& tagged_node : ready) {
+  for (auto& tagged_node : nodes) {
     const NodeItem& item = *tagged_node.node_item;
     if (tagged_node.is_dead || !item.kernel->IsExpensive()) {
       // Inline this inexpensive node.
       inline_ready->push_back(tagged_node);
+    } else if (by_priority && curr_expensive_node) {
+      // A node with a higher priority is already kept for this thread.
+      runner_(std::bind(&ExecutorState::Process, this, tagged_node,
+                        scheduled_nsec));
     } else {
       if (curr_expensive_node) {
         // Dispatch to another thread since there is plenty of work to
@@ -2815,6 +2946,54 @@ void ExecutorState::FrameState::ActivateNodes(const NodeItem* item,
   }
 }
 
+void ExecutorState::FrameState::ActivateNodesShared(const NodeItem* item,
+                                                    const bool is_dead,
+                                                    int64 iter,
+                                                    EntryVector* outputs,
+                                                    TaggedNodeSeq* ready) {
+  const GraphView& gview = executor->gview_;
+  IterationState* iter_state = GetIteration(iter);
+  const size_t num_output_edges = item->num_output_edges;
+  const EdgeInfo* edges = item->output_edge_list();
+  Entry* input_tensors = iter_state->input_tensors;
+  size_t num_activated = 0;
+  for (size_t out_index = 0; out_index < num_output_edges; out_index++) {
+    const EdgeInfo& e = edges[out_index];
+    const NodeItem* dst_item = gview.node(e.dst_id);
+    if (dst_item->is_sink) continue;
+    DCHECK(!dst_item->is_merge);
+
+    const int src_slot = e.output_slot;
+    const bool is_control_edge = (src_slot == Graph::kControlSlot);
+    const bool increment_dead =
+        (is_dead || (!is_control_edge && !(*outputs)[src_slot].has_value));
+
+    // Set the input before decrementing the pending count, since another
+    // thread runs the node as soon as its count reaches zero.
+    if (!is_control_edge) {
+      const int dst_loc = dst_item->input_start + e.input_slot;
+      if (e.is_last) {
+        input_tensors[dst_loc] = std::move((*outputs)[src_slot]);
+      } else {
+        input_tensors[dst_loc] = (*outputs)[src_slot];
+      }
+    }
+
+    int pending, dead;
+    iter_state->adjust_for_activation_atomic(dst_item->pending_id,
+                                             increment_dead, &pending, &dead);
+    if (pending == 0) {
+      const bool dst_dead = (dead > 0) && !dst_item->is_control_trigger;
+      ready->emplace_back(dst_item, this, iter, dst_dead);
+      num_activated++;
+    }
+  }
+  if (num_activated > 0) {
+    iter_state->outstanding_ops.fetch_add(num_activated,
+                                          std::memory_order_relaxed);
+  }
+}
+
 void ExecutorState::FrameState::ActivateNexts(const GraphView* gview,
                                               int64 iter,
                                               TaggedNodeSeq* ready) {
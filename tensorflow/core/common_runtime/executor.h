@@ -31,6 +31,8 @@ limitations under the License.
 
 namespace tensorflow {
 
+class CostModel;
+class StaticMemoryPlan;
 class StepStatsCollector;
 
 // Executor runs a graph computation.
@@ -145,6 +147,22 @@ struct LocalExecutorParams {
   std::function<void(OpKernel*)> delete_kernel;
 
   Executor::RendezvousFactory rendezvous_factory;
+
+  // If true, ready nodes are run in decreasing order of the length of the
+  // longest path from them to the end of the graph, rather than in the order
+  // they became ready. This keeps the critical path of wide graphs from being
+  // delayed behind nodes which are not on it.
+  bool prioritize_critical_path = false;
+
+  // Optional execution time estimates used to weight the paths when
+  // prioritizing the critical path. Without it every node counts as one unit
+  // of time. Not owned, and only used while the executor is created.
+  const CostModel* cost_model = nullptr;
+
+  // Optional plan from which the tensors allocated by the kernels are served
+  // once the first steps have been recorded. Not owned, and must outlive the
+  // executor.
+  StaticMemoryPlan* memory_plan = nullptr;
 };
 ::tensorflow::Status NewLocalExecutor(const LocalExecutorParams& params,
                                       const Graph& graph, Executor** executor);
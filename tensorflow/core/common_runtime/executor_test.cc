@@ -26,7 +26,9 @@ limitations under the License.
 #include "tensorflow/core/framework/rendezvous.h"
 #include "tensorflow/core/framework/step_stats.pb.h"
 #include "tensorflow/core/framework/versions.pb.h"
+#include "tensorflow/core/graph/costmodel.h"
 #include "tensorflow/core/graph/graph_constructor.h"
+#include "tensorflow/core/graph/node_builder.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/lib/strings/strcat.h"
@@ -76,6 +78,8 @@ class ExecutorTest : public ::testing::Test {
       rendez_->Ref();
       return Status::OK();
     };
+    params.prioritize_critical_path = prioritize_critical_path_;
+    params.cost_model = cost_model_;
     delete exec_;
     TF_CHECK_OK(NewLocalExecutor(params, *graph, &exec_));
     runner_ = [this](std::function<void()> fn) { thread_pool_->Schedule(fn); };
@@ -96,6 +100,8 @@ class ExecutorTest : public ::testing::Test {
   StepStats step_stats_;
   Executor::Args::Runner runner_;
   Rendezvous* rendez_ = nullptr;
+  bool prioritize_critical_path_ = false;
+  const CostModel* cost_model_ = nullptr;
 };
 
 // A float val -> Tensor<float>
@@ -250,6 +256,107 @@ TEST_F(ExecutorTest, RandomTree) {
   EXPECT_EQ(4096.0, V(out));
 }
 
+TEST_F(ExecutorTest, RandomTreeCriticalPath) {
+  auto g = absl::make_unique<Graph>(OpRegistry::Global());
+  BuildTree(4096, g.get());
+  prioritize_critical_path_ = true;
+  Create(std::move(g));
+  Rendezvous::Args args;
+  TF_ASSERT_OK(
+      rendez_->Send(Key(ALICE, kIncarnation, BOB, "a"), args, V(1.0), false));
+  TF_ASSERT_OK(Run(rendez_));
+  Tensor out = V(-1);
+  bool is_dead = false;
+  TF_ASSERT_OK(
+      rendez_->Recv(Key(BOB, kIncarnation, ALICE, "b"), args, &out, &is_dead));
+  EXPECT_EQ(4096.0, V(out));
+}
+
+TEST_F(ExecutorTest, RandomTreeCriticalPathWithCostModel) {
+  auto g = absl::make_unique<Graph>(OpRegistry::Global());
+  BuildTree(4096, g.get());
+  CostModel cost_model(/*is_global=*/false);
+  cost_model.InitFromGraph(*g);
+  for (const Node* n : g->op_nodes()) {
+    cost_model.RecordCount(n, 1);
+    cost_model.RecordTime(n, Microseconds(1 + n->id() % 7));
+  }
+  prioritize_critical_path_ = true;
+  cost_model_ = &cost_model;
+  Create(std::move(g));
+  Rendezvous::Args args;
+  TF_ASSERT_OK(
+      rendez_->Send(Key(ALICE, kIncarnation, BOB, "a"), args, V(1.0), false));
+  TF_ASSERT_OK(Run(rendez_));
+  Tensor out = V(-1);
+  bool is_dead = false;
+  TF_ASSERT_OK(
+      rendez_->Recv(Key(BOB, kIncarnation, ALICE, "b"), args, &out, &is_dead));
+  EXPECT_EQ(4096.0, V(out));
+}
+
+// A constant c feeding a single identity a1 and a chain of identities b1, b2,
+// b3. With every node costing one unit, the longest paths to the end of the
+// graph give c, b1, b2, a1 and b3 the priorities 4, 3, 2, 1 and 1. Returns the
+// node names in that order.
+std::vector<string> BuildChains(Graph* g) {
+  Node* c = test::graph::Constant(g, V(1.0));
+  Node* a1 = test::graph::Identity(g, c);
+  Node* b1 = test::graph::Identity(g, c);
+  Node* b2 = test::graph::Identity(g, b1);
+  Node* b3 = test::graph::Identity(g, b2);
+  return {c->name(), b1->name(), b2->name(), a1->name(), b3->name()};
+}
+
+// The given nodes in the order they were run. As they are all inexpensive
+// they run one after the other from the ready queue of a single thread.
+std::vector<string> RunOrder(StepStatsCollector* collector,
+                             StepStats* step_stats,
+                             const std::vector<string>& names) {
+  collector->Finalize();
+  std::vector<string> order;
+  for (const DeviceStepStats& dev_stats : step_stats->dev_stats()) {
+    for (const NodeExecStats& node_stats : dev_stats.node_stats()) {
+      if (std::find(names.begin(), names.end(), node_stats.node_name()) !=
+          names.end()) {
+        order.push_back(node_stats.node_name());
+      }
+    }
+  }
+  return order;
+}
+
+TEST_F(ExecutorTest, CriticalPathOrder) {
+  auto g = absl::make_unique<Graph>(OpRegistry::Global());
+  const std::vector<string> names = BuildChains(g.get());
+  prioritize_critical_path_ = true;
+  Create(std::move(g));
+  TF_ASSERT_OK(Run(rendez_));
+  // b2 is queued after a1 but runs before it, while a1 and b3 have the same
+  // priority and run in the order they became ready.
+  EXPECT_EQ(RunOrder(&step_stats_collector_, &step_stats_, names), names);
+}
+
+TEST_F(ExecutorTest, CriticalPathOrderWithCostModel) {
+  auto g = absl::make_unique<Graph>(OpRegistry::Global());
+  const std::vector<string> names = BuildChains(g.get());
+  const string& a1 = names[3];
+  // With a1 taking 10us, its path is the longest: c and a1 have the priorities
+  // 11 and 10, and the chain keeps 3, 2 and 1.
+  CostModel cost_model(/*is_global=*/false);
+  cost_model.InitFromGraph(*g);
+  for (const Node* n : g->op_nodes()) {
+    cost_model.RecordCount(n, 1);
+    cost_model.RecordTime(n, Microseconds(n->name() == a1 ? 10 : 1));
+  }
+  prioritize_critical_path_ = true;
+  cost_model_ = &cost_model;
+  Create(std::move(g));
+  TF_ASSERT_OK(Run(rendez_));
+  EXPECT_EQ(RunOrder(&step_stats_collector_, &step_stats_, names),
+            std::vector<string>({names[0], a1, names[1], names[2], names[4]}));
+}
+
 void BuildConcurrentAddAssign(Graph* g) {
   auto one = test::graph::Constant(g, V(1.0));
   // A variable holds one float.
@@ -470,6 +577,69 @@ BENCHMARK(BM_executor)->ArgPair(8192, 32);
 // Tall fat graph
 BENCHMARK(BM_executor)->ArgPair(1024, 1024);
 
+// Create a while loop which runs 'num_iterations' times, whose body has
+// 'width' independent nodes, and run it with 'inter_op_threads' threads. All
+// the nodes of the body activate each other in the same frame, so this
+// measures the contention on it. The body nodes are small MatMuls, which are
+// expensive kernels, so that they are spread across the inter-op threads
+// rather than run inline by the thread which made them ready.
+static void BM_WideLoopBody(int iters, int inter_op_threads) {
+  const int width = 256;
+  const int num_iterations = 64;
+#ifdef PLATFORM_GOOGLE
+  BenchmarkUseRealTime();
+#endif  // PLATFORM_GOOGLE
+  Graph* g = new Graph(OpRegistry::Global());
+  auto constant_enter = [g](const Tensor& value) {
+    Node* enter;
+    TF_CHECK_OK(NodeBuilder(g->NewName("n"), "Enter")
+                    .Input(test::graph::Constant(g, value))
+                    .Attr("frame_name", "loop")
+                    .Attr("is_constant", true)
+                    .Finalize(g, &enter));
+    return enter;
+  };
+  Node* enter = test::graph::Enter(g, test::graph::Constant(g, VI(0)), "loop");
+  Node* merge = test::graph::Merge(g, enter, {"next"});
+  Node* cond = test::graph::LoopCond(
+      g, test::graph::Less(g, merge, constant_enter(VI(num_iterations))));
+  Node* sw = test::graph::Switch(g, merge, cond);
+  test::graph::Exit(g, sw);
+  Node* body = test::graph::Identity(g, sw, 1);
+  Tensor matrix(DT_FLOAT, TensorShape({16, 16}));
+  matrix.flat<float>().setRandom();
+  Node* matrix_enter = constant_enter(matrix);
+  std::vector<Node*> wide_nodes;
+  for (int i = 0; i < width; ++i) {
+    Node* matmul = test::graph::Matmul(g, matrix_enter, matrix_enter,
+                                       /*transpose_a=*/false,
+                                       /*transpose_b=*/false);
+    // Run the loop invariant MatMul again in every iteration.
+    g->AddControlEdge(body, matmul);
+    wide_nodes.push_back(matmul);
+  }
+  Node* increment = test::graph::Add(g, body, constant_enter(VI(1)));
+  g->AddControlEdge(test::graph::NoOp(g, wide_nodes), increment);
+  Node* next = test::graph::Next(g, "next", increment);
+  g->AddEdge(next, 0, merge, 1);
+
+  SessionOptions options;
+  options.config.set_inter_op_parallelism_threads(inter_op_threads);
+#ifdef PLATFORM_GOOGLE
+  SetBenchmarkItemsProcessed(static_cast<int64>(iters) * num_iterations *
+                             width);
+#endif  // PLATFORM_GOOGLE
+  test::Benchmark("cpu", g, &options).Run(iters);
+}
+BENCHMARK(BM_WideLoopBody)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->Arg(16)
+    ->Arg(32)
+    ->Arg(64);
+
 static void BM_FeedInputFetchOutput(int iters) {
   Graph* g = new Graph(OpRegistry::Global());
   // z = x + y: x and y are provided as benchmark inputs.  z is the
@@ -16,6 +16,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <atomic>
+
 #include "tensorflow/core/lib/gtl/flatmap.h"
 #include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/platform/logging.h"
@@ -226,6 +228,20 @@ class PendingCounts {
     }
   }
 
+  // The same as adjust_for_activation, but safe to call from several threads
+  // at once for the same handle. None of the other methods may be called
+  // concurrently with it.
+  void adjust_for_activation_atomic(Handle h, bool increment_dead,
+                                    int* pending_result, int* dead_result) {
+    if (h.is_large_) {
+      adjust_for_activation_shared_atomic(LargeAtomic(h), increment_dead,
+                                          pending_result, dead_result);
+    } else {
+      adjust_for_activation_shared_atomic(PackedAtomic(h), increment_dead,
+                                          pending_result, dead_result);
+    }
+  }
+
   class Handle {
    public:
     Handle() : byte_offset_(0), is_large_(0) {}
@@ -251,6 +267,29 @@ class PendingCounts {
     *pending_result = c->pending;
   }
 
+  template <typename T>
+  inline void adjust_for_activation_shared_atomic(std::atomic<T>* c,
+                                                  bool increment_dead,
+                                                  int* pending_result,
+                                                  int* dead_result) {
+    T old_counts = c->load(std::memory_order_relaxed);
+    T new_counts;
+    do {
+      new_counts = old_counts;
+      if (increment_dead &&
+          PENDING_NOTREADY == NodeStateForStruct(&new_counts)) {
+        new_counts.dead_count++;
+      }
+      new_counts.pending -= 1;
+      // Acquire and release, so that the inputs written by the other threads
+      // activating the node are visible to the thread which runs it.
+    } while (!c->compare_exchange_weak(old_counts, new_counts,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_relaxed));
+    *dead_result = new_counts.dead_count;
+    *pending_result = new_counts.pending;
+  }
+
   // We keep track of the pending count and dead input count for each
   // graph node.  The representation used here is designed to be cache
   // efficient for graphs with large numbers of nodes, where most
@@ -273,11 +312,13 @@ class PendingCounts {
     uint8 has_started : 1;
   };
 
-  struct LargeCounts {
+  // Aligned to its size so that it can be updated atomically.
+  struct alignas(8) LargeCounts {
     uint32 pending;
     uint32 dead_count : 31;
-    uint8 has_started : 1;
+    uint32 has_started : 1;
   };
+  static_assert(sizeof(LargeCounts) == 8, "LargeCounts must fit in 64 bits");
 
   template <typename T>
   NodeState NodeStateForStruct(T* c) const {
@@ -298,6 +339,16 @@ class PendingCounts {
     DCHECK_LE(h.byte_offset_ + sizeof(PackedCounts), num_bytes_);
     return reinterpret_cast<PackedCounts*>(bytes_ + h.byte_offset_);
   }
+  inline std::atomic<LargeCounts>* LargeAtomic(Handle h) {
+    static_assert(sizeof(std::atomic<LargeCounts>) == sizeof(LargeCounts),
+                  "std::atomic<LargeCounts> must have the same size");
+    return reinterpret_cast<std::atomic<LargeCounts>*>(Large(h));
+  }
+  inline std::atomic<PackedCounts>* PackedAtomic(Handle h) {
+    static_assert(sizeof(std::atomic<PackedCounts>) == sizeof(PackedCounts),
+                  "std::atomic<PackedCounts> must have the same size");
+    return reinterpret_cast<std::atomic<PackedCounts>*>(Packed(h));
+  }
 
   const int num_bytes_;  // Just for bounds checking in debug mode
   char* bytes_;          // Array of num_bytes_ bytes
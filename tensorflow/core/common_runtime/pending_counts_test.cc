@@ -13,10 +13,13 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 
 #include "tensorflow/core/common_runtime/pending_counts.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/test.h"
 
 namespace tensorflow {
@@ -166,4 +169,69 @@ TEST(PendingCounts, AdjustForActivation) {
   }
 }
 
+TEST(PendingCounts, AdjustForActivationAtomic) {
+  PendingCounts::Layout layout;
+  PendingCounts::Handle handles[2];
+  handles[0] = layout.CreateHandle(5, 4);
+  handles[1] = layout.CreateHandle(15, 4);
+  for (int id = 0; id < 2; id++) {
+    PendingCounts::Handle h = handles[id];
+    // Test for both packed and large.
+    int count = (id == 0) ? 5 : 15;
+    int pending, dead;
+
+    PendingCounts c(layout);
+    c.set_initial_count(h, count);
+
+    c.adjust_for_activation_atomic(h, false, &pending, &dead);
+    EXPECT_EQ(c.pending(h), count - 1);
+    EXPECT_EQ(c.pending(h), pending);
+    EXPECT_EQ(c.dead_count(h), 0);
+    EXPECT_EQ(c.dead_count(h), dead);
+
+    c.adjust_for_activation_atomic(h, true, &pending, &dead);
+    EXPECT_EQ(c.pending(h), count - 2);
+    EXPECT_EQ(c.pending(h), pending);
+    EXPECT_EQ(c.dead_count(h), dead);
+    EXPECT_EQ(c.dead_count(h), 1);
+  }
+}
+
+TEST(PendingCounts, AdjustForActivationAtomicConcurrently) {
+  const int kNumThreads = 4;
+  const int kCount = 1000;
+  PendingCounts::Layout layout;
+  // A large and a packed count next to each other.
+  PendingCounts::Handle large = layout.CreateHandle(kCount, kNumThreads);
+  PendingCounts::Handle packed = layout.CreateHandle(kNumThreads, 0);
+  PendingCounts c(layout);
+  c.set_initial_count(large, kCount);
+  c.set_initial_count(packed, kNumThreads);
+
+  std::atomic<int> num_ready(0);
+  {
+    thread::ThreadPool pool(Env::Default(), "test", kNumThreads);
+    for (int t = 0; t < kNumThreads; ++t) {
+      pool.Schedule([&c, &num_ready, large, packed, t]() {
+        int pending, dead;
+        for (int i = t; i < kCount; i += kNumThreads) {
+          c.adjust_for_activation_atomic(large, i == 0, &pending, &dead);
+          if (pending == 0) {
+            num_ready++;
+          }
+        }
+        c.adjust_for_activation_atomic(packed, false, &pending, &dead);
+        if (pending == 0) {
+          num_ready++;
+        }
+      });
+    }
+  }
+  // Exactly one thread saw each count reach zero.
+  EXPECT_EQ(num_ready, 2);
+  EXPECT_EQ(c.node_state(large), PendingCounts::PENDING_READY);
+  EXPECT_EQ(c.dead_count(large), 1);
+  EXPECT_EQ(c.node_state(packed), PendingCounts::PENDING_READY);
+}
+
 }  // namespace tensorflow
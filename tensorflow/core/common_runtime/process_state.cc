@@ -90,10 +90,22 @@ Allocator* ProcessState::GetCPUAllocator(int numa_node) {
         LOG(ERROR) << "GetCPUAllocator: " << status.error_message();
       }
       int64 cpu_mem_limit = cpu_mem_limit_in_mb * (1LL << 20);
+      // Small buffers freed by each group of threads can be kept for reuse
+      // without taking the allocator lock.
+      int64 front_cache_in_kb = 0;
+      status = ReadInt64FromEnvVar("TF_CPU_BFC_FRONT_CACHE_IN_KB", 0,
+                                   &front_cache_in_kb);
+      if (!status.ok()) {
+        LOG(ERROR) << "GetCPUAllocator: " << status.error_message();
+      }
       DCHECK(sub_allocator);
-      allocator =
+      BFCAllocator* bfc_allocator =
           new BFCAllocator(sub_allocator, cpu_mem_limit, true /*allow_growth*/,
                            "bfc_cpu_allocator_for_gpu" /*name*/);
+      if (front_cache_in_kb > 0) {
+        bfc_allocator->SetFrontCacheBytes(front_cache_in_kb * (1LL << 10));
+      }
+      allocator = bfc_allocator;
       VLOG(2) << "Using BFCAllocator with memory limit of "
               << cpu_mem_limit_in_mb << " MB for ProcessState CPU allocator";
     } else if (sub_allocator) {
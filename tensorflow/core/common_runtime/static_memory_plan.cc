@@ -0,0 +1,304 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/static_memory_plan.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+
+// The allocator of one planned buffer, which is returned to the kernel in
+// place of the device allocator.
+class StaticMemoryPlan::BufferAllocator : public Allocator {
+ public:
+  explicit BufferAllocator(StaticMemoryPlan* plan) : plan_(plan) {}
+
+  string Name() override { return plan_->allocator_->Name(); }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override {
+    return plan_->Allocate(this, alignment, num_bytes, AllocationAttributes());
+  }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes,
+                    const AllocationAttributes& allocation_attr) override {
+    return plan_->Allocate(this, alignment, num_bytes, allocation_attr);
+  }
+
+  void DeallocateRaw(void* ptr) override { plan_->Deallocate(this, ptr); }
+
+ private:
+  friend class StaticMemoryPlan;
+
+  StaticMemoryPlan* const plan_;
+
+  // Set when the plan is computed.
+  bool planned_ = false;
+  size_t offset_ = 0;
+  size_t size_ = 0;
+  // The planned buffers which overlap this one in the arena.
+  std::vector<BufferAllocator*> conflicts_;
+
+  // Whether the planned buffer holds a tensor.
+  std::atomic<bool> in_use_{false};
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BufferAllocator);
+};
+
+StaticMemoryPlan::StaticMemoryPlan(Allocator* allocator,
+                                   int num_recorded_steps)
+    : allocator_(allocator), num_recorded_steps_(num_recorded_steps) {}
+
+StaticMemoryPlan::~StaticMemoryPlan() {
+  if (arena_ != nullptr) {
+    allocator_->DeallocateRaw(arena_);
+  }
+}
+
+Allocator* StaticMemoryPlan::GetAllocator(const OpKernel* kernel, int index,
+                                          Allocator* allocator) {
+  if (allocator != allocator_) {
+    return allocator;
+  }
+  const BufferKey key(kernel, index);
+  if (!planned()) {
+    mutex_lock l(mu_);
+    // The buffers are only added while recording, as they are read without
+    // the lock once planned.
+    if (!planned()) {
+      std::unique_ptr<BufferAllocator>& buffer = buffers_[key];
+      if (buffer == nullptr) {
+        buffer.reset(new BufferAllocator(this));
+      }
+      return buffer.get();
+    }
+  }
+  auto it = buffers_.find(key);
+  if (it == buffers_.end() || !it->second->planned_) {
+    return allocator;
+  }
+  return it->second.get();
+}
+
+void StaticMemoryPlan::StartStep() {
+  if (planned()) {
+    return;
+  }
+  mutex_lock l(mu_);
+  if (num_active_steps_++ > 0) {
+    recording_overlapped_ |= recording_;
+    return;
+  }
+  if (planned()) {
+    return;
+  }
+  recording_ = true;
+  recording_overlapped_ = false;
+  clock_ = 0;
+}
+
+void StaticMemoryPlan::EndStep() {
+  if (planned()) {
+    return;
+  }
+  mutex_lock l(mu_);
+  if (--num_active_steps_ > 0 || !recording_) {
+    return;
+  }
+  recording_ = false;
+  if (!recording_overlapped_) {
+    for (const auto& entry : step_intervals_) {
+      auto it = intervals_.find(entry.first);
+      if (it == intervals_.end()) {
+        intervals_.insert(entry);
+        continue;
+      }
+      Interval& interval = it->second;
+      interval.start = std::min(interval.start, entry.second.start);
+      interval.end = std::max(interval.end, entry.second.end);
+      interval.size = std::max(interval.size, entry.second.size);
+    }
+    for (const auto& entry : live_) {
+      escaped_.insert(entry.second.buffer);
+    }
+    ++num_completed_recordings_;
+  }
+  live_.clear();
+  step_intervals_.clear();
+  if (num_completed_recordings_ >= num_recorded_steps_) {
+    Plan();
+  }
+}
+
+void StaticMemoryPlan::Plan() {
+  std::vector<std::pair<BufferAllocator*, Interval>> buffers;
+  for (const auto& entry : intervals_) {
+    if (!escaped_.contains(entry.first)) {
+      buffers.push_back(entry);
+    }
+  }
+  // Place the largest buffers first, as the heap simulator does.
+  std::sort(buffers.begin(), buffers.end(),
+            [](const std::pair<BufferAllocator*, Interval>& a,
+               const std::pair<BufferAllocator*, Interval>& b) {
+              if (a.second.size != b.second.size) {
+                return a.second.size > b.second.size;
+              }
+              return a.second.start < b.second.start;
+            });
+
+  size_t total_bytes = 0;
+  for (int i = 0; i < buffers.size(); ++i) {
+    BufferAllocator* buffer = buffers[i].first;
+    const Interval& interval = buffers[i].second;
+    const size_t size =
+        (interval.size + Allocator::kAllocatorAlignment - 1) /
+        Allocator::kAllocatorAlignment * Allocator::kAllocatorAlignment;
+    total_bytes += size;
+
+    // The ranges of the placed buffers which are live at the same time.
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (int j = 0; j < i; ++j) {
+      const Interval& other = buffers[j].second;
+      if (other.start <= interval.end && interval.start <= other.end) {
+        BufferAllocator* placed = buffers[j].first;
+        ranges.emplace_back(placed->offset_, placed->offset_ + placed->size_);
+      }
+    }
+    std::sort(ranges.begin(), ranges.end());
+
+    // Use the smallest gap between them which fits, or else the end.
+    size_t best_offset = 0;
+    size_t best_gap = std::numeric_limits<size_t>::max();
+    size_t offset = 0;
+    for (const auto& range : ranges) {
+      if (range.first > offset) {
+        const size_t gap = range.first - offset;
+        if (gap >= size && gap < best_gap) {
+          best_offset = offset;
+          best_gap = gap;
+        }
+      }
+      offset = std::max(offset, range.second);
+    }
+    buffer->offset_ =
+        best_gap == std::numeric_limits<size_t>::max() ? offset : best_offset;
+    buffer->size_ = size;
+    arena_bytes_ = std::max(arena_bytes_, buffer->offset_ + size);
+  }
+
+  if (arena_bytes_ > 0) {
+    arena_ = static_cast<char*>(
+        allocator_->AllocateRaw(Allocator::kAllocatorAlignment, arena_bytes_));
+    if (arena_ == nullptr) {
+      LOG(WARNING) << "Could not allocate an arena of "
+                   << strings::HumanReadableNumBytes(arena_bytes_)
+                   << " for the static memory plan";
+      buffers.clear();
+      arena_bytes_ = 0;
+    }
+  }
+
+  for (int i = 0; i < buffers.size(); ++i) {
+    BufferAllocator* a = buffers[i].first;
+    a->planned_ = true;
+    for (int j = i + 1; j < buffers.size(); ++j) {
+      BufferAllocator* b = buffers[j].first;
+      if (a->offset_ < b->offset_ + b->size_ &&
+          b->offset_ < a->offset_ + a->size_) {
+        a->conflicts_.push_back(b);
+        b->conflicts_.push_back(a);
+      }
+    }
+  }
+  VLOG(1) << "Planned " << buffers.size() << " buffers of "
+          << strings::HumanReadableNumBytes(total_bytes) << " in an arena of "
+          << strings::HumanReadableNumBytes(arena_bytes_);
+
+  intervals_.clear();
+  escaped_.clear();
+  planned_.store(true, std::memory_order_release);
+}
+
+bool StaticMemoryPlan::Claim(BufferAllocator* buffer) {
+  // Both the flag of the buffer and those of its conflicts are accessed with
+  // sequentially consistent operations, so two buffers which overlap cannot
+  // both see the other as free.
+  if (buffer->in_use_.exchange(true)) {
+    return false;
+  }
+  for (BufferAllocator* other : buffer->conflicts_) {
+    if (other->in_use_.load()) {
+      buffer->in_use_.store(false);
+      return false;
+    }
+  }
+  return true;
+}
+
+void* StaticMemoryPlan::Allocate(BufferAllocator* buffer, size_t alignment,
+                                 size_t num_bytes,
+                                 const AllocationAttributes& allocation_attr) {
+  const bool is_planned = planned();
+  if (is_planned && buffer->planned_ && num_bytes <= buffer->size_ &&
+      alignment <= Allocator::kAllocatorAlignment && Claim(buffer)) {
+    Ref();
+    return arena_ + buffer->offset_;
+  }
+  void* ptr = allocator_->AllocateRaw(alignment, num_bytes, allocation_attr);
+  if (ptr == nullptr) {
+    return nullptr;
+  }
+  Ref();
+  if (!is_planned) {
+    mutex_lock l(mu_);
+    if (recording_) {
+      live_[ptr] = {buffer, clock_++, num_bytes};
+    }
+  }
+  return ptr;
+}
+
+void StaticMemoryPlan::Deallocate(BufferAllocator* buffer, void* ptr) {
+  if (InArena(ptr)) {
+    buffer->in_use_.store(false);
+  } else {
+    if (!planned()) {
+      // Recorded before the memory is freed, as it may then be allocated
+      // again by another thread.
+      mutex_lock l(mu_);
+      auto it = live_.find(ptr);
+      if (it != live_.end()) {
+        const LiveAllocation& allocation = it->second;
+        auto inserted = step_intervals_.insert(
+            {buffer, {allocation.start, clock_++, allocation.size}});
+        if (!inserted.second) {
+          // The kernel ran more than once in the step.
+          Interval& interval = inserted.first->second;
+          interval.end = clock_ - 1;
+          interval.size = std::max(interval.size, allocation.size);
+        }
+        live_.erase(it);
+      }
+    }
+    allocator_->DeallocateRaw(ptr);
+  }
+  Unref();
+}
+
+}  // namespace tensorflow
@@ -0,0 +1,138 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_COMMON_RUNTIME_STATIC_MEMORY_PLAN_H_
+#define TENSORFLOW_CORE_COMMON_RUNTIME_STATIC_MEMORY_PLAN_H_
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+
+// Serves the tensors allocated by the kernels of an executor from a single
+// arena, at offsets planned from the allocations of its first steps.
+//
+// The first 'num_recorded_steps' steps which do not overlap with any other
+// step are recorded. Each tensor is identified by its kernel and by the order
+// in which the kernel allocated it, and its lifetime is measured in allocation
+// and deallocation events since the start of the step. The tensors which were
+// freed within each recorded step are then given offsets in the arena with a
+// best-fit heap simulation, in decreasing order of size, so that tensors whose
+// lifetimes overlapped do not overlap in memory.
+//
+// Later steps may run in a different order, overlap with each other or change
+// shapes, so a planned buffer is only used if it is large enough and no buffer
+// overlapping it in memory is in use. Other allocations fall back to the
+// device allocator.
+//
+// The plan is reference counted, and each outstanding allocation holds a
+// reference so that tensors may outlive the executor.
+class StaticMemoryPlan : public StepMemoryPlanInterface,
+                         public core::RefCounted {
+ public:
+  // Plans the allocations made from 'allocator', which must outlive the plan.
+  StaticMemoryPlan(Allocator* allocator, int num_recorded_steps);
+  ~StaticMemoryPlan() override;
+
+  Allocator* GetAllocator(const OpKernel* kernel, int index,
+                          Allocator* allocator) override;
+
+  // Must be called by the executor at the start and the end of each step.
+  void StartStep();
+  void EndStep();
+
+  // Whether the plan has been computed.
+  bool planned() const { return planned_.load(std::memory_order_acquire); }
+
+  // The size of the arena, once planned.
+  size_t arena_bytes() const { return arena_bytes_; }
+
+  // Whether 'ptr' was served from the arena.
+  bool InArena(const void* ptr) const {
+    return planned() && ptr >= arena_ && ptr < arena_ + arena_bytes_;
+  }
+
+ private:
+  class BufferAllocator;
+  typedef std::pair<const OpKernel*, int> BufferKey;
+
+  // The lifetime and size of a buffer within a step.
+  struct Interval {
+    int64 start = 0;
+    int64 end = 0;
+    size_t size = 0;
+  };
+
+  // An allocation made while recording a step.
+  struct LiveAllocation {
+    BufferAllocator* buffer;
+    int64 start;
+    size_t size;
+  };
+
+  void* Allocate(BufferAllocator* buffer, size_t alignment, size_t num_bytes,
+                 const AllocationAttributes& allocation_attr);
+  void Deallocate(BufferAllocator* buffer, void* ptr);
+
+  // Assigns the offsets of the recorded buffers and allocates the arena.
+  void Plan() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Marks 'buffer' as in use if no buffer overlapping it in the arena is.
+  bool Claim(BufferAllocator* buffer);
+
+  Allocator* const allocator_;
+  const int num_recorded_steps_;
+
+  std::atomic<bool> planned_{false};
+  char* arena_ = nullptr;
+  size_t arena_bytes_ = 0;
+
+  mutex mu_;
+  // Only modified before the plan is computed.
+  absl::flat_hash_map<BufferKey, std::unique_ptr<BufferAllocator>> buffers_;
+  int num_active_steps_ GUARDED_BY(mu_) = 0;
+  int num_completed_recordings_ GUARDED_BY(mu_) = 0;
+
+  // The state of the step being recorded, if any.
+  bool recording_ GUARDED_BY(mu_) = false;
+  bool recording_overlapped_ GUARDED_BY(mu_) = false;
+  int64 clock_ GUARDED_BY(mu_) = 0;
+  absl::flat_hash_map<void*, LiveAllocation> live_ GUARDED_BY(mu_);
+  absl::flat_hash_map<BufferAllocator*, Interval> step_intervals_
+      GUARDED_BY(mu_);
+
+  // The union of the intervals of each buffer over the recorded steps. Buffers
+  // which were still live at the end of a step are not planned.
+  absl::flat_hash_map<BufferAllocator*, Interval> intervals_ GUARDED_BY(mu_);
+  absl::flat_hash_set<BufferAllocator*> escaped_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(StaticMemoryPlan);
+};
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_COMMON_RUNTIME_STATIC_MEMORY_PLAN_H_
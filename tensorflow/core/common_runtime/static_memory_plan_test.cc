@@ -0,0 +1,142 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/static_memory_plan.h"
+
+#include <unordered_map>
+
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace {
+
+// The kernels are only used as keys by the plan.
+const OpKernel* Kernel(intptr_t i) {
+  return reinterpret_cast<const OpKernel*>(i);
+}
+
+class StaticMemoryPlanTest : public ::testing::Test {
+ protected:
+  StaticMemoryPlanTest() : plan_(new StaticMemoryPlan(cpu_allocator(), 1)) {}
+
+  void* Allocate(int kernel, size_t num_bytes) {
+    Allocator* a = plan_->GetAllocator(Kernel(kernel), 0, cpu_allocator());
+    void* ptr = a->AllocateRaw(Allocator::kAllocatorAlignment, num_bytes);
+    allocators_[ptr] = a;
+    return ptr;
+  }
+
+  void Deallocate(void* ptr) {
+    allocators_[ptr]->DeallocateRaw(ptr);
+    allocators_.erase(ptr);
+  }
+
+  // Records a step in which the tensor of kernel 2 is live at the same time
+  // as those of kernels 1 and 3, which are not live at the same time.
+  void RecordStep() {
+    plan_->StartStep();
+    void* a = Allocate(1, 1000);
+    void* b = Allocate(2, 1000);
+    Deallocate(a);
+    void* c = Allocate(3, 2000);
+    Deallocate(b);
+    Deallocate(c);
+    plan_->EndStep();
+  }
+
+  core::RefCountPtr<StaticMemoryPlan> plan_;
+  std::unordered_map<void*, Allocator*> allocators_;
+};
+
+TEST_F(StaticMemoryPlanTest, PlansNonOverlappingBuffers) {
+  EXPECT_FALSE(plan_->planned());
+  RecordStep();
+  ASSERT_TRUE(plan_->planned());
+  // The tensors of kernels 1 and 3 share memory.
+  EXPECT_EQ(plan_->arena_bytes(), 3072);
+
+  plan_->StartStep();
+  void* a = Allocate(1, 1000);
+  void* b = Allocate(2, 1000);
+  EXPECT_NE(a, b);
+  Deallocate(a);
+  void* c = Allocate(3, 2000);
+  EXPECT_EQ(a, c);
+  Deallocate(b);
+  Deallocate(c);
+  plan_->EndStep();
+}
+
+TEST_F(StaticMemoryPlanTest, FallsBackWhenBuffersOverlap) {
+  RecordStep();
+  ASSERT_TRUE(plan_->planned());
+
+  // Kernel 3 runs before kernel 1 is done, so it cannot use its buffer.
+  void* a = Allocate(1, 1000);
+  void* c = Allocate(3, 2000);
+  EXPECT_NE(a, c);
+  Deallocate(c);
+  Deallocate(a);
+
+  // Once the buffer is free again it is reused.
+  void* c2 = Allocate(3, 2000);
+  EXPECT_EQ(a, c2);
+  Deallocate(c2);
+}
+
+TEST_F(StaticMemoryPlanTest, FallsBackForLargerTensors) {
+  RecordStep();
+  ASSERT_TRUE(plan_->planned());
+
+  void* a = Allocate(1, 1000);
+  Deallocate(a);
+  void* large = Allocate(1, 4000);
+  EXPECT_NE(a, large);
+  Deallocate(large);
+}
+
+TEST_F(StaticMemoryPlanTest, DoesNotPlanOutputs) {
+  plan_->StartStep();
+  void* output = Allocate(1, 1000);
+  void* temp = Allocate(2, 1000);
+  Deallocate(temp);
+  plan_->EndStep();
+  ASSERT_TRUE(plan_->planned());
+  EXPECT_EQ(plan_->arena_bytes(), 1024);
+
+  // Tensors which outlive the step are allocated by the device allocator.
+  EXPECT_EQ(plan_->GetAllocator(Kernel(1), 0, cpu_allocator()),
+            cpu_allocator());
+  EXPECT_NE(plan_->GetAllocator(Kernel(2), 0, cpu_allocator()),
+            cpu_allocator());
+  Deallocate(output);
+}
+
+TEST_F(StaticMemoryPlanTest, IgnoresOverlappingSteps) {
+  plan_->StartStep();
+  plan_->StartStep();
+  void* a = Allocate(1, 1000);
+  Deallocate(a);
+  plan_->EndStep();
+  plan_->EndStep();
+  EXPECT_FALSE(plan_->planned());
+
+  RecordStep();
+  EXPECT_TRUE(plan_->planned());
+}
+
+}  // namespace
+}  // namespace tensorflow
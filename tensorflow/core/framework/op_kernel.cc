@@ -710,6 +710,13 @@ Status OpKernelContext::allocate_tensor(
     DataType type, const TensorShape& shape, Tensor* out_tensor,
     AllocatorAttributes attr, const AllocationAttributes& allocation_attr) {
   Allocator* a = get_allocator(attr);
+  // Tracked allocations must be deallocated by the TrackingAllocator, so they
+  // are not planned.
+  if (TF_PREDICT_FALSE(params_->memory_plan != nullptr) &&
+      attr.scope_id <= 0 && !track_allocations()) {
+    a = params_->memory_plan->GetAllocator(
+        params_->op_kernel, num_planned_allocations_.fetch_add(1), a);
+  }
   MEMDEBUG_CACHE_OP(op_kernel().name().c_str());
   MEMDEBUG_CACHE_STEPID(step_id());
   Tensor new_tensor(a, type, shape,
@@ -605,6 +605,18 @@ struct GraphCollector {
   }
 };
 
+// Chooses the allocators of the tensors allocated by kernels during a step,
+// for example to place them in memory planned ahead of the step.
+class StepMemoryPlanInterface {
+ public:
+  virtual ~StepMemoryPlanInterface() {}
+
+  // Returns the allocator of the 'index'-th tensor allocated by 'kernel' in
+  // its current invocation, which would otherwise come from 'allocator'.
+  virtual Allocator* GetAllocator(const OpKernel* kernel, int index,
+                                  Allocator* allocator) = 0;
+};
+
 class OpKernelContext {
  public:
   // The first element of a WrappedAllocator is a "base" Allocator and
@@ -716,6 +728,9 @@ class OpKernelContext {
     StepStatsCollectorInterface* stats_collector = nullptr;
     GraphCollector* graph_collector = nullptr;
 
+    // Memory plan of the step. Can be nullptr.
+    StepMemoryPlanInterface* memory_plan = nullptr;
+
     // TensorSliceReaderCache support.
     checkpoint::TensorSliceReaderCacheWrapper* slice_reader_cache = nullptr;
 
@@ -1316,6 +1331,9 @@ class OpKernelContext {
   gtl::InlinedVector<WrappedAllocator, 4> wrapped_allocators_ GUARDED_BY(mu_);
   gtl::InlinedVector<TensorValue, 4> outputs_;
 
+  // The number of tensors allocated through the memory plan of the step.
+  std::atomic<int> num_planned_allocations_{0};
+
   // Keep track of calls to ScopedAllocator.
   // TODO(ayushd): change to absl::flat_hash_set.
   std::unique_ptr<std::unordered_set<int32>> allocated_scope_ids_;
@@ -19,6 +19,7 @@ limitations under the License.
 
 #include <algorithm>
 #include <cmath>
+#include <limits>
 #include <memory>
 
 #include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
@@ -45,6 +46,7 @@ class RunHandlerEnvironment {
     std::function<void()> f;
     Context context;
     uint64 trace_id;
+    uint64 enqueue_time_us;
   };
   Env* const env_;
   const ThreadOptions thread_options_;
@@ -83,6 +85,7 @@ class RunHandlerEnvironment {
             std::move(f),
             Context(ContextKind::kThread),
             id,
+            env_->NowMicros(),
         }),
     };
   }
@@ -93,6 +96,12 @@ class RunHandlerEnvironment {
                                  t.f->trace_id);
     t.f->f();
   }
+
+  // Returns the time since the task was created.
+  uint64 QueueWaitMicros(const Task& t) {
+    const uint64 now = env_->NowMicros();
+    return now > t.f->enqueue_time_us ? now - t.f->enqueue_time_us : 0;
+  }
 };
 
 typedef typename RunHandlerEnvironment::Task Task;
@@ -147,6 +156,28 @@ void WaitOnWaiter(Waiter* waiter, Waiter* queue_head, mutex* mutex,
   }
 }
 
+// Removes the most recently added waiter from the queue, if any.
+Waiter* PopWaiter(Waiter* queue_head, mutex* mutex) {
+  mutex_lock l(*mutex);
+  if (queue_head->next == queue_head) {
+    return nullptr;
+  }
+  // Remove waiter from the LIFO queue
+  Waiter* w = queue_head->next;
+
+  CHECK(w->prev != w);
+  CHECK(w->next != w);
+
+  w->next->prev = w->prev;
+  w->prev->next = w->next;
+
+  // Use `w->next == &w` to indicate that the waiter has been removed
+  // from the queue.
+  w->next = w;
+  w->prev = w;
+  return w;
+}
+
 class ThreadWorkSource {
  public:
   ThreadWorkSource()
@@ -156,7 +187,12 @@ class ThreadWorkSource {
         non_blocking_work_queues_(non_blocking_work_sharding_factor_),
         blocking_inflight_(0),
         non_blocking_inflight_(0),
-        traceme_id_(0) {
+        num_dequeued_tasks_(0),
+        total_queue_wait_us_(0),
+        max_queue_wait_us_(0),
+        traceme_id_(0),
+        all_sub_thread_pool_waiters_(nullptr),
+        all_sub_thread_pool_waiters_mu_(nullptr) {
     queue_waiters_.next = &queue_waiters_;
     queue_waiters_.prev = &queue_waiters_;
     for (int i = 0; i < NonBlockingWorkShardingFactor(); ++i) {
@@ -225,22 +261,22 @@ class ThreadWorkSource {
         waiter_queue_mu = &waiters_mu_;
       }
 
-      {
-        mutex_lock l(*waiter_queue_mu);
-        if (waiter_queue->next != waiter_queue) {
-          // Remove waiter from the LIFO queue
-          w = waiter_queue->next;
-
-          CHECK(w->prev != w);
-          CHECK(w->next != w);
-
-          w->next->prev = w->prev;
-          w->prev->next = w->next;
-
-          // Use `w->next == &w` to indicate that the waiter has been removed
-          // from the queue.
-          w->next = w;
-          w->prev = w;
+      w = PopWaiter(waiter_queue, waiter_queue_mu);
+      static const bool wake_up_other_sub_thread_pools =
+          ParamFromEnvBoolWithDefault(
+              "TF_RUN_HANDLER_WAKE_UP_OTHER_SUB_THREAD_POOLS", true);
+      if (w == nullptr && use_sub_thread_pool &&
+          wake_up_other_sub_thread_pools &&
+          all_sub_thread_pool_waiters_ != nullptr) {
+        // All the threads of the sub thread pool of the request are busy, so
+        // wake up an idle thread of another sub thread pool. It steals the
+        // work once it finds none in the requests of its own sub thread pool.
+        const int num_sub_thread_pools = all_sub_thread_pool_waiters_->size();
+        for (int i = 0; w == nullptr && i < num_sub_thread_pools; ++i) {
+          if (&(*all_sub_thread_pool_waiters_)[i] != waiter_queue) {
+            w = PopWaiter(&(*all_sub_thread_pool_waiters_)[i],
+                          &(*all_sub_thread_pool_waiters_mu_)[i]);
+          }
         }
       }
       if (w != nullptr) {
@@ -301,6 +337,14 @@ class ThreadWorkSource {
     sub_thread_pool_waiter_mu_ = mutex;
   }
 
+  // Sets the waiting queues of all the sub thread pools. Must be called before
+  // any task is enqueued.
+  void SetSubThreadPoolWaiters(Eigen::MaxSizeVector<Waiter>* waiters,
+                               Eigen::MaxSizeVector<mutex>* waiters_mu) {
+    all_sub_thread_pool_waiters_ = waiters;
+    all_sub_thread_pool_waiters_mu_ = waiters_mu;
+  }
+
   int64 GetInflightTaskCount(bool is_blocking) {
     std::atomic<int64>* counter =
         is_blocking ? &blocking_inflight_ : &non_blocking_inflight_;
@@ -319,6 +363,34 @@ class ThreadWorkSource {
     counter->fetch_sub(1, std::memory_order_relaxed);
   }
 
+  // Records the time a task of the request waited in its queue before being
+  // picked up by a thread.
+  void RecordQueueWait(uint64 wait_us) {
+    num_dequeued_tasks_.fetch_add(1, std::memory_order_relaxed);
+    total_queue_wait_us_.fetch_add(wait_us, std::memory_order_relaxed);
+    uint64 max_wait_us = max_queue_wait_us_.load(std::memory_order_relaxed);
+    while (wait_us > max_wait_us &&
+           !max_queue_wait_us_.compare_exchange_weak(
+               max_wait_us, wait_us, std::memory_order_relaxed)) {
+    }
+  }
+
+  int64 NumDequeuedTasks() {
+    return num_dequeued_tasks_.load(std::memory_order_relaxed);
+  }
+  uint64 TotalQueueWaitMicros() {
+    return total_queue_wait_us_.load(std::memory_order_relaxed);
+  }
+  uint64 MaxQueueWaitMicros() {
+    return max_queue_wait_us_.load(std::memory_order_relaxed);
+  }
+
+  void ResetQueueWaitStats() {
+    num_dequeued_tasks_ = 0;
+    total_queue_wait_us_ = 0;
+    max_queue_wait_us_ = 0;
+  }
+
   unsigned NonBlockingWorkShardingFactor() {
     return non_blocking_work_sharding_factor_;
   }
@@ -328,7 +400,9 @@ class ThreadWorkSource {
                            ", inter queue size = ", TaskQueueSize(true),
                            ", inter inflight = ", GetInflightTaskCount(true),
                            ", intra queue size = ", TaskQueueSize(false),
-                           ", intra inflight = ", GetInflightTaskCount(false));
+                           ", intra inflight = ", GetInflightTaskCount(false),
+                           ", dequeued tasks = ", NumDequeuedTasks(),
+                           ", max queue wait = ", MaxQueueWaitMicros(), " us");
   }
 
  private:
@@ -344,6 +418,10 @@ class ThreadWorkSource {
   std::atomic<int64> blocking_inflight_;
   std::atomic<int64> non_blocking_inflight_;
 
+  std::atomic<int64> num_dequeued_tasks_;
+  std::atomic<uint64> total_queue_wait_us_;
+  std::atomic<uint64> max_queue_wait_us_;
+
   Queue blocking_work_queue_;
   mutex blocking_queue_op_mu_;
   char pad_[128];
@@ -355,6 +433,9 @@ class ThreadWorkSource {
   mutex run_handler_waiter_mu_;
   mutex* sub_thread_pool_waiter_mu_ GUARDED_BY(run_handler_waiter_mu_);
   Waiter* sub_thread_pool_waiter_ GUARDED_BY(run_handler_waiter_mu_);
+
+  Eigen::MaxSizeVector<Waiter>* all_sub_thread_pool_waiters_;
+  Eigen::MaxSizeVector<mutex>* all_sub_thread_pool_waiters_mu_;
 };
 
 class RunHandlerThreadPool {
@@ -442,7 +523,8 @@ class RunHandlerThreadPool {
 
   // Set work queues from which the thread 'tid' can steal its work.
   // The request with start_request_idx will be attempted first. Other requests
-  // will be attempted in FIFO order based on their arrival time.
+  // will be attempted in the order of their deadline, then of their arrival
+  // time.
 
   // TODO(donglin) Change the task steal order to be round-robin such that if
   // an attempt to steal task from request i failed, then attempt to steal task
@@ -706,6 +788,7 @@ void RunHandlerThreadPool::WorkerLoop(int thread_id,
           profiler::TraceMeLevel::kInfo);
       VLOG(2) << "Running " << (task_from_blocking_queue ? "inter" : "intra")
               << " work from " << tws->GetTracemeId();
+      tws->RecordQueueWait(env_.QueueWaitMicros(t));
       tws->IncrementInflightTaskCount(task_from_blocking_queue);
       env_.ExecuteTask(t);
       tws->DecrementInflightTaskCount(task_from_blocking_queue);
@@ -795,11 +878,14 @@ class RunHandler::Impl {
   // Stores now time (in microseconds) since unix epoch when the handler is
   // requested via RunHandlerPool::Get().
   uint64 start_time_us() const { return start_time_us_; }
+  // Time (in microseconds) since unix epoch by which the request should
+  // complete, or the maximum value if it has no deadline.
+  uint64 deadline_us() const { return deadline_us_; }
   int64 step_id() const { return step_id_; }
   void ScheduleInterOpClosure(std::function<void()> fn);
   void ScheduleIntraOpClosure(std::function<void()> fn);
 
-  void Reset(int64 step_id);
+  void Reset(int64 step_id, int64 timeout_in_ms);
 
   RunHandlerPool::Impl* pool_impl() { return pool_impl_; }
 
@@ -821,6 +907,7 @@ class RunHandler::Impl {
 
   RunHandlerPool::Impl* pool_impl_;  // NOT OWNED.
   uint64 start_time_us_;
+  uint64 deadline_us_;
   int64 step_id_;
   std::unique_ptr<thread::ThreadPoolInterface> thread_pool_interface_;
   ThreadWorkSource tws_;
@@ -850,6 +937,8 @@ class RunHandlerPool::Impl {
     VLOG(1) << "Creating a RunHandlerPool with max handlers: " << max_handlers_;
     for (int i = 0; i < max_handlers_; ++i) {
       handlers_.emplace_back(new RunHandler::Impl(this));
+      handlers_.back()->tws()->SetSubThreadPoolWaiters(&queue_waiters_,
+                                                       &waiters_mu_);
       free_handlers_.push_back(handlers_.back().get());
     }
     queue_waiters_.resize(
@@ -879,7 +968,8 @@ class RunHandlerPool::Impl {
     return run_handler_thread_pool_.get();
   }
 
-  std::unique_ptr<RunHandler> Get(int64 step_id) LOCKS_EXCLUDED(mu_) {
+  std::unique_ptr<RunHandler> Get(int64 step_id, int64 timeout_in_ms)
+      LOCKS_EXCLUDED(mu_) {
     std::unique_ptr<Eigen::MaxSizeVector<ThreadWorkSource*>>
         thread_work_sources;
     uint64 version;
@@ -890,13 +980,21 @@ class RunHandlerPool::Impl {
       while (free_handlers_.empty()) {
         one_handler_free_.wait(l);
       }
-      // Remove the last entry from free_handlers_ and add to the end of
+      // Remove the last entry from free_handlers_ and add to
       // sorted_active_handlers_.
       handler_impl = free_handlers_.back();
-      handler_impl->Reset(step_id);
-      // Sortedness isn't violated if we simply add at the end of the list,
-      // since handlers are expected to be obtained in increasing order of time.
-      sorted_active_handlers_.push_back(handler_impl);
+      handler_impl->Reset(step_id, timeout_in_ms);
+      // Insert after the handlers with an earlier or the same deadline, which
+      // have been obtained earlier, so that the list stays sorted by deadline
+      // and then by start time.
+      sorted_active_handlers_.insert(
+          std::upper_bound(sorted_active_handlers_.begin(),
+                           sorted_active_handlers_.end(), handler_impl,
+                           [](const RunHandler::Impl* a,
+                              const RunHandler::Impl* b) {
+                             return a->deadline_us() < b->deadline_us();
+                           }),
+          handler_impl);
       DCHECK_LE(sorted_active_handlers_.size(), max_handlers_);
       free_handlers_.pop_back();
 
@@ -943,6 +1041,12 @@ class RunHandlerPool::Impl {
       uint64 now = tensorflow::Env::Default()->NowMicros();
       double elapsed = (now - handler->start_time_us()) / 1000.0;
       time_hist_.Add(elapsed);
+      const int64 num_dequeued_tasks = handler->tws()->NumDequeuedTasks();
+      if (num_dequeued_tasks > 0) {
+        mean_queue_wait_hist_.Add(handler->tws()->TotalQueueWaitMicros() /
+                                  1000.0 / num_dequeued_tasks);
+        max_queue_wait_hist_.Add(handler->tws()->MaxQueueWaitMicros() / 1000.0);
+      }
 
       // Erase from and update sorted_active_handlers_. Add it to the end of
       // free_handlers_.
@@ -987,6 +1091,15 @@ class RunHandlerPool::Impl {
     one_handler_free_.notify_one();
   }
 
+  void GetQueueWaitStats(HistogramProto* mean_wait_ms,
+                         HistogramProto* max_wait_ms) LOCKS_EXCLUDED(mu_) {
+    mutex_lock l(mu_);
+    mean_queue_wait_hist_.EncodeToProto(mean_wait_ms,
+                                        /*preserve_zero_buckets=*/false);
+    max_queue_wait_hist_.EncodeToProto(max_wait_ms,
+                                       /*preserve_zero_buckets=*/false);
+  }
+
  private:
   void RecomputePoolStats(
       int num_active_requests, uint64 version,
@@ -1005,13 +1118,16 @@ class RunHandlerPool::Impl {
 
   std::unique_ptr<RunHandlerThreadPool> run_handler_thread_pool_;
   // Thread compatible part used only by lock under RunHandlerPool.
-  // Handlers are sorted by start time.
-  // TODO(azaks): sort by the remaining latency budget.
+  // Handlers are sorted by deadline, then by start time.
   std::vector<RunHandler::Impl*> sorted_active_handlers_ GUARDED_BY(mu_);
   std::vector<RunHandler::Impl*> free_handlers_ GUARDED_BY(mu_);
   std::vector<std::unique_ptr<RunHandler::Impl>> handlers_ GUARDED_BY(mu_);
   // Histogram of elapsed runtime of every handler (in ms).
   histogram::Histogram time_hist_ GUARDED_BY(mu_);
+  // Histograms of the mean and of the maximum time the closures of every
+  // handler waited in the queues (in ms).
+  histogram::Histogram mean_queue_wait_hist_ GUARDED_BY(mu_);
+  histogram::Histogram max_queue_wait_hist_ GUARDED_BY(mu_);
 
   int64 iterations_ GUARDED_BY(mu_);
   condition_variable one_handler_free_;
@@ -1053,6 +1169,10 @@ void RunHandlerPool::Impl::LogInfo() {
   if (iterations_++ % 50000 == 10 && VLOG_IS_ON(1)) {
     int num_active_requests = sorted_active_handlers_.size();
     VLOG(1) << "Printing time histogram: " << time_hist_.ToString();
+    VLOG(1) << "Printing mean queue wait histogram: "
+            << mean_queue_wait_hist_.ToString();
+    VLOG(1) << "Printing max queue wait histogram: "
+            << max_queue_wait_hist_.ToString();
     VLOG(1) << "Active session runs: " << num_active_requests;
     uint64 now = tensorflow::Env::Default()->NowMicros();
     string times_str = "";
@@ -1092,7 +1212,7 @@ void RunHandler::Impl::ThreadPoolInterfaceWrapper::Schedule(
 RunHandler::Impl::Impl(RunHandlerPool::Impl* pool_impl)
     : pool_impl_(pool_impl) {
   thread_pool_interface_.reset(new ThreadPoolInterfaceWrapper(this));
-  Reset(0);
+  Reset(0, 0);
 }
 
 void RunHandler::Impl::ScheduleInterOpClosure(std::function<void()> fn) {
@@ -1107,10 +1227,13 @@ void RunHandler::Impl::ScheduleIntraOpClosure(std::function<void()> fn) {
                                                         std::move(fn));
 }
 
-void RunHandler::Impl::Reset(int64 step_id) {
+void RunHandler::Impl::Reset(int64 step_id, int64 timeout_in_ms) {
   start_time_us_ = tensorflow::Env::Default()->NowMicros();
+  deadline_us_ = timeout_in_ms > 0 ? start_time_us_ + timeout_in_ms * 1000
+                                   : std::numeric_limits<uint64>::max();
   step_id_ = step_id;
   tws_.SetTracemeId(step_id);
+  tws_.ResetQueueWaitStats();
 }
 
 RunHandlerPool::RunHandlerPool(int num_inter_op_threads)
@@ -1122,8 +1245,14 @@ RunHandlerPool::RunHandlerPool(int num_inter_op_threads,
 
 RunHandlerPool::~RunHandlerPool() {}
 
-std::unique_ptr<RunHandler> RunHandlerPool::Get(int64 step_id) {
-  return impl_->Get(step_id);
+std::unique_ptr<RunHandler> RunHandlerPool::Get(int64 step_id,
+                                                int64 timeout_in_ms) {
+  return impl_->Get(step_id, timeout_in_ms);
+}
+
+void RunHandlerPool::GetQueueWaitStats(HistogramProto* mean_wait_ms,
+                                       HistogramProto* max_wait_ms) {
+  impl_->GetQueueWaitStats(mean_wait_ms, max_wait_ms);
 }
 
 RunHandler::RunHandler(Impl* impl) : impl_(impl) {}
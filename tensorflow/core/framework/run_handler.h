@@ -62,7 +62,19 @@ class RunHandlerPool {
   // unique_ptr is destroyed.
   //
   // Will block unless there is an inactive handler.
-  std::unique_ptr<RunHandler> Get(int64 step_id = 0);
+  //
+  // The work of the active handlers is run in increasing order of their
+  // deadline, which is 'timeout_in_ms' after the call if it is positive, and
+  // in the order of the calls among the handlers without a deadline, which
+  // come last.
+  std::unique_ptr<RunHandler> Get(int64 step_id = 0, int64 timeout_in_ms = 0);
+
+  // Returns the histograms, over the requests whose handlers have been
+  // released, of the mean and of the maximum time their closures waited in the
+  // queues before running, in milliseconds. Requests which scheduled no
+  // closures on the pool threads are not counted.
+  void GetQueueWaitStats(HistogramProto* mean_wait_ms,
+                         HistogramProto* max_wait_ms);
 
  private:
   class Impl;
@@ -74,7 +86,7 @@ class RunHandlerPool {
 // RunHandler can be used to schedule inter/intra-op closures to run on a global
 // pool shared across all Session::Run(s). The closures are enqueued to a
 // handler specific queue, from which the work is stolen in a priority order
-// (time of the Get() call).
+// (deadline, then time of the Get() call).
 //
 // It can only be created via RunHandlerPool::Get().
 //
@@ -25,10 +25,12 @@ limitations under the License.
 #include "absl/synchronization/barrier.h"
 #include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
 #include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/summary.pb.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/graph/graph.h"
 #include "tensorflow/core/graph/testlib.h"
 #include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
@@ -78,6 +80,53 @@ TEST(RunHandlerUtilTest, TestBasicScheduling) {
   counter.Wait();
 }
 
+TEST(RunHandlerUtilTest, TestDeadlineOrderingAndQueueWaitStats) {
+  // A single inter-op thread, which is kept busy while the closures of the
+  // other requests are queued.
+  std::unique_ptr<RunHandlerPool> pool(new RunHandlerPool(1, 0));
+
+  mutex mu;
+  std::vector<int64> order;
+  BlockingCounter counter(2);
+  {
+    Notification started;
+    Notification unblock;
+    auto blocking_handler = pool->Get(0);
+    blocking_handler->ScheduleInterOpClosure([&started, &unblock]() {
+      started.Notify();
+      unblock.WaitForNotification();
+    });
+    started.WaitForNotification();
+
+    auto late_handler = pool->Get(1);
+    auto urgent_handler = pool->Get(2, /*timeout_in_ms=*/60000);
+    for (int64 step_id : {1, 2}) {
+      RunHandler* handler =
+          step_id == 1 ? late_handler.get() : urgent_handler.get();
+      handler->ScheduleInterOpClosure([&mu, &order, &counter, step_id]() {
+        {
+          mutex_lock l(mu);
+          order.push_back(step_id);
+        }
+        counter.DecrementCount();
+      });
+    }
+    Env::Default()->SleepForMicroseconds(20000);
+    unblock.Notify();
+    counter.Wait();
+  }
+
+  // The request with a deadline runs first, although it came last.
+  EXPECT_EQ(order, std::vector<int64>({2, 1}));
+
+  HistogramProto mean_wait_ms;
+  HistogramProto max_wait_ms;
+  pool->GetQueueWaitStats(&mean_wait_ms, &max_wait_ms);
+  EXPECT_EQ(mean_wait_ms.num(), 3);
+  EXPECT_EQ(max_wait_ms.num(), 3);
+  EXPECT_GE(max_wait_ms.max(), 20);
+}
+
 SessionOptions DefaultSessionOptions() {
   SessionOptions options;
   (*options.config.mutable_device_count())["CPU"] = 2;
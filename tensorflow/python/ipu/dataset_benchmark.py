@@ -17,18 +17,28 @@ Dataset benchmarking
 ~~~~~~~~~~~~~~~~~~~~
 """
 
+import itertools
+
 from tensorflow.compiler.plugin.poplar.ops import gen_dataset_benchmark
 from tensorflow.python.ipu import ipu_infeed_queue
 from tensorflow.python.data.ops import dataset_ops
+from tensorflow.python.framework import ops
+from tensorflow.python.ops import string_ops
 
 
 def dataset_benchmark(dataset,
                       number_of_epochs,
                       elements_per_epochs,
                       print_stats=True,
-                      apply_options=True):
+                      apply_options=True,
+                      replication_factor=1,
+                      prefetch_depth=1):
   """Allows the user to benchmark performance of a `tf.data.Dataset`.
 
+    The elements are fed through the same infeed queues as an
+    `ipu.ipu_infeed_queue.IPUInfeedQueue`, including splitting them between
+    the replicas and converting them to their device representation.
+
     Args:
       dataset: An instance of `tf.data.Dataset` which will be benchmarked.
       number_of_epochs: The number of epochs this dataset will be run for.
@@ -37,6 +47,10 @@ def dataset_benchmark(dataset,
         console.
       apply_options: Whether to apply optimization options which can improve the
         dataset performance.
+      replication_factor: The number of replicas the elements are split
+        between. The outermost dimension of each element must be equal to it.
+      prefetch_depth: The number of elements which are prefetched from each
+        infeed queue, as for `ipu.ipu_infeed_queue.IPUInfeedQueue`.
 
     Returns:
       A JSON string with performance statistics, which records the following
@@ -47,6 +61,12 @@ def dataset_benchmark(dataset,
           complete.
         * `elements_per_second` - number of elements processed per second.
         * `bandwidth` - the bandwidth achieved, measured in GB/s.
+        * `latency_p50`, `latency_p90`, `latency_p99` and `latency_max` - the
+          percentiles of the time (in seconds) it took to dequeue an element.
+
+      The `summary` records the 10th, 50th and 90th percentiles of the
+      `elements_per_second` over all the epochs, and the `replication_factor`,
+      `prefetch_depth` and `elements_per_epochs` record the configuration.
 
     The JSON string returned can be parsed into a native Python JSON library
     (see https://docs.python.org/3/library/json.html).
@@ -73,10 +93,14 @@ def dataset_benchmark(dataset,
   except TypeError:
     dataset_variant = dataset._as_variant_tensor  # pylint: disable=protected-access
 
-  return gen_dataset_benchmark.dataset_benchmark(dataset_variant, print_stats,
-                                                 number_of_epochs,
-                                                 elements_per_epochs,
-                                                 **dataset._flat_structure)  # pylint: disable=protected-access
+  return gen_dataset_benchmark.dataset_benchmark(
+      dataset_variant,
+      print_stats,
+      number_of_epochs,
+      elements_per_epochs,
+      replication_factor=replication_factor,
+      prefetch_depth=prefetch_depth,
+      **dataset._flat_structure)  # pylint: disable=protected-access
 
 
 def infeed_benchmark(infeed_queue,
@@ -123,4 +147,87 @@ def infeed_benchmark(infeed_queue,
       number_of_epochs,
       elements_per_epochs,
       print_stats=print_stats,
-      apply_options=apply_options)
+      apply_options=apply_options,
+      replication_factor=infeed_queue._replication_factor,  # pylint: disable=protected-access
+      prefetch_depth=infeed_queue._prefetch_depth)  # pylint: disable=protected-access
+
+
+def infeed_benchmark_sweep(dataset,
+                           number_of_epochs,
+                           elements_per_epochs,
+                           batch_sizes=(1,),
+                           replication_factors=(1,),
+                           prefetch_depths=(1,),
+                           print_stats=False):
+  """Benchmarks a `tf.data.Dataset` through the infeed for every combination
+    of the given configurations, so that infeed regressions can be tracked.
+
+    For each configuration the dataset is batched by the batch size and then
+    by the replication factor, as an `ipu.ipu_infeed_queue.IPUInfeedQueue`
+    does, before being benchmarked with `dataset_benchmark`.
+
+    Args:
+      dataset: An instance of `tf.data.Dataset` which will be benchmarked. It
+        should be unbatched and must contain enough elements for all the
+        epochs of every configuration.
+      number_of_epochs: The number of epochs each configuration is run for.
+      elements_per_epochs: The number of elements in each epoch, or a list of
+        them to sweep over.
+      batch_sizes: The batch sizes to sweep over.
+      replication_factors: The replication factors to sweep over.
+      prefetch_depths: The prefetch depths to sweep over.
+      print_stats: Whether to print statistics about the performance to the
+        console.
+
+    Returns:
+      A string tensor holding a JSON list with an entry for every
+      configuration, which records its `batch_size` and the statistics returned
+      by `dataset_benchmark` as `benchmark`.
+
+    Raises:
+      TypeError: if `dataset` is not an instance of `tf.data.Dataset`.
+      ValueError: if any of the configurations are less than 1.
+    """
+  if not isinstance(dataset, dataset_ops.DatasetV2):
+    raise TypeError("Expected `dataset` argument to be of type "
+                    "`tf.data.Dataset`, but got %s "
+                    "instead." % (str(dataset)))
+
+  if isinstance(elements_per_epochs, int):
+    elements_per_epochs = [elements_per_epochs]
+
+  for name, values in [("elements_per_epochs", elements_per_epochs),
+                       ("batch_sizes", batch_sizes),
+                       ("replication_factors", replication_factors),
+                       ("prefetch_depths", prefetch_depths)]:
+    if not values or min(values) < 1:
+      raise ValueError("Expected `%s` to only contain values of at least 1, "
+                       "but got %s." % (name, str(values)))
+
+  results = []
+  with ops.device('/device:CPU:0'):
+    for elements, batch_size, replication_factor, prefetch_depth in \
+        itertools.product(elements_per_epochs, batch_sizes,
+                          replication_factors, prefetch_depths):
+      batched = dataset
+      if batch_size != 1:
+        batched = batched.batch(batch_size, drop_remainder=True)
+      if replication_factor != 1:
+        batched = batched.batch(replication_factor, drop_remainder=True)
+
+      # Run the configurations one at a time so they do not compete for the
+      # host.
+      with ops.control_dependencies(results[-1:]):
+        result = dataset_benchmark(batched,
+                                   number_of_epochs,
+                                   elements,
+                                   print_stats=print_stats,
+                                   replication_factor=replication_factor,
+                                   prefetch_depth=prefetch_depth)
+      results.append(
+          string_ops.string_join([
+              '{"batch_size": %d, "benchmark": ' % batch_size, result[0], '}'
+          ]))
+
+    return string_ops.string_join(
+        ["[", string_ops.reduce_join(results, separator=", "), "]"])
@@ -93,7 +93,8 @@ class IPUInfeedQueue:
                device_ordinal=0,
                replication_factor=1,
                data_to_prefetch=1,
-               prefetch_depth=None):
+               prefetch_depth=None,
+               io_priority=0):
     """Creates an IPUInfeedQueue object.
 
     Args:
@@ -128,6 +129,10 @@ class IPUInfeedQueue:
           allows for prefetching of multiple entries, increasing the probability
           there will be a valid entry in the buffer for the device to read
           before falling back to synchronously fetching the next entry.
+        io_priority: the priority of this queue when it shares the host IO
+          threads with other infeed and outfeed queues. A queue with priority
+          N is given N + 1 steps each time it gets a turn on a thread.
+          Defaults to 0.
 
     Raises:
       ValueError: if all dimensions of shapes of dataset.output_shapes are not
@@ -152,6 +157,9 @@ tf.Dataset.batch, set `drop_remainder=True`.""".format(output_shape))
       raise ValueError(
           "prefetch_depth must be less than 256, but it is {}".format(
               prefetch_depth))
+    if io_priority < 0:
+      raise ValueError(
+          "io_priority must not be negative, but it is {}".format(io_priority))
 
     with ops.device('/device:CPU:0'):
       self._replication_factor = replication_factor
@@ -160,6 +168,7 @@ tf.Dataset.batch, set `drop_remainder=True`.""".format(output_shape))
       self._flat_structure = dataset._flat_structure
       self._device_ordinal = device_ordinal
       self._prefetch_depth = prefetch_depth
+      self._io_priority = io_priority
 
       # We use max to clamp 0/1 to the same value.
       self._io_batch_size = max(1, data_to_prefetch)
@@ -220,6 +229,7 @@ tf.Dataset.batch, set `drop_remainder=True`.""".format(output_shape))
         replication_factor=self._replication_factor,
         io_batch_size=self._io_batch_size,
         prefetch_depth=self._prefetch_depth,
+        io_priority=self._io_priority,
         **self._flat_structure)
     self._dequeued = True
     return structure.from_tensor_list(self._structure, flat_ret)
@@ -65,7 +65,8 @@ class IPUOutfeedQueue:
                outfeed_all=None,
                device_ordinal=0,
                replication_factor=1,
-               io_batch_size=1):
+               io_batch_size=1,
+               io_priority=0):
     """Creates an IPUOutfeedQueue object.
 
     Args:
@@ -85,6 +86,10 @@ class IPUOutfeedQueue:
           device->host communication at the expense of needing to store the
           tensors on the device, and the extra computation required to operate
           the batching.
+        io_priority: the priority of this queue when it shares the host IO
+          threads with other infeed and outfeed queues. A queue with priority
+          N is given N + 1 steps each time it gets a turn on a thread.
+          Defaults to 0.
 
     Raises:
       ValueError: if the types or values are incorrect
@@ -117,10 +122,14 @@ class IPUOutfeedQueue:
     if replication_factor < 1:
       raise ValueError('Replication factor must be >= 1')
 
+    if io_priority < 0:
+      raise ValueError('IO priority must be >= 0')
+
     self._outfeed_all = self._outfeed_mode == IPUOutfeedMode.ALL
     self._device_ordinal = device_ordinal
     self._replication_factor = replication_factor
     self._io_batch_size = max(1, io_batch_size)
+    self._io_priority = io_priority
     self._feed_name = str(feed_name)
 
     self._operations = []
@@ -213,7 +222,8 @@ class IPUOutfeedQueue:
           outfeed_mode=self._outfeed_mode.value,
           feed_id=self._feed_name,
           replication_factor=self._replication_factor,
-          io_batch_size=self._io_batch_size)
+          io_batch_size=self._io_batch_size,
+          io_priority=self._io_priority)
 
     self._operations.append(outfeed_op)
     return outfeed_op
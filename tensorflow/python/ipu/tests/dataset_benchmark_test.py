@@ -14,6 +14,8 @@
 # =============================================================================
 import json
 
+import numpy as np
+
 from tensorflow.compiler.plugin.poplar.tests import test_utils as tu
 from tensorflow.python.framework import test_util
 from tensorflow.python.platform import googletest
@@ -60,6 +62,57 @@ class DatasetBenchmarkTest(test_util.TensorFlowTestCase):
         for field in x:
           self.assertAllGreater(x[field], 0.0)
 
+  @test_util.deprecated_graph_mode_only
+  def testWithInt64Dataset(self):
+    dataset = tu.create_single_increasing_dataset(10,
+                                                  shape=[2, 4],
+                                                  dtype=np.int64)
+    benchmark_op = ipu.dataset_benchmark.dataset_benchmark(
+        dataset, 2, 100, replication_factor=2, prefetch_depth=3)
+
+    with self.session() as sess:
+      j_str = sess.run(benchmark_op)
+      j = json.loads(j_str[0])
+      self.assertAllEqual(j["replication_factor"], 2)
+      self.assertAllEqual(j["prefetch_depth"], 3)
+      self.assertAllEqual(len(j["epochs"]), 2)
+      for x in j["epochs"]:
+        self.assertAllEqual(x["total_bytes_processed"], 100 * 2 * 4 * 8)
+        self.assertLessEqual(x["latency_p50"], x["latency_p99"])
+        self.assertLessEqual(x["latency_p99"], x["latency_max"])
+
+  @test_util.deprecated_graph_mode_only
+  def testSweep(self):
+    dataset = tu.create_single_increasing_dataset(10, shape=[4, 4])
+    benchmark_op = ipu.dataset_benchmark.infeed_benchmark_sweep(
+        dataset,
+        2, [10, 20],
+        batch_sizes=[1, 4],
+        replication_factors=[1, 2],
+        prefetch_depths=[1, 2])
+
+    with self.session() as sess:
+      j = json.loads(sess.run(benchmark_op))
+      self.assertAllEqual(len(j), 16)
+      configs = set()
+      for x in j:
+        benchmark = x["benchmark"]
+        configs.add((benchmark["elements_per_epochs"], x["batch_size"],
+                     benchmark["replication_factor"],
+                     benchmark["prefetch_depth"]))
+        self.assertAllEqual(len(benchmark["epochs"]), 2)
+        for field in benchmark["summary"]:
+          self.assertAllGreater(benchmark["summary"][field], 0.0)
+      self.assertAllEqual(len(configs), 16)
+
+  def testSweepInvalid(self):
+    dataset = tu.create_single_increasing_dataset(10, shape=[4, 4])
+    with self.assertRaisesRegex(ValueError, "batch_sizes"):
+      ipu.dataset_benchmark.infeed_benchmark_sweep(dataset,
+                                                   1,
+                                                   10,
+                                                   batch_sizes=[0])
+
 
 if __name__ == "__main__":
   googletest.main()
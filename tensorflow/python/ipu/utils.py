@@ -296,7 +296,8 @@ def create_ipu_config(profiling=False,
                       max_scheduler_search_space_size=64,
                       prefetch_data_streams=True,
                       selection_order=None,
-                      enable_experimental_remote_buffer_embedding=False):
+                      enable_experimental_remote_buffer_embedding=False,
+                      max_scheduler_time_ms=0):
   """Create an empty IPU session configuration structure.
 
   Args:
@@ -357,6 +358,9 @@ def create_ipu_config(profiling=False,
       instance of `SelectionOrder`.
     enable_experimental_remote_buffer_embedding: When set to true,
       `HostEmbedding` will make use of poplar remote buffers.
+    max_scheduler_time_ms: The maximum time in milliseconds each scheduler can
+      spend on a computation when `scheduler_selection` is "Parallel".
+      Schedulers exceeding it are discarded. 0 means no limit.
 
   Returns:
     An IpuOptions configuration protobuf, suitable for passing to
@@ -424,6 +428,7 @@ def create_ipu_config(profiling=False,
 
   opts.max_scheduler_lookahead_depth = max_scheduler_lookahead_depth
   opts.max_scheduler_search_space_size = max_scheduler_search_space_size
+  opts.max_scheduler_time_ms = max_scheduler_time_ms
 
   opts.prefetch_data_streams = prefetch_data_streams
   opts.selection_order = selection_order.value
@@ -488,8 +493,8 @@ def set_optimization_options(opts,
   Args:
     combine_embedding_lookups: Fuse embedding lookups on the same tensor. This
       might improve performance but increase memory usage.
-    combine_matmuls: Fuse matmul operations if they share the same weights or
-      the same input.
+    combine_matmuls: Fuse independent matmul operations if they share the same
+      weights or the same input, or if they only differ in their batch size.
     max_cross_replica_sum_buffer_size: The maximum number of bytes that can be
       waiting before a cross replica sum op is scheduled.
     max_reduce_scatter_buffer_size: The maximum number of bytes that can be